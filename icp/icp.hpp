@@ -26,6 +26,8 @@
 #include <utility>
 #include <boost/concept_check.hpp>
 
+#include "stability.hpp"
+
 namespace envire {
 namespace icp {
 
@@ -99,6 +101,8 @@ struct VertexEdgeAndNormalNode : public VertexNode
 class PointcloudAdapter
 {
 public:
+    typedef VertexNode node_type;
+
     PointcloudAdapter( envire::Pointcloud* model, double density )
 	: model(model), index( 0.0 ),
 	vertices( &model->vertices ), 
@@ -173,6 +177,8 @@ protected:
 class PointcloudEdgeAndNormalAdapter : public PointcloudAdapter
 {
 public:
+    typedef VertexEdgeAndNormalNode node_type;
+
     PointcloudEdgeAndNormalAdapter( envire::Pointcloud* model, double density )
 	: PointcloudAdapter( model, density ) 
     {
@@ -256,9 +262,35 @@ public:
 	kdtree.clear();
     }
 
+    /** estimates the surface normal of the model at the closest model point
+     * to @param node, from the model points within @param radius of it.
+     * Returns false if there is no model point within @param d_box, or the
+     * neighbourhood is not planar.
+     */
+    bool findNormal( const _TreeNode& node, double d_box, double radius, Eigen::Vector3d& normal )
+    {
+	std::pair<typename tree_type::const_iterator,double> found = kdtree.find_nearest(node, d_box);
+	if( found.first == kdtree.end() )
+	    return false;
+
+	// the range query uses a box, so the corners are removed afterwards
+	neighbours.clear();
+	kdtree.find_within_range( *(found.first), radius, std::back_inserter( neighbours ) );
+	points.clear();
+	const Eigen::Vector3d center = (found.first)->point;
+	for( size_t i=0; i<neighbours.size(); i++ )
+	    if( (neighbours[i].point - center).squaredNorm() <= radius * radius )
+		points.push_back( neighbours[i].point );
+
+	return DegeneracyAnalysis::estimateNormal( points, normal );
+    }
+
 private:
     typedef KDTree::KDTree<3, _TreeNode> tree_type;
 
+    std::vector<_TreeNode> neighbours;
+    std::vector<Eigen::Vector3d> points;
+
     _Filter filter;
     tree_type kdtree;
 };
@@ -397,6 +429,7 @@ public:
 		beta,
 		eps);
 
+	evaluateQuality( measurement );
 	measurement.applyTransform( minResult.C_global2globalnew );
     }
 
@@ -414,6 +447,7 @@ public:
     {
 	
 	minResult = _align( measurement, max_iter, min_mse, min_mse_diff, overlap );
+	evaluateQuality( measurement );
 	measurement.applyTransform( minResult.C_global2globalnew );
     }
 
@@ -438,6 +472,15 @@ public:
     size_t getPairs() { return minResult.pairs; }
      std::vector<double> getPairsDistance() { return minResult.pairs_distance; }
 
+    /** enables the quality estimation, which is done after each alignment
+     */
+    void setQualityConfiguration( const ICPQualityConfiguration& conf ) { quality_conf = conf; }
+
+    /** @return the quality of the last alignment. Only valid if the quality
+     * estimation was enabled with setQualityConfiguration()
+     */
+    const RegistrationQuality& getQuality() const { return quality; }
+
 
 private:
     /** performs a single alignment of the measurement to the model.
@@ -506,8 +549,46 @@ private:
 	return result;
     }
 
+    /** estimates the quality of minResult. The histogram of the pair
+     * distances is classified by the svm, and the point-to-plane hessian of
+     * a subset of the measurement points is analysed for degenerate
+     * directions. Both only touch a fraction of the points of an
+     * alignment, so this can be done on every match.
+     */
+    void evaluateQuality( _Adapter measurement )
+    {
+	quality = RegistrationQuality();
+	if( !quality_conf.enabled || minResult.pairs < Pairs::MIN_PAIRS )
+	    return;
+
+	Histogram histogram( quality_conf.histogram );
+	histogram.calculateHistogram( minResult.pairs_distance );
+	quality.svm_value = histogram.getSVMValue();
+	quality.histogram = histogram.getHistogram();
+
+	const size_t stride = std::max( measurement.size() / std::max( quality_conf.max_samples, 1 ), static_cast<size_t>( 1 ) );
+	DegeneracyAnalysis analysis;
+	Eigen::Vector3d normal;
+	measurement.setOffsetTransform( minResult.C_global2globalnew );
+	measurement.reset();
+	for( size_t i=0; measurement.hasNext(); i++ )
+	{
+	    typename _Adapter::node_type node = measurement.next();
+	    if( i % stride == 0 && findPairs.findNormal( node, minResult.d_box, quality_conf.normal_radius, normal ) )
+		analysis.add( node.point, normal );
+	}
+
+	quality.valid = analysis.compute();
+	quality.constraints = analysis.getConstraints();
+	quality.degeneracy = analysis.getDegeneracy();
+	quality.eigenvalues = analysis.getEigenvalues();
+	quality.eigenvectors = analysis.getEigenvectors();
+    }
+
     _FindPairs findPairs;
     Result minResult;
+    ICPQualityConfiguration quality_conf;
+    RegistrationQuality quality;
 };
 
 typedef FindPairsKDTree< VertexEdgeAndNormalNode,
@@ -45,6 +45,60 @@ namespace icp
 	double min_rotation_head_for_new_line; 
     };
     
+    /** 
+     * Configuration for the histogram.hpp clss 
+     */ 
+    //TODO FIX THE CONFIGURATION ! 
+    struct HistogramConfiguration{
+	/** Number of bins in the histogram */ 
+	double number_bins; 
+	/** total area of the histogram */ 
+	double area;
+	/** if the histogram should be normalized */
+	bool normalization; 
+	/** if 2 extra bins should be added for the outliners*/ 
+	bool outliners;
+	/** mean of the normalization */ 
+	double mean; 
+	/** sigma for the normalization */ 
+	double sigma; 
+    };
+
+    /**
+     * Configuration of the quality estimation of an icp match, see
+     * RegistrationQuality in stability.hpp
+     */
+    struct ICPQualityConfiguration
+    {
+	/** if the quality of each match should be estimated */
+	bool enabled;
+	/** histogram of the pair distances for the svm classification */
+	HistogramConfiguration histogram;
+	/** matches with a lower svm value are rejected (< -1 bad, > 1 good) */
+	double min_svm_value;
+	/** matches with a lower ratio between the smallest and largest
+	 * eigenvalue of the point-to-plane hessian are rejected */
+	double min_degeneracy;
+	/** maximum number of measurement points used for the degeneracy analysis */
+	int max_samples;
+	/** radius of the model neighbourhood for the normal estimation */
+	double normal_radius;
+
+	ICPQualityConfiguration()
+	    : enabled(false), min_svm_value(-1.0), min_degeneracy(0.01),
+	    max_samples(500), normal_radius(0.3)
+	{
+	    // the reference configuration of the Histogram class, with the
+	    // bin width the svm weights were trained with
+	    histogram.number_bins = 8;
+	    histogram.area = 4 * 0.26136;
+	    histogram.normalization = true;
+	    histogram.outliners = true;
+	    histogram.mean = 0.1;
+	    histogram.sigma = 0.26136;
+	}
+    };
+
     /**
      * icp.hpp class configuration 
      */
@@ -65,6 +119,9 @@ namespace icp
 	double measurement_density;
 	
 	ICPResultCovarianceConf cov_conf; 
+
+	/** quality estimation, matches which fail it are not used */
+	ICPQualityConfiguration quality_conf;
 	
       	/**if this property set, scans will be collected, and environment written to given path when the module stops*/
 	std::string environment_debug_path; 
@@ -116,24 +173,6 @@ namespace icp
 	
     }; 
     
-    /** 
-     * Configuration for the histogram.hpp clss 
-     */ 
-    //TODO FIX THE CONFIGURATION ! 
-    struct HistogramConfiguration{
-	/** Number of bins in the histogram */ 
-	double number_bins; 
-	/** total area of the histogram */ 
-	double area;
-	/** if the histogram should be normalized */
-	bool normalization; 
-	/** if 2 extra bins should be added for the outliners*/ 
-	bool outliners;
-	/** mean of the normalization */ 
-	double mean; 
-	/** sigma for the normalization */ 
-	double sigma; 
-    };
 
 
 
@@ -210,6 +210,9 @@ ICPResult ICPLocalization::doScanMatch(struct ICPInputData& inputData, bool save
     result.points = pc->vertices.size(); 
     result.from = inputData.pc2World; 
     result.pairs = icp.getPairs(); 
+    result.quality = icp.getQuality(); 
+    result.accepted = result.pairs > 0 
+	&& ( !conf.quality_conf.enabled || result.quality.isAcceptable( conf.quality_conf ) ); 
     
     if(result.pairs > 0) {
 	
@@ -240,10 +243,17 @@ ICPResult ICPLocalization::doScanMatch(struct ICPInputData& inputData, bool save
 	    }
 	}
 
+	if( !result.accepted ) 
+	{
+	    result.cov_position = Eigen::Matrix3d::Ones()*INFINITY; 
+	    result.cov_orientation = Eigen::Matrix3d::Ones()*INFINITY; 
+	}
     }
     
   
-    if(!save || conf.environment_debug_path.empty())
+    // rejected matches are never kept, so they don't end up in the merged
+    // pointclouds 
+    if(!save || conf.environment_debug_path.empty() || !result.accepted)
     {
 	env->detachItem( pc );
 	env->detachItem( fn );	
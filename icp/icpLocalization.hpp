@@ -51,6 +51,11 @@ struct ICPResult {
     Eigen::Matrix3d cov_position;
     Eigen::Matrix3d cov_orientation; 
     
+    /** quality of the match, if enabled in the ICPConfiguration */ 
+    RegistrationQuality quality; 
+    /** false if the match had no pairs, or failed the quality check. The
+     * covariances of a rejected match are infinite. */ 
+    bool accepted; 
 };
 
 class LaserAndTransform {
@@ -98,7 +103,7 @@ class ICPLocalization
   
 	void removeLastSavedPointCloud();
 	
-	void loadIcpConfiguration(ICPConfiguration conf){ this->conf = conf; }  
+	void loadIcpConfiguration(ICPConfiguration conf){ this->conf = conf; icp.setQualityConfiguration( conf.quality_conf ); }  
 	
 	void loadEnvironment(std::string environment_path, double model_density); 
 	
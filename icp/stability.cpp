@@ -7,6 +7,7 @@
 #include <Eigen/Dense>
 
 #include <iostream>
+#include <algorithm>
 
 using namespace std; 
 using namespace Eigen; 
@@ -293,111 +294,156 @@ double Histogram::calcSVMValue( )
     
 }
 
-void Histogram::calculateHistogram( std::vector<double> pairs_distance ) 
+void Histogram::calculateHistogram( const std::vector<double>& pairs_distance ) 
 {
     if ( conf.normalization ) 
-	calculateNormalizedHistogram( pairs_distance ); 
-    
-    //else 
-	//calculateNotNormalizedHistogram( pairs_distance ); 
+	calculateNormalizedHistogram( pairs_distance, conf.mean, conf.sigma ); 
+    else 
+	calculateNormalizedHistogram( pairs_distance, 0.0, 1.0 ); 
 	
     svm_value = calcSVMValue(); 
 
 }
 
-void Histogram::calculateNormalizedHistogram(std::vector<double> _pairs_distance)
+void Histogram::calculateNormalizedHistogram(const std::vector<double>& pairs_distance, double mean, double sigma)
 {
-    
-    std::vector<double> pairs_distance; 
-    pairs_distance.clear(); 
-    
-    for(size_t i=0;i<_pairs_distance.size();i++) 
+    const int number_bins = conf.number_bins; 
+    const double bin_size = conf.area / number_bins; 
+
+    //the bins are centered around zero, the outliers are stored in an extra 
+    //bin at each end, so there are number_bins + 2 bins 
+    const double lower_limit = -0.5 * number_bins * bin_size; 
+    const double upper_limit = lower_limit + number_bins * bin_size; 
+
+    //the bin of a distance d is ((d - mean) / sigma - lower_limit) / bin_size, 
+    //which is folded into a single multiply add, so the data doesn't need to 
+    //be copied or sorted 
+    const double scale = 1.0 / (sigma * bin_size); 
+    const double offset = (mean / sigma + lower_limit) / bin_size; 
+
+    std::vector<size_t> count( number_bins + 2, 0 ); 
+    double min_distance = std::numeric_limits<double>::infinity(); 
+    double max_distance = -std::numeric_limits<double>::infinity(); 
+    const size_t size = pairs_distance.size(); 
+    for(size_t i=0;i<size;i++) 
     {
-	pairs_distance.push_back( (_pairs_distance.at(i)- conf.mean)/conf.sigma); 
+	const double d = pairs_distance[i]; 
+	const double f = d * scale - offset; 
+	const int bin = f < 0 ? 0 : std::min( static_cast<int>( f ) + 1, number_bins + 1 ); 
+	count[bin]++; 
+	min_distance = std::min( min_distance, d ); 
+	max_distance = std::max( max_distance, d ); 
     }
+    const double min_normalized = (min_distance - mean) / sigma; 
+    const double max_normalized = (max_distance - mean) / sigma; 
 
-    histogram.clear();
     histogram_limits.clear(); 
+    if ( size > 0 && min_normalized < lower_limit ) 
+	histogram_limits.push_back( lower_limit + min_normalized ); 
+    else 
+	histogram_limits.push_back( lower_limit - bin_size ); 
+    for (int bin = 0; bin <= number_bins; bin++) 
+	histogram_limits.push_back( lower_limit + bin * bin_size ); 
+    if ( size > 0 && max_normalized > upper_limit ) 
+	histogram_limits.push_back( upper_limit + max_normalized ); 
+    else 
+	histogram_limits.push_back( upper_limit + bin_size ); 
+
+    //the frequency is given by the number of points inside a bin / ( total 
+    //points * area ), which is what the svm was trained with. The upper 
+    //outlier bin is normalized with its own width. 
+    const double n = std::max( size, static_cast<size_t>( 1 ) ); 
+    histogram.resize( number_bins + 2 ); 
+    for (int bin = 0; bin <= number_bins; bin++) 
+	histogram[bin] = count[bin] / ( n * conf.area ); 
+    const double outlier_width = histogram_limits[number_bins+2] - histogram_limits[number_bins+1]; 
+    histogram[number_bins+1] = count[number_bins+1] / ( n * outlier_width ); 
+}
 
-    int bin = 1; 
-    
-    double bin_size = conf.area / conf.number_bins; 
+/**
+ * **************** DEGENERACY****************************
+ * *******************************************************
+ */
 
-    int number_of_points = 0; 
-    unsigned int i = 0; 
+void DegeneracyAnalysis::clear() 
+{
+    points.clear(); 
+    normals.clear(); 
+}
 
-    //outlier will be stores at the first and last bin, so the total number of bins if bin_size + 2, so those bins will have variable size 
-    //the frequency inside a bin is given by number of points inside a bin / ( total points * width of bin ) 
+void DegeneracyAnalysis::add( const Eigen::Vector3d& point, const Eigen::Vector3d& normal ) 
+{
+    points.push_back( point ); 
+    normals.push_back( normal ); 
+}
 
-    //Calculate the bin placement (the central point is zero, since the data is normalized 
-    
-    //add the lower limit for the outliner 
-    double outliner_upper_limit = (-conf.number_bins / 2)  * bin_size;
-    
-    if (  pairs_distance.front() < outliner_upper_limit ) 
-	histogram_limits.push_back( outliner_upper_limit + pairs_distance.front() );
-    else 
-	histogram_limits.push_back( outliner_upper_limit - bin_size );
-    
-    
-    double bin_lower_limit = 0; 
-    for (bin = 0; bin <= conf.number_bins; bin++) 
-    {
-	bin_lower_limit = ((-conf.number_bins / 2) + bin ) * bin_size;
-	histogram_limits.push_back( bin_lower_limit );
-	
-    }    
-    
-    //add the upper limit for the outliner 
-    if ( pairs_distance.back() > bin_lower_limit) 
-	histogram_limits.push_back( bin_lower_limit + pairs_distance.back() );
-    else 
-	histogram_limits.push_back( bin_lower_limit + bin_size );
-    
-    
-    double bin_area = 0;
-    //fill the bins 
-    bin = 1; 
-    while (i < pairs_distance.size()) 
+bool DegeneracyAnalysis::compute() 
+{
+    eigenvalues.setZero(); 
+    eigenvectors.setIdentity(); 
+    if( points.size() < 6 ) 
+	return false; 
+
+    //the rotations are around the centroid, and scaled by the extent of 
+    //the points, so that a rotation moves the points by about as much as a 
+    //unit translation 
+    Vector3d centroid( Vector3d::Zero() ); 
+    for(size_t i=0;i<points.size();i++) 
+	centroid += points[i]; 
+    centroid /= points.size(); 
+    double extent = 0; 
+    for(size_t i=0;i<points.size();i++) 
+	extent += (points[i] - centroid).squaredNorm(); 
+    extent = sqrt( extent / points.size() ); 
+    if( extent <= 0 ) 
+	return false; 
+
+    //the jacobian of the point-to-plane distance n.(R p + t) is [n, p x n] 
+    Matrix6d hessian( Matrix6d::Zero() ); 
+    for(size_t i=0;i<points.size();i++) 
     {
-	  
-	  if ( pairs_distance.at(i) < histogram_limits[bin]) 
-	  {
-		number_of_points ++; 
-		i++; 
-	  }
-	  else 
-	  {
-		
-		bin_area =fabs(histogram_limits[bin-1] - histogram_limits[bin]); 
-		histogram.push_back( number_of_points/ ( pairs_distance.size() * conf.area) ); 
-		
-		bin ++; 
-		//the +2 is for the outliers bins
-		if (bin == conf.number_bins+2) 
-		{
-		    number_of_points = pairs_distance.size() - i; 
-		    bin_area = fabs(histogram_limits[bin-1] - histogram_limits[bin]); 
-		    histogram.push_back( number_of_points / (pairs_distance.size() * bin_area) );
-		    return; 
-		}
-		  
-		number_of_points = 0; 
-	  }
+	Vector6d j; 
+	j << normals[i], (points[i] - centroid).cross( normals[i] ) / extent; 
+	hessian += j * j.transpose(); 
     }
+    hessian /= points.size(); 
 
-    bin_area = fabs(histogram_limits[bin-1] - histogram_limits[bin]); 
-    histogram.push_back( number_of_points/ ( pairs_distance.size() * bin_area) ); 
-    
-   
-    bin++;
-    
-    //the +2 is because of the 2 outliers bins, upper and lower
-    while(bin <= (conf.number_bins+2)) 
+    SelfAdjointEigenSolver<Matrix6d> solver( hessian ); 
+    eigenvalues = solver.eigenvalues(); 
+    eigenvectors = solver.eigenvectors(); 
+    return true; 
+}
+
+double DegeneracyAnalysis::getDegeneracy() const 
+{
+    if( eigenvalues(5) <= 0 ) 
+	return 0; 
+    return std::max( eigenvalues(0), 0.0 ) / eigenvalues(5); 
+}
+
+bool DegeneracyAnalysis::estimateNormal( const std::vector<Eigen::Vector3d>& neighbours, Eigen::Vector3d& normal ) 
+{
+    if( neighbours.size() < 3 ) 
+	return false; 
+
+    Vector3d mean( Vector3d::Zero() ); 
+    for(size_t i=0;i<neighbours.size();i++) 
+	mean += neighbours[i]; 
+    mean /= neighbours.size(); 
+    Matrix3d cov( Matrix3d::Zero() ); 
+    for(size_t i=0;i<neighbours.size();i++) 
     {
-      histogram.push_back(0);
-      bin++;
-      
+	const Vector3d d = neighbours[i] - mean; 
+	cov += d * d.transpose(); 
     }
 
+    //the smallest eigenvalue has to be well below the second one, lines 
+    //(e.g. a single scan line) and blobs don't have a normal 
+    SelfAdjointEigenSolver<Matrix3d> solver( cov ); 
+    const Vector3d ev = solver.eigenvalues(); 
+    if( ev(1) <= 0 || ev(0) > 0.25 * ev(1) ) 
+	return false; 
+
+    normal = solver.eigenvectors().col(0); 
+    return true; 
 }
@@ -1,5 +1,5 @@
 #ifndef __STABILITY_H__
-#define __STABILITY_H_
+#define __STABILITY_H__
 
 #define EIGEN_USE_NEW_STDVECTOR
 
@@ -19,6 +19,7 @@
 #include <boost/random/uniform_real.hpp>
 #include <boost/random/variate_generator.hpp>
 #include <ctime>  
+#include <limits>
 
 #include "icpConfigurationTypes.hpp"
 
@@ -182,7 +183,7 @@ class Histogram
 	 * the histogram is normalized so if the oultiners are considered this will impact the distribution
 	 */
 	Histogram(HistogramConfiguration conf) 
-	    {  this->conf = conf;  }
+	    : svm_value(0) {  this->conf = conf;  }
 
 	/**
 	* gets ths histogram classification based on a linear quernel trained data 
@@ -191,7 +192,11 @@ class Histogram
 	std::vector<double> getHistogram() { return histogram; } 
 	std::vector<double> getHistogramLimits() { return histogram_limits; } 	
 	
-	void calculateHistogram( std::vector<double> pairs_distance ) ;
+	/** 
+	 * Fills the histogram from the pair distances, which don't need to
+	 * be sorted, and calculates the svm value. 
+	 */ 
+	void calculateHistogram( const std::vector<double>& pairs_distance ) ;
 	
 	
     private:
@@ -199,8 +204,7 @@ class Histogram
 	HistogramConfiguration conf; 
 	std::vector<double> histogram; 
 	std::vector<double> histogram_limits; 
-	void calculateNormalizedHistogram(std::vector<double> _pairs_distance);
-	void calculateNotNormalizedHistogram(std::vector<double> pairs_distance);
+	void calculateNormalizedHistogram(const std::vector<double>& pairs_distance, double mean, double sigma);
 	double calcSVMValue( ); 
 // 		//for normalization 
 // 	//In theory the mean distance to nearest neighbor in an infinitly large random distribution is 
@@ -215,6 +219,89 @@ class Histogram
 // 	Histogram histogram( 8, 4*sigma); 
 }; 
 
+/**
+ * Degeneracy analysis of a registration. 
+ *
+ * The point-to-plane error of the matched points is linearized around the
+ * final alignment. The eigenvalues of the resulting 6x6 hessian tell how
+ * well each direction of the transform is constrained by the geometry: a
+ * match against a single plane or along a corridor can converge to a low
+ * error, while the pose is still free to slide along the small eigenvectors.
+ * The rotational part is scaled with the extent of the points, so that the
+ * eigenvalues can be compared. 
+ */
+class DegeneracyAnalysis
+{
+    public: 
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Matrix<double,6,1> Vector6d;
+	typedef Eigen::Matrix<double,6,6> Matrix6d;
+
+	void clear(); 
+
+	/** adds a matched point and the surface normal at that point */
+	void add( const Eigen::Vector3d& point, const Eigen::Vector3d& normal ); 
+
+	/** 
+	 * Calculates the normalized hessian and its eigenvalues. Returns false
+	 * if there are less than 6 constraints. 
+	 */ 
+	bool compute(); 
+
+	/** eigenvalues of the hessian, in ascending order */ 
+	Vector6d getEigenvalues() const { return eigenvalues; } 
+	/** corresponding eigenvectors (translation, rotation) in the columns */ 
+	Matrix6d getEigenvectors() const { return eigenvectors; } 
+	/** ratio between the smallest and largest eigenvalue, 0 for a fully degenerate match */ 
+	double getDegeneracy() const; 
+	size_t getConstraints() const { return points.size(); } 
+
+	/** 
+	 * Estimates the surface normal of a neighbourhood of points. Returns
+	 * false if the neighbourhood is not planar enough. 
+	 */ 
+	static bool estimateNormal( const std::vector<Eigen::Vector3d>& neighbours, Eigen::Vector3d& normal ); 
+
+    private: 
+	std::vector<Eigen::Vector3d> points, normals; 
+	Vector6d eigenvalues; 
+	Matrix6d eigenvectors; 
+}; 
+
+/**
+ * Quality of an icp match, see Trimmed::getQuality(). 
+ */ 
+struct RegistrationQuality 
+{
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    RegistrationQuality() 
+	: valid(false), svm_value(-std::numeric_limits<double>::infinity()), 
+	degeneracy(0), constraints(0) 
+    {
+	eigenvalues.setZero(); 
+	eigenvectors.setIdentity(); 
+    }
+
+    /** false if the match had not enough pairs to estimate the quality */ 
+    bool valid; 
+    /** svm classification of the pair distance histogram, < -1 bad, > 1 good */ 
+    double svm_value; 
+    std::vector<double> histogram; 
+    /** see DegeneracyAnalysis::getDegeneracy() */ 
+    double degeneracy; 
+    /** number of points with a normal used in the degeneracy analysis */ 
+    size_t constraints; 
+    DegeneracyAnalysis::Vector6d eigenvalues; 
+    DegeneracyAnalysis::Matrix6d eigenvectors; 
+
+    bool isAcceptable( const ICPQualityConfiguration& conf ) const 
+    {
+	return valid && svm_value >= conf.min_svm_value && degeneracy >= conf.min_degeneracy; 
+    }
+}; 
+
 }
 }
 
@@ -21,6 +21,7 @@
 #include <envire/core/FrameNode.hpp>
 #include <envire/core/Layer.hpp>
 #include <envire/core/Operator.hpp>
+#include <envire/core/ExecutionContext.hpp>
 #include <base/samples/rigid_body_state.h>
 
 
@@ -5,6 +5,7 @@
 #include "Operator.hpp"
 
 #include <algorithm>
+#include <set>
 #include <utility>
 #include <stdexcept>
 #include <Eigen/LU>
@@ -15,6 +16,7 @@
 #include <boost/filesystem/path.hpp>
 
 #include <iostream>
+#include <fstream>
 
 using namespace std;
 using namespace envire;
@@ -25,18 +27,18 @@ void envire::intrusive_ptr_add_ref( EnvironmentItem* item ) { item->ref_count++;
 void envire::intrusive_ptr_release( EnvironmentItem* item ) { if(!--item->ref_count) delete item; }
 
 EnvironmentItem::EnvironmentItem(std::string const& unique_id)
-    : ref_count(0), unique_id(unique_id), env(NULL)
+    : ref_count(0), unique_id(unique_id), env(NULL), generation(0)
 {
 }
 
 EnvironmentItem::EnvironmentItem(Environment* envPtr)
-   : ref_count(0), unique_id( Environment::ITEM_NOT_ATTACHED ), env(NULL)
+   : ref_count(0), unique_id( Environment::ITEM_NOT_ATTACHED ), env(NULL), generation(0)
 {
     envPtr->attachItem( this );
 }
 
 EnvironmentItem::EnvironmentItem(const EnvironmentItem& item)
-    : ref_count(0), unique_id( Environment::ITEM_NOT_ATTACHED ), env(NULL)
+    : ref_count(0), unique_id( Environment::ITEM_NOT_ATTACHED ), env(NULL), generation(0)
 {
 }
 
@@ -128,6 +130,12 @@ void EnvironmentItem::itemModified()
 	env->itemModified(this);
 }
 
+void EnvironmentItem::raiseGeneration()
+{
+    if( isAttached() )
+	generation = ++env->lastGeneration;
+}
+
 EnvironmentItem::Ptr EnvironmentItem::detach()
 {
     assert( env );
@@ -136,7 +144,8 @@ EnvironmentItem::Ptr EnvironmentItem::detach()
 
 const std::string Environment::ITEM_NOT_ATTACHED = "";
 
-Environment::Environment() : last_id(0), synchronizationEventQueue(NULL),envPrefix("/")
+Environment::Environment() : last_id(0), synchronizationEventQueue(NULL),envPrefix("/"),
+    memoryBudget(0), accessTick(0), lastGeneration(0)
 {
     // each environment has a root node
     rootNode = new FrameNode();
@@ -148,6 +157,18 @@ Environment::Environment() : last_id(0), synchronizationEventQueue(NULL),envPref
 
 Environment::~Environment() 
 {
+    // the data of evicted layers is not restored, only the files are
+    // removed
+    for( itemListType::iterator it = items.begin(); it != items.end(); it++ )
+    {
+	Layer* layer = dynamic_cast<Layer*>( it->second.get() );
+	if( layer && layer->evicted )
+	{
+	    boost::filesystem::remove( getEvictionFile( layer ) );
+	    layer->evicted = false;
+	}
+    }
+
     // perform a delete on all the owned objects
     itemListType::iterator it;
     while( (it = items.begin()) != items.end() )
@@ -176,8 +197,15 @@ void Environment::handle( const Event& event )
 
 void Environment::addEventHandler(EventHandler *handler) 
 {
-    //new listener was added, iterate over all items and 
-    //attach them at the listener
+    //new listener was added, publish all items
+    publishEvents(handler);
+    
+    eventHandlers.addEventHandler(handler);
+}
+
+void Environment::publishEvents(EventHandler *handler) 
+{
+    //iterate over all items and attach them at the listener
     for(itemListType::iterator it = items.begin(); it != items.end(); it++) 
     {
 	handler->receive( Event( event::ITEM, event::ADD, it->second ) );
@@ -194,8 +222,6 @@ void Environment::addEventHandler(EventHandler *handler)
     {
 	handler->receive( Event( event::FRAMENODE, event::ADD, it->first, it->second ) );
     }
-    
-    eventHandlers.addEventHandler(handler);
 }
 
 void Environment::detachChilds(FrameNode *parent, EventHandler *evl)
@@ -302,6 +328,7 @@ void Environment::attachItem(EnvironmentItem* item)
    
     // set a pointer to environment object
     item->env = this;
+    item->raiseGeneration();
     
     handle( Event( event::ITEM, event::ADD, item ) );
 } 
@@ -321,6 +348,11 @@ EnvironmentItem::Ptr Environment::detachItem(EnvironmentItem* item, bool deep)
     assert( item );
     assert( items.count( item->getUniqueId() ) );
 
+    // the data of an evicted layer can only be restored while it is attached
+    Layer* layer = dynamic_cast<Layer*>( item );
+    if( layer )
+	layer->touch();
+
     if( deep )
     {
 	// remove all associated objects first
@@ -398,7 +430,17 @@ EnvironmentItem::Ptr Environment::detachItem(EnvironmentItem* item, bool deep)
 
 void Environment::itemModified(EnvironmentItem* item) 
 {
+    item->raiseGeneration();
     handle( Event( event::ITEM, event::UPDATE, item ) );
+
+    if( memoryBudget )
+    {
+	accessTick++;
+	Layer* layer = dynamic_cast<Layer*>( item );
+	if( layer )
+	    layer->lastAccess = accessTick;
+	enforceMemoryBudget( layer );
+    }
 }
 
 void Environment::addChild(FrameNode* parent, FrameNode* child)
@@ -684,7 +726,10 @@ std::list<Layer*> Environment::getInputs(Operator* op)
     for(operatorGraphType::iterator it=operatorGraphInput.begin();it != operatorGraphInput.end();++it)
     {
 	if( it->first == op )
+	{
+	    it->second->touch();
 	    inputs.push_back( it->second );
+	}
     }
     return inputs;
 }
@@ -695,7 +740,10 @@ std::list<Layer*> Environment::getOutputs(Operator* op)
     for(operatorGraphType::iterator it=operatorGraphOutput.begin();it != operatorGraphOutput.end();++it)
     {
 	if( it->first == op )
+	{
+	    it->second->touch();
 	    outputs.push_back( it->second );
+	}
     }
     return outputs;
 }
@@ -741,6 +789,29 @@ void Environment::updateOperators(){
     }
 }
 
+bool Environment::updateOperators( ExecutionContext& context )
+{
+    std::vector<envire::Operator*> ops = getItems<envire::Operator>();
+
+    for(std::vector<envire::Operator*>::iterator it=ops.begin();it!=ops.end();it++)
+    {
+	// an operator is only abandoned if it found the context cancelled
+	// while it was running, a completed update is always kept
+	if( context.isCancelled() )
+	    return false;
+
+	(*it)->execute( context );
+	if( (*it)->wasAbandoned() )
+	    return false;
+
+	std::list<Layer*> outs = getOutputs(*it);
+	for (std::list<Layer*>::iterator out = outs.begin();out != outs.end();out++){
+	    itemModified(*out);
+	}
+    }
+    return true;
+}
+
 template <class T> 
 T getTransform( const FrameNode* fn ) { return fn->getTransform(); }
 
@@ -803,9 +874,14 @@ void Environment::serialize(std::string const& path)
     boost::filesystem::path scene( sceneDir / serialization.STRUCTURE_FILE );
 
     boost::filesystem::create_directories( path );
+    // a pending checkpoint would overwrite the new files
+    FileSerialization::recoverCheckpoint( path );
 
     serialization.setSceneDir(sceneDir.string());
     serialization.writeToFile( this, scene.string() );
+
+    checkpointPath = path;
+    FileSerialization::getCheckpointItems( this, checkpointItems );
 }
 
 Environment* Environment::unserialize(std::string const& path)
@@ -814,6 +890,8 @@ Environment* Environment::unserialize(std::string const& path)
     boost::filesystem::path sceneDir( path ); 
     boost::filesystem::path scene( sceneDir / serialization.STRUCTURE_FILE );
 
+    FileSerialization::recoverCheckpoint( path );
+
     if( !boost::filesystem::is_regular( scene ) )
     {
         std::cerr << "failed to open " << scene << std::endl;
@@ -821,9 +899,178 @@ Environment* Environment::unserialize(std::string const& path)
     }
 
     serialization.setSceneDir(sceneDir.string());
-    return serialization.readFromFile( scene.string() );
+    Environment* env = serialization.readFromFile( scene.string() );
+
+    // the loaded items are the same as the ones in the directory
+    env->checkpointPath = path;
+    FileSerialization::getCheckpointItems( env, env->checkpointItems );
+
+    return env;
+}
+
+void Environment::checkpoint(std::string const& path)
+{
+    if( path != checkpointPath )
+    {
+	checkpointItems.clear();
+	checkpointPath = path;
+    }
+
+    FileSerialization serialization;
+    serialization.writeCheckpoint( this, path, checkpointItems );
 }
 
+void Environment::setMemoryBudget( size_t bytes, const std::string& path )
+{
+    if( bytes )
+	boost::filesystem::create_directories( path );
+
+    memoryBudget = bytes;
+    evictionPath = path;
+}
+
+size_t Environment::getMemoryUsage() const
+{
+    size_t usage = 0;
+    for( itemListType::const_iterator it = items.begin(); it != items.end(); it++ )
+    {
+	const Layer* layer = dynamic_cast<const Layer*>( it->second.get() );
+	if( layer && !layer->evicted )
+	    usage += layer->getMemoryUsage();
+    }
+    return usage;
+}
+
+namespace
+{
+    struct EvictionCandidate
+    {
+	Layer* layer;
+	unsigned long lastAccess;
+	size_t usage;
+
+	/** least recently accessed first, and the larger one for the same
+	 * access */
+	bool operator<( const EvictionCandidate& other ) const
+	{
+	    if( lastAccess != other.lastAccess )
+		return lastAccess < other.lastAccess;
+	    return usage > other.usage;
+	}
+    };
+}
+
+void Environment::enforceMemoryBudget( Layer* keep )
+{
+    if( !memoryBudget )
+	return;
+
+    // the layer is usually modified by an operator, which can still
+    // hold references to the data of its other inputs and outputs
+    std::set<Layer*> used;
+    if( keep )
+    {
+	std::set<Operator*> ops;
+	for( operatorGraphType::iterator it = operatorGraphInput.begin(); it != operatorGraphInput.end(); it++ )
+	    if( it->second == keep )
+		ops.insert( it->first );
+	for( operatorGraphType::iterator it = operatorGraphOutput.begin(); it != operatorGraphOutput.end(); it++ )
+	    if( it->second == keep )
+		ops.insert( it->first );
+
+	used.insert( keep );
+	for( operatorGraphType::iterator it = operatorGraphInput.begin(); it != operatorGraphInput.end(); it++ )
+	    if( ops.count( it->first ) )
+		used.insert( it->second );
+	for( operatorGraphType::iterator it = operatorGraphOutput.begin(); it != operatorGraphOutput.end(); it++ )
+	    if( ops.count( it->first ) )
+		used.insert( it->second );
+    }
+
+    size_t usage = 0;
+    std::vector<EvictionCandidate> candidates;
+    for( itemListType::iterator it = items.begin(); it != items.end(); it++ )
+    {
+	Layer* layer = dynamic_cast<Layer*>( it->second.get() );
+	if( !layer || layer->evicted )
+	    continue;
+
+	EvictionCandidate c;
+	c.layer = layer;
+	c.lastAccess = layer->lastAccess;
+	c.usage = layer->getMemoryUsage();
+	usage += c.usage;
+	if( c.usage && !used.count( layer ) )
+	    candidates.push_back( c );
+    }
+
+    std::sort( candidates.begin(), candidates.end() );
+    for( size_t i=0; i<candidates.size() && usage > memoryBudget; i++ )
+    {
+	if( evictLayer( candidates[i].layer ) )
+	    usage -= candidates[i].usage;
+    }
+}
+
+std::string Environment::getEvictionFile( const Layer* layer ) const
+{
+    std::string name = layer->getUniqueId();
+    std::replace( name.begin(), name.end(), '/', '_' );
+    return (boost::filesystem::path( evictionPath ) / (name + ".bin")).string();
+}
+
+bool Environment::evictLayer( Layer* layer )
+{
+    assert( layer->getEnvironment() == this );
+    if( layer->evicted )
+	return true;
+
+    // evicting doesn't change the layer, but the data accessors used by
+    // writeData() and releaseData() raise the generation
+    const unsigned long generation = layer->generation;
+    const std::string file = getEvictionFile( layer );
+    {
+	std::ofstream os( file.c_str(), std::ios::binary );
+	if( !os )
+	    throw std::runtime_error("envire: could not open " + file + " for eviction.");
+	if( !layer->writeData( os ) )
+	{
+	    layer->generation = generation;
+	    os.close();
+	    boost::filesystem::remove( file );
+	    return false;
+	}
+	os.flush();
+	if( !os )
+	    throw std::runtime_error("envire: could not write " + file + " for eviction.");
+    }
+
+    layer->releaseData();
+    layer->evicted = true;
+    layer->generation = generation;
+    return true;
+}
+
+void Environment::restoreLayer( Layer* layer )
+{
+    if( !layer->evicted )
+	return;
+
+    const std::string file = getEvictionFile( layer );
+    std::ifstream is( file.c_str(), std::ios::binary );
+    if( !is )
+	throw std::runtime_error("envire: could not open evicted layer " + file );
+
+    // the accessors used by readData() check the flag
+    layer->evicted = false;
+    layer->lastAccess = accessTick;
+    const unsigned long generation = layer->generation;
+    layer->readData( is );
+    layer->generation = generation;
+    is.close();
+
+    boost::filesystem::remove( file );
+}
 
 void Environment::applyEvents(std::vector<BinaryEvent> const& events)
 {
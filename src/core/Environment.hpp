@@ -18,6 +18,7 @@ namespace envire
     class SynchronizationEventQueue;
     class Event;
     class SerializationFactory;
+    class ExecutionContext;
     
     /** The environment class manages EnvironmentItem objects and has ownership
      * of these.  all dependencies between the objects are handled in the
@@ -28,6 +29,8 @@ namespace envire
     {
 	friend class FileSerialization;
 	friend class GraphViz;
+	friend class Layer;
+	friend class EnvironmentItem;
 
 	/** we track the last id given to an item, for assigning new id's.
 	 */
@@ -57,6 +60,23 @@ namespace envire
         std::string envPrefix;
 
 	EventSource eventHandlers;
+
+	/** memory budget for the layers in bytes, 0 if disabled */
+	size_t memoryBudget;
+	/** directory for the evicted layers */
+	std::string evictionPath;
+	/** counts the modifications of the environment, used to find the
+	 * least recently accessed layers */
+	unsigned long accessTick;
+
+	std::string getEvictionFile( const Layer* layer ) const;
+
+	/** counter for the generations of the items */
+	unsigned long lastGeneration;
+	/** directory of the last checkpoint, and the items written to it */
+	std::string checkpointPath;
+	FileSerialization::CheckpointItems checkpointItems;
+
 	void publishChilds(EventHandler* handler, FrameNode *parent);
 	void detachChilds(FrameNode *parent, EventHandler* handler);
 
@@ -275,12 +295,44 @@ namespace envire
 
 	void updateOperators();
 
+	/** Runs all operators under the control of the given context, and
+	 * stops when it is cancelled or runs out of time. The context is
+	 * checked before each operator is started. The outputs of all
+	 * operators which completed their update are marked as modified, also
+	 * if the context expired in the meantime.
+	 *
+	 * @return false if the update was abandoned
+	 */
+	bool updateOperators( ExecutionContext& context );
+
         /** Serializes this environment to the given directory */
         void serialize(std::string const& path);
 
-        /** Loads the environment from the given directory and returns it */
+        /** Loads the environment from the given directory and returns it.
+         * An interrupted checkpoint() in the directory is completed or
+         * discarded first. */
         static Environment* unserialize(std::string const& path);
 
+        /** Serializes this environment incrementally to the given directory.
+         *
+         * If the last serialize(), unserialize() or checkpoint() of this
+         * environment used the same directory, only the binary files of the
+         * items which changed since then are written, as reported by
+         * EnvironmentItem::getGeneration(). The scene file is always
+         * rewritten. Otherwise, this is a full serialization.
+         *
+         * The files are written to a staging directory first. A manifest
+         * listing them is then renamed into place, which commits the
+         * checkpoint, and the files are renamed over the old ones. If the
+         * process is interrupted, the directory is recovered by the next
+         * checkpoint() or unserialize() on it: a committed checkpoint is
+         * completed, an uncommitted one is discarded, so the directory
+         * always holds either the previous or the new state. The binary
+         * files of the items which have been removed since the last
+         * checkpoint are deleted together with the commit.
+         */
+        void checkpoint(std::string const& path);
+
 	/**
 	 * Adds an eventHandler that gets called whenever there
 	 * are modifications to the evironment.
@@ -289,6 +341,13 @@ namespace envire
 	 */
 	void addEventHandler(EventHandler *handler);
 
+	/**
+	 * Passes the complete content of the environment to the given handler
+	 * as if it was being generated, without registering the handler.
+	 * This is what addEventHandler() does on registration.
+	 */
+	void publishEvents(EventHandler *handler);
+
 	/**
 	 * Remove the given eventHandler from the environment.
 	 * The handler will receive events as if the Environment was destroyed.
@@ -375,6 +434,60 @@ namespace envire
          */
         std::string getEnvironmentPrefix() const { return envPrefix; }
 
+        /** Sets a limit for the memory used by the data of the layers in
+         * this environment.
+         *
+         * When the budget is exceeded, the least recently accessed layers are
+         * written to files in @a path and their data is freed. The data is
+         * restored transparently the next time the layer is accessed, see
+         * Layer::touch(). Only layers which implement Layer::getMemoryUsage()
+         * and Layer::writeData() can be evicted, which are Grid<T> and
+         * MLSGrid. Pointclouds and TriMeshes count towards the budget, but
+         * stay in memory.
+         *
+         * The budget is checked whenever an item is modified, and on calls of
+         * enforceMemoryBudget(). The modified item is never evicted, and
+         * neither are the other inputs and outputs of the operators it is
+         * connected to, since these are usually still in use. Evicted grids
+         * keep their bands, so references to the band data stay valid, but
+         * the bands are empty until the grid is accessed again. Restoring a layer does not evict others, so
+         * the memory usage can exceed the budget until the next modification.
+         * Restoring is not thread safe, so layers which are used by multiple
+         * threads need to be restored with Layer::touch() before. The inputs
+         * and outputs of operators are restored by getInputs() and
+         * getOutputs().
+         *
+         * @param bytes the budget in bytes, 0 disables eviction
+         * @param path directory for the evicted layers, which is created if
+         *        necessary
+         */
+        void setMemoryBudget( size_t bytes, const std::string& path );
+        size_t getMemoryBudget() const { return memoryBudget; }
+
+        /** @return the memory used by the data of all layers which are not
+         * evicted, as reported by Layer::getMemoryUsage() */
+        size_t getMemoryUsage() const;
+
+        /** Evicts the least recently accessed layers, until the memory usage
+         * is within the budget.
+         *
+         * @param keep optional layer which is not evicted, together with the
+         *        inputs and outputs of the operators it is connected to
+         */
+        void enforceMemoryBudget( Layer* keep = NULL );
+
+        /** Writes the data of the layer to the eviction directory and frees
+         * it.
+         *
+         * @return false if the layer doesn't support eviction
+         */
+        bool evictLayer( Layer* layer );
+
+        /** Reads the data of an evicted layer back in. This is called by
+         * Layer::touch() and usually doesn't need to be called directly.
+         */
+        void restoreLayer( Layer* layer );
+
         /** Apply a set of serialized modifications to this environment
          */
         void applyEvents(std::vector<BinaryEvent> const& events);
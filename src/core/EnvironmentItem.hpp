@@ -102,6 +102,14 @@ namespace envire
 	 */
 	Environment* env;
 
+	/** generation of the last modification of this item, see
+	 * getGeneration() */
+	unsigned long generation;
+
+	/** marks this item as changed, without notifying the environment like
+	 * itemModified() does. Used by the data setters. */
+	void raiseGeneration();
+
     public:
 	static const std::string className;
 	
@@ -174,6 +182,17 @@ namespace envire
 	 */
 	void itemModified();
 
+	/** @return the generation of the last modification of this item.
+	 *
+	 * The generation is taken from a counter of the environment, and
+	 * raised when the item is attached, by itemModified() and by the data
+	 * setters and non-const data accessors of the layers. It is used to
+	 * detect the items which changed since the last checkpoint, see
+	 * Environment::checkpoint(). Changes to public members, like the
+	 * vertices of a Pointcloud, need to be reported with itemModified().
+	 */
+	unsigned long getGeneration() const { return generation; }
+
 	/** will detach the item from the current environment
 	 */
 	EnvironmentItem::Ptr detach();
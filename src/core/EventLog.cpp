@@ -0,0 +1,470 @@
+#include "EventLog.hpp"
+#include "Environment.hpp"
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+
+using namespace envire;
+namespace fs = boost::filesystem;
+
+const std::string EventLog::INDEX_FILE = "index";
+
+namespace
+{
+    const uint32_t RECORD_MAGIC = 0x47454c45; // "ELEG"
+
+    // size of the record header, which is magic, kind, seq, time,
+    // payload size and number of events
+    const size_t RECORD_HEADER_SIZE = 4 + 4 + 8 + 8 + 4 + 4;
+
+    template <class T>
+    void writeValue( std::ostream& os, const T& value )
+    {
+	os.write( reinterpret_cast<const char*>( &value ), sizeof( T ) );
+    }
+
+    template <class T>
+    bool readValue( std::istream& is, T& value )
+    {
+	is.read( reinterpret_cast<char*>( &value ), sizeof( T ) );
+	return is.gcount() == sizeof( T );
+    }
+
+    void writeString( std::ostream& os, const std::string& str )
+    {
+	writeValue<uint32_t>( os, str.size() );
+	os.write( str.data(), str.size() );
+    }
+
+    void readString( std::istream& is, std::string& str )
+    {
+	uint32_t size = 0;
+	readValue( is, size );
+	str.resize( size );
+	if( size )
+	    is.read( &str[0], size );
+    }
+
+    void writeBytes( std::ostream& os, const std::vector<uint8_t>& data )
+    {
+	writeValue<uint32_t>( os, data.size() );
+	if( !data.empty() )
+	    os.write( reinterpret_cast<const char*>( &data[0] ), data.size() );
+    }
+
+    void readBytes( std::istream& is, std::vector<uint8_t>& data )
+    {
+	uint32_t size = 0;
+	readValue( is, size );
+	data.resize( size );
+	if( size )
+	    is.read( reinterpret_cast<char*>( &data[0] ), size );
+    }
+
+    void writeIndexEntry( std::ostream& os, const EventLogIndexEntry& entry )
+    {
+	writeValue<uint64_t>( os, entry.seq );
+	writeValue<int64_t>( os, entry.time.toMicroseconds() );
+	writeValue<uint32_t>( os, entry.kind );
+	writeValue<uint32_t>( os, entry.segment );
+	writeValue<uint64_t>( os, entry.offset );
+	writeValue<uint32_t>( os, entry.size );
+    }
+
+    bool readIndexEntry( std::istream& is, EventLogIndexEntry& entry )
+    {
+	int64_t time;
+	uint32_t kind;
+	if( !( readValue( is, entry.seq )
+		&& readValue( is, time )
+		&& readValue( is, kind )
+		&& readValue( is, entry.segment )
+		&& readValue( is, entry.offset )
+		&& readValue( is, entry.size ) ) )
+	    return false;
+
+	entry.time = base::Time::fromMicroseconds( time );
+	entry.kind = static_cast<EventLogIndexEntry::Kind>( kind );
+	return true;
+    }
+
+    /** reads the records of a segment starting from the given offset and
+     * appends them to the index. Stops at the first incomplete record. */
+    void scanSegment( const std::string& path, uint32_t segment, uint64_t offset, std::vector<EventLogIndexEntry>& index )
+    {
+	std::ifstream is( EventLog::getSegmentFileName( path, segment ).c_str(), std::ios::binary );
+	const uint64_t fileSize = fs::file_size( EventLog::getSegmentFileName( path, segment ) );
+	is.seekg( offset );
+	while( offset + RECORD_HEADER_SIZE <= fileSize )
+	{
+	    uint32_t magic, kind, size, count;
+	    int64_t time;
+	    EventLogIndexEntry entry;
+	    if( !( readValue( is, magic )
+			&& readValue( is, kind )
+			&& readValue( is, entry.seq )
+			&& readValue( is, time )
+			&& readValue( is, size )
+			&& readValue( is, count ) )
+		    || magic != RECORD_MAGIC
+		    || offset + RECORD_HEADER_SIZE + size > fileSize )
+		break;
+
+	    entry.time = base::Time::fromMicroseconds( time );
+	    entry.kind = static_cast<EventLogIndexEntry::Kind>( kind );
+	    entry.segment = segment;
+	    entry.offset = offset;
+	    entry.size = RECORD_HEADER_SIZE + size;
+	    index.push_back( entry );
+
+	    offset += entry.size;
+	    is.seekg( offset );
+	}
+    }
+
+    /** handler which collects the binary events of the complete
+     * environment for a keyframe */
+    class KeyframeCollector : public SynchronizationEventHandler
+    {
+    public:
+	std::vector<BinaryEvent> events;
+
+    protected:
+	void handle( std::vector<BinaryEvent>& msgs )
+	{
+	    for( size_t i=0; i<msgs.size(); i++ )
+	    {
+		events.push_back( BinaryEvent() );
+		events.back().move( msgs[i] );
+	    }
+	}
+    };
+
+    struct IndexTimeCompare
+    {
+	bool operator()( const base::Time& time, const EventLogIndexEntry& entry ) const
+	{
+	    return time < entry.time;
+	}
+    };
+}
+
+std::string EventLog::getSegmentFileName( const std::string& path, uint32_t segment )
+{
+    std::ostringstream ss;
+    ss << "segment_" << std::setw( 6 ) << std::setfill( '0' ) << segment << ".log";
+    return (fs::path( path ) / ss.str()).string();
+}
+
+void EventLog::readIndex( const std::string& path, std::vector<EventLogIndexEntry>& index )
+{
+    index.clear();
+
+    const std::string indexFile = (fs::path( path ) / INDEX_FILE).string();
+    if( fs::exists( indexFile ) )
+    {
+	std::ifstream is( indexFile.c_str(), std::ios::binary );
+	EventLogIndexEntry entry;
+	while( readIndexEntry( is, entry ) )
+	    index.push_back( entry );
+    }
+
+    // the index is written after the segment, so there may be records which
+    // have not made it into the index. Continue after the last indexed
+    // record.
+    uint32_t segment = 0;
+    uint64_t offset = 0;
+    if( !index.empty() )
+    {
+	segment = index.back().segment;
+	offset = index.back().offset + index.back().size;
+    }
+
+    while( fs::exists( getSegmentFileName( path, segment ) ) )
+    {
+	scanSegment( path, segment, offset, index );
+	segment++;
+	offset = 0;
+    }
+}
+
+void EventLog::writeEvent( std::ostream& os, const BinaryEvent& event )
+{
+    writeValue<int64_t>( os, event.time.toMicroseconds() );
+    writeString( os, event.id_a );
+    writeString( os, event.id_b );
+    writeValue<uint32_t>( os, event.type );
+    writeValue<uint32_t>( os, event.operation );
+    writeString( os, event.className );
+    writeBytes( os, event.yamlProperties );
+    writeValue<uint32_t>( os, event.binaryStreamNames.size() );
+    for( size_t i=0; i<event.binaryStreamNames.size(); i++ )
+    {
+	writeString( os, event.binaryStreamNames[i] );
+	writeBytes( os, event.binaryStreams[i] );
+    }
+}
+
+void EventLog::readEvent( std::istream& is, BinaryEvent& event )
+{
+    int64_t time;
+    uint32_t type, operation, streams;
+    readValue( is, time );
+    event.time = base::Time::fromMicroseconds( time );
+    readString( is, event.id_a );
+    readString( is, event.id_b );
+    readValue( is, type );
+    readValue( is, operation );
+    event.type = static_cast<event::Type>( type );
+    event.operation = static_cast<event::Operation>( operation );
+    readString( is, event.className );
+    readBytes( is, event.yamlProperties );
+    readValue( is, streams );
+    event.binaryStreamNames.resize( streams );
+    event.binaryStreams.resize( streams );
+    for( size_t i=0; i<streams; i++ )
+    {
+	readString( is, event.binaryStreamNames[i] );
+	readBytes( is, event.binaryStreams[i] );
+    }
+
+    if( !is )
+	throw std::runtime_error( "EventLog: could not read event, log is corrupt." );
+}
+
+void EventLog::readRecord( const std::string& path, const EventLogIndexEntry& entry, std::vector<BinaryEvent>& events )
+{
+    std::ifstream is( getSegmentFileName( path, entry.segment ).c_str(), std::ios::binary );
+    is.seekg( entry.offset );
+
+    uint32_t magic, kind, size, count;
+    int64_t time;
+    uint64_t seq;
+    if( !( readValue( is, magic )
+		&& readValue( is, kind )
+		&& readValue( is, seq )
+		&& readValue( is, time )
+		&& readValue( is, size )
+		&& readValue( is, count ) )
+	    || magic != RECORD_MAGIC || seq != entry.seq )
+	throw std::runtime_error( "EventLog: record does not match index." );
+
+    events.resize( count );
+    for( size_t i=0; i<count; i++ )
+	readEvent( is, events[i] );
+}
+
+EventLogRecorder::EventLogRecorder( const std::string& path, Environment* env )
+    : path( path ), env( env ), segment( 0 ), seq( 0 ),
+    keyframeEvents( 1000 ), maxSegmentSize( 64 * 1024 * 1024 ),
+    eventsSinceKeyframe( 0 )
+{
+    useEventQueue( true );
+
+    fs::create_directories( path );
+
+    // continue an existing log. The index is rewritten, since it might
+    // have been rebuilt from the segments
+    std::vector<EventLogIndexEntry> index;
+    EventLog::readIndex( path, index );
+    if( !index.empty() )
+    {
+	seq = index.back().seq + 1;
+	segment = index.back().segment;
+	lastEventTime = index.back().time;
+
+	// cut off any incomplete record at the end of the segment
+	const uint64_t end = index.back().offset + index.back().size;
+	if( fs::file_size( EventLog::getSegmentFileName( path, segment ) ) > end )
+	    fs::resize_file( EventLog::getSegmentFileName( path, segment ), end );
+    }
+
+    const std::string indexFile = (fs::path( path ) / EventLog::INDEX_FILE).string();
+    indexStream.open( indexFile.c_str(), std::ios::binary | std::ios::trunc );
+    for( size_t i=0; i<index.size(); i++ )
+	writeIndexEntry( indexStream, index[i] );
+    indexStream.flush();
+
+    openSegment( segment );
+}
+
+EventLogRecorder::~EventLogRecorder()
+{
+    // don't call flush() here, as the environment might
+    // already be gone
+    segmentStream.close();
+    indexStream.close();
+}
+
+void EventLogRecorder::setKeyframeInterval( size_t events, const base::Time& period )
+{
+    keyframeEvents = events;
+    keyframePeriod = period;
+}
+
+void EventLogRecorder::setMaxSegmentSize( size_t bytes )
+{
+    maxSegmentSize = bytes;
+}
+
+void EventLogRecorder::openSegment( uint32_t segment )
+{
+    this->segment = segment;
+    if( segmentStream.is_open() )
+	segmentStream.close();
+
+    const std::string fileName = EventLog::getSegmentFileName( path, segment );
+    segmentStream.open( fileName.c_str(), std::ios::binary | std::ios::app );
+    if( !segmentStream )
+	throw std::runtime_error( "EventLogRecorder: could not open " + fileName );
+    segmentStream.seekp( 0, std::ios::end );
+}
+
+void EventLogRecorder::writeRecord( EventLogIndexEntry::Kind kind, const base::Time& time, const std::vector<BinaryEvent>& events )
+{
+    std::ostringstream payload;
+    for( size_t i=0; i<events.size(); i++ )
+	EventLog::writeEvent( payload, events[i] );
+    const std::string data = payload.str();
+
+    // rotate before the segment exceeds its maximum size, but never
+    // leave a segment empty
+    uint64_t offset = segmentStream.tellp();
+    if( offset > 0 && offset + RECORD_HEADER_SIZE + data.size() > maxSegmentSize )
+    {
+	openSegment( segment + 1 );
+	offset = 0;
+    }
+
+    EventLogIndexEntry entry;
+    entry.seq = seq++;
+    entry.time = time;
+    entry.kind = kind;
+    entry.segment = segment;
+    entry.offset = offset;
+    entry.size = RECORD_HEADER_SIZE + data.size();
+
+    writeValue<uint32_t>( segmentStream, RECORD_MAGIC );
+    writeValue<uint32_t>( segmentStream, kind );
+    writeValue<uint64_t>( segmentStream, entry.seq );
+    writeValue<int64_t>( segmentStream, time.toMicroseconds() );
+    writeValue<uint32_t>( segmentStream, data.size() );
+    writeValue<uint32_t>( segmentStream, events.size() );
+    segmentStream.write( data.data(), data.size() );
+
+    writeIndexEntry( indexStream, entry );
+
+    if( !segmentStream || !indexStream )
+	throw std::runtime_error( "EventLogRecorder: failed to write to " + path );
+}
+
+void EventLogRecorder::handle( std::vector<BinaryEvent>& msgs )
+{
+    for( size_t i=0; i<msgs.size(); i++ )
+    {
+	writeRecord( EventLogIndexEntry::EVENT, msgs[i].time,
+		std::vector<BinaryEvent>( 1, msgs[i] ) );
+	eventsSinceKeyframe++;
+
+	// keyframes use the clock of the events, so that the index stays
+	// sorted by time
+	if( lastEventTime.isNull() || msgs[i].time > lastEventTime )
+	    lastEventTime = msgs[i].time;
+	if( lastKeyframe.isNull() )
+	    lastKeyframe = lastEventTime;
+    }
+}
+
+void EventLogRecorder::writeKeyframe()
+{
+    KeyframeCollector collector;
+    env->publishEvents( &collector );
+
+    writeRecord( EventLogIndexEntry::KEYFRAME, lastEventTime, collector.events );
+    eventsSinceKeyframe = 0;
+    lastKeyframe = lastEventTime;
+}
+
+void EventLogRecorder::flush()
+{
+    // writes the queued events through handle()
+    SynchronizationEventHandler::flush();
+
+    // at this point the log and the environment are in the same state,
+    // so this is a safe point for a keyframe
+    if( eventsSinceKeyframe > 0 &&
+	    ( (keyframeEvents > 0 && eventsSinceKeyframe >= keyframeEvents)
+	      || (!keyframePeriod.isNull() && lastEventTime - lastKeyframe >= keyframePeriod) ) )
+	writeKeyframe();
+
+    segmentStream.flush();
+    indexStream.flush();
+}
+
+EventLogReplay::EventLogReplay( const std::string& path )
+    : path( path ), position( 0 )
+{
+    if( !fs::exists( path ) )
+	throw std::runtime_error( "EventLogReplay: log " + path + " does not exist." );
+
+    EventLog::readIndex( path, index );
+}
+
+base::Time EventLogReplay::getStartTime() const
+{
+    return index.empty() ? base::Time() : index.front().time;
+}
+
+base::Time EventLogReplay::getEndTime() const
+{
+    return index.empty() ? base::Time() : index.back().time;
+}
+
+Environment* EventLogReplay::seek( const base::Time& time )
+{
+    // records are in time order, find the first record after the given time
+    const size_t end =
+	std::upper_bound( index.begin(), index.end(), time, IndexTimeCompare() ) - index.begin();
+
+    // and the latest keyframe before that
+    size_t start = end;
+    while( start > 0 && index[start-1].kind != EventLogIndexEntry::KEYFRAME )
+	start--;
+    if( start > 0 )
+	start--;
+
+    Environment *env = new Environment();
+    position = start;
+    if( position < end && index[position].kind == EventLogIndexEntry::KEYFRAME )
+    {
+	std::vector<BinaryEvent> events;
+	EventLog::readRecord( path, index[position], events );
+	BinarySerialization::applyEvents( env, events );
+	position++;
+    }
+    advance( env, time );
+    return env;
+}
+
+size_t EventLogReplay::advance( Environment* env, const base::Time& time )
+{
+    size_t count = 0;
+    std::vector<BinaryEvent> events;
+    while( position < index.size() && index[position].time <= time )
+    {
+	// keyframes are redundant when playing forward, they are only
+	// needed as the starting point of a seek
+	if( index[position].kind == EventLogIndexEntry::EVENT )
+	{
+	    EventLog::readRecord( path, index[position], events );
+	    BinarySerialization::applyEvents( env, events );
+	    count += events.size();
+	}
+	position++;
+    }
+    return count;
+}
@@ -0,0 +1,198 @@
+#ifndef __ENVIRE_EVENTLOG_HPP__
+#define __ENVIRE_EVENTLOG_HPP__
+
+#include <envire/core/Serialization.hpp>
+#include <envire/core/EventTypes.hpp>
+#include <fstream>
+#include <vector>
+#include <string>
+
+namespace envire
+{
+    class Environment;
+
+    /**
+     * Entry in the index file of an event log. There is one entry for each
+     * record in the log, a record being either a single BinaryEvent or a
+     * keyframe, which is the complete content of an environment as a list
+     * of BinaryEvents.
+     */
+    struct EventLogIndexEntry
+    {
+        enum Kind
+        {
+            EVENT = 0,
+            KEYFRAME = 1
+        };
+
+        /** sequence number of the record, starting at 0 */
+        uint64_t seq;
+        /** time of the event, or the time the keyframe was taken */
+        base::Time time;
+        Kind kind;
+        /** number of the segment file the record is stored in */
+        uint32_t segment;
+        /** byte offset of the record in the segment file */
+        uint64_t offset;
+        /** size of the record in bytes */
+        uint32_t size;
+    };
+
+    /**
+     * Common functionality of the event log recorder and replay.
+     *
+     * An event log is a directory, which contains a number of append-only
+     * segment files (segment_<n>.log) with the serialized records and an
+     * index file with one EventLogIndexEntry per record.
+     */
+    class EventLog
+    {
+    public:
+        static const std::string INDEX_FILE;
+
+        /** @return the file name of the segment with the given number */
+        static std::string getSegmentFileName( const std::string& path, uint32_t segment );
+
+        /** Reads the index of the log in the given directory. If the index
+         * file is missing or truncated, the index is rebuilt from the
+         * segment files.
+         */
+        static void readIndex( const std::string& path, std::vector<EventLogIndexEntry>& index );
+
+        /** Writes a single binary event to the stream */
+        static void writeEvent( std::ostream& os, const BinaryEvent& event );
+
+        /** Reads a single binary event from the stream */
+        static void readEvent( std::istream& is, BinaryEvent& event );
+
+        /** Reads the events of the record described by the index entry */
+        static void readRecord( const std::string& path, const EventLogIndexEntry& entry, std::vector<BinaryEvent>& events );
+    };
+
+    /**
+     * @brief Records the events of an environment to an indexed event log.
+     *
+     * Attach the recorder to an environment using
+     * Environment::addEventHandler(). Events are queued and written to disk
+     * when flush() is called. Whenever the configured number of events or
+     * amount of time has passed since the last keyframe, flush() will
+     * additionally write a keyframe of the complete environment, which
+     * allows EventLogReplay to seek in the log without replaying all the
+     * events from the start.
+     *
+     * Keyframes are only written from flush(), so that the state of the
+     * environment is consistent with the events that have been written to
+     * the log.
+     *
+     * If the log directory already contains a log, new records are appended
+     * to it.
+     */
+    class EventLogRecorder : public SynchronizationEventHandler
+    {
+    public:
+        /**
+         * @param path directory of the log, will be created if it does not exist
+         * @param env the environment that is recorded, used for keyframes
+         */
+        EventLogRecorder( const std::string& path, Environment* env );
+        ~EventLogRecorder();
+
+        /** Write a keyframe every @param events events or every @param
+         * period time, whatever comes first. The period is measured in the
+         * time of the recorded events. Setting a value to zero disables
+         * the respective condition. The default is a keyframe every 1000
+         * events.
+         */
+        void setKeyframeInterval( size_t events, const base::Time& period = base::Time() );
+
+        /** Segment files are rotated once they are larger than the given
+         * number of bytes. Default is 64MB.
+         */
+        void setMaxSegmentSize( size_t bytes );
+
+        /** Writes a keyframe with the current content of the environment.
+         * The keyframe has the time of the last recorded event. */
+        void writeKeyframe();
+
+        /** Writes all queued events to the log, and a keyframe if required */
+        virtual void flush();
+
+        /** @return the number of records in the log */
+        size_t getRecordCount() const { return seq; }
+
+    protected:
+        void handle( std::vector<BinaryEvent>& msgs );
+
+    private:
+        void openSegment( uint32_t segment );
+        void writeRecord( EventLogIndexEntry::Kind kind, const base::Time& time, const std::vector<BinaryEvent>& events );
+
+        std::string path;
+        Environment* env;
+
+        std::ofstream segmentStream;
+        std::ofstream indexStream;
+        uint32_t segment;
+        uint64_t seq;
+
+        size_t keyframeEvents;
+        base::Time keyframePeriod;
+        size_t maxSegmentSize;
+
+        size_t eventsSinceKeyframe;
+        /** times of the last keyframe and of the latest event, both in
+         * the time of the events */
+        base::Time lastKeyframe;
+        base::Time lastEventTime;
+    };
+
+    /**
+     * @brief Replays an event log written by EventLogRecorder.
+     *
+     * seek() creates a new environment with the state at the given time by
+     * applying the closest keyframe before that time and the events
+     * recorded after it. advance() can then be used to play the log forward
+     * on that environment.
+     */
+    class EventLogReplay
+    {
+    public:
+        explicit EventLogReplay( const std::string& path );
+
+        /** @return the number of records in the log */
+        size_t getRecordCount() const { return index.size(); }
+
+        /** @return the index entry of the given record */
+        const EventLogIndexEntry& getIndexEntry( size_t record ) const { return index.at( record ); }
+
+        /** @return the time of the first record */
+        base::Time getStartTime() const;
+
+        /** @return the time of the last record */
+        base::Time getEndTime() const;
+
+        /** Creates a new environment with the state of the recorded
+         * environment at the given time. Ownership of the returned
+         * environment is passed to the caller.
+         */
+        Environment* seek( const base::Time& time );
+
+        /** Applies all records after the current position up to and including
+         * the given time to the environment, which should be the one returned
+         * by seek().
+         *
+         * @return the number of events that have been applied
+         */
+        size_t advance( Environment* env, const base::Time& time );
+
+        /** @return the index of the next record that advance() would apply */
+        size_t getPosition() const { return position; }
+
+    private:
+        std::string path;
+        std::vector<EventLogIndexEntry> index;
+        size_t position;
+    };
+}
+
+#endif
@@ -0,0 +1,81 @@
+#include "ExecutionContext.hpp"
+
+#include <algorithm>
+
+using namespace envire;
+
+ExecutionContext::ExecutionContext()
+    : cancelled( 0 ), hasDeadline( false ), progress( 0.0 )
+{
+}
+
+void ExecutionContext::cancel()
+{
+    cancelled = 1;
+}
+
+void ExecutionContext::reset()
+{
+    cancelled = 0;
+    boost::mutex::scoped_lock lock( mutex );
+    hasDeadline = false;
+    progress = 0.0;
+}
+
+void ExecutionContext::setDeadline( const boost::posix_time::ptime& deadline )
+{
+    boost::mutex::scoped_lock lock( mutex );
+    this->deadline = deadline;
+    hasDeadline = true;
+}
+
+void ExecutionContext::setTimeBudget( double seconds )
+{
+    setDeadline( boost::posix_time::microsec_clock::universal_time()
+	    + boost::posix_time::microseconds( static_cast<long>( seconds * 1e6 ) ) );
+}
+
+bool ExecutionContext::isExpired() const
+{
+    boost::mutex::scoped_lock lock( mutex );
+    return hasDeadline && boost::posix_time::microsec_clock::universal_time() >= deadline;
+}
+
+bool ExecutionContext::isCancelled() const
+{
+    return cancelled || isExpired();
+}
+
+void ExecutionContext::check() const
+{
+    if( cancelled )
+	throw OperationCancelled("operation was cancelled");
+    if( isExpired() )
+	throw OperationCancelled("operation ran out of time");
+}
+
+void ExecutionContext::setProgressCallback( const ProgressCallback& callback )
+{
+    boost::mutex::scoped_lock lock( mutex );
+    this->callback = callback;
+}
+
+void ExecutionContext::setProgress( const std::string& item, double progress )
+{
+    progress = std::min( std::max( progress, 0.0 ), 1.0 );
+    ProgressCallback callback;
+    {
+	boost::mutex::scoped_lock lock( mutex );
+	this->progress = progress;
+	callback = this->callback;
+    }
+    // called without the lock, so that the callback can use the context
+    if( callback )
+	callback( item, progress );
+}
+
+double ExecutionContext::getProgress() const
+{
+    boost::mutex::scoped_lock lock( mutex );
+    return progress;
+}
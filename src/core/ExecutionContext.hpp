@@ -0,0 +1,101 @@
+#ifndef __ENVIRE_EXECUTIONCONTEXT__
+#define __ENVIRE_EXECUTIONCONTEXT__
+
+#include <string>
+#include <stdexcept>
+#include <csignal>
+
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace envire
+{
+
+/** thrown from ExecutionContext::check() to abandon an operation which was
+ * cancelled or ran out of time
+ */
+class OperationCancelled : public std::runtime_error
+{
+public:
+    explicit OperationCancelled( const std::string& msg )
+	: std::runtime_error( msg ) {}
+};
+
+/**
+ * Cooperative control of long running operations, like the update of an
+ * operator.
+ *
+ * The context carries a cancellation flag, an optional deadline and a
+ * progress callback. The operation polls it at a coarse granularity, e.g.
+ * once per row or tile, and stops when isCancelled() returns true, either
+ * by returning early or by calling check(), which throws
+ * OperationCancelled. A context is cancelled if cancel() was called, or if
+ * the deadline has passed.
+ *
+ * All methods can be called from multiple threads. cancel() can also be
+ * called from a signal handler.
+ *
+ * @code
+ * ExecutionContext context;
+ * context.setTimeBudget( 0.5 );
+ * if( !op->execute( context ) )
+ *     std::cout << "update abandoned" << std::endl;
+ * @endcode
+ */
+class ExecutionContext
+{
+public:
+    /** called with the id of the item that reports, and its progress in
+     * the range [0, 1] */
+    typedef boost::function<void (const std::string&, double)> ProgressCallback;
+
+public:
+    ExecutionContext();
+
+    /** request the cancellation of the running operation */
+    void cancel();
+
+    /** reset the cancellation flag and the deadline, so that the context
+     * can be reused */
+    void reset();
+
+    /** abandon the operation at the given time (UTC) */
+    void setDeadline( const boost::posix_time::ptime& deadline );
+
+    /** abandon the operation after the given number of seconds from now */
+    void setTimeBudget( double seconds );
+
+    /** @return true if a deadline is set, and has passed */
+    bool isExpired() const;
+
+    /** @return true if the operation should stop, because it was cancelled
+     * or is past the deadline */
+    bool isCancelled() const;
+
+    /** throws OperationCancelled if isCancelled() is true */
+    void check() const;
+
+    /** set the callback, which receives the progress reports */
+    void setProgressCallback( const ProgressCallback& callback );
+
+    /** report the progress of an operation, which is a value between 0
+     * and 1 */
+    void setProgress( const std::string& item, double progress );
+
+    /** @return the last reported progress */
+    double getProgress() const;
+
+private:
+    volatile sig_atomic_t cancelled;
+
+    mutable boost::mutex mutex;
+    bool hasDeadline;
+    boost::posix_time::ptime deadline;
+    ProgressCallback callback;
+    double progress;
+};
+
+}
+
+#endif
@@ -14,15 +14,21 @@ namespace fs = boost::filesystem;
 const std::string Layer::className = "envire::Layer";
 
 Layer::Layer(std::string const& id) :
-    EnvironmentItem(id), immutable(false), dirty(false)
+    EnvironmentItem(id), immutable(false), dirty(false),
+    evicted(false), lastAccess(0)
 {
 }
 
 Layer::Layer(const Layer& other) :
     EnvironmentItem( other ),
     immutable( other.immutable ),
-    dirty( other.dirty )
+    dirty( other.dirty ),
+    evicted( false ), lastAccess( 0 )
 {
+    // the data members of derived classes are copied after this, so an
+    // evicted layer needs to be restored here
+    other.touch();
+
     // copy the data map, and clone the holders
     for( DataMap::const_iterator it = other.data_map.begin(); it != other.data_map.end(); it++ )
 	data_map.insert( std::make_pair( it->first, it->second->clone() ) );
@@ -32,6 +38,8 @@ Layer& Layer::operator=(const Layer& other)
 {
     if( this != &other )
     {
+	other.touch();
+	touch();
 	EnvironmentItem::operator=( other );
 	immutable = other.immutable;
 	dirty = other.dirty;
@@ -44,6 +52,11 @@ Layer& Layer::operator=(const Layer& other)
 
 void Layer::serialize(Serialization& so)
 {
+    // the derived classes write the data after this. Without binary
+    // output, like for the unchanged layers of a checkpoint, only the
+    // configuration is written, which is kept for evicted layers.
+    if( so.hasBinaryOutput() )
+	touch();
     EnvironmentItem::serialize(so);
 
     so.write( "immutable", immutable );
@@ -146,15 +159,29 @@ const std::string Layer::getMapFileName(const std::string& path, const std::stri
 
 bool Layer::hasData(const std::string& type) const
 {
+    restore();
     return data_map.count(type);
 }
 
+void Layer::touch() const
+{
+    if( !env )
+	return;
+
+    if( evicted )
+	env->restoreLayer( const_cast<Layer*>( this ) );
+
+    if( env->memoryBudget )
+	lastAccess = env->accessTick;
+}
+
 void Layer::removeData(const std::string& type)
 {
     if( data_map.count( type ) )
     {
 	delete data_map[type];
 	data_map.erase( type );
+	raiseGeneration();
     }
 }
 
@@ -164,6 +191,7 @@ void Layer::removeData()
 	delete it->second;
     
     data_map.clear();
+    raiseGeneration();
 }
 
 const std::string CartesianMap::className = "envire::CartesianMap";
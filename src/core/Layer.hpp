@@ -3,6 +3,7 @@
 
 #include "EnvironmentItem.hpp"
 #include "Holder.hpp"
+#include <iosfwd>
 
 namespace envire
 {
@@ -12,6 +13,8 @@ namespace envire
      */
     class Layer : public EnvironmentItem
     {
+	friend class Environment;
+
     protected:
         /** @todo explain immutability for layer */
         bool immutable;
@@ -24,6 +27,14 @@ namespace envire
 	/** associating key values with metadata stored in holder objects */ 
 	DataMap data_map;
 
+	/** true if the data of this layer has been written to disk by the
+	 * environment, in order to stay within its memory budget */
+	mutable bool evicted;
+
+	/** access counter of the environment at the last access of this layer
+	 */
+	mutable unsigned long lastAccess;
+
     public:
 	static const std::string className;
 
@@ -116,6 +127,54 @@ namespace envire
          */
         const std::string getMapFileName() const;
 
+	/** @return the approximate number of bytes used by the data of this
+	 * layer. Layers which don't override this method report 0 and are
+	 * not considered by the memory budget of the environment.
+	 */
+	virtual size_t getMemoryUsage() const { return 0; }
+
+	/** Writes the data of this layer to the stream, using the binary
+	 * format of the serialization. Used by the environment to evict the
+	 * layer to disk.
+	 *
+	 * @return false if the layer doesn't support eviction
+	 */
+	virtual bool writeData( std::ostream& os ) { return false; }
+
+	/** Frees the data which has been written by writeData(). The
+	 * configuration of the layer, like the size of a grid, is kept.
+	 */
+	virtual void releaseData() {}
+
+	/** Reads the data written by writeData() back into the layer
+	 */
+	virtual void readData( std::istream& is ) {}
+
+	/** @return true if the data of this layer has been evicted to disk
+	 * @see Environment::setMemoryBudget
+	 */
+	bool isEvicted() const { return evicted; }
+
+	/** Marks this layer as used, and restores its data if it has been
+	 * evicted. This is not thread safe, and needs to be called from the
+	 * thread which uses the environment, before the layer is handed to
+	 * other threads. getInputs() and getOutputs() of the environment call
+	 * it for the layers of an operator.
+	 */
+	void touch() const;
+
+	/** Restores the data of this layer if it has been evicted, without
+	 * marking it as used. This is called by the data accessors of the
+	 * layers, like getData(), hasData() or MLSGrid::beginCell(), which
+	 * only read the layer once it has been touched, and can then be used
+	 * from multiple threads.
+	 */
+	void restore() const
+	{
+	    if( evicted )
+		touch();
+	}
+
 	/** will return true if an entry for metadata for the given key exists
 	 */
 	bool hasData(const std::string& type) const;
@@ -126,6 +185,7 @@ namespace envire
         template<typename T>
         bool hasData(const std::string& type) const
         {
+            restore();
             DataMap::const_iterator it = data_map.find(type);
             if (it == data_map.end())
                 return false;
@@ -135,14 +195,17 @@ namespace envire
 	/** For a given key, return the metadata associated with it. If the data
 	 * does not exist, it will be created.
 	 * Will throw a runtime error if the datatypes don't match.
+	 *
+	 * The data can be changed through the returned reference, so this
+	 * raises the generation of the layer.
 	 */
 	template <typename T>
 	    T& getData(const std::string& type)
 	{
+	    restore();
+	    raiseGeneration();
 	    if( !hasData( type ) )
-	    {
 		data_map[type] = new Holder<T>;
-	    }
 
 	    /*
 	    if( typeid(*data_map[type]) != typeid(Holder<T>) )
@@ -167,6 +230,7 @@ namespace envire
 	template <typename T>
 	const T& getData(const std::string& type) const
 	{
+	    restore();
 	    std::map <std::string, envire::HolderBase* >::const_iterator it = data_map.find(type);
 	    if(it == data_map.end())
 		throw std::runtime_error("No metadata with name " + type + " available ");
@@ -0,0 +1,285 @@
+#include "LieUncertainty.hpp"
+#include <envire/tools/ParallelFor.hpp>
+
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <cmath>
+
+using namespace envire;
+
+namespace
+{
+    typedef TransformWithLieUncertainty::Covariance Matrix6d;
+
+    Eigen::Matrix3d skew( const Eigen::Vector3d& v )
+    {
+	Eigen::Matrix3d res;
+	res << 0, -v.z(), v.y(),
+	    v.z(), 0, -v.x(),
+	    -v.y(), v.x(), 0;
+	return res;
+    }
+
+    /** rotation vector of a rotation matrix, together with the sine and
+     * cosine of its angle, so that the Jacobians don't need to evaluate
+     * them again */
+    struct RotationLog
+    {
+	Eigen::Vector3d r;
+	double theta, sinTheta, cosTheta;
+
+	explicit RotationLog( const Eigen::Matrix3d& R )
+	{
+	    // the trace gives the cosine, the skew part the sine of the angle
+	    const Eigen::Vector3d v( R(2,1) - R(1,2), R(0,2) - R(2,0), R(1,0) - R(0,1) );
+	    cosTheta = std::min( std::max( 0.5 * (R.trace() - 1.0), -1.0 ), 1.0 );
+	    sinTheta = 0.5 * v.norm();
+	    theta = atan2( sinTheta, cosTheta );
+	    if( sinTheta > 1e-6 )
+		r = v * (0.5 * theta / sinTheta);
+	    else if( cosTheta > 0 )
+		r = 0.5 * v;
+	    else
+	    {
+		// the skew part vanishes close to a half turn
+		Eigen::AngleAxisd aa( R );
+		r = aa.axis() * aa.angle();
+	    }
+	}
+    };
+
+    /** left Jacobian of SO(3), exp(r + dr) = exp(Jl(r) dr) exp(r) */
+    Eigen::Matrix3d leftJacobian( const RotationLog& log )
+    {
+	const double theta = log.theta;
+	const Eigen::Matrix3d S( skew( log.r ) );
+	if( theta < 1e-6 )
+	    return Eigen::Matrix3d::Identity() + 0.5 * S + S * S / 6.0;
+	const double theta2 = theta * theta;
+	return Eigen::Matrix3d::Identity()
+	    + (1.0 - log.cosTheta) / theta2 * S
+	    + (theta - log.sinTheta) / (theta2 * theta) * S * S;
+    }
+
+    Eigen::Matrix3d invLeftJacobian( const RotationLog& log )
+    {
+	const double theta = log.theta;
+	const Eigen::Matrix3d S( skew( log.r ) );
+	double c;
+	if( theta < 1e-4 )
+	    c = 1.0 / 12.0;
+	else
+	    c = 1.0 / (theta * theta) - (1.0 + log.cosTheta) / (2.0 * theta * log.sinTheta);
+	return Eigen::Matrix3d::Identity() - 0.5 * S + c * S * S;
+    }
+
+    /** @return the Jacobian of the tangent perturbation with respect to the
+     * [r t] parameters of the transform */
+    Matrix6d toTangentJacobian( const Transform& trans )
+    {
+	const Eigen::Matrix3d Jl( leftJacobian( RotationLog( trans.linear() ) ) );
+	Matrix6d J;
+	J << Jl, Eigen::Matrix3d::Zero(),
+	  skew( trans.translation() ) * Jl, Eigen::Matrix3d::Identity();
+	return J;
+    }
+
+    /** @return the Jacobian of the [r t] parameters with respect to the
+     * tangent perturbation */
+    Matrix6d fromTangentJacobian( const Transform& trans )
+    {
+	Matrix6d J;
+	J << invLeftJacobian( RotationLog( trans.linear() ) ), Eigen::Matrix3d::Zero(),
+	  -skew( trans.translation() ), Eigen::Matrix3d::Identity();
+	return J;
+    }
+
+    struct ComposeParams
+    {
+	const TransformWithLieUncertainty trans;
+	const Matrix6d adjoint;
+	const TransformWithLieUncertainty::TransformVector& transforms;
+	TransformWithLieUncertainty::TransformVector& result;
+
+	ComposeParams( const TransformWithLieUncertainty& trans,
+		const TransformWithLieUncertainty::TransformVector& transforms,
+		TransformWithLieUncertainty::TransformVector& result )
+	    : trans( trans ), adjoint( TransformWithLieUncertainty::adjoint( trans.getTransform() ) ),
+	    transforms( transforms ), result( result ) {}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    for( size_t i=begin; i<end; i++ )
+	    {
+		const TransformWithUncertainty &t( transforms[i] );
+		const Transform composed( trans.getTransform() * t.getTransform() );
+		if( !t.hasUncertainty() && !trans.hasUncertainty() )
+		{
+		    result[i] = TransformWithUncertainty( composed );
+		    continue;
+		}
+
+		// propagate the parameter covariance of t directly to the
+		// parameters of the result
+		Matrix6d cov( Matrix6d::Zero() );
+		if( trans.hasUncertainty() )
+		    cov = trans.getCovariance();
+		if( t.hasUncertainty() )
+		{
+		    const Matrix6d J( adjoint * toTangentJacobian( t.getTransform() ) );
+		    cov += J * t.getCovariance() * J.transpose();
+		}
+		const Matrix6d J( fromTangentJacobian( composed ) );
+		result[i] = TransformWithUncertainty( composed, J * cov * J.transpose() );
+	    }
+	}
+    };
+
+    struct LieComposeParams
+    {
+	const TransformWithLieUncertainty& trans;
+	const TransformWithLieUncertainty::LieTransformVector& transforms;
+	TransformWithLieUncertainty::LieTransformVector& result;
+
+	LieComposeParams( const TransformWithLieUncertainty& trans,
+		const TransformWithLieUncertainty::LieTransformVector& transforms,
+		TransformWithLieUncertainty::LieTransformVector& result )
+	    : trans( trans ), transforms( transforms ), result( result ) {}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    for( size_t i=begin; i<end; i++ )
+		result[i] = trans * transforms[i];
+	}
+    };
+
+    struct PointParams
+    {
+	const TransformWithLieUncertainty trans;
+	const std::vector<PointWithUncertainty>& points;
+	std::vector<PointWithUncertainty>& result;
+
+	PointParams( const TransformWithLieUncertainty& trans,
+		const std::vector<PointWithUncertainty>& points,
+		std::vector<PointWithUncertainty>& result )
+	    : trans( trans ), points( points ), result( result ) {}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    for( size_t i=begin; i<end; i++ )
+		result[i] = trans * points[i];
+	}
+    };
+}
+
+TransformWithLieUncertainty::TransformWithLieUncertainty()
+    : cov( Covariance::Zero() ), uncertain(false) {}
+TransformWithLieUncertainty::TransformWithLieUncertainty( const Transform& trans )
+    : trans( trans ), cov( Covariance::Zero() ), uncertain(false) {}
+TransformWithLieUncertainty::TransformWithLieUncertainty( const Transform& trans, const Covariance& cov )
+    : trans( trans ), cov( cov ), uncertain(true) {}
+
+TransformWithLieUncertainty::TransformWithLieUncertainty( const TransformWithUncertainty& t )
+    : trans( t.getTransform() ), cov( Covariance::Zero() ), uncertain( t.hasUncertainty() )
+{
+    if( uncertain )
+    {
+	const Covariance J( toTangentJacobian( trans ) );
+	cov = J * t.getCovariance() * J.transpose();
+    }
+}
+
+TransformWithUncertainty TransformWithLieUncertainty::toTransformWithUncertainty() const
+{
+    if( !uncertain )
+	return TransformWithUncertainty( trans );
+
+    const Covariance J( fromTangentJacobian( trans ) );
+    return TransformWithUncertainty( trans, J * cov * J.transpose() );
+}
+
+TransformWithLieUncertainty::Covariance TransformWithLieUncertainty::adjoint( const Transform& trans )
+{
+    const Eigen::Matrix3d R( trans.linear() );
+    Covariance res;
+    res << R, Eigen::Matrix3d::Zero(),
+	skew( trans.translation() ) * R, R;
+    return res;
+}
+
+TransformWithLieUncertainty TransformWithLieUncertainty::operator*( const TransformWithLieUncertainty& t1 ) const
+{
+    const TransformWithLieUncertainty &t2(*this);
+    // short path if there is no uncertainty
+    if( !t1.hasUncertainty() && !t2.hasUncertainty() )
+	return TransformWithLieUncertainty( Transform( t2.getTransform() * t1.getTransform() ) );
+
+    // exp(xi2) T2 exp(xi1) T1 = exp(xi2) exp(Ad(T2) xi1) T2 T1
+    Covariance cov( Covariance::Zero() );
+    if( t2.hasUncertainty() )
+	cov = t2.getCovariance();
+    if( t1.hasUncertainty() )
+    {
+	const Covariance Ad( adjoint( t2.getTransform() ) );
+	cov += Ad * t1.getCovariance() * Ad.transpose();
+    }
+
+    return TransformWithLieUncertainty(
+	    Transform( t2.getTransform() * t1.getTransform() ), cov );
+}
+
+PointWithUncertainty TransformWithLieUncertainty::operator*( const PointWithUncertainty& point ) const
+{
+    const Eigen::Vector3d p( getTransform() * point.getPoint() );
+    if( !hasUncertainty() && !point.hasUncertainty() )
+	return PointWithUncertainty( p );
+
+    // exp(xi) T p = T p + w x (T p) + v
+    Eigen::Matrix<double,3,6> J;
+    J << -skew( p ), Eigen::Matrix3d::Identity();
+
+    Eigen::Matrix3d pcov = J * getCovariance() * J.transpose();
+    if( point.hasUncertainty() )
+    {
+	const Eigen::Matrix3d R( getTransform().linear() );
+	pcov += R * point.getCovariance() * R.transpose();
+    }
+
+    return PointWithUncertainty( p, pcov );
+}
+
+TransformWithLieUncertainty TransformWithLieUncertainty::inverse() const
+{
+    const Transform inv( getTransform().inverse( Eigen::Isometry ) );
+    if( !hasUncertainty() )
+	return TransformWithLieUncertainty( inv );
+
+    // (exp(xi) T)^-1 = T^-1 exp(-xi) = exp(-Ad(T^-1) xi) T^-1
+    const Covariance Ad( adjoint( inv ) );
+    return TransformWithLieUncertainty( inv, Ad * getCovariance() * Ad.transpose() );
+}
+
+void TransformWithLieUncertainty::compose( const TransformWithUncertainty& trans,
+	const TransformVector& transforms, TransformVector& result, size_t threads )
+{
+    result.resize( transforms.size() );
+    ComposeParams params( TransformWithLieUncertainty( trans ), transforms, result );
+    parallelFor( transforms.size(), params, threads );
+}
+
+void TransformWithLieUncertainty::compose( const TransformWithLieUncertainty& trans,
+	const LieTransformVector& transforms, LieTransformVector& result, size_t threads )
+{
+    result.resize( transforms.size() );
+    LieComposeParams params( trans, transforms, result );
+    parallelFor( transforms.size(), params, threads );
+}
+
+void TransformWithLieUncertainty::transform( const TransformWithUncertainty& trans,
+	const std::vector<PointWithUncertainty>& points,
+	std::vector<PointWithUncertainty>& result, size_t threads )
+{
+    result.resize( points.size() );
+    PointParams params( TransformWithLieUncertainty( trans ), points, result );
+    parallelFor( points.size(), params, threads );
+}
@@ -0,0 +1,101 @@
+#ifndef __ENVIRE_CORE_LIEUNCERTAINTY_HPP__
+#define __ENVIRE_CORE_LIEUNCERTAINTY_HPP__
+
+#include "Transform.hpp"
+#include <Eigen/StdVector>
+#include <vector>
+
+namespace envire
+{
+    /**
+     * Transform with uncertainty, where the uncertainty is represented in
+     * the tangent space of SE(3).
+     *
+     * The covariance is that of a left perturbation xi = [w v], such that the
+     * actual transform is exp(xi) * T. In this representation, the
+     * uncertainty of a composition is propagated with the adjoint of the
+     * transform, which is a closed form expression of its rotation and
+     * translation. No conversion of the rotation to a rotation vector is
+     * required, so long chains of transforms and large numbers of points can
+     * be propagated without any trigonometric functions. Only the conversion
+     * from and to TransformWithUncertainty needs the rotation vector.
+     *
+     * TransformWithUncertainty, which uses the covariance of the [r t]
+     * parameters, can be converted to and from this representation. The
+     * conversion is exact to first order, while TransformWithUncertainty uses
+     * series approximations of the Jacobians, which are only accurate for
+     * small rotations.
+     */
+    class TransformWithLieUncertainty
+    {
+    public:
+	typedef Eigen::Matrix<double,6,6> Covariance;
+	typedef std::vector<TransformWithUncertainty, Eigen::aligned_allocator<TransformWithUncertainty> > TransformVector;
+	typedef std::vector<TransformWithLieUncertainty, Eigen::aligned_allocator<TransformWithLieUncertainty> > LieTransformVector;
+
+    public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+	TransformWithLieUncertainty();
+	explicit TransformWithLieUncertainty( const Transform& trans );
+	TransformWithLieUncertainty( const Transform& trans, const Covariance& cov );
+
+	/** converts the covariance of the [r t] parameters to the tangent space */
+	explicit TransformWithLieUncertainty( const TransformWithUncertainty& trans );
+
+	/** @return the transform with the covariance of the [r t] parameters */
+	TransformWithUncertainty toTransformWithUncertainty() const;
+
+	/** performs a composition of this transform with the transform given.
+	 * The result is another transform with result = this * trans
+	 */
+	TransformWithLieUncertainty operator*( const TransformWithLieUncertainty& trans ) const;
+	PointWithUncertainty operator*( const PointWithUncertainty& point ) const;
+	TransformWithLieUncertainty inverse() const;
+
+	const Covariance& getCovariance() const { return cov; }
+	void setCovariance( const Covariance& cov ) { this->cov = cov; uncertain = true; }
+	const Transform& getTransform() const { return trans; }
+	void setTransform( const Transform& trans ) { this->trans = trans; }
+
+	bool hasUncertainty() const { return uncertain; }
+
+	/** @return the adjoint of the transform, which maps a perturbation
+	 * on the right side of the transform to the left side */
+	static Covariance adjoint( const Transform& trans );
+
+	/**
+	 * Composes the transform with each of the given transforms, such that
+	 * result[i] = trans * transforms[i]. The result is the same as for
+	 * TransformWithUncertainty::operator*, but the Jacobians of trans are
+	 * only computed once. For each element, the rotation of transforms[i]
+	 * and of the result is converted to a rotation vector once, and the
+	 * sine and cosine of that conversion are reused for its Jacobian.
+	 *
+	 * @param threads number of threads to use, 0 to use one per hardware thread
+	 */
+	static void compose( const TransformWithUncertainty& trans,
+		const TransformVector& transforms, TransformVector& result, size_t threads = 0 );
+
+	/** same as above, for transforms which are already in the tangent
+	 * representation */
+	static void compose( const TransformWithLieUncertainty& trans,
+		const LieTransformVector& transforms, LieTransformVector& result, size_t threads = 0 );
+
+	/**
+	 * Transforms each of the given points, such that result[i] = trans *
+	 * points[i].
+	 *
+	 * @param threads number of threads to use, 0 to use one per hardware thread
+	 */
+	static void transform( const TransformWithUncertainty& trans,
+		const std::vector<PointWithUncertainty>& points,
+		std::vector<PointWithUncertainty>& result, size_t threads = 0 );
+
+    protected:
+	Transform trans;
+	Covariance cov;
+	bool uncertain;
+    };
+}
+
+#endif
@@ -7,13 +7,13 @@ using namespace envire;
 const std::string Operator::className = "envire::Operator";
 
 Operator::Operator(std::string const& id, int inputArity, int outputArity)
-    : EnvironmentItem(id), inputArity(inputArity), outputArity(outputArity)
+    : EnvironmentItem(id), context(NULL), abandoned(0), inputArity(inputArity), outputArity(outputArity)
 {
 }
 
 Operator::Operator(int inputArity, int outputArity)
     : EnvironmentItem(Environment::ITEM_NOT_ATTACHED)
-    , inputArity(inputArity), outputArity(outputArity)
+    , context(NULL), abandoned(0), inputArity(inputArity), outputArity(outputArity)
 {
 }
 
@@ -65,3 +65,50 @@ void Operator::removeOutputs()
     env->removeOutputs( this );
 }
 
+
+bool Operator::execute( ExecutionContext& context )
+{
+    this->context = &context;
+    abandoned = 0;
+    bool result = false;
+    try
+    {
+	result = updateAll();
+    }
+    catch( const OperationCancelled& )
+    {
+	abandoned = 1;
+    }
+    catch( ... )
+    {
+	this->context = NULL;
+	throw;
+    }
+    this->context = NULL;
+    return result && !abandoned;
+}
+
+bool Operator::isCancelled() const
+{
+    if( !context )
+	return false;
+    // an operator which sees the cancellation returns early
+    if( context->isCancelled() )
+	abandoned = 1;
+    return abandoned != 0;
+}
+
+void Operator::checkCancelled() const
+{
+    if( context && context->isCancelled() )
+    {
+	abandoned = 1;
+	context->check();
+    }
+}
+
+void Operator::reportProgress( double progress )
+{
+    if( context )
+	context->setProgress( getUniqueId(), progress );
+}
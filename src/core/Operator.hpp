@@ -3,6 +3,7 @@
 
 #include "EnvironmentItem.hpp"
 #include "Environment.hpp"
+#include "ExecutionContext.hpp"
 
 namespace envire
 {
@@ -47,6 +48,23 @@ namespace envire
          */
         virtual bool updateAll(){return false;};
 
+        /** Runs updateAll() under the control of the given context. Long
+         * running operators poll the context and abandon the update when it
+         * is cancelled or runs out of time, which may leave the outputs
+         * partially updated.
+         *
+         * @return the result of updateAll(), or false if the update was
+         *         abandoned
+         */
+        bool execute(ExecutionContext& context);
+
+        /** @return true if the last call to execute() was abandoned, because
+         * the operator found the context cancelled while it was running. An
+         * operator which completed its update is not abandoned, even if the
+         * context was cancelled or ran out of time afterwards.
+         */
+        bool wasAbandoned() const { return abandoned != 0; }
+
         /** Adds a new input to this operator. The operator may not support
          * this, in which case it will return false
          */
@@ -114,7 +132,27 @@ namespace envire
         template<typename LayerT>
         LayerT getInput();
 
+    protected:
+        /** @return true if the update should be abandoned, which is never
+         * the case outside of execute()
+         */
+        bool isCancelled() const;
+
+        /** Throws OperationCancelled if the update should be abandoned.
+         * execute() catches the exception.
+         */
+        void checkCancelled() const;
+
+        /** Reports the progress of the update, between 0 and 1, to the
+         * context of execute()
+         */
+        void reportProgress(double progress);
+
     private:
+        ExecutionContext* context;
+        /** set from the threads of the operator, like the flag of the
+         * context */
+        mutable volatile sig_atomic_t abandoned;
         int inputArity;
         int outputArity;
     };
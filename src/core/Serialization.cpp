@@ -299,8 +299,11 @@ std::ostream& Serialization::getBinaryOutputStream(const std::string &filename)
 //// FileSerialization ////
 
 const std::string FileSerialization::STRUCTURE_FILE = "scene.yml";
+const std::string FileSerialization::CHECKPOINT_DIR = "checkpoint.tmp";
+const std::string FileSerialization::CHECKPOINT_MANIFEST = "checkpoint.manifest";
 
 FileSerialization::FileSerialization()
+    : binaryOutput( true ), nullStream( NULL ), writtenItems( NULL )
 {
 }
 
@@ -333,6 +336,9 @@ std::istream& FileSerialization::getBinaryInputStream(const std::string &filenam
 
 std::ostream& FileSerialization::getBinaryOutputStream(const std::string &filename)
 {
+    if( !binaryOutput )
+	return nullStream;
+
     boost::filesystem::path fileDir(sceneDir);
     fileDir = fileDir / filename;
     std::ofstream *os = new std::ofstream(fileDir.string().c_str());
@@ -383,7 +389,15 @@ bool FileSerialization::writeToFile( Environment *env, const std::string &path )
 	yamlSerialization->addToSequence( obj_id, yamlSerialization->current_node );
 
 	yamlSerialization->addNodeToMap( "class", yamlSerialization->addScalar((*it).second->getClassName()) );
+
+	// the binary data of unchanged items is already in the scene
+	if( writtenItems )
+	{
+	    CheckpointItems::const_iterator item = writtenItems->find( (*it).first );
+	    binaryOutput = item == writtenItems->end() || item->second.generation != (*it).second->getGeneration();
+	}
 	(*it).second->serialize( *this );
+	binaryOutput = true;
     }
 
     // and all the links
@@ -478,6 +492,155 @@ bool FileSerialization::writeToFile( Environment *env, const std::string &path )
     return result;
 }
 
+bool FileSerialization::writeCheckpoint( Environment *env, const std::string &path, CheckpointItems& items )
+{
+    fs::path sceneDir( path );
+    fs::path staging( sceneDir / CHECKPOINT_DIR );
+
+    fs::create_directories( sceneDir );
+    recoverCheckpoint( path );
+    fs::create_directories( staging );
+
+    // write the changed items and the scene file to the staging directory
+    setSceneDir( staging.string() );
+    writtenItems = &items;
+    bool result;
+    try
+    {
+	result = writeToFile( env, (staging / STRUCTURE_FILE).string() );
+    }
+    catch(...)
+    {
+	writtenItems = NULL;
+	setSceneDir( path );
+	fs::remove_all( staging );
+	throw;
+    }
+    writtenItems = NULL;
+    setSceneDir( path );
+
+    if( !result )
+    {
+	fs::remove_all( staging );
+	return false;
+    }
+
+    CheckpointItems current;
+    getCheckpointItems( env, current );
+
+    // the files of the removed items, which don't belong to any of the
+    // current items, are removed when the checkpoint is applied
+    std::vector<std::string> removed;
+    std::vector<std::string> removedMapFiles;
+    for( CheckpointItems::const_iterator it = items.begin(); it != items.end(); it++ )
+    {
+	if( !it->second.mapFile.empty() && !current.count( it->first ) )
+	    removedMapFiles.push_back( it->second.mapFile );
+    }
+    if( !removedMapFiles.empty() )
+    {
+	for( fs::directory_iterator it( sceneDir ); it != fs::directory_iterator(); it++ )
+	{
+	    if( fs::is_directory( it->status() ) )
+		continue;
+	    const std::string file = it->path().filename().string();
+	    bool isRemoved = false;
+	    for( size_t i=0; i<removedMapFiles.size() && !isRemoved; i++ )
+		isRemoved = isMapFile( file, removedMapFiles[i] );
+	    for( CheckpointItems::const_iterator c = current.begin(); c != current.end() && isRemoved; c++ )
+		isRemoved = !isMapFile( file, c->second.mapFile );
+	    if( isRemoved )
+		removed.push_back( file );
+	}
+    }
+
+    // the rename of the manifest commits the checkpoint. It lists the files
+    // in the staging directory, followed by an empty line and the files
+    // which are removed.
+    fs::path manifest( sceneDir / CHECKPOINT_MANIFEST );
+    fs::path manifestTmp( sceneDir / (CHECKPOINT_MANIFEST + ".tmp") );
+    {
+	std::ofstream os( manifestTmp.string().c_str() );
+	for( fs::directory_iterator it( staging ); it != fs::directory_iterator(); it++ )
+	    os << it->path().filename().string() << std::endl;
+	if( !removed.empty() )
+	{
+	    os << std::endl;
+	    for( size_t i=0; i<removed.size(); i++ )
+		os << removed[i] << std::endl;
+	}
+	os.close();
+	if( !os )
+	    throw runtime_error("envire: could not write " + manifestTmp.string());
+    }
+    fs::rename( manifestTmp, manifest );
+
+    applyCheckpoint( path );
+
+    items.swap( current );
+
+    return true;
+}
+
+void FileSerialization::getCheckpointItems( Environment* env, CheckpointItems& items )
+{
+    items.clear();
+    for( Environment::itemListType::iterator it = env->items.begin(); it != env->items.end(); it++ )
+    {
+	CheckpointItem &item( items[it->first] );
+	item.generation = it->second->getGeneration();
+	if( Layer *layer = dynamic_cast<Layer*>( it->second.get() ) )
+	    item.mapFile = layer->getMapFileName();
+    }
+}
+
+bool FileSerialization::isMapFile( const std::string& file, const std::string& mapFile )
+{
+    // the binary files append an extension or the name of a band
+    return !mapFile.empty() && file.size() > mapFile.size()
+	&& file.compare( 0, mapFile.size(), mapFile ) == 0
+	&& (file[mapFile.size()] == '.' || file[mapFile.size()] == '_');
+}
+
+void FileSerialization::applyCheckpoint( const std::string &path )
+{
+    fs::path sceneDir( path );
+    fs::path staging( sceneDir / CHECKPOINT_DIR );
+    fs::path manifest( sceneDir / CHECKPOINT_MANIFEST );
+
+    // files which are missing have been moved or removed before an
+    // interruption
+    std::ifstream is( manifest.string().c_str() );
+    std::string file;
+    bool removed = false;
+    while( std::getline( is, file ) )
+    {
+	if( file.empty() )
+	    removed = true;
+	else if( removed )
+	    fs::remove( sceneDir / file );
+	else if( fs::exists( staging / file ) )
+	    fs::rename( staging / file, sceneDir / file );
+    }
+    is.close();
+
+    fs::remove( manifest );
+    fs::remove_all( staging );
+}
+
+void FileSerialization::recoverCheckpoint( const std::string &path )
+{
+    fs::path sceneDir( path );
+
+    if( fs::exists( sceneDir / CHECKPOINT_MANIFEST ) )
+	applyCheckpoint( path );
+    else
+    {
+	fs::remove( sceneDir / (CHECKPOINT_MANIFEST + ".tmp") );
+	fs::remove_all( sceneDir / CHECKPOINT_DIR );
+    }
+}
+
 template<typename MapType>
 static MapType* getMap(YAMLSerializationImpl* yaml, Environment* env, const char* key)
 {
@@ -4,6 +4,7 @@
 
 #include <vector>
 #include <string>
+#include <map>
 #include <sstream>
 #include <boost/lexical_cast.hpp>
 
@@ -119,6 +120,13 @@ namespace envire
          * @return an ostream for a given filename
          */
         virtual std::ostream& getBinaryOutputStream(const std::string &filename);
+
+        /**
+         * @return false if the binary data of the item which is currently
+         * serialized doesn't need to be written, because it didn't change.
+         * Items should skip writing their binary streams in this case.
+         */
+        virtual bool hasBinaryOutput() const { return true; }
     };
     
     template <class T> bool Serialization::read(const std::string &key, T& value)
@@ -150,10 +158,43 @@ namespace envire
         std::string sceneDir;
         std::vector<std::ifstream*> ifstreams;
         std::vector<std::ofstream*> ofstreams;
+
+        /** false while an unchanged item is serialized by
+         * writeCheckpoint() */
+        bool binaryOutput;
+        /** discards the binary data of unchanged items */
+        std::ostream nullStream;
+    public:
+        /** an item in the scene directory of a checkpoint */
+        struct CheckpointItem
+        {
+            /** generation of the item when it was written */
+            unsigned long generation;
+            /** the name which all binary files of the item start with,
+             * empty if it has none */
+            std::string mapFile;
+        };
+        typedef std::map<std::string, CheckpointItem> CheckpointItems;
+
+    protected:
+        /** items in the scene directory, NULL to write all items */
+        const CheckpointItems* writtenItems;
+
+        /** moves the files listed in the manifest from the staging
+         * directory into @a path, and removes the files of the removed
+         * items */
+        static void applyCheckpoint( const std::string& path );
+
+        /** @return true if @a file is a binary file of the item with the
+         * map file name @a mapFile */
+        static bool isMapFile( const std::string& file, const std::string& mapFile );
         
     public:
         /* name of the yaml file */
         static const std::string STRUCTURE_FILE;
+        /* staging directory and manifest file of writeCheckpoint() */
+        static const std::string CHECKPOINT_DIR;
+        static const std::string CHECKPOINT_MANIFEST;
         
         FileSerialization();
         ~FileSerialization();
@@ -169,6 +210,29 @@ namespace envire
          * @return true on success
          */
         bool writeToFile( Environment* env, const std::string &path );
+
+        /**
+         * Serializes a given Environment incrementally to the directory
+         * @a path, see Environment::checkpoint().
+         *
+         * @param items the items at the last checkpoint to this directory.
+         *        Only items with a different generation write their binary
+         *        data. The binary files of items which are no longer in the
+         *        environment are removed with the checkpoint. Updated with
+         *        the current items on success.
+         * @return true on success
+         */
+        bool writeCheckpoint( Environment* env, const std::string &path, CheckpointItems& items );
+
+        /** @return the current generations and map file names of the items
+         * of the environment in @a items */
+        static void getCheckpointItems( Environment* env, CheckpointItems& items );
+
+        /**
+         * Completes a committed checkpoint in the directory @a path, which
+         * has been interrupted, or discards an uncommitted one.
+         */
+        static void recoverCheckpoint( const std::string &path );
         
         /**
          * Opens an ifstream for the given filename in the current sceneDir.
@@ -197,6 +261,8 @@ namespace envire
          * @return the serialization path
          */
         virtual const std::string getMapPath() const;
+
+        bool hasBinaryOutput() const { return binaryOutput; }
     };
     
     /**
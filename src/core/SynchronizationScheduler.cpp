@@ -0,0 +1,360 @@
+#include "SynchronizationScheduler.hpp"
+#include "EventLog.hpp"
+#include "FrameNode.hpp"
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <sstream>
+
+using namespace envire;
+
+const std::string SynchronizationScheduler::CHUNK_CLASS = "envire::SynchronizationChunk";
+
+namespace
+{
+    /** orders slots by their arrival */
+    template <class Slot>
+    bool compareSequence( const Slot* a, const Slot* b )
+    {
+	return a->sequence < b->sequence;
+    }
+
+    bool refersTo( const BinaryEvent& event, const std::string& id )
+    {
+	return event.id_a == id || event.id_b == id;
+    }
+
+    /** chunk index of the marker which aborts a transfer */
+    const std::string CHUNK_ABORT = "abort";
+
+    bool isAbort( const BinaryEvent& event )
+    {
+	return event.className == SynchronizationScheduler::CHUNK_CLASS && event.id_b == CHUNK_ABORT;
+    }
+}
+
+SynchronizationScheduler::SynchronizationScheduler()
+    : byteBudget( 0 ), chunkSize( 64 * 1024 ), sequence( 0 )
+{
+    useEventQueue( true );
+}
+
+void SynchronizationScheduler::setByteBudget( size_t bytes )
+{
+    byteBudget = bytes;
+}
+
+void SynchronizationScheduler::setChunkSize( size_t bytes )
+{
+    chunkSize = bytes;
+}
+
+size_t SynchronizationScheduler::getEventSize( const BinaryEvent& event )
+{
+    // time, type and operation, and the length fields
+    size_t size = 32;
+    size += event.id_a.size() + event.id_b.size() + event.className.size();
+    size += event.yamlProperties.size();
+    for( size_t i=0; i<event.binaryStreamNames.size(); i++ )
+	size += event.binaryStreamNames[i].size() + 4;
+    for( size_t i=0; i<event.binaryStreams.size(); i++ )
+	size += event.binaryStreams[i].size() + 4;
+    return size;
+}
+
+SynchronizationScheduler::Priority SynchronizationScheduler::getPriority( const BinaryEvent& event )
+{
+    if( event.type == event::ITEM && (event.operation == event::ADD || event.operation == event::UPDATE) )
+	return event.className == FrameNode::className ? TRANSFORM : ITEM;
+    return STRUCTURE;
+}
+
+size_t SynchronizationScheduler::getPendingCount() const
+{
+    size_t count = slots.size() + structure.size();
+    for( std::deque<Transfer>::const_iterator it = transfers.begin(); it != transfers.end(); it++ )
+	count += it->chunks - it->chunk;
+    return count;
+}
+
+void SynchronizationScheduler::handle( std::vector<BinaryEvent>& msgs )
+{
+    for( size_t i=0; i<msgs.size(); i++ )
+    {
+	BinaryEvent& event( msgs[i] );
+	if( event.type == event::ITEM && (event.operation == event::ADD || event.operation == event::UPDATE) )
+	{
+	    // the latest state replaces the pending one, but an add stays an
+	    // add, since the receiver doesn't have the item yet
+	    std::map<std::string, Slot>::iterator it = slots.find( event.id_a );
+	    if( it == slots.end() )
+	    {
+		Slot& slot( slots[event.id_a] );
+		slot.event.move( event );
+		slot.sequence = sequence++;
+	    }
+	    else
+	    {
+		const event::Operation operation = it->second.event.operation;
+		it->second.event.move( event );
+		if( operation == event::ADD )
+		    it->second.event.operation = event::ADD;
+	    }
+	    continue;
+	}
+
+	if( event.type == event::ITEM && event.operation == event::REMOVE )
+	{
+	    // if the receiver never got the item, nothing about it needs to
+	    // be sent
+	    const bool added = hasPendingAdd( event.id_a );
+	    dropItem( event.id_a );
+	    if( added )
+		continue;
+	}
+
+	structure.push_back( BinaryEvent() );
+	structure.back().move( event );
+    }
+}
+
+bool SynchronizationScheduler::hasPendingAdd( const std::string& id ) const
+{
+    std::map<std::string, Slot>::const_iterator it = slots.find( id );
+    if( it != slots.end() && it->second.event.operation == event::ADD )
+	return true;
+    for( std::deque<Transfer>::const_iterator t = transfers.begin(); t != transfers.end(); t++ )
+	if( t->header.id_a == id && t->header.operation == event::ADD )
+	    return true;
+    return false;
+}
+
+void SynchronizationScheduler::dropItem( const std::string& id )
+{
+    const bool added = hasPendingAdd( id );
+
+    slots.erase( id );
+    bool aborted = false;
+    for( std::deque<Transfer>::iterator t = transfers.begin(); t != transfers.end(); )
+    {
+	if( t->header.id_a == id )
+	{
+	    aborted |= t->chunk > 0;
+	    t = transfers.erase( t );
+	}
+	else
+	    t++;
+    }
+
+    // without the add, the events which refer to the item can't be
+    // applied on the receiving side. Aborts of earlier transfers are kept,
+    // the receiver still holds their chunks.
+    if( added )
+    {
+	std::deque<BinaryEvent>::iterator it = structure.begin();
+	while( it != structure.end() )
+	{
+	    if( refersTo( *it, id ) && !isAbort( *it ) )
+		it = structure.erase( it );
+	    else
+		it++;
+	}
+    }
+
+    // the receiver has to drop the chunks it already got
+    if( aborted )
+    {
+	structure.push_back( BinaryEvent( event::ITEM, event::REMOVE, id, CHUNK_ABORT ) );
+	structure.back().className = CHUNK_CLASS;
+    }
+}
+
+bool SynchronizationScheduler::isBlocked( const BinaryEvent& event ) const
+{
+    // an abort has to get through before a new transfer of the item starts
+    if( isAbort( event ) )
+	return false;
+    return hasPendingAdd( event.id_a ) || (!event.id_b.empty() && hasPendingAdd( event.id_b ));
+}
+
+bool SynchronizationScheduler::fits( size_t size, size_t used, const std::vector<BinaryEvent>& msgs ) const
+{
+    return byteBudget == 0 || used + size <= byteBudget || msgs.empty();
+}
+
+void SynchronizationScheduler::startTransfer( BinaryEvent& event )
+{
+    std::ostringstream os;
+    EventLog::writeEvent( os, event );
+    const std::string data = os.str();
+
+    transfers.push_back( Transfer() );
+    Transfer& transfer( transfers.back() );
+    transfer.header = BinaryEvent( event.type, event.operation, event.id_a, "" );
+    transfer.header.time = event.time;
+    transfer.data.assign( data.begin(), data.end() );
+    transfer.chunk = 0;
+    transfer.chunks = (transfer.data.size() + chunkSize - 1) / chunkSize;
+}
+
+bool SynchronizationScheduler::popTransfer( std::vector<BinaryEvent>& msgs, size_t& used )
+{
+    bool popped = false;
+    while( !transfers.empty() )
+    {
+	Transfer& transfer( transfers.front() );
+	const size_t begin = transfer.chunk * chunkSize;
+	const size_t end = std::min( begin + chunkSize, transfer.data.size() );
+
+	BinaryEvent chunk( transfer.header.type, transfer.header.operation, transfer.header.id_a,
+		boost::lexical_cast<std::string>( transfer.chunk ) + "/" + boost::lexical_cast<std::string>( transfer.chunks ) );
+	chunk.time = transfer.header.time;
+	chunk.className = CHUNK_CLASS;
+	chunk.binaryStreamNames.push_back( "chunk" );
+	chunk.binaryStreams.push_back( std::vector<uint8_t>( transfer.data.begin() + begin, transfer.data.begin() + end ) );
+
+	const size_t size = getEventSize( chunk );
+	if( !fits( size, used, msgs ) )
+	    break;
+
+	msgs.push_back( BinaryEvent() );
+	msgs.back().move( chunk );
+	used += size;
+	popped = true;
+
+	if( ++transfer.chunk == transfer.chunks )
+	    transfers.pop_front();
+    }
+    return popped;
+}
+
+bool SynchronizationScheduler::popSlots( Priority priority, std::vector<BinaryEvent>& msgs, size_t& used )
+{
+    std::vector<Slot*> ordered;
+    for( std::map<std::string, Slot>::iterator it = slots.begin(); it != slots.end(); it++ )
+	if( getPriority( it->second.event ) == priority )
+	    ordered.push_back( &it->second );
+    std::sort( ordered.begin(), ordered.end(), compareSequence<Slot> );
+
+    bool popped = false;
+    for( size_t i=0; i<ordered.size(); i++ )
+    {
+	BinaryEvent& event( ordered[i]->event );
+	const std::string id = event.id_a;
+
+	// a new version waits for an earlier removal of the item, and for
+	// the chunks of the previous version
+	bool waiting = false;
+	for( std::deque<BinaryEvent>::const_iterator it = structure.begin(); it != structure.end() && !waiting; it++ )
+	    waiting = it->type == event::ITEM && it->operation == event::REMOVE && it->id_a == id;
+	for( std::deque<Transfer>::const_iterator t = transfers.begin(); t != transfers.end() && !waiting; t++ )
+	    waiting = t->header.id_a == id;
+	if( waiting )
+	    continue;
+
+	const size_t size = getEventSize( event );
+	if( priority == ITEM && chunkSize && size > chunkSize )
+	{
+	    startTransfer( event );
+	    slots.erase( id );
+	    popped |= popTransfer( msgs, used );
+	    if( !transfers.empty() )
+		break;
+	    continue;
+	}
+
+	if( !fits( size, used, msgs ) )
+	    break;
+
+	msgs.push_back( BinaryEvent() );
+	msgs.back().move( event );
+	used += size;
+	popped = true;
+	slots.erase( id );
+    }
+    return popped;
+}
+
+bool SynchronizationScheduler::popStructure( std::vector<BinaryEvent>& msgs, size_t& used )
+{
+    // structure events keep their order, so the first blocked event stops
+    // all later ones
+    bool popped = false;
+    while( !structure.empty() && !isBlocked( structure.front() ) )
+    {
+	const size_t size = getEventSize( structure.front() );
+	if( !fits( size, used, msgs ) )
+	    break;
+
+	msgs.push_back( BinaryEvent() );
+	msgs.back().move( structure.front() );
+	structure.pop_front();
+	used += size;
+	popped = true;
+    }
+    return popped;
+}
+
+void SynchronizationScheduler::popEvents( std::vector<BinaryEvent>& msgs )
+{
+    // serializes the queued events and passes them to handle()
+    flush();
+
+    msgs.clear();
+    size_t used = 0;
+
+    // structure events can wait for items, so go on as long as anything
+    // gets through
+    bool popped = true;
+    while( popped )
+    {
+	popped = popSlots( TRANSFORM, msgs, used );
+	popped |= popStructure( msgs, used );
+	popped |= popTransfer( msgs, used );
+	popped |= popSlots( ITEM, msgs, used );
+    }
+}
+
+void SynchronizationChunkAssembler::process( std::vector<BinaryEvent>& events )
+{
+    std::vector<BinaryEvent> result;
+    result.reserve( events.size() );
+    for( size_t i=0; i<events.size(); i++ )
+    {
+	BinaryEvent& event( events[i] );
+	if( event.className != SynchronizationScheduler::CHUNK_CLASS )
+	{
+	    result.push_back( BinaryEvent() );
+	    result.back().move( event );
+	    continue;
+	}
+
+	if( isAbort( event ) )
+	{
+	    transfers.erase( event.id_a );
+	    continue;
+	}
+
+	const size_t slash = event.id_b.find( '/' );
+	if( slash == std::string::npos )
+	    throw std::runtime_error( "SynchronizationChunkAssembler: invalid chunk " + event.id_b );
+	const size_t chunk = boost::lexical_cast<size_t>( event.id_b.substr( 0, slash ) );
+	const size_t chunks = boost::lexical_cast<size_t>( event.id_b.substr( slash + 1 ) );
+
+	std::vector<uint8_t>& data( transfers[event.id_a] );
+	if( chunk == 0 )
+	    data.clear();
+	for( size_t s=0; s<event.binaryStreams.size(); s++ )
+	    data.insert( data.end(), event.binaryStreams[s].begin(), event.binaryStreams[s].end() );
+
+	if( chunk + 1 == chunks )
+	{
+	    std::istringstream is( std::string( data.begin(), data.end() ) );
+	    result.push_back( BinaryEvent() );
+	    EventLog::readEvent( is, result.back() );
+	    transfers.erase( event.id_a );
+	}
+    }
+    events.swap( result );
+}
@@ -0,0 +1,143 @@
+#ifndef __ENVIRE_SYNCHRONIZATIONSCHEDULER_HPP__
+#define __ENVIRE_SYNCHRONIZATIONSCHEDULER_HPP__
+
+#include <envire/core/Serialization.hpp>
+#include <envire/core/EventTypes.hpp>
+#include <deque>
+#include <map>
+#include <vector>
+#include <string>
+
+namespace envire
+{
+    /**
+     * @brief Synchronization event queue for links with a limited bandwidth.
+     *
+     * Like the SynchronizationEventQueue, the scheduler converts the events
+     * of an environment into binary events, which are retrieved with
+     * popEvents(). Instead of returning all events in the order they
+     * arrived, it
+     *
+     * - keeps only the latest state of each item, in a slot which keeps the
+     *   position of the first pending event of the item,
+     * - returns the events by priority class, with transforms (FrameNode
+     *   items) first, then the changes of the structure of the environment,
+     *   and then all other items like layers and operators,
+     * - returns no more than the byte budget per call, and
+     * - splits items which are larger than the chunk size into chunks,
+     *   which are sent over consecutive calls.
+     *
+     * The order is only changed where it is safe: an event which refers to
+     * an item is not returned before the event which adds the item. Chunked
+     * transfers are completed before newer versions of the same item are
+     * sent, so that large layers which are updated often still get through.
+     * If an item is removed while its chunks are sent, the rest of the
+     * transfer is dropped and the receiver is told to discard the chunks
+     * it already got.
+     *
+     * The receiving side has to put the chunks together again with a
+     * SynchronizationChunkAssembler, before the events are applied.
+     */
+    class SynchronizationScheduler : public SynchronizationEventHandler
+    {
+    public:
+        enum Priority
+        {
+            TRANSFORM = 0,
+            STRUCTURE = 1,
+            ITEM = 2
+        };
+
+        /** class name of the binary events which hold a chunk */
+        static const std::string CHUNK_CLASS;
+
+        SynchronizationScheduler();
+
+        /** Maximum number of bytes returned by a single call to
+         * popEvents(), 0 (default) for no limit. A single event is
+         * returned even if it is larger than the budget, so that the
+         * synchronization does not stall.
+         */
+        void setByteBudget( size_t bytes );
+
+        /** Items which are larger than the given number of bytes are split
+         * into chunks of this size. Default is 64kB, 0 disables chunking.
+         */
+        void setChunkSize( size_t bytes );
+
+        /** @brief pops the pending events, in order of priority, up to the
+         * byte budget
+         */
+        void popEvents( std::vector<BinaryEvent>& msgs );
+
+        /** @return the number of events which are waiting to be sent,
+         * including unsent chunks */
+        size_t getPendingCount() const;
+
+        /** @return the approximate size of the event in bytes */
+        static size_t getEventSize( const BinaryEvent& event );
+
+        /** @return the priority class of the event */
+        static Priority getPriority( const BinaryEvent& event );
+
+    protected:
+        void handle( std::vector<BinaryEvent>& msgs );
+
+    private:
+        struct Slot
+        {
+            BinaryEvent event;
+            /** order of arrival of the first pending event */
+            size_t sequence;
+        };
+
+        /** item which is sent in chunks */
+        struct Transfer
+        {
+            BinaryEvent header;
+            std::vector<uint8_t> data;
+            size_t chunk;
+            size_t chunks;
+        };
+
+        bool isBlocked( const BinaryEvent& event ) const;
+        bool hasPendingAdd( const std::string& id ) const;
+        void dropItem( const std::string& id );
+        void startTransfer( BinaryEvent& event );
+        bool popTransfer( std::vector<BinaryEvent>& msgs, size_t& used );
+        bool popSlots( Priority priority, std::vector<BinaryEvent>& msgs, size_t& used );
+        bool popStructure( std::vector<BinaryEvent>& msgs, size_t& used );
+        bool fits( size_t size, size_t used, const std::vector<BinaryEvent>& msgs ) const;
+
+        size_t byteBudget;
+        size_t chunkSize;
+        size_t sequence;
+
+        /** latest add or update event of each item */
+        std::map<std::string, Slot> slots;
+        /** all other events, in order of arrival */
+        std::deque<BinaryEvent> structure;
+        std::deque<Transfer> transfers;
+    };
+
+    /**
+     * @brief Puts the chunks of a SynchronizationScheduler together again.
+     */
+    class SynchronizationChunkAssembler
+    {
+    public:
+        /** Replaces the chunks in the events by the events they were split
+         * from. Chunks of incomplete transfers are removed from the events
+         * and kept until the remaining chunks arrive, or until the
+         * transfer is aborted because the item was removed.
+         */
+        void process( std::vector<BinaryEvent>& events );
+
+        /** @return the number of incomplete transfers */
+        size_t getPendingCount() const { return transfers.size(); }
+
+    private:
+        std::map<std::string, std::vector<uint8_t> > transfers;
+    };
+}
+#endif
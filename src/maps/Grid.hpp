@@ -210,6 +210,14 @@ namespace envire
         /** Returns the list of bands defined on this grid
          */
 	virtual const std::vector<std::string>& getBands() const {return bands;};
+
+	/** @return the size of all bands */
+	size_t getMemoryUsage() const;
+	/** writes all bands in the raw form of writeGridData() */
+	bool writeData( std::ostream& os );
+	/** empties the bands, which keep their names */
+	void releaseData();
+	void readData( std::istream& is );
 	
 	Grid* clone() const;
 	void set( EnvironmentItem* other );
@@ -446,19 +454,69 @@ namespace envire
 	    so.write(boost::lexical_cast<std::string>(i), layers[i]);
 
 	// differentiate between single file, multi-file and memory serialization
-	if( fso && singleFile() )
-	    writeGridData( layers, getFullPath(getMapFileName( fso->getMapPath(), getClassName() ), "") );
-	else
-	    if( fso )
-		for( size_t i=0; i<layers.size(); i++ )
-		    writeGridData(layers[i], getFullPath(getMapFileName( fso->getMapPath(), getClassName() ), layers[i]));
+	// the data of unchanged grids is not written at all
+	if( so.hasBinaryOutput() )
+	{
+	    if( fso && singleFile() )
+		writeGridData( layers, getFullPath(getMapFileName( fso->getMapPath(), getClassName() ), "") );
 	    else
-		for( size_t i=0; i<layers.size(); i++ )
-		    writeGridData(layers[i], so.getBinaryOutputStream(getFullPath(getMapFileName(), layers[i])));
+		if( fso )
+		    for( size_t i=0; i<layers.size(); i++ )
+			writeGridData(layers[i], getFullPath(getMapFileName( fso->getMapPath(), getClassName() ), layers[i]));
+		else
+		    for( size_t i=0; i<layers.size(); i++ )
+			writeGridData(layers[i], so.getBinaryOutputStream(getFullPath(getMapFileName(), layers[i])));
+	}
 
         so.write("map_count", layers.size());
     }
 
+    template<class T>size_t Grid<T>::getMemoryUsage() const
+    {
+	size_t usage = 0;
+        for (DataMap::const_iterator it = data_map.begin(); it != data_map.end(); ++it)
+            if (it->second->isOfType<ArrayType>())
+		usage += it->second->get<ArrayType>().num_elements() * sizeof(T);
+	return usage;
+    }
+
+    template<class T>bool Grid<T>::writeData(std::ostream& os)
+    {
+	std::vector<std::string> layers; 
+        for (DataMap::const_iterator it = data_map.begin(); it != data_map.end(); ++it)
+            if (it->second->isOfType<ArrayType>())
+		layers.push_back( it->first );
+
+	// the band names are stored as a header of text lines
+	os << layers.size() << "\n";
+	for( size_t i=0; i<layers.size(); i++ )
+	    os << layers[i] << "\n";
+	for( size_t i=0; i<layers.size(); i++ )
+	    writeGridData( layers[i], os );
+	return true;
+    }
+
+    template<class T>void Grid<T>::releaseData()
+    {
+	// only the storage is freed, the holders are kept so that references
+	// to the bands stay valid
+        for (DataMap::iterator it = data_map.begin(); it != data_map.end(); ++it)
+            if (it->second->isOfType<ArrayType>())
+		it->second->get<ArrayType>().resize( boost::extents[0][0] );
+    }
+
+    template<class T>void Grid<T>::readData(std::istream& is)
+    {
+	size_t count = 0;
+	is >> count;
+	is.ignore( 1 );
+	std::vector<std::string> layers( count ); 
+	for( size_t i=0; i<count; i++ )
+	    std::getline( is, layers[i] );
+	for( size_t i=0; i<count; i++ )
+	    readGridData( layers[i], is );
+    }
+
     template<class T>void Grid<T>::readMap(const std::string& path)
     {
 	LOG_DEBUG_S << "loading all GridData for " << getClassName();
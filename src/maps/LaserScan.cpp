@@ -21,7 +21,8 @@ void LaserScan::serialize(Serialization& so)
 {
     CartesianMap::serialize(so);
 
-    writeScan( so.getBinaryOutputStream(getMapFileName()) );
+    if( so.hasBinaryOutput() )
+	writeScan( so.getBinaryOutputStream(getMapFileName()) );
 }
 
 void LaserScan::setXForward()
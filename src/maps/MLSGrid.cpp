@@ -28,6 +28,8 @@ MLSGrid::MLSGrid(size_t cellSizeX, size_t cellSizeY, double scalex, double scale
 
 void MLSGrid::clear()
 {
+    restore();
+    raiseGeneration();
     cells.clear();
     cellcount = 0;
     if(index) index->reset();
@@ -148,7 +150,8 @@ void MLSGrid::serialize(Serialization& so)
     so.write( "hasCellColor", config.useColor );
     long updateModelInt = static_cast<long>( config.updateModel );
     so.write( "updateModel", updateModelInt );
-    writeMap( so.getBinaryOutputStream(getMapFileName() + ".mls") );
+    if( so.hasBinaryOutput() )
+	writeMap( so.getBinaryOutputStream(getMapFileName() + ".mls") );
 }
 
 void MLSGrid::unserialize(Serialization& so)
@@ -316,6 +319,30 @@ void MLSGrid::writeMap(std::ostream& os)
     }
 }
 
+size_t MLSGrid::getMemoryUsage() const
+{
+    return isEvicted() ? 0 : cells.getMemoryUsage( cellcount );
+}
+
+bool MLSGrid::writeData(std::ostream& os)
+{
+    writeMap( os );
+    return true;
+}
+
+void MLSGrid::releaseData()
+{
+    cells.resize( 0, 0 );
+}
+
+void MLSGrid::readData(std::istream& is)
+{
+    // the patches are counted again while reading
+    cells.resize( cellSizeX, cellSizeY );
+    cellcount = 0;
+    readMap( is );
+}
+
 void MLSGrid::readMap(std::istream& is)
 {   
     char c[32];
@@ -378,11 +405,14 @@ void MLSGrid::readMap(std::istream& is)
 
 MLSGrid::iterator MLSGrid::beginCell( size_t xi, size_t yi )
 {
+    restore();
+    raiseGeneration();
     return cells.beginCell( xi, yi );
 }
 
 MLSGrid::const_iterator MLSGrid::beginCell( size_t xi, size_t yi ) const
 {
+    restore();
     return cells.beginCell( xi, yi );
 }
 
@@ -398,18 +428,23 @@ MLSGrid::const_iterator MLSGrid::endCell() const
 
 void MLSGrid::insertHead( size_t xi, size_t yi, const SurfacePatch& value )
 {
+    restore();
+    raiseGeneration();
     cells.insertHead( xi, yi, value );
     addCell( Position( xi, yi ) );
 }
 
 void MLSGrid::insertTail( size_t xi, size_t yi, const SurfacePatch& value )
 {
+    restore();
+    raiseGeneration();
     cells.insertTail( xi, yi, value );
     addCell( Position( xi, yi ) );
 }
 
 MLSGrid::iterator MLSGrid::erase( iterator position )
 {
+    raiseGeneration();
     iterator res = cells.erase( position );
     cellcount--;
     return res; 
@@ -485,6 +520,7 @@ void MLSGrid::updateCell( size_t xi, size_t yi, const SurfacePatch& co )
     iterator_list merged;
     // make a copy of the surfacepatch as it may get updated in the merge
     SurfacePatch o( co );
+    raiseGeneration();
 
     for(MLSGrid::iterator it = beginCell( xi, yi ); it != endCell(); it++ )
     {
@@ -761,6 +797,8 @@ void MLSGrid::initIndex()
 
 void MLSGrid::move(int x, int y)
 {
+    restore();
+    raiseGeneration();
     cells.move(x, y);
 }
 
@@ -96,6 +96,13 @@ namespace envire
 	void writeMap(std::ostream& os);
 	void readMap(std::istream& is);
 
+	size_t getMemoryUsage() const;
+	/** writes the patches in the format of writeMap() */
+	bool writeData(std::ostream& os);
+	/** frees the patches, but keeps the cell count and extents */
+	void releaseData();
+	void readData(std::istream& is);
+
         /** Clears the whole map */
 	void clear();
 
@@ -114,7 +121,8 @@ namespace envire
 	std::vector<Eigen::Vector3d> projectPointsOnSurface(double startHeight, const std::vector<Position> &gridPoints, const double zOffset = 0.0);
 	
         /** Returns the iterator on the first registered patch at \c xi and \c
-         * yi
+         * yi. The patches can be changed through the iterator, so this
+         * raises the generation of the grid.
          */
         iterator beginCell( size_t xi, size_t yi );
         iterator beginCell( const Position &pos )
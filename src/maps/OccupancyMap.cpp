@@ -0,0 +1,378 @@
+#include "OccupancyMap.hpp"
+
+#include <boost/lexical_cast.hpp>
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <limits>
+#include <cmath>
+
+using namespace envire;
+
+ENVIRONMENT_ITEM_DEF( OccupancyMap )
+
+namespace
+{
+    /** true if p is finite and its voxel index can be represented as int */
+    bool isValidPosition( const Eigen::Vector3d& p, double resolution )
+    {
+	const double limit = std::numeric_limits<int>::max() * resolution;
+	for( int i=0; i<3; i++ )
+	{
+	    if( !boost::math::isfinite( p[i] ) || std::abs( p[i] ) >= limit )
+		return false;
+	}
+	return true;
+    }
+}
+
+const int OccupancyMap::BLOCK_SIZE;
+const int OccupancyMap::BLOCK_VOXELS;
+
+OccupancyMap::Block::Block()
+{
+    std::fill( logOdds, logOdds + BLOCK_VOXELS, std::numeric_limits<float>::quiet_NaN() );
+}
+
+OccupancyMap::OccupancyMap( double resolution )
+    : resolution( resolution ),
+    hitLogOdds( toLogOdds( 0.7 ) ), missLogOdds( toLogOdds( 0.4 ) ),
+    clampMin( toLogOdds( 0.12 ) ), clampMax( toLogOdds( 0.97 ) ),
+    occupancyThreshold( 0.0 )
+{
+}
+
+void OccupancyMap::serialize( Serialization& so )
+{
+    CartesianMap::serialize( so );
+
+    so.write( "resolution", resolution );
+    so.write( "hit", hitLogOdds );
+    so.write( "miss", missLogOdds );
+    so.write( "clamp_min", clampMin );
+    so.write( "clamp_max", clampMax );
+    so.write( "occupancy_threshold", occupancyThreshold );
+
+    if( so.hasBinaryOutput() )
+	writeMap( so.getBinaryOutputStream( getMapFileName() + ".occ" ) );
+}
+
+void OccupancyMap::unserialize( Serialization& so )
+{
+    CartesianMap::unserialize( so );
+
+    so.read( "resolution", resolution );
+    so.read( "hit", hitLogOdds );
+    so.read( "miss", missLogOdds );
+    so.read( "clamp_min", clampMin );
+    so.read( "clamp_max", clampMax );
+    so.read( "occupancy_threshold", occupancyThreshold );
+
+    readMap( so.getBinaryInputStream( getMapFileName() + ".occ" ) );
+}
+
+void OccupancyMap::writeMap( std::ostream& os )
+{
+    os << "occ" << std::endl;
+    os << "1.0" << std::endl;
+    os << BLOCK_SIZE << std::endl;
+    os << "bin" << std::endl;
+
+    for( BlockMap::const_iterator it = blocks.begin(); it != blocks.end(); it++ )
+    {
+	const int32_t idx[3] = { it->first.x, it->first.y, it->first.z };
+	os.write( reinterpret_cast<const char*>( idx ), sizeof( idx ) );
+	os.write( reinterpret_cast<const char*>( it->second.logOdds ), sizeof( it->second.logOdds ) );
+    }
+}
+
+void OccupancyMap::readMap( std::istream& is )
+{
+    char c[32];
+    is.getline( c, 20 );
+    if( std::string( c ) != "occ" )
+	throw std::runtime_error( "bad magic " + std::string( c ) );
+
+    is.getline( c, 20 );
+    std::string version = std::string( c );
+    if( version != "1.0" )
+	throw std::runtime_error( "version not supported " + version );
+
+    is.getline( c, 20 );
+    if( boost::lexical_cast<int>( std::string( c ) ) != BLOCK_SIZE )
+	throw std::runtime_error( "block size mismatch" );
+    is.getline( c, 20 );
+    if( std::string( c ) != "bin" )
+	throw std::runtime_error( "missing bin identifier" + std::string( c ) );
+
+    blocks.clear();
+    int32_t idx[3];
+    while( is.read( reinterpret_cast<char*>( idx ), sizeof( idx ) ) )
+    {
+	Block &block( blocks[ Index( idx[0], idx[1], idx[2] ) ] );
+	if( !is.read( reinterpret_cast<char*>( block.logOdds ), sizeof( block.logOdds ) ) )
+	    throw std::runtime_error( "unexpected end of occupancy map data" );
+    }
+}
+
+OccupancyMap::Extents OccupancyMap::getExtents() const
+{
+    Extents extents;
+    const Eigen::Vector3d half( Eigen::Vector3d::Constant( resolution * 0.5 ) );
+    for( BlockMap::const_iterator it = blocks.begin(); it != blocks.end(); it++ )
+    {
+	for( int i=0; i<BLOCK_VOXELS; i++ )
+	{
+	    if( !boost::math::isnan( it->second.logOdds[i] ) )
+	    {
+		const Index idx(
+			it->first.x * BLOCK_SIZE + i % BLOCK_SIZE,
+			it->first.y * BLOCK_SIZE + (i / BLOCK_SIZE) % BLOCK_SIZE,
+			it->first.z * BLOCK_SIZE + i / (BLOCK_SIZE * BLOCK_SIZE) );
+		const Eigen::Vector3d center( fromIndex( idx ) );
+		extents.extend( center - half );
+		extents.extend( center + half );
+	    }
+	}
+    }
+    return extents;
+}
+
+void OccupancyMap::clear()
+{
+    raiseGeneration();
+    blocks.clear();
+}
+
+OccupancyMap::Index OccupancyMap::toIndex( const Eigen::Vector3d& p ) const
+{
+    return Index(
+	    std::floor( p.x() / resolution ),
+	    std::floor( p.y() / resolution ),
+	    std::floor( p.z() / resolution ) );
+}
+
+Eigen::Vector3d OccupancyMap::fromIndex( const Index& idx ) const
+{
+    return Eigen::Vector3d( idx.x + 0.5, idx.y + 0.5, idx.z + 0.5 ) * resolution;
+}
+
+OccupancyMap::Index OccupancyMap::getBlockIndex( const Index& idx )
+{
+    // floor division, which also works for negative indices
+    return Index(
+	    idx.x >= 0 ? idx.x / BLOCK_SIZE : (idx.x + 1) / BLOCK_SIZE - 1,
+	    idx.y >= 0 ? idx.y / BLOCK_SIZE : (idx.y + 1) / BLOCK_SIZE - 1,
+	    idx.z >= 0 ? idx.z / BLOCK_SIZE : (idx.z + 1) / BLOCK_SIZE - 1 );
+}
+
+int OccupancyMap::getVoxelOffset( const Index& idx )
+{
+    const Index block( getBlockIndex( idx ) );
+    const int x = idx.x - block.x * BLOCK_SIZE;
+    const int y = idx.y - block.y * BLOCK_SIZE;
+    const int z = idx.z - block.z * BLOCK_SIZE;
+    return x + BLOCK_SIZE * (y + BLOCK_SIZE * z);
+}
+
+bool OccupancyMap::isKnown( const Index& idx ) const
+{
+    BlockMap::const_iterator it = blocks.find( getBlockIndex( idx ) );
+    return it != blocks.end() && !boost::math::isnan( it->second.logOdds[ getVoxelOffset( idx ) ] );
+}
+
+float OccupancyMap::getLogOdds( const Index& idx ) const
+{
+    BlockMap::const_iterator it = blocks.find( getBlockIndex( idx ) );
+    if( it == blocks.end() )
+	return 0.0;
+    const float value = it->second.logOdds[ getVoxelOffset( idx ) ];
+    return boost::math::isnan( value ) ? 0.0 : value;
+}
+
+double OccupancyMap::getProbability( const Index& idx ) const
+{
+    return toProbability( getLogOdds( idx ) );
+}
+
+bool OccupancyMap::isOccupied( const Index& idx ) const
+{
+    return isKnown( idx ) && getLogOdds( idx ) > occupancyThreshold;
+}
+
+bool OccupancyMap::isFree( const Index& idx ) const
+{
+    return isKnown( idx ) && getLogOdds( idx ) <= occupancyThreshold;
+}
+
+void OccupancyMap::setLogOdds( const Index& idx, float value )
+{
+    raiseGeneration();
+    blocks[ getBlockIndex( idx ) ].logOdds[ getVoxelOffset( idx ) ] = value;
+}
+
+void OccupancyMap::updateLogOdds( const Index& idx, float delta )
+{
+    raiseGeneration();
+    float &value( blocks[ getBlockIndex( idx ) ].logOdds[ getVoxelOffset( idx ) ] );
+    if( boost::math::isnan( value ) )
+	value = 0.0;
+    value = std::min( std::max( value + delta, clampMin ), clampMax );
+}
+
+void OccupancyMap::computeRay( const Eigen::Vector3d& start, const Eigen::Vector3d& end, IndexSet& voxels ) const
+{
+    // 3D version of the traversal in VoxelTraversal, see
+    // "A Fast Voxel Traversal Algorithm for Ray Tracing"
+    // John Amanatides, Andrew Woo
+    const Index startIdx( toIndex( start ) ), endIdx( toIndex( end ) );
+    int cur[3] = { startIdx.x, startIdx.y, startIdx.z };
+    const int last[3] = { endIdx.x, endIdx.y, endIdx.z };
+
+    Eigen::Vector3d dir( end - start );
+    const double length = dir.norm();
+    if( length <= 0 )
+	return;
+    dir /= length;
+
+    int step[3];
+    double tMax[3], tDelta[3];
+    for( int i=0; i<3; i++ )
+    {
+	if( dir[i] > 0 )
+	{
+	    step[i] = 1;
+	    tMax[i] = ((cur[i] + 1) * resolution - start[i]) / dir[i];
+	    tDelta[i] = resolution / dir[i];
+	}
+	else if( dir[i] < 0 )
+	{
+	    step[i] = -1;
+	    tMax[i] = (cur[i] * resolution - start[i]) / dir[i];
+	    tDelta[i] = -resolution / dir[i];
+	}
+	else
+	{
+	    step[i] = 0;
+	    tMax[i] = std::numeric_limits<double>::infinity();
+	    tDelta[i] = std::numeric_limits<double>::infinity();
+	}
+    }
+
+    while( cur[0] != last[0] || cur[1] != last[1] || cur[2] != last[2] )
+    {
+	voxels.insert( Index( cur[0], cur[1], cur[2] ) );
+
+	int axis = 0;
+	if( tMax[1] < tMax[axis] ) axis = 1;
+	if( tMax[2] < tMax[axis] ) axis = 2;
+
+	// numerical safeguard, we can't go further than the end point
+	if( tMax[axis] > length )
+	    break;
+
+	cur[axis] += step[axis];
+	tMax[axis] += tDelta[axis];
+    }
+}
+
+void OccupancyMap::insertScan( const Eigen::Vector3d& origin, const std::vector<Eigen::Vector3d>& points, double maxRange )
+{
+    if( !isValidPosition( origin, resolution ) )
+	throw std::runtime_error( "OccupancyMap::insertScan: scan origin is not finite" );
+
+    // collect the voxels for the whole scan first, so that every voxel
+    // is only updated once, no matter how many rays pass through it
+    IndexSet freeVoxels, occupiedVoxels;
+    for( size_t i=0; i<points.size(); i++ )
+    {
+	const Eigen::Vector3d &p( points[i] );
+	// invalid returns are usually reported as NaN, skip them
+	if( !isValidPosition( p, resolution ) )
+	    continue;
+
+	const double range = (p - origin).norm();
+	if( maxRange > 0 && range > maxRange )
+	{
+	    computeRay( origin, origin + (p - origin) * (maxRange / range), freeVoxels );
+	}
+	else
+	{
+	    occupiedVoxels.insert( toIndex( p ) );
+	    computeRay( origin, p, freeVoxels );
+	}
+    }
+
+    for( IndexSet::iterator it = freeVoxels.begin(); it != freeVoxels.end(); it++ )
+    {
+	if( !occupiedVoxels.count( *it ) )
+	    integrateMiss( *it );
+    }
+
+    for( IndexSet::iterator it = occupiedVoxels.begin(); it != occupiedVoxels.end(); it++ )
+	integrateHit( *it );
+}
+
+void OccupancyMap::getOccupiedVoxels( std::vector<Eigen::Vector3d>& centers ) const
+{
+    centers.clear();
+    for( BlockMap::const_iterator it = blocks.begin(); it != blocks.end(); it++ )
+    {
+	for( int i=0; i<BLOCK_VOXELS; i++ )
+	{
+	    const float value = it->second.logOdds[i];
+	    if( !boost::math::isnan( value ) && value > occupancyThreshold )
+	    {
+		const Index idx(
+			it->first.x * BLOCK_SIZE + i % BLOCK_SIZE,
+			it->first.y * BLOCK_SIZE + (i / BLOCK_SIZE) % BLOCK_SIZE,
+			it->first.z * BLOCK_SIZE + i / (BLOCK_SIZE * BLOCK_SIZE) );
+		centers.push_back( fromIndex( idx ) );
+	    }
+	}
+    }
+}
+
+void OccupancyMap::setProbHit( double p )
+{
+    hitLogOdds = toLogOdds( p );
+}
+
+void OccupancyMap::setProbMiss( double p )
+{
+    missLogOdds = toLogOdds( p );
+}
+
+void OccupancyMap::setClampingThresholds( double min, double max )
+{
+    clampMin = toLogOdds( min );
+    clampMax = toLogOdds( max );
+}
+
+void OccupancyMap::setOccupancyThreshold( double p )
+{
+    occupancyThreshold = toLogOdds( p );
+}
+
+double OccupancyMap::getProbHit() const
+{
+    return toProbability( hitLogOdds );
+}
+
+double OccupancyMap::getProbMiss() const
+{
+    return toProbability( missLogOdds );
+}
+
+double OccupancyMap::getOccupancyThreshold() const
+{
+    return toProbability( occupancyThreshold );
+}
+
+float OccupancyMap::toLogOdds( double p )
+{
+    return std::log( p / (1.0 - p) );
+}
+
+double OccupancyMap::toProbability( float logOdds )
+{
+    return 1.0 - 1.0 / (1.0 + std::exp( logOdds ));
+}
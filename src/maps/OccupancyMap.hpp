@@ -0,0 +1,194 @@
+#ifndef __ENVIRE_OCCUPANCYMAP_HPP__
+#define __ENVIRE_OCCUPANCYMAP_HPP__
+
+#include <envire/Core.hpp>
+#include <envire/core/Serialization.hpp>
+
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/functional/hash.hpp>
+#include <Eigen/Core>
+#include <vector>
+
+namespace envire
+{
+    /**
+     * Sparse 3D voxel map, which stores the occupancy probability of each
+     * voxel in log-odds form.
+     *
+     * The voxels are grouped into blocks of BLOCK_SIZE^3 voxels, which are
+     * kept in a hash map indexed by the block position. Blocks are only
+     * allocated for regions which have been observed, so the map can cover
+     * large areas while still giving constant time access to a voxel. Voxels
+     * which have not been observed inside an allocated block are marked as
+     * unknown.
+     *
+     * Updates are clamped to [clampMin, clampMax], so that the map stays
+     * able to react to changes in the environment.
+     */
+    class OccupancyMap : public Map<3>
+    {
+	ENVIRONMENT_ITEM( OccupancyMap )
+
+    public:
+	/** edge length of a block in voxels */
+	static const int BLOCK_SIZE = 8;
+	static const int BLOCK_VOXELS = BLOCK_SIZE * BLOCK_SIZE * BLOCK_SIZE;
+
+	/** integer position of a voxel or a block */
+	struct Index
+	{
+	    int x, y, z;
+
+	    Index() : x(0), y(0), z(0) {}
+	    Index( int x, int y, int z ) : x(x), y(y), z(z) {}
+
+	    bool operator==( const Index& other ) const
+	    { return x == other.x && y == other.y && z == other.z; }
+	    bool operator!=( const Index& other ) const
+	    { return !(*this == other); }
+	    bool operator<( const Index& other ) const
+	    { return x < other.x || (x == other.x && (y < other.y || (y == other.y && z < other.z))); }
+	};
+
+	struct Block
+	{
+	    /** log-odds of the voxels, NaN for unknown voxels. The voxel
+	     * (x,y,z) within the block is stored at x + BLOCK_SIZE * (y +
+	     * BLOCK_SIZE * z) */
+	    float logOdds[BLOCK_VOXELS];
+
+	    Block();
+	};
+
+	typedef boost::unordered_map<Index, Block, boost::hash<Index> > BlockMap;
+	typedef boost::unordered_set<Index, boost::hash<Index> > IndexSet;
+	typedef BlockMap::const_iterator const_block_iterator;
+
+    public:
+	/** @param resolution edge length of a voxel in m */
+	explicit OccupancyMap( double resolution = 0.1 );
+
+	void serialize( Serialization& so );
+	void unserialize( Serialization& so );
+
+	void writeMap( std::ostream& os );
+	void readMap( std::istream& is );
+
+	Extents getExtents() const;
+
+	double getResolution() const { return resolution; }
+
+	/** removes all voxels from the map */
+	void clear();
+
+	/** @return the index of the voxel that contains the point given in
+	 * map coordinates */
+	Index toIndex( const Eigen::Vector3d& p ) const;
+
+	/** @return the center of the voxel in map coordinates */
+	Eigen::Vector3d fromIndex( const Index& idx ) const;
+
+	/** @return true if the voxel has been observed */
+	bool isKnown( const Index& idx ) const;
+
+	/** @return log-odds of the voxel, or 0 for unknown voxels */
+	float getLogOdds( const Index& idx ) const;
+
+	/** @return occupancy probability of the voxel, 0.5 for unknown voxels */
+	double getProbability( const Index& idx ) const;
+
+	/** @return true if the voxel is known and its log-odds are above the
+	 * occupancy threshold */
+	bool isOccupied( const Index& idx ) const;
+
+	/** @return true if the voxel is known and its log-odds are below or
+	 * equal to the occupancy threshold */
+	bool isFree( const Index& idx ) const;
+
+	/** sets the log-odds of the voxel, without clamping */
+	void setLogOdds( const Index& idx, float value );
+
+	/** adds the given log-odds to the voxel, the result is clamped. Unknown
+	 * voxels are treated as having a probability of 0.5 */
+	void updateLogOdds( const Index& idx, float delta );
+
+	/** integrates an observation of the voxel as occupied */
+	void integrateHit( const Index& idx ) { updateLogOdds( idx, hitLogOdds ); }
+
+	/** integrates an observation of the voxel as free */
+	void integrateMiss( const Index& idx ) { updateLogOdds( idx, missLogOdds ); }
+
+	/**
+	 * Inserts a scan into the map. For each point, the voxels on the ray
+	 * from the origin to the point are updated as free, and the voxel of
+	 * the point as occupied. All positions are in map coordinates.
+	 *
+	 * The voxels are collected for the whole scan before the map is
+	 * updated, so that each voxel is updated at most once per scan, even
+	 * if it is crossed by many rays. A voxel that is hit by any point of
+	 * the scan is only updated as occupied.
+	 *
+	 * Points that are not finite, or too far away to be indexed, are
+	 * skipped. An origin like that throws std::runtime_error.
+	 *
+	 * @param maxRange points further away than this from the origin only
+	 *        clear the voxels up to maxRange, and are not inserted as
+	 *        occupied. A value of 0 disables the limit.
+	 */
+	void insertScan( const Eigen::Vector3d& origin, const std::vector<Eigen::Vector3d>& points, double maxRange = 0.0 );
+
+	/** collects the voxels that are crossed by the ray from start to end,
+	 * excluding the voxel that contains end */
+	void computeRay( const Eigen::Vector3d& start, const Eigen::Vector3d& end, IndexSet& voxels ) const;
+
+	/** @return the centers of all occupied voxels */
+	void getOccupiedVoxels( std::vector<Eigen::Vector3d>& centers ) const;
+
+	/** @return the number of allocated blocks */
+	size_t getBlockCount() const { return blocks.size(); }
+
+	const_block_iterator beginBlocks() const { return blocks.begin(); }
+	const_block_iterator endBlocks() const { return blocks.end(); }
+
+	/** sensor model, probability of a voxel being occupied when it is hit
+	 * by a measurement, default 0.7 */
+	void setProbHit( double p );
+	/** sensor model, probability of a voxel being occupied when a ray
+	 * passes through it, default 0.4 */
+	void setProbMiss( double p );
+	/** limits for the probability of a voxel, default 0.12 and 0.97 */
+	void setClampingThresholds( double min, double max );
+	/** voxels with a probability above this are occupied, default 0.5 */
+	void setOccupancyThreshold( double p );
+
+	double getProbHit() const;
+	double getProbMiss() const;
+	double getOccupancyThreshold() const;
+
+	static float toLogOdds( double p );
+	static double toProbability( float logOdds );
+
+    protected:
+	static Index getBlockIndex( const Index& idx );
+	static int getVoxelOffset( const Index& idx );
+
+	double resolution;
+	float hitLogOdds, missLogOdds;
+	float clampMin, clampMax;
+	float occupancyThreshold;
+
+	BlockMap blocks;
+    };
+
+    inline std::size_t hash_value( const OccupancyMap::Index& idx )
+    {
+	std::size_t seed = 0;
+	boost::hash_combine( seed, idx.x );
+	boost::hash_combine( seed, idx.y );
+	boost::hash_combine( seed, idx.z );
+	return seed;
+    }
+}
+
+#endif
@@ -38,7 +38,7 @@ void Pointcloud::serialize(Serialization& so, bool handleMap)
 
     so.write( "sensor_origin", sensor_origin );
 
-    if(handleMap)
+    if(handleMap && so.hasBinaryOutput())
 	writePly( getMapFileName() + ".ply", so.getBinaryOutputStream(getMapFileName() + ".ply") );
 }
 
@@ -70,6 +70,21 @@ bool Pointcloud::readPly(const std::string& filename, std::istream& is)
     return ply.unserialize( this, is );
 }
 
+size_t Pointcloud::getMemoryUsage() const
+{
+    size_t usage = vertices.capacity() * sizeof(Eigen::Vector3d);
+    for( DataMap::const_iterator it = data_map.begin(); it != data_map.end(); it++ )
+    {
+	if( it->second->isOfType<std::vector<Eigen::Vector3d> >() )
+	    usage += it->second->get<std::vector<Eigen::Vector3d> >().capacity() * sizeof(Eigen::Vector3d);
+	else if( it->second->isOfType<std::vector<double> >() )
+	    usage += it->second->get<std::vector<double> >().capacity() * sizeof(double);
+	else if( it->second->isOfType<std::vector<attr_flag> >() )
+	    usage += it->second->get<std::vector<attr_flag> >().capacity() * sizeof(attr_flag);
+    }
+    return usage;
+}
+
 bool Pointcloud::writeText(std::ostream& os)
 {
     for(size_t i=0;i<vertices.size();i++)
@@ -54,6 +54,7 @@ namespace envire {
 
 	void clear()
 	{
+	    raiseGeneration();
 	    vertices.clear();
 	    if( hasData( VERTEX_COLOR ) ) getVertexData<Eigen::Vector3d>( VERTEX_COLOR ).clear();
 	    if( hasData( VERTEX_NORMAL ) ) getVertexData<Eigen::Vector3d>( VERTEX_NORMAL ).clear();
@@ -78,6 +79,11 @@ namespace envire {
 	bool writePly(const std::string& filename, std::ostream& os, bool const doublePrecision = true);
 	bool readPly(const std::string& filename, std::istream& is);
 
+	/** Pointclouds count towards the memory budget of the environment,
+	 * but are never evicted, since the vertices are public
+	 * members which are used without Layer::touch(). */
+	size_t getMemoryUsage() const;
+
 	Extents getExtents() const;
 
     void setSensorOrigin(const Transform& origin);
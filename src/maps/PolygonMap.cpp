@@ -2,6 +2,7 @@
 #include <envire/core/Serialization.hpp>
 #include <Box2D/Collision/b2Collision.h>
 #include <Box2D/Box2D.h>
+#include <envire/tools/ParallelFor.hpp>
 
 
 namespace envire
@@ -37,6 +38,7 @@ public:
 
 Polygon::Polygon(const std::vector<Eigen::Vector2d>& points) : data(new PolygonData)
 {
+    data->proxyId = b2_nullNode;
     data->setShape(data->shape, points);
     data->pose.SetIdentity();
     data->moved = true;
@@ -67,17 +69,27 @@ void Polygon::move(const base::Pose& pose)
 
 
 
-class PolygonSetData
+class PolygonSetData;
+
+/**
+ * State of a single query of a polygon against the tree of a polygon set.
+ * The query only reads from the set, so several queries can run in
+ * parallel as long as each one has its own PolygonQuery object.
+ * */
+class PolygonQuery
 {
 public:
-    PolygonSetData() : curTestPoly(NULL), collisionPoly(NULL), hasCollision(false)
+    PolygonQuery(const PolygonSetData &set) : set(set), curTestPoly(NULL), collisionPoly(NULL), hasCollision(false)
     {
 	minDistance.distance = std::numeric_limits< float >::max();
     }
-    std::vector<envire::Polygon *> polygons;
-    b2BroadPhase broadPhase;
+
+    void run(const envire::Polygon &poly);
+    bool isInside() const;
     bool QueryCallback(int32_t proxyId);
-    
+
+    const PolygonSetData &set;
+
     //collision test data
     const envire::Polygon *curTestPoly;
     const envire::Polygon *collisionPoly;
@@ -85,6 +97,19 @@ public:
     b2DistanceOutput minDistance;
 };
 
+class PolygonSetData
+{
+public:
+    PolygonSetData() : lastQuery(*this)
+    {
+    }
+    std::vector<envire::Polygon *> polygons;
+    b2DynamicTree tree;
+
+    //result of the last single query
+    PolygonQuery lastQuery;
+};
+
 PolygonMap::PolygonMap()
 {
     
@@ -102,13 +127,37 @@ PolygonSet::~PolygonSet()
 
 void PolygonSet::add(envire::Polygon& poly)
 {
-    int proxyId = data->broadPhase.CreateProxy(poly.data->aabb, NULL);
+    int proxyId = data->tree.CreateProxy(poly.data->aabb, NULL);
     if(data->polygons.size() <= proxyId)
 	data->polygons.resize(proxyId + 1, NULL);
 	
     poly.data->proxyId = proxyId;
 
     data->polygons[proxyId] = &poly;
+    data->lastQuery.curTestPoly = NULL;
+}
+
+void PolygonSet::remove(envire::Polygon& poly)
+{
+    const int proxyId = poly.data->proxyId;
+    if(proxyId < 0 || proxyId >= (int)data->polygons.size() || data->polygons[proxyId] != &poly)
+	throw std::runtime_error("PolygonSet: polygon is not part of this set.");
+
+    data->tree.DestroyProxy(proxyId);
+    data->polygons[proxyId] = NULL;
+    poly.data->proxyId = b2_nullNode;
+    data->lastQuery.curTestPoly = NULL;
+}
+
+void PolygonSet::update(envire::Polygon& poly)
+{
+    const int proxyId = poly.data->proxyId;
+    if(proxyId < 0 || proxyId >= (int)data->polygons.size() || data->polygons[proxyId] != &poly)
+	throw std::runtime_error("PolygonSet: polygon is not part of this set.");
+
+    //the tree only reinserts the proxy if it left its fat AABB
+    data->tree.MoveProxy(proxyId, poly.data->aabb, b2Vec2(0, 0));
+    data->lastQuery.curTestPoly = NULL;
 }
 
 Map< 2 >::Extents PolygonMap::getExtents() const
@@ -119,68 +168,111 @@ Map< 2 >::Extents PolygonMap::getExtents() const
 void PolygonSet::doQuery(const envire::Polygon& poly)
 {
     //check if we allready computed distance and intersection
-    if((&poly == data->curTestPoly) && !poly.data->moved)
+    if((&poly == data->lastQuery.curTestPoly) && !poly.data->moved)
 	return;
     
-//     std::cout << "Performing querry" << std::endl;
-    
     poly.data->moved = false;
-    data->hasCollision = false;
-    data->minDistance.distance = std::numeric_limits< float >::max();
-    data->curTestPoly = &poly;    
-    data->broadPhase.Query(data, poly.data->aabb);
+    data->lastQuery.run(poly);
 }
 
 double PolygonSet::getMinimalDistance(const envire::Polygon& poly)
 {
     doQuery(poly);
     
-    return data->minDistance.distance;
+    return data->lastQuery.minDistance.distance;
 }
 
 bool PolygonSet::isInside(const envire::Polygon& poly)
 {
     doQuery(poly);
 
-    if(!data->hasCollision)
+    return data->lastQuery.isInside();
+}
+
+bool PolygonSet::isIntersecting(const envire::Polygon& poly)
+{
+    doQuery(poly);
+
+    return data->lastQuery.hasCollision;
+}
+
+namespace
+{
+    struct BatchQuery
+    {
+	const PolygonSetData &set;
+	const std::vector<const Polygon*> &polys;
+	std::vector<PolygonSet::QueryResult> &results;
+
+	BatchQuery(const PolygonSetData &set, const std::vector<const Polygon*> &polys, std::vector<PolygonSet::QueryResult> &results)
+	    : set(set), polys(polys), results(results) {}
+
+	void operator()(size_t begin, size_t end)
+	{
+	    for(size_t i = begin; i < end; i++)
+	    {
+		PolygonQuery query(set);
+		query.run(*polys[i]);
+		results[i].intersecting = query.hasCollision;
+		results[i].inside = query.isInside();
+		results[i].minDistance = query.minDistance.distance;
+	    }
+	}
+    };
+}
+
+void PolygonSet::query(const std::vector<const Polygon*> &polys, std::vector<QueryResult> &results, size_t threads) const
+{
+    results.resize(polys.size());
+    BatchQuery batch(*data, polys, results);
+    parallelFor(polys.size(), batch, threads, 64);
+}
+
+void PolygonQuery::run(const envire::Polygon& poly)
+{
+    hasCollision = false;
+    collisionPoly = NULL;
+    minDistance.distance = std::numeric_limits< float >::max();
+    curTestPoly = &poly;
+    set.tree.Query(this, poly.data->aabb);
+}
+
+bool PolygonQuery::isInside() const
+{
+    if(!hasCollision)
 	return false;
     
-    const b2PolygonShape *shape1 = &(poly.data->shape);
-    const b2PolygonShape *shape2 = &(data->collisionPoly->data->shape);
+    const b2PolygonShape *shape1 = &(curTestPoly->data->shape);
+    const b2PolygonShape *shape2 = &(collisionPoly->data->shape);
     
-    //perform point test for every vertex in poly
+    //perform point test for every vertex in poly, the vertices
+    //need to be in world coordinates
     for(int i = 0;i < shape1->GetVertexCount(); i++)
     {
-	if(!shape2->TestPoint(poly.data->pose, shape1->m_vertices[i]))
+	if(!shape2->TestPoint(collisionPoly->data->pose, b2Mul(curTestPoly->data->pose, shape1->m_vertices[i])))
 	    return false;
     }
     return true;
 }
 
-bool PolygonSet::isIntersecting(const envire::Polygon& poly)
-{
-    doQuery(poly);
-
-    return data->hasCollision;
-}
-
 /**
  * This function gets called if we hit a leaf in the AABB-Tree.
  * In this case we compute the distance of the two shapes
  * inside the colliding AABBs. If the distance is really small
  * we assume a collision happended and terminate the tree query.
  * */
-bool PolygonSetData::QueryCallback(int32_t proxyId)
+bool PolygonQuery::QueryCallback(int32_t proxyId)
 {
-//     std::cout << "Querry callback proxyId " << proxyId << " test id " << curTestPoly->data->proxyId << std::endl; 
+    const envire::Polygon *poly = set.polygons[proxyId];
+
     b2DistanceInput input;
     input.proxyA.Set(&(curTestPoly->data->shape), 0);
-    input.proxyB.Set(&(polygons[proxyId]->data->shape), 0);
+    input.proxyB.Set(&(poly->data->shape), 0);
     input.transformA = curTestPoly->data->pose;
-//     std::cout << "Pos A " << input.transformA.p.x << " " << input.transformA.p.y << std::endl;
-    input.transformB = polygons[proxyId]->data->pose;
-//     std::cout << "Pos B " << input.transformB.p.x << " " << input.transformB.p.y << std::endl;
-    input.useRadii = true;
+    input.transformB = poly->data->pose;
+    //the AABBs only give candidates, do the exact test
+    //on the polygons without the collision skin of box2d
+    input.useRadii = false;
 
     b2SimplexCache cache;
     cache.count = 0;
@@ -194,12 +286,9 @@ bool PolygonSetData::QueryCallback(int32_t proxyId)
     if(collision)
     {
 	hasCollision = true;
-	collisionPoly = polygons[proxyId];
+	collisionPoly = poly;
     }
     
-    std::cout << output.pointA.x << " " << output.pointA.y << std::endl;
-    std::cout << output.pointB.x << " " << output.pointB.y << std::endl;
-    
     //save minimum distance
     if(output.distance < minDistance.distance)
 	minDistance = output;
@@ -209,4 +298,4 @@ bool PolygonSetData::QueryCallback(int32_t proxyId)
 }
 
 
-}
\ No newline at end of file
+}
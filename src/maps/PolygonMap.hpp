@@ -11,6 +11,7 @@ namespace envire
 class PolygonData;
 //pimpl class
 class PolygonSetData;
+class PolygonQuery;
 
 class PolygonSet;
     
@@ -18,6 +19,7 @@ class Polygon
 {
     friend class PolygonSet;
     friend class PolygonSetData;
+    friend class PolygonQuery;
 public:
     Polygon(const std::vector<Eigen::Vector2d> &points);
     ~Polygon();
@@ -40,12 +42,44 @@ private:
 class PolygonSet
 {
 public:
+    /** result of a query of a single polygon against the set */
+    struct QueryResult
+    {
+	/** true if the polygon intersects any polygon of the set */
+	bool intersecting;
+	/** true if the polygon is fully inside the intersecting polygon */
+	bool inside;
+	/** minimal distance to the polygons of the set which are inside
+	 * the distance calculation area of the polygon */
+	double minDistance;
+    };
+
     PolygonSet();
     ~PolygonSet();
+
+    /** Adds the polygon to the set. The polygon is not copied and needs to
+     * stay valid while it is part of the set. A polygon can only be part
+     * of one set. */
     void add(Polygon &poly);
+
+    /** Removes the polygon from the set */
+    void remove(Polygon &poly);
+
+    /** Needs to be called after a polygon of the set has been moved */
+    void update(Polygon &poly);
+
     bool isIntersecting(const Polygon &poly);
     bool isInside(const Polygon &poly);
     double getMinimalDistance(const envire::Polygon& poly);
+
+    /**
+     * Queries a batch of polygons against the set. The set is only read
+     * during the query, so the polygons are processed in parallel.
+     *
+     * @param threads number of threads to use, 0 for one per hardware thread
+     */
+    void query(const std::vector<const Polygon*> &polys, std::vector<QueryResult> &results, size_t threads = 0) const;
+
 private:
     void doQuery(const Polygon &poly);
     PolygonSetData *data;
@@ -1,7 +1,6 @@
 #include "TraversabilityGrid.hpp"
 #include <boost/bind.hpp>
-#include <tools/RadialLookUpTable.hpp>
-#include <tools/BoxLookUpTable.hpp>
+#include <tools/LookUpTableCache.hpp>
 #include <Eigen/Geometry>
 
 using namespace envire;
@@ -25,8 +24,7 @@ const std::vector<std::string> &TraversabilityGrid::bands = initTraversabilityBa
 
 class StatisticHelper
 {
-    static RadialLookUpTable *lut;
-    static BoxLookUpTable *boxLut;
+    LookUpTableCache::Entry luts;
     const base::Pose2D &pose;
     Eigen::Rotation2D<double> inverseOrientation;
     const TraversabilityGrid &grid;
@@ -43,22 +41,16 @@ public:
     inverseOrientation(Eigen::Rotation2D<double>(pose.orientation).inverse()), grid(grid), gridData(grid.getGridData(TraversabilityGrid::TRAVERSABILITY))
     , scaleX(grid.getScaleX()), scaleY(grid.getScaleY())
     {
-        if(!lut)
-            lut = new RadialLookUpTable();
-        lut->recompute(grid.getScaleX(), std::max(sizeX, sizeY));
-        
-        if(!boxLut)
-            boxLut = new BoxLookUpTable();
-        //note the scale should be higher than the grid scale because 
-        //of the roation. Else we get aliasing problems.
-        boxLut->recompute(scaleX / 10.0, sizeX, sizeY, borderWidth * 2);
+        //the tables are shared and never modified, so several statistics
+        //can be computed concurrently
+        luts = LookUpTableCache::getInstance().get(scaleX, sizeX, sizeY, borderWidth);
         
         grid.toGrid(pose.position.x(), pose.position.y(), xCenter, yCenter);
     }
 
     void addInnerVal(size_t x, size_t y)
     {
-        innerStats->addMeasurement(gridData[y][x], lut->getDistance(x-xCenter, y-yCenter));
+        innerStats->addMeasurement(gridData[y][x], luts.radial->getDistance(x-xCenter, y-yCenter));
     }
     
     void addOuterVal(size_t x, size_t y)
@@ -67,7 +59,7 @@ public:
         grid.fromGrid(x, y, pos_map.x(), pos_map.y());
         Vector2d posAligned = inverseOrientation * (pos_map - pose.position);
         
-        outerStats->addMeasurement(gridData[y][x], boxLut->getDistanceToBox(posAligned.x(), posAligned.y()));
+        outerStats->addMeasurement(gridData[y][x], luts.box->getDistanceToBox(posAligned.x(), posAligned.y()));
     }
 
     void setInnerStatistic(TraversabilityStatistic *innerStat)
@@ -80,9 +72,6 @@ public:
     }
 };
 
-RadialLookUpTable *StatisticHelper::lut;
-BoxLookUpTable *StatisticHelper::boxLut;
-
 void addVal(size_t x, size_t y, std::vector<uint8_t> &stats, const TraversabilityGrid::ArrayType &gridData)
 {
     stats[gridData[y][x]]++;
@@ -244,7 +233,7 @@ void TraversabilityGrid::setProbability(double probability, size_t x, size_t y)
 {
     setProbabilityArray();
     
-    const uint8_t probVal = std::max<uint32_t>(std::numeric_limits< uint8_t >::max(), probability * std::numeric_limits< uint8_t >::max());
+    const uint8_t probVal = std::min<uint32_t>(std::numeric_limits< uint8_t >::max(), probability * std::numeric_limits< uint8_t >::max());
     
     (*probabilityArray)[y][x] = probVal;
 }
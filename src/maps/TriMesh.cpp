@@ -15,7 +15,8 @@ void TriMesh::serialize(Serialization& so)
 {
     Pointcloud::serialize(so, false);
 
-    writePly( getMapFileName() + ".ply" , so.getBinaryOutputStream(getMapFileName() + ".ply"));
+    if( so.hasBinaryOutput() )
+	writePly( getMapFileName() + ".ply" , so.getBinaryOutputStream(getMapFileName() + ".ply"));
 }
 
 void TriMesh::unserialize(Serialization& so)
@@ -25,6 +26,11 @@ void TriMesh::unserialize(Serialization& so)
     readPly( getMapFileName() + ".ply", so.getBinaryInputStream(getMapFileName() + ".ply") );
 }
 
+size_t TriMesh::getMemoryUsage() const
+{
+    return Pointcloud::getMemoryUsage() + faces.capacity() * sizeof(triangle_t);
+}
+
 void TriMesh::calcVertexNormals()
 {
     // calculate the Triangle normals first
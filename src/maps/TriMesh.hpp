@@ -36,6 +36,8 @@ namespace envire {
 	void serialize(Serialization& so);
     void unserialize(Serialization& so);
 
+	size_t getMemoryUsage() const;
+
 	void calcVertexNormals( void );
     };
 }
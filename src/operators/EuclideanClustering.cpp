@@ -0,0 +1,304 @@
+#include "EuclideanClustering.hpp"
+
+#include <envire/tools/KdTree.hpp>
+#include <envire/tools/ParallelFor.hpp>
+#include <algorithm>
+#include <limits>
+
+using namespace envire;
+
+ENVIRONMENT_ITEM_DEF( EuclideanClustering )
+
+const std::string EuclideanClustering::CLUSTER_ID = "cluster_id";
+
+namespace
+{
+    typedef KdTree::index_t index_t;
+    typedef std::vector<std::pair<index_t, index_t> > Links;
+
+    struct AxisLess
+    {
+	const std::vector<Eigen::Vector3d>& points;
+	int axis;
+
+	AxisLess( const std::vector<Eigen::Vector3d>& points, int axis )
+	    : points( points ), axis( axis ) {}
+
+	bool operator()( index_t a, index_t b ) const
+	{
+	    return points[a][axis] < points[b][axis];
+	}
+    };
+
+    /** largest clusters first, ties by their root */
+    struct ClusterLess
+    {
+	bool operator()( const std::pair<size_t, index_t>& a, const std::pair<size_t, index_t>& b ) const
+	{
+	    return a.first > b.first || (a.first == b.first && a.second < b.second);
+	}
+    };
+
+    /** union-find over the positions of the points in the slab order, so
+     * that the points of a slab are a continuous range */
+    struct ClusterTask
+    {
+	const KdTree& tree;
+	const std::vector<index_t>& order;
+	const std::vector<index_t>& rank;
+	const double radius;
+	const size_t slabs;
+
+	std::vector<index_t> parent;
+	/** links which cross the border of each slab */
+	std::vector<Links> borders;
+
+	ClusterTask( const KdTree& tree, const std::vector<index_t>& order,
+		const std::vector<index_t>& rank, double radius, size_t slabs )
+	    : tree( tree ), order( order ), rank( rank ), radius( radius ),
+	    slabs( slabs ), parent( order.size() ), borders( slabs )
+	{
+	    for( size_t i=0; i<parent.size(); i++ )
+		parent[i] = i;
+	}
+
+	size_t getBegin( size_t slab ) const
+	{
+	    return slab * order.size() / slabs;
+	}
+
+	index_t find( index_t i )
+	{
+	    while( parent[i] != i )
+	    {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	    }
+	    return i;
+	}
+
+	void unite( index_t a, index_t b )
+	{
+	    a = find( a );
+	    b = find( b );
+	    if( a < b )
+		parent[b] = a;
+	    else if( b < a )
+		parent[a] = b;
+	}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    const std::vector<Eigen::Vector3d>& points( tree.getPoints() );
+	    std::vector<KdTree::Neighbour> result;
+	    for( size_t s=begin; s<end; s++ )
+	    {
+		const size_t sb = getBegin( s ), se = getBegin( s + 1 );
+		for( size_t p=sb; p<se; p++ )
+		{
+		    tree.findInRadius( points[order[p]], radius, result );
+		    for( size_t i=0; i<result.size(); i++ )
+		    {
+			// each pair is seen from both sides
+			const index_t q = rank[result[i].index];
+			if( q <= p )
+			    continue;
+			if( q < se )
+			    unite( p, q );
+			else
+			    borders[s].push_back( std::make_pair( p, q ) );
+		    }
+		}
+	    }
+	}
+    };
+
+    void copyPoints( Pointcloud& in, Pointcloud& out, const std::vector<size_t>& indices, const Eigen::Affine3d& C_in2out )
+    {
+	out.clear();
+	out.vertices.reserve( indices.size() );
+	for( size_t i=0; i<indices.size(); i++ )
+	    out.vertices.push_back( C_in2out * in.vertices[indices[i]] );
+
+	if( in.hasData( Pointcloud::VERTEX_COLOR ) )
+	{
+	    const std::vector<Eigen::Vector3d>& src( in.getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR ) );
+	    std::vector<Eigen::Vector3d>& dst( out.getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR ) );
+	    for( size_t i=0; i<indices.size(); i++ )
+		dst.push_back( src[indices[i]] );
+	}
+	if( in.hasData( Pointcloud::VERTEX_NORMAL ) )
+	{
+	    const std::vector<Eigen::Vector3d>& src( in.getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL ) );
+	    std::vector<Eigen::Vector3d>& dst( out.getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL ) );
+	    for( size_t i=0; i<indices.size(); i++ )
+		dst.push_back( C_in2out.linear() * src[indices[i]] );
+	}
+	if( in.hasData( Pointcloud::VERTEX_VARIANCE ) )
+	{
+	    const std::vector<double>& src( in.getVertexData<double>( Pointcloud::VERTEX_VARIANCE ) );
+	    std::vector<double>& dst( out.getVertexData<double>( Pointcloud::VERTEX_VARIANCE ) );
+	    for( size_t i=0; i<indices.size(); i++ )
+		dst.push_back( src[indices[i]] );
+	}
+	if( in.hasData( Pointcloud::VERTEX_ATTRIBUTES ) )
+	{
+	    const std::vector<Pointcloud::attr_flag>& src( in.getVertexData<Pointcloud::attr_flag>( Pointcloud::VERTEX_ATTRIBUTES ) );
+	    std::vector<Pointcloud::attr_flag>& dst( out.getVertexData<Pointcloud::attr_flag>( Pointcloud::VERTEX_ATTRIBUTES ) );
+	    for( size_t i=0; i<indices.size(); i++ )
+		dst.push_back( src[indices[i]] );
+	}
+    }
+}
+
+EuclideanClustering::EuclideanClustering()
+    : radius( 0.1 ), minSize( 1 ), maxSize( std::numeric_limits<size_t>::max() ),
+    split( false ), threads( 0 ), clusterCount( 0 )
+{
+}
+
+void EuclideanClustering::serialize(Serialization& so)
+{
+    Operator::serialize(so);
+    so.write( "radius", radius );
+    so.write( "min_size", minSize );
+    so.write( "max_size", maxSize );
+    so.write( "split", split );
+}
+
+void EuclideanClustering::unserialize(Serialization& so)
+{
+    Operator::unserialize(so);
+    if( so.hasKey( "radius" ) )
+	so.read( "radius", radius );
+    if( so.hasKey( "min_size" ) )
+	so.read( "min_size", minSize );
+    if( so.hasKey( "max_size" ) )
+	so.read( "max_size", maxSize );
+    if( so.hasKey( "split" ) )
+	so.read( "split", split );
+}
+
+void EuclideanClustering::addInput( Pointcloud* input )
+{
+    if( env->getInputs(this).size() > 0 )
+        throw std::runtime_error("EuclideanClustering can only have one input.");
+
+    Operator::addInput(input);
+}
+
+void EuclideanClustering::addOutput( Pointcloud* output )
+{
+    Operator::addOutput(output);
+}
+
+size_t EuclideanClustering::computeClusters( const std::vector<Eigen::Vector3d>& points, std::vector<int>& ids )
+{
+    const size_t n = points.size();
+    ids.assign( n, -1 );
+    if( n == 0 )
+	return 0;
+    if( n > std::numeric_limits<index_t>::max() )
+	throw std::runtime_error("EuclideanClustering: too many points.");
+
+    KdTree tree;
+    tree.build( points, threads );
+
+    // sort the points along the longest extent, so that the slabs only
+    // touch their neighbours
+    Eigen::Vector3d min( points[0] ), max( points[0] );
+    for( size_t i=1; i<n; i++ )
+    {
+	min = min.cwiseMin( points[i] );
+	max = max.cwiseMax( points[i] );
+    }
+    int axis;
+    (max - min).maxCoeff( &axis );
+
+    std::vector<index_t> order( n ), rank( n );
+    for( size_t i=0; i<n; i++ )
+	order[i] = i;
+    std::sort( order.begin(), order.end(), AxisLess( points, axis ) );
+    for( size_t i=0; i<n; i++ )
+	rank[order[i]] = i;
+    checkCancelled();
+
+    const size_t slabs = std::max( std::min( getThreadCount( threads ) * 4, n / 1024 ), (size_t)1 );
+    ClusterTask task( tree, order, rank, radius, slabs );
+    parallelFor( slabs, task, threads, 1 );
+    for( size_t s=0; s<slabs; s++ )
+	for( size_t i=0; i<task.borders[s].size(); i++ )
+	    task.unite( task.borders[s][i].first, task.borders[s][i].second );
+    checkCancelled();
+
+    // flatten the forest and count the points of each cluster
+    std::vector<index_t> size( n, 0 );
+    for( size_t p=0; p<n; p++ )
+    {
+	task.parent[p] = task.find( p );
+	size[task.parent[p]]++;
+    }
+
+    std::vector<std::pair<size_t, index_t> > clusters;
+    for( size_t p=0; p<n; p++ )
+	if( task.parent[p] == p && size[p] >= minSize && size[p] <= maxSize )
+	    clusters.push_back( std::make_pair( size[p], p ) );
+    std::sort( clusters.begin(), clusters.end(), ClusterLess() );
+
+    std::vector<int> clusterId( n, -1 );
+    for( size_t c=0; c<clusters.size(); c++ )
+	clusterId[clusters[c].second] = c;
+    for( size_t p=0; p<n; p++ )
+	ids[order[p]] = clusterId[task.parent[p]];
+
+    return clusters.size();
+}
+
+bool EuclideanClustering::updateAll()
+{
+    Pointcloud* pc_in = getInput<Pointcloud*>();
+    std::list<Layer*> layers = env->getOutputs(this);
+    std::vector<Pointcloud*> outputs;
+    for( std::list<Layer*>::iterator it = layers.begin(); it != layers.end(); it++ )
+	if( Pointcloud* pc = dynamic_cast<Pointcloud*>( *it ) )
+	    outputs.push_back( pc );
+    if( !pc_in || outputs.empty() )
+	throw std::runtime_error("EuclideanClustering: needs a Pointcloud input and output.");
+    if( !split && outputs.size() > 1 )
+	throw std::runtime_error("EuclideanClustering: can only have one output, unless split is set.");
+    if( split && std::find( outputs.begin(), outputs.end(), pc_in ) != outputs.end() )
+	throw std::runtime_error("EuclideanClustering: the input can't be an output if split is set.");
+
+    std::vector<int> ids;
+    clusterCount = computeClusters( pc_in->vertices, ids );
+
+    if( !split )
+    {
+	Pointcloud* pc_out = outputs.front();
+	if( pc_in != pc_out )
+	{
+	    std::vector<size_t> all( ids.size() );
+	    for( size_t i=0; i<all.size(); i++ )
+		all[i] = i;
+	    copyPoints( *pc_in, *pc_out, all,
+		    env->relativeTransform( pc_in->getFrameNode(), pc_out->getFrameNode() ) );
+	}
+	pc_out->getVertexData<int>( CLUSTER_ID ) = ids;
+	env->itemModified( pc_out );
+	return true;
+    }
+
+    std::vector<std::vector<size_t> > members( std::min( clusterCount, outputs.size() ) );
+    for( size_t i=0; i<ids.size(); i++ )
+	if( ids[i] >= 0 && static_cast<size_t>( ids[i] ) < members.size() )
+	    members[ids[i]].push_back( i );
+
+    for( size_t o=0; o<outputs.size(); o++ )
+    {
+	copyPoints( *pc_in, *outputs[o], o < members.size() ? members[o] : std::vector<size_t>(),
+		env->relativeTransform( pc_in->getFrameNode(), outputs[o]->getFrameNode() ) );
+	env->itemModified( outputs[o] );
+    }
+
+    return true;
+}
@@ -0,0 +1,80 @@
+#ifndef __ENVIRE_EUCLIDEANCLUSTERING_HPP__
+#define __ENVIRE_EUCLIDEANCLUSTERING_HPP__
+
+#include <envire/Core.hpp>
+#include <envire/maps/Pointcloud.hpp>
+
+namespace envire {
+    /**
+     * Splits a pointcloud into clusters of connected points. Two points are
+     * connected if they are closer than the radius, and a cluster is a
+     * connected component of the points. Clusters with less than minSize or
+     * more than maxSize points are discarded. The remaining clusters are
+     * numbered by size, the largest cluster has the id 0.
+     *
+     * The result is written in one of two ways:
+     *
+     * - by default, the single output receives the points of the input,
+     *   with the cluster id of each point in the CLUSTER_ID vertex data.
+     *   Points of discarded clusters have the id -1. Input and output may be
+     *   the same cloud.
+     * - if split is set, the n-th output receives the points of the cluster
+     *   with the id n, together with their color, normal, variance and
+     *   attribute data. Outputs without a cluster are cleared, and clusters
+     *   without an output are dropped. The input can't be an output.
+     *
+     * The points are sorted into slabs along their longest extent, which are
+     * connected with a union-find over the radius neighbourhoods from a
+     * KdTree in parallel. The links across the slab borders are joined
+     * afterwards.
+     */
+    class EuclideanClustering : public Operator
+    {
+	ENVIRONMENT_ITEM( EuclideanClustering )
+
+    public:
+	/** vertex data with the cluster ids, std::vector<int> */
+	static const std::string CLUSTER_ID;
+
+	EuclideanClustering();
+
+	void serialize(Serialization& so);
+        void unserialize(Serialization& so);
+
+	void addInput( Pointcloud* input );
+	void addOutput( Pointcloud* output );
+
+	bool updateAll();
+
+	/** maximum distance between connected points, default 0.1 */
+	void setRadius( double value ) { radius = value; }
+	double getRadius() const { return radius; }
+	/** minimum number of points in a cluster, default 1 */
+	void setMinSize( size_t value ) { minSize = value; }
+	size_t getMinSize() const { return minSize; }
+	/** maximum number of points in a cluster, default no limit */
+	void setMaxSize( size_t value ) { maxSize = value; }
+	size_t getMaxSize() const { return maxSize; }
+	/** write each cluster into its own output, default false */
+	void setSplit( bool value ) { split = value; }
+	bool getSplit() const { return split; }
+	/** number of threads to use, 0 (default) for one per hardware thread */
+	void setThreads( size_t value ) { threads = value; }
+
+	/** computes the cluster id of each point, -1 for points of discarded
+	 * clusters. @return the number of clusters */
+	size_t computeClusters( const std::vector<Eigen::Vector3d>& points, std::vector<int>& ids );
+
+	/** @return the number of clusters found in the last update */
+	size_t getClusterCount() const { return clusterCount; }
+
+    protected:
+	double radius;
+	size_t minSize;
+	size_t maxSize;
+	bool split;
+	size_t threads;
+	size_t clusterCount;
+    };
+}
+#endif
@@ -26,6 +26,9 @@ bool GridIllumination::updateAll()
 
     for( size_t x = 0; x < grid->getCellSizeX(); x++ )
     {
+	checkCancelled();
+	reportProgress( static_cast<double>( x ) / grid->getCellSizeX() );
+
 	for( size_t y = 0; y < grid->getCellSizeY(); y++ )
 	{
 	    Vector3d cell = grid->fromGrid( x, y );
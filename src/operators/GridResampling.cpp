@@ -0,0 +1,314 @@
+#include "GridResampling.hpp"
+
+#include <envire/tools/ParallelFor.hpp>
+#include <boost/lexical_cast.hpp>
+#include <limits>
+#include <cmath>
+
+using namespace envire;
+
+ENVIRONMENT_ITEM_DEF( GridResampling )
+
+namespace
+{
+    /** converts the double value to the data type of the grid, rounding and
+     * clamping it for integer types */
+    template <class T>
+    T toValue( double v )
+    {
+	if( std::numeric_limits<T>::is_integer )
+	{
+	    v = std::floor( v + 0.5 );
+	    v = std::max( v, (double)std::numeric_limits<T>::min() );
+	    v = std::min( v, (double)std::numeric_limits<T>::max() );
+	}
+	return static_cast<T>( v );
+    }
+
+    template <class T>
+    struct ResampleTask
+    {
+	typedef typename Grid<T>::ArrayType ArrayType;
+
+	const Grid<T>& in;
+	const ArrayType& src;
+	const std::pair<T, bool> noData;
+	const GridBase& out;
+	ArrayType& dst;
+	/** transform from the output to the input frame */
+	const Eigen::Affine3d C_out2in;
+	const GridResampling::Method method;
+	const size_t tileSize;
+	const size_t tilesX;
+	/** number of samples per cell and axis for the aggregation methods */
+	size_t samplesX, samplesY;
+
+	ResampleTask( const Grid<T>& in, const std::string& inBand,
+		Grid<T>& out, const std::string& outBand,
+		const Eigen::Affine3d& C_out2in, GridResampling::Method method, size_t tileSize )
+	    : in( in ), src( in.getGridData( inBand ) ), noData( in.getNoData( inBand ) ),
+	    out( out ), dst( out.getGridData( outBand ) ), C_out2in( C_out2in ),
+	    method( method ), tileSize( tileSize ),
+	    tilesX( (out.getCellSizeX() + tileSize - 1) / tileSize )
+	{
+	    samplesX = std::max( 1.0, std::ceil( out.getScaleX() / in.getScaleX() ) );
+	    samplesY = std::max( 1.0, std::ceil( out.getScaleY() / in.getScaleY() ) );
+	}
+
+	size_t getTileCount() const
+	{
+	    return tilesX * ((out.getCellSizeY() + tileSize - 1) / tileSize);
+	}
+
+	bool isValid( T v ) const
+	{
+	    // NaN is used as no-data value for floating point bands
+	    if( v != v )
+		return false;
+	    return !noData.second || v != noData.first;
+	}
+
+	bool nearest( double x, double y, double& v ) const
+	{
+	    size_t xi, yi;
+	    if( !in.toGrid( x, y, xi, yi ) )
+		return false;
+	    const T value = src[yi][xi];
+	    v = value;
+	    return isValid( value );
+	}
+
+	bool bilinear( double x, double y, double& v ) const
+	{
+	    // position in cell units, relative to the cell centers
+	    const double u = (x - in.getOffsetX()) / in.getScaleX() - 0.5;
+	    const double w = (y - in.getOffsetY()) / in.getScaleY() - 0.5;
+	    const double x0 = std::floor( u ), y0 = std::floor( w );
+	    if( x0 < 0 || y0 < 0 || x0 + 1 >= in.getCellSizeX() || y0 + 1 >= in.getCellSizeY() )
+		return false;
+
+	    const size_t xi = x0, yi = y0;
+	    const T v00 = src[yi][xi], v10 = src[yi][xi+1],
+		  v01 = src[yi+1][xi], v11 = src[yi+1][xi+1];
+	    if( !isValid( v00 ) || !isValid( v10 ) || !isValid( v01 ) || !isValid( v11 ) )
+		return false;
+
+	    const double fx = u - x0, fy = w - y0;
+	    v = (1.0 - fy) * ((1.0 - fx) * v00 + fx * v10)
+		+ fy * ((1.0 - fx) * v01 + fx * v11);
+	    return true;
+	}
+
+	bool aggregate( size_t xi, size_t yi, double& v ) const
+	{
+	    double min = std::numeric_limits<double>::infinity(),
+		   max = -std::numeric_limits<double>::infinity(),
+		   sum = 0;
+	    size_t count = 0;
+
+	    const double x0 = xi * out.getScaleX() + out.getOffsetX(),
+		  y0 = yi * out.getScaleY() + out.getOffsetY();
+	    for( size_t sy=0; sy<samplesY; sy++ )
+	    {
+		for( size_t sx=0; sx<samplesX; sx++ )
+		{
+		    const Eigen::Vector3d p( C_out2in * Eigen::Vector3d(
+				x0 + (sx + 0.5) / samplesX * out.getScaleX(),
+				y0 + (sy + 0.5) / samplesY * out.getScaleY(), 0 ) );
+		    double s;
+		    if( !nearest( p.x(), p.y(), s ) )
+			continue;
+		    min = std::min( min, s );
+		    max = std::max( max, s );
+		    sum += s;
+		    count++;
+		}
+	    }
+
+	    if( !count )
+		return false;
+
+	    if( method == GridResampling::MIN )
+		v = min;
+	    else if( method == GridResampling::MAX )
+		v = max;
+	    else
+		v = sum / count;
+	    return true;
+	}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    for( size_t t=begin; t<end; t++ )
+	    {
+		const size_t tx = (t % tilesX) * tileSize, ty = (t / tilesX) * tileSize;
+		const size_t ex = std::min( tx + tileSize, out.getCellSizeX() ),
+		      ey = std::min( ty + tileSize, out.getCellSizeY() );
+
+		for( size_t yi=ty; yi<ey; yi++ )
+		{
+		    for( size_t xi=tx; xi<ex; xi++ )
+		    {
+			double v = 0;
+			bool valid;
+			if( method == GridResampling::NEAREST || method == GridResampling::BILINEAR )
+			{
+			    double x, y;
+			    out.fromGrid( xi, yi, x, y );
+			    const Eigen::Vector3d p( C_out2in * Eigen::Vector3d( x, y, 0 ) );
+			    valid = method == GridResampling::BILINEAR && bilinear( p.x(), p.y(), v );
+			    if( !valid )
+				valid = nearest( p.x(), p.y(), v );
+			}
+			else
+			    valid = aggregate( xi, yi, v );
+
+			if( valid )
+			    dst[yi][xi] = toValue<T>( v );
+		    }
+		}
+	    }
+	}
+    };
+
+    template <class T>
+    bool resample( BandedGrid* input, BandedGrid* output,
+	    const std::vector<std::pair<std::string, std::string> >& bands,
+	    const Eigen::Affine3d& C_out2in, GridResampling::Method method,
+	    size_t tileSize, size_t threads )
+    {
+	Grid<T>* in = dynamic_cast<Grid<T>*>( input );
+	if( !in )
+	    return false;
+	Grid<T>* out = dynamic_cast<Grid<T>*>( output );
+	if( !out )
+	    throw std::runtime_error("GridResampling: input and output grid need to have the same data type.");
+
+	std::vector<std::pair<std::string, std::string> > todo( bands );
+	if( todo.empty() )
+	{
+	    const std::vector<std::string>& inBands( in->getBands() );
+	    for( size_t i=0; i<inBands.size(); i++ )
+		todo.push_back( std::make_pair( inBands[i], inBands[i] ) );
+	}
+
+	for( size_t i=0; i<todo.size(); i++ )
+	{
+	    const std::string &inBand( todo[i].first ), &outBand( todo[i].second );
+	    if( !in->hasBand( inBand ) )
+	    {
+		if( bands.empty() )
+		    continue;
+		throw std::runtime_error("GridResampling: input grid has no band " + inBand );
+	    }
+
+	    // create the band before the tasks access it concurrently
+	    out->createBand( outBand );
+	    std::pair<T, bool> noData = in->getNoData( inBand );
+	    if( noData.second && !out->getNoData( outBand ).second )
+		out->setNoData( outBand, noData.first );
+
+	    ResampleTask<T> task( *in, inBand, *out, outBand, C_out2in, method, tileSize );
+	    parallelFor( task.getTileCount(), task, threads, 1 );
+	}
+
+	return true;
+    }
+}
+
+GridResampling::GridResampling()
+    : method( NEAREST ), tileSize( 64 ), threads( 0 )
+{
+}
+
+void GridResampling::serialize(Serialization& so)
+{
+    Operator::serialize(so);
+    so.write( "method", static_cast<int>( method ) );
+    so.write( "tile_size", tileSize );
+    so.write( "band_count", bands.size() );
+    for( size_t i=0; i<bands.size(); i++ )
+    {
+	so.write( "in_band_" + boost::lexical_cast<std::string>(i), bands[i].first );
+	so.write( "out_band_" + boost::lexical_cast<std::string>(i), bands[i].second );
+    }
+}
+
+void GridResampling::unserialize(Serialization& so)
+{
+    Operator::unserialize(so);
+    if( so.hasKey( "method" ) )
+    {
+	int methodInt = NEAREST;
+	so.read( "method", methodInt );
+	method = static_cast<Method>( methodInt );
+    }
+    if( so.hasKey( "tile_size" ) )
+	so.read( "tile_size", tileSize );
+
+    bands.clear();
+    if( so.hasKey( "band_count" ) )
+    {
+	size_t count = 0;
+	so.read( "band_count", count );
+	for( size_t i=0; i<count; i++ )
+	{
+	    std::string inBand, outBand;
+	    so.read( "in_band_" + boost::lexical_cast<std::string>(i), inBand );
+	    so.read( "out_band_" + boost::lexical_cast<std::string>(i), outBand );
+	    bands.push_back( std::make_pair( inBand, outBand ) );
+	}
+    }
+}
+
+void GridResampling::addInput( BandedGrid* input )
+{
+    if( env->getInputs(this).size() > 0 )
+        throw std::runtime_error("GridResampling can only have one input.");
+
+    Operator::addInput(input);
+}
+
+void GridResampling::addOutput( BandedGrid* output )
+{
+    if( env->getOutputs(this).size() > 0 )
+        throw std::runtime_error("GridResampling can only have one output.");
+
+    Operator::addOutput(output);
+}
+
+void GridResampling::addBand( const std::string& inBand, const std::string& outBand )
+{
+    bands.push_back( std::make_pair( inBand, outBand.empty() ? inBand : outBand ) );
+}
+
+void GridResampling::clearBands()
+{
+    bands.clear();
+}
+
+bool GridResampling::updateAll()
+{
+    BandedGrid* in = getInput<BandedGrid*>();
+    BandedGrid* out = getOutput<BandedGrid*>();
+    assert( in && out );
+
+    const Eigen::Affine3d C_out2in(
+	    env->relativeTransform( out->getFrameNode(), in->getFrameNode() ) );
+    const size_t ts = std::max( tileSize, (size_t)1 );
+
+    bool done =
+	resample<double>( in, out, bands, C_out2in, method, ts, threads ) ||
+	resample<float>( in, out, bands, C_out2in, method, ts, threads ) ||
+	resample<uint8_t>( in, out, bands, C_out2in, method, ts, threads ) ||
+	resample<int16_t>( in, out, bands, C_out2in, method, ts, threads ) ||
+	resample<uint16_t>( in, out, bands, C_out2in, method, ts, threads ) ||
+	resample<int32_t>( in, out, bands, C_out2in, method, ts, threads ) ||
+	resample<uint32_t>( in, out, bands, C_out2in, method, ts, threads );
+
+    if( !done )
+	throw std::runtime_error("GridResampling: unsupported grid type " + in->getClassName() );
+
+    env->itemModified( out );
+    return true;
+}
@@ -0,0 +1,81 @@
+#ifndef __ENVIRE_GRIDRESAMPLING_HPP__
+#define __ENVIRE_GRIDRESAMPLING_HPP__
+
+#include <envire/Core.hpp>
+#include <envire/maps/Grid.hpp>
+
+namespace envire {
+    /**
+     * Resamples the bands of a Grid<T> onto another grid of the same data
+     * type, which may have a different resolution, extent or FrameNode.
+     *
+     * For each cell of the output, its position is transformed into the
+     * frame of the input using the relative transform between the FrameNodes
+     * of the grids. The value is then computed with one of the following
+     * methods:
+     *
+     * - NEAREST: the value of the input cell that contains the position
+     * - BILINEAR: bilinear interpolation between the four closest input
+     *   cells, falls back to NEAREST at the border and next to no-data cells
+     * - MIN, MAX, MEAN: aggregation over the footprint of the output cell,
+     *   which is sampled at the resolution of the input. This is the right
+     *   choice if the output is coarser than the input.
+     *
+     * Input cells which have the no-data value of their band are ignored.
+     * Output cells which are outside of the input, or for which there are
+     * only no-data cells, are left unchanged, so that several inputs can be
+     * fused into the same output by running one operator per input. The
+     * values themselves are not transformed, i.e. an elevation band keeps the
+     * heights of the input frame.
+     *
+     * The output is processed in tiles, which are distributed over the
+     * available threads. All fundamental types which Grid<T> is instantiated
+     * for are supported.
+     */
+    class GridResampling : public Operator
+    {
+	ENVIRONMENT_ITEM( GridResampling )
+
+    public:
+	enum Method
+	{
+	    NEAREST = 0,
+	    BILINEAR = 1,
+	    MIN = 2,
+	    MAX = 3,
+	    MEAN = 4
+	};
+
+	GridResampling();
+
+	void serialize(Serialization& so);
+        void unserialize(Serialization& so);
+
+	void addInput( BandedGrid* input );
+	void addOutput( BandedGrid* output );
+
+	bool updateAll();
+
+	void setMethod( Method value ) { method = value; }
+	Method getMethod() const { return method; }
+
+	/** resamples the band @a inBand of the input into the band @a outBand
+	 * of the output, which defaults to the same name. If no band is
+	 * given, all bands of the input which have data are resampled into
+	 * bands with the same name. */
+	void addBand( const std::string& inBand, const std::string& outBand = "" );
+	void clearBands();
+
+	/** size of the tiles in output cells, default 64 */
+	void setTileSize( size_t value ) { tileSize = value; }
+	/** number of threads to use, 0 (default) for one per hardware thread */
+	void setThreads( size_t value ) { threads = value; }
+
+    protected:
+	Method method;
+	std::vector<std::pair<std::string, std::string> > bands;
+	size_t tileSize;
+	size_t threads;
+    };
+}
+#endif
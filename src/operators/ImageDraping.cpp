@@ -0,0 +1,441 @@
+#include "ImageDraping.hpp"
+
+#include <envire/maps/Grids.hpp>
+#include <envire/maps/ElevationGrid.hpp>
+#include <envire/maps/MLSGrid.hpp>
+#include <envire/tools/ParallelFor.hpp>
+#include <limits>
+#include <cmath>
+
+using namespace envire;
+
+ENVIRONMENT_ITEM_DEF( ImageDraping )
+
+namespace
+{
+    /** height of the top surface for each cell of a grid, NaN if the cell
+     * is empty */
+    struct Surface
+    {
+	const GridBase& grid;
+	std::vector<double> heights;
+	/** heights at the corners of the cells, which are the mean of the
+	 * adjacent cells, (width+1) * (height+1) values */
+	std::vector<double> corners;
+
+	explicit Surface( const GridBase& grid )
+	    : grid( grid ),
+	    heights( grid.getCellSizeX() * grid.getCellSizeY(), std::numeric_limits<double>::quiet_NaN() ) {}
+
+	double getHeight( int xi, int yi ) const
+	{
+	    if( xi < 0 || yi < 0 || xi >= (int)grid.getCellSizeX() || yi >= (int)grid.getCellSizeY() )
+		return std::numeric_limits<double>::quiet_NaN();
+	    return heights[yi * grid.getCellSizeX() + xi];
+	}
+
+	void computeCorners()
+	{
+	    const size_t w = grid.getCellSizeX() + 1, h = grid.getCellSizeY() + 1;
+	    corners.resize( w * h );
+	    for( size_t yi=0; yi<h; yi++ )
+	    {
+		for( size_t xi=0; xi<w; xi++ )
+		{
+		    double sum = 0;
+		    size_t count = 0;
+		    for( int dy=-1; dy<=0; dy++ )
+			for( int dx=-1; dx<=0; dx++ )
+			{
+			    const double v = getHeight( xi + dx, yi + dy );
+			    if( v == v )
+			    {
+				sum += v;
+				count++;
+			    }
+			}
+		    corners[yi * w + xi] = count ? sum / count : 0.0;
+		}
+	    }
+	}
+    };
+
+    /** a grid cell projected into the image */
+    struct Quad
+    {
+	size_t cell;
+	/** corners in image coordinates, with the inverse depth as third
+	 * coordinate */
+	Eigen::Vector3d p[4];
+	int minU, maxU, minV, maxV;
+	bool valid;
+
+	Quad() : valid( false ) {}
+    };
+
+    struct ProjectTask
+    {
+	const Surface& surface;
+	const Eigen::Affine3d C_map2cam;
+	const ImageDraping::CameraModel& camera;
+	const double minDepth;
+	const int width, height;
+	std::vector<Quad>& quads;
+
+	ProjectTask( const Surface& surface, const Eigen::Affine3d& C_map2cam,
+		const ImageDraping::CameraModel& camera, double minDepth,
+		int width, int height, std::vector<Quad>& quads )
+	    : surface( surface ), C_map2cam( C_map2cam ), camera( camera ),
+	    minDepth( minDepth ), width( width ), height( height ), quads( quads ) {}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    const GridBase& grid( surface.grid );
+	    const size_t cw = grid.getCellSizeX() + 1;
+	    static const int offsets[4][2] = { {0,0}, {1,0}, {1,1}, {0,1} };
+
+	    for( size_t i=begin; i<end; i++ )
+	    {
+		Quad &q( quads[i] );
+		q.valid = false;
+		if( !(surface.heights[i] == surface.heights[i]) )
+		    continue;
+
+		const size_t xi = i % grid.getCellSizeX(), yi = i / grid.getCellSizeX();
+		double minU = std::numeric_limits<double>::infinity(), maxU = -minU,
+		       minV = minU, maxV = -minU;
+		bool visible = true;
+		for( int c=0; c<4 && visible; c++ )
+		{
+		    const size_t cx = xi + offsets[c][0], cy = yi + offsets[c][1];
+		    const Eigen::Vector3d p( C_map2cam * Eigen::Vector3d(
+				cx * grid.getScaleX() + grid.getOffsetX(),
+				cy * grid.getScaleY() + grid.getOffsetY(),
+				surface.corners[cy * cw + cx] ) );
+		    if( !(p.z() >= minDepth) )
+		    {
+			visible = false;
+			break;
+		    }
+		    const double u = camera.fx * p.x() / p.z() + camera.cx;
+		    const double v = camera.fy * p.y() / p.z() + camera.cy;
+		    q.p[c] = Eigen::Vector3d( u, v, 1.0 / p.z() );
+		    minU = std::min( minU, u ); maxU = std::max( maxU, u );
+		    minV = std::min( minV, v ); maxV = std::max( maxV, v );
+		}
+		if( !visible )
+		    continue;
+
+		// pixel centers are at integer coordinates. The bounds are
+		// clamped to the image before they are converted, as the corners
+		// can be far outside of it.
+		const double u0 = std::max( 0.0, std::ceil( minU ) ),
+		      u1 = std::min( width - 1.0, std::floor( maxU ) ),
+		      v0 = std::max( 0.0, std::ceil( minV ) ),
+		      v1 = std::min( height - 1.0, std::floor( maxV ) );
+		if( !(u0 <= u1 && v0 <= v1) )
+		    continue;
+		q.minU = u0;
+		q.maxU = u1;
+		q.minV = v0;
+		q.maxV = v1;
+		q.cell = i;
+		q.valid = true;
+	    }
+	}
+    };
+
+    struct RasterTask
+    {
+	const std::vector<Quad>& quads;
+	const std::vector<std::vector<size_t> >& bins;
+	const int width, height, tileSize, tilesX;
+	std::vector<double>& depth;
+	std::vector<int>& cells;
+
+	RasterTask( const std::vector<Quad>& quads, const std::vector<std::vector<size_t> >& bins,
+		int width, int height, int tileSize, int tilesX,
+		std::vector<double>& depth, std::vector<int>& cells )
+	    : quads( quads ), bins( bins ), width( width ), height( height ),
+	    tileSize( tileSize ), tilesX( tilesX ), depth( depth ), cells( cells ) {}
+
+	static double edge( const Eigen::Vector3d& a, const Eigen::Vector3d& b, double u, double v )
+	{
+	    return (b.x() - a.x()) * (v - a.y()) - (b.y() - a.y()) * (u - a.x());
+	}
+
+	void drawTriangle( const Eigen::Vector3d& a, const Eigen::Vector3d& b, const Eigen::Vector3d& c,
+		int cell, int u0, int u1, int v0, int v1 )
+	{
+	    const double area = edge( a, b, c.x(), c.y() );
+	    if( std::fabs( area ) < 1e-12 )
+		return;
+
+	    for( int v=v0; v<=v1; v++ )
+	    {
+		for( int u=u0; u<=u1; u++ )
+		{
+		    // barycentric coordinates, independent of the orientation
+		    const double w0 = edge( b, c, u, v ) / area;
+		    const double w1 = edge( c, a, u, v ) / area;
+		    const double w2 = 1.0 - w0 - w1;
+		    if( w0 < 0 || w1 < 0 || w2 < 0 )
+			continue;
+
+		    // the inverse depth is linear in image space
+		    const double invz = w0 * a.z() + w1 * b.z() + w2 * c.z();
+		    const size_t idx = v * width + u;
+		    if( invz > depth[idx] )
+		    {
+			depth[idx] = invz;
+			cells[idx] = cell;
+		    }
+		}
+	    }
+	}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    for( size_t t=begin; t<end; t++ )
+	    {
+		const int tu = (t % tilesX) * tileSize, tv = (t / tilesX) * tileSize;
+		const int eu = std::min( tu + tileSize, width ) - 1,
+		      ev = std::min( tv + tileSize, height ) - 1;
+
+		const std::vector<size_t>& bin( bins[t] );
+		for( size_t i=0; i<bin.size(); i++ )
+		{
+		    const Quad &q( quads[bin[i]] );
+		    const int u0 = std::max( tu, q.minU ), u1 = std::min( eu, q.maxU ),
+			  v0 = std::max( tv, q.minV ), v1 = std::min( ev, q.maxV );
+		    drawTriangle( q.p[0], q.p[1], q.p[2], q.cell, u0, u1, v0, v1 );
+		    drawTriangle( q.p[0], q.p[2], q.p[3], q.cell, u0, u1, v0, v1 );
+		}
+	    }
+	}
+    };
+
+    SurfacePatch* getTopPatch( MLSGrid& mls, size_t xi, size_t yi )
+    {
+	SurfacePatch* top = NULL;
+	for( MLSGrid::iterator it = mls.beginCell( xi, yi ); it != mls.endCell(); it++ )
+	{
+	    if( !it->isNegative() && (!top || it->mean > top->mean) )
+		top = &(*it);
+	}
+	return top;
+    }
+
+    uint8_t blend( uint8_t old, double value, double weight )
+    {
+	const double v = (1.0 - weight) * old + weight * value;
+	return std::max( 0.0, std::min( 255.0, std::floor( v + 0.5 ) ) );
+    }
+}
+
+ImageDraping::ImageDraping()
+    : blendWeight( 1.0 ), minDepth( 0.1 ), tileSize( 32 ), threads( 0 )
+{
+}
+
+void ImageDraping::serialize(Serialization& so)
+{
+    Operator::serialize(so);
+    so.write( "fx", camera.fx );
+    so.write( "fy", camera.fy );
+    so.write( "cx", camera.cx );
+    so.write( "cy", camera.cy );
+    so.write( "blend_weight", blendWeight );
+    so.write( "min_depth", minDepth );
+    so.write( "tile_size", tileSize );
+}
+
+void ImageDraping::unserialize(Serialization& so)
+{
+    Operator::unserialize(so);
+    if( so.hasKey( "fx" ) )
+    {
+	so.read( "fx", camera.fx );
+	so.read( "fy", camera.fy );
+	so.read( "cx", camera.cx );
+	so.read( "cy", camera.cy );
+    }
+    if( so.hasKey( "blend_weight" ) )
+	so.read( "blend_weight", blendWeight );
+    if( so.hasKey( "min_depth" ) )
+	so.read( "min_depth", minDepth );
+    if( so.hasKey( "tile_size" ) )
+	so.read( "tile_size", tileSize );
+}
+
+void ImageDraping::addInput( ImageRGB24* image )
+{
+    Operator::addInput(image);
+}
+
+void ImageDraping::addInput( ElevationGrid* surface )
+{
+    Operator::addInput(surface);
+}
+
+void ImageDraping::addOutput( MLSGrid* mls )
+{
+    if( env->getOutputs(this).size() > 0 )
+        throw std::runtime_error("ImageDraping can only have one output.");
+
+    Operator::addOutput(mls);
+}
+
+void ImageDraping::addOutput( ImageRGB24* texture )
+{
+    if( env->getOutputs(this).size() > 0 )
+        throw std::runtime_error("ImageDraping can only have one output.");
+
+    Operator::addOutput(texture);
+}
+
+bool ImageDraping::updateAll()
+{
+    ImageRGB24* image = NULL;
+    ElevationGrid* elevation = NULL;
+    std::list<Layer*> inputs = env->getInputs(this);
+    for( std::list<Layer*>::iterator it = inputs.begin(); it != inputs.end(); it++ )
+    {
+	if( dynamic_cast<ImageRGB24*>( *it ) )
+	    image = dynamic_cast<ImageRGB24*>( *it );
+	else if( dynamic_cast<ElevationGrid*>( *it ) )
+	    elevation = dynamic_cast<ElevationGrid*>( *it );
+    }
+    if( !image )
+	throw std::runtime_error("ImageDraping: no input image.");
+
+    MLSGrid* mls = NULL;
+    ImageRGB24* texture = NULL;
+    std::list<Layer*> outputs = env->getOutputs(this);
+    if( !outputs.empty() )
+    {
+	mls = dynamic_cast<MLSGrid*>( outputs.front() );
+	texture = dynamic_cast<ImageRGB24*>( outputs.front() );
+    }
+
+    GridBase* map = NULL;
+    if( mls )
+	map = mls;
+    else if( texture && elevation )
+    {
+	// the texture is written by cell index, so both grids have to cover
+	// the same area
+	if( texture->getCellSizeX() != elevation->getCellSizeX() || texture->getCellSizeY() != elevation->getCellSizeY()
+		|| texture->getScaleX() != elevation->getScaleX() || texture->getScaleY() != elevation->getScaleY()
+		|| texture->getOffsetX() != elevation->getOffsetX() || texture->getOffsetY() != elevation->getOffsetY() )
+	    throw std::runtime_error("ImageDraping: the texture needs to have the same size, scale and offset as the elevation grid.");
+	const Eigen::Affine3d C_tex2map( env->relativeTransform( texture->getFrameNode(), elevation->getFrameNode() ) );
+	if( !C_tex2map.matrix().isIdentity( 1e-9 ) )
+	    throw std::runtime_error("ImageDraping: the texture needs to be in the same frame as the elevation grid.");
+	map = elevation;
+    }
+    else
+	throw std::runtime_error("ImageDraping: needs either an MLSGrid output, or an ElevationGrid input and an ImageRGB24 output.");
+
+    // get the top surface of the map
+    Surface surface( *map );
+    if( mls )
+    {
+	for( size_t yi=0; yi<mls->getCellSizeY(); yi++ )
+	    for( size_t xi=0; xi<mls->getCellSizeX(); xi++ )
+	    {
+		SurfacePatch* top = getTopPatch( *mls, xi, yi );
+		if( top )
+		    surface.heights[yi * mls->getCellSizeX() + xi] = top->mean;
+	    }
+    }
+    else
+    {
+	const ElevationGrid::ArrayType& data( elevation->getGridData( ElevationGrid::ELEVATION ) );
+	const std::pair<double, bool> noData( elevation->getNoData( ElevationGrid::ELEVATION ) );
+	for( size_t yi=0; yi<elevation->getCellSizeY(); yi++ )
+	    for( size_t xi=0; xi<elevation->getCellSizeX(); xi++ )
+		if( !noData.second || data[yi][xi] != noData.first )
+		    surface.heights[yi * elevation->getCellSizeX() + xi] = data[yi][xi];
+    }
+    surface.computeCorners();
+
+    // project the cells into the image
+    const int width = image->getCellSizeX(), height = image->getCellSizeY();
+    const Eigen::Affine3d C_map2cam( env->relativeTransform( map->getFrameNode(), image->getFrameNode() ) );
+    std::vector<Quad> quads( surface.heights.size() );
+    ProjectTask project( surface, C_map2cam, camera, minDepth, width, height, quads );
+    parallelFor( quads.size(), project, threads );
+
+    // sort the quads into the image tiles they overlap
+    const int ts = std::max( tileSize, (size_t)1 );
+    const int tilesX = (width + ts - 1) / ts, tilesY = (height + ts - 1) / ts;
+    std::vector<std::vector<size_t> > bins( tilesX * tilesY );
+    for( size_t i=0; i<quads.size(); i++ )
+    {
+	const Quad &q( quads[i] );
+	if( !q.valid )
+	    continue;
+	for( int ty = q.minV / ts; ty <= q.maxV / ts; ty++ )
+	    for( int tx = q.minU / ts; tx <= q.maxU / ts; tx++ )
+		bins[ty * tilesX + tx].push_back( i );
+    }
+
+    // the tiles are disjoint, so they can write to the buffers concurrently
+    std::vector<double> depth( width * height, 0.0 );
+    std::vector<int> cells( width * height, -1 );
+    RasterTask raster( quads, bins, width, height, ts, tilesX, depth, cells );
+    parallelFor( bins.size(), raster, threads, 1 );
+
+    // average the colour of the pixels for each visible cell
+    const ImageRGB24& cimage( *image );
+    const ImageRGB24::ArrayType &r( cimage.getGridData( ImageRGB24::R ) ),
+	  &g( cimage.getGridData( ImageRGB24::G ) ),
+	  &b( cimage.getGridData( ImageRGB24::B ) );
+    std::vector<Eigen::Vector3d> colors( quads.size(), Eigen::Vector3d::Zero() );
+    std::vector<size_t> counts( quads.size(), 0 );
+    for( int v=0; v<height; v++ )
+	for( int u=0; u<width; u++ )
+	{
+	    const int cell = cells[v * width + u];
+	    if( cell < 0 )
+		continue;
+	    colors[cell] += Eigen::Vector3d( r[v][u], g[v][u], b[v][u] );
+	    counts[cell]++;
+	}
+
+    const size_t cw = map->getCellSizeX();
+    if( mls )
+    {
+	mls->setHasCellColor( true );
+	for( size_t i=0; i<counts.size(); i++ )
+	{
+	    if( !counts[i] )
+		continue;
+	    SurfacePatch* top = getTopPatch( *mls, i % cw, i / cw );
+	    const Eigen::Vector3d c( colors[i] / counts[i] );
+	    for( int k=0; k<3; k++ )
+		top->color[k] = blend( top->color[k], c[k], blendWeight );
+	}
+	env->itemModified( mls );
+    }
+    else
+    {
+	ImageRGB24::ArrayType &tr( texture->getGridData( ImageRGB24::R ) ),
+	    &tg( texture->getGridData( ImageRGB24::G ) ),
+	    &tb( texture->getGridData( ImageRGB24::B ) );
+	for( size_t i=0; i<counts.size(); i++ )
+	{
+	    if( !counts[i] )
+		continue;
+	    const size_t xi = i % cw, yi = i / cw;
+	    const Eigen::Vector3d c( colors[i] / counts[i] );
+	    tr[yi][xi] = blend( tr[yi][xi], c[0], blendWeight );
+	    tg[yi][xi] = blend( tg[yi][xi], c[1], blendWeight );
+	    tb[yi][xi] = blend( tb[yi][xi], c[2], blendWeight );
+	}
+	env->itemModified( texture );
+    }
+
+    return true;
+}
@@ -0,0 +1,86 @@
+#ifndef __ENVIRE_IMAGEDRAPING_HPP__
+#define __ENVIRE_IMAGEDRAPING_HPP__
+
+#include <envire/Core.hpp>
+
+namespace envire {
+    class ImageRGB24;
+    class ElevationGrid;
+    class MLSGrid;
+
+    /**
+     * Drapes a camera image onto the top surface of an MLSGrid or an
+     * ElevationGrid.
+     *
+     * The input is an ImageRGB24, which is attached to the FrameNode of the
+     * camera. The camera follows the usual convention with z pointing
+     * forward, x to the right and y down, and the image is indexed with
+     * getGridData()[row][column].
+     *
+     * The top surface of the map is rasterized into a depth buffer of the
+     * size of the image. Each grid cell is rendered as a quad, with the
+     * corner heights averaged over the neighbouring cells, so that occluded
+     * cells don't receive any colour. The image is split into tiles, which
+     * are rasterized in parallel. The colour of each visible cell is the
+     * mean of the pixels it covers, which is blended into the existing
+     * colour with the blend weight.
+     *
+     * Two configurations are supported:
+     * - an MLSGrid as output, for which the colour of the top patch of each
+     *   visible cell is updated.
+     * - an ElevationGrid as additional input and an ImageRGB24 with the same
+     *   cells, scale, offset and frame as output, for which the r, g and b
+     *   bands are updated.
+     *
+     * Cells with a corner behind the near plane of the camera are not drawn.
+     */
+    class ImageDraping : public Operator
+    {
+	ENVIRONMENT_ITEM( ImageDraping )
+
+    public:
+	/** intrinsic parameters of a pinhole camera, in pixels */
+	struct CameraModel
+	{
+	    double fx, fy, cx, cy;
+
+	    CameraModel() : fx( 1.0 ), fy( 1.0 ), cx( 0 ), cy( 0 ) {}
+	    CameraModel( double fx, double fy, double cx, double cy )
+		: fx( fx ), fy( fy ), cx( cx ), cy( cy ) {}
+	};
+
+	ImageDraping();
+
+	void serialize(Serialization& so);
+        void unserialize(Serialization& so);
+
+	/** the camera image, attached to the frame of the camera */
+	void addInput( ImageRGB24* image );
+	/** the surface to drape the image on, if the output is an ImageRGB24 */
+	void addInput( ElevationGrid* surface );
+	void addOutput( MLSGrid* mls );
+	void addOutput( ImageRGB24* texture );
+
+	bool updateAll();
+
+	void setCameraModel( const CameraModel& value ) { camera = value; }
+	const CameraModel& getCameraModel() const { return camera; }
+
+	/** weight of the new colour, 1.0 (default) replaces the existing colour */
+	void setBlendWeight( double value ) { blendWeight = value; }
+	/** distance of the near plane to the camera, default 0.1 */
+	void setMinDepth( double value ) { minDepth = value; }
+	/** size of the image tiles in pixels, default 32 */
+	void setTileSize( size_t value ) { tileSize = value; }
+	/** number of threads to use, 0 (default) for one per hardware thread */
+	void setThreads( size_t value ) { threads = value; }
+
+    protected:
+	CameraModel camera;
+	double blendWeight;
+	double minDepth;
+	size_t tileSize;
+	size_t threads;
+    };
+}
+#endif
@@ -0,0 +1,289 @@
+#include "MLSChangeDetection.hpp"
+
+#include <envire/maps/MLSGrid.hpp>
+#include <envire/maps/Pointcloud.hpp>
+#include <envire/tools/ParallelFor.hpp>
+#include <boost/math/special_functions/erf.hpp>
+#include <limits>
+#include <cmath>
+
+using namespace envire;
+
+ENVIRONMENT_ITEM_DEF( MLSChangeDetection )
+
+namespace
+{
+    /** a patch of one of the inputs in the frame of the output grid */
+    struct Patch
+    {
+	Eigen::Vector3d position;
+	double bottom;
+	double var;
+    };
+
+    /** probability that a difference of d is not caused by noise with the
+     * variance var. Without any noise, every difference is a change. */
+    double changeProbability( double d, double var )
+    {
+	if( var <= 0 )
+	    return d > 0 ? 1.0 : 0.0;
+	return boost::math::erf( d / std::sqrt( 2.0 * var ) );
+    }
+
+    double changeProbability( const Patch& a, const Patch& b )
+    {
+	double d = 0;
+	if( a.bottom > b.position.z() )
+	    d = a.bottom - b.position.z();
+	else if( b.bottom > a.position.z() )
+	    d = b.bottom - a.position.z();
+	return changeProbability( d, a.var + b.var );
+    }
+
+    typedef std::vector<std::pair<Eigen::Vector3d, double> > ChangedPatches;
+
+    struct ChangeTask
+    {
+	const MLSGrid* mls[2];
+	/** transforms between the output grid and the inputs */
+	Eigen::Affine3d C_out2mls[2], C_mls2out[2];
+	const GridBase& out;
+	Grid<float>::ArrayType& dst;
+	const double minVar;
+	const double threshold;
+	const size_t tileSize;
+	const size_t tilesX;
+	/** the changed patches for each tile, NULL if not required */
+	std::vector<ChangedPatches>* changed;
+
+	ChangeTask( Grid<float>& out, const std::string& band,
+		double minStdev, double threshold, size_t tileSize )
+	    : out( out ), dst( out.getGridData( band ) ),
+	    minVar( minStdev * minStdev ), threshold( threshold ),
+	    tileSize( tileSize ),
+	    tilesX( (out.getCellSizeX() + tileSize - 1) / tileSize ),
+	    changed( NULL )
+	{
+	}
+
+	size_t getTileCount() const
+	{
+	    return tilesX * ((out.getCellSizeY() + tileSize - 1) / tileSize);
+	}
+
+	void getPatches( size_t i, double x, double y, std::vector<Patch>& patches ) const
+	{
+	    patches.clear();
+
+	    const Eigen::Vector3d p( C_out2mls[i] * Eigen::Vector3d( x, y, 0 ) );
+	    size_t xi, yi;
+	    if( !mls[i]->toGrid( p.x(), p.y(), xi, yi ) )
+		return;
+	    double cx, cy;
+	    mls[i]->fromGrid( xi, yi, cx, cy );
+
+	    for( MLSGrid::const_iterator it = mls[i]->beginCell( xi, yi ); it != mls[i]->endCell(); it++ )
+	    {
+		if( it->isNegative() )
+		    continue;
+
+		Patch patch;
+		patch.position = C_mls2out[i] * Eigen::Vector3d( cx, cy, it->mean );
+		patch.bottom = it->isHorizontal() ?
+		    patch.position.z() : patch.position.z() - it->height;
+		patch.var = it->stdev * it->stdev + minVar;
+		patches.push_back( patch );
+	    }
+	}
+
+	static size_t getTop( const std::vector<Patch>& patches )
+	{
+	    size_t top = 0;
+	    for( size_t i=1; i<patches.size(); i++ )
+		if( patches[i].position.z() > patches[top].position.z() )
+		    top = i;
+	    return top;
+	}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    std::vector<Patch> patches[2];
+
+	    for( size_t t=begin; t<end; t++ )
+	    {
+		const size_t tx = (t % tilesX) * tileSize, ty = (t / tilesX) * tileSize;
+		const size_t ex = std::min( tx + tileSize, out.getCellSizeX() ),
+		      ey = std::min( ty + tileSize, out.getCellSizeY() );
+
+		for( size_t yi=ty; yi<ey; yi++ )
+		{
+		    for( size_t xi=tx; xi<ex; xi++ )
+		    {
+			double x, y;
+			out.fromGrid( xi, yi, x, y );
+			getPatches( 0, x, y, patches[0] );
+			getPatches( 1, x, y, patches[1] );
+
+			if( patches[0].empty() || patches[1].empty() )
+			{
+			    dst[yi][xi] = std::numeric_limits<float>::quiet_NaN();
+			    continue;
+			}
+
+			// top surface
+			const Patch &top0( patches[0][getTop( patches[0] )] ),
+			      &top1( patches[1][getTop( patches[1] )] );
+			double cellProb = changeProbability(
+				std::abs( top0.position.z() - top1.position.z() ),
+				top0.var + top1.var );
+
+			// individual patches against the closest patch of the
+			// other input
+			for( size_t s=0; s<2; s++ )
+			{
+			    const std::vector<Patch> &own( patches[s] ), &other( patches[1-s] );
+			    for( size_t i=0; i<own.size(); i++ )
+			    {
+				double prob = 1.0;
+				for( size_t j=0; j<other.size(); j++ )
+				    prob = std::min( prob, changeProbability( own[i], other[j] ) );
+				cellProb = std::max( cellProb, prob );
+
+				if( !changed || prob < threshold )
+				    continue;
+
+				// input cells can be seen by several output cells,
+				// only report the patch for the one containing it
+				size_t pxi, pyi;
+				if( out.toGrid( own[i].position.x(), own[i].position.y(), pxi, pyi )
+					&& pxi == xi && pyi == yi )
+				    (*changed)[t].push_back( std::make_pair(
+						own[i].position, own[i].var - minVar ) );
+			    }
+			}
+
+			dst[yi][xi] = cellProb;
+		    }
+		}
+	    }
+	}
+    };
+}
+
+MLSChangeDetection::MLSChangeDetection()
+    : band( Grid<float>::GRID_DATA ), threshold( 0.95 ), minStdev( 0.02 ),
+    tileSize( 64 ), threads( 0 )
+{
+}
+
+void MLSChangeDetection::serialize(Serialization& so)
+{
+    Operator::serialize(so);
+    so.write( "band", band );
+    so.write( "threshold", threshold );
+    so.write( "min_stdev", minStdev );
+    so.write( "tile_size", tileSize );
+}
+
+void MLSChangeDetection::unserialize(Serialization& so)
+{
+    Operator::unserialize(so);
+    if( so.hasKey( "band" ) )
+	so.read( "band", band );
+    if( so.hasKey( "threshold" ) )
+	so.read( "threshold", threshold );
+    if( so.hasKey( "min_stdev" ) )
+	so.read( "min_stdev", minStdev );
+    if( so.hasKey( "tile_size" ) )
+	so.read( "tile_size", tileSize );
+}
+
+void MLSChangeDetection::addInput( MLSGrid* mls )
+{
+    if( env->getInputs(this).size() > 1 )
+        throw std::runtime_error("MLSChangeDetection can only have two inputs.");
+
+    Operator::addInput(mls);
+}
+
+void MLSChangeDetection::addOutput( Grid<float>* change )
+{
+    std::list<Layer*> outputs = env->getOutputs(this);
+    for( std::list<Layer*>::iterator it = outputs.begin(); it != outputs.end(); it++ )
+	if( dynamic_cast<Grid<float>*>( *it ) )
+	    throw std::runtime_error("MLSChangeDetection can only have one grid output.");
+
+    Operator::addOutput(change);
+}
+
+void MLSChangeDetection::addOutput( Pointcloud* changed )
+{
+    std::list<Layer*> outputs = env->getOutputs(this);
+    for( std::list<Layer*>::iterator it = outputs.begin(); it != outputs.end(); it++ )
+	if( dynamic_cast<Pointcloud*>( *it ) )
+	    throw std::runtime_error("MLSChangeDetection can only have one pointcloud output.");
+
+    Operator::addOutput(changed);
+}
+
+bool MLSChangeDetection::updateAll()
+{
+    std::vector<MLSGrid*> inputs;
+    std::list<Layer*> layers = env->getInputs(this);
+    for( std::list<Layer*>::iterator it = layers.begin(); it != layers.end(); it++ )
+	if( MLSGrid* mls = dynamic_cast<MLSGrid*>( *it ) )
+	    inputs.push_back( mls );
+    if( inputs.size() != 2 )
+	throw std::runtime_error("MLSChangeDetection: needs two MLSGrid inputs.");
+
+    Grid<float>* change = NULL;
+    Pointcloud* pc = NULL;
+    layers = env->getOutputs(this);
+    for( std::list<Layer*>::iterator it = layers.begin(); it != layers.end(); it++ )
+    {
+	if( !change )
+	    change = dynamic_cast<Grid<float>*>( *it );
+	if( !pc )
+	    pc = dynamic_cast<Pointcloud*>( *it );
+    }
+    if( !change )
+	throw std::runtime_error("MLSChangeDetection: needs a Grid<float> output.");
+
+    ChangeTask task( *change, band, minStdev, threshold, std::max( tileSize, (size_t)1 ) );
+    for( size_t i=0; i<2; i++ )
+    {
+	task.mls[i] = inputs[i];
+	task.C_out2mls[i] = env->relativeTransform( change->getFrameNode(), inputs[i]->getFrameNode() );
+	task.C_mls2out[i] = task.C_out2mls[i].inverse();
+    }
+
+    std::vector<ChangedPatches> changed;
+    if( pc )
+    {
+	changed.resize( task.getTileCount() );
+	task.changed = &changed;
+    }
+
+    parallelFor( task.getTileCount(), task, threads, 1 );
+
+    if( pc )
+    {
+	const Eigen::Affine3d C_out2pc(
+		env->relativeTransform( change->getFrameNode(), pc->getFrameNode() ) );
+
+	pc->clear();
+	std::vector<double>& variance( pc->getVertexData<double>( Pointcloud::VERTEX_VARIANCE ) );
+	for( size_t t=0; t<changed.size(); t++ )
+	{
+	    for( size_t i=0; i<changed[t].size(); i++ )
+	    {
+		pc->vertices.push_back( C_out2pc * changed[t][i].first );
+		variance.push_back( changed[t][i].second );
+	    }
+	}
+	env->itemModified( pc );
+    }
+
+    env->itemModified( change );
+    return true;
+}
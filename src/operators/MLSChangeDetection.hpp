@@ -0,0 +1,87 @@
+#ifndef __ENVIRE_MLSCHANGEDETECTION_HPP__
+#define __ENVIRE_MLSCHANGEDETECTION_HPP__
+
+#include <envire/Core.hpp>
+#include <envire/maps/Grid.hpp>
+
+namespace envire {
+    class MLSGrid;
+    class Pointcloud;
+
+    /**
+     * Detects changes between two MLSGrids of the same area.
+     *
+     * The operator takes exactly two MLSGrids as input, which are aligned
+     * through their FrameNodes, so that they can have different resolutions
+     * and positions. The cells of the Grid<float> output define the area
+     * which is compared. For each of its cells, the patches of the
+     * corresponding cells in both inputs are compared:
+     *
+     * - each patch is matched against the closest patch of the other map,
+     *   and the distance is weighted by the combined standard deviation of
+     *   the two patches. Vertical patches are treated as blocks, which match
+     *   any patch inside their vertical extent. The change probability of a
+     *   patch is erf(d / sqrt(2)) for a weighted distance d, which is the
+     *   probability that the difference is not explained by the noise of the
+     *   two patches.
+     * - the top patches of both cells are compared in the same way.
+     *
+     * The change probability of the cell is the maximum of the values of the
+     * top patches and all individual patches. Cells which are empty in either
+     * of the inputs can't be compared and are set to NaN.
+     *
+     * Negative patches are ignored. A minimum standard deviation is added to
+     * the one of the patches, so that tiny differences between very certain
+     * patches are not reported as changes.
+     *
+     * If a Pointcloud output is given, it receives the position of all
+     * patches (from both inputs) with a change probability above the
+     * threshold, with the variance of the patch in the VERTEX_VARIANCE data.
+     *
+     * The output grid is processed in tiles, which are distributed over
+     * multiple threads.
+     */
+    class MLSChangeDetection : public Operator
+    {
+	ENVIRONMENT_ITEM( MLSChangeDetection )
+
+    public:
+	MLSChangeDetection();
+
+	void serialize(Serialization& so);
+        void unserialize(Serialization& so);
+
+	void addInput( MLSGrid* mls );
+	/** the change probability, in the range [0, 1] */
+	void addOutput( Grid<float>* change );
+	/** the changed patches */
+	void addOutput( Pointcloud* changed );
+
+	bool updateAll();
+
+	/** band of the Grid<float> output, default Grid<float>::GRID_DATA */
+	void setBand( const std::string& value ) { band = value; }
+	const std::string& getBand() const { return band; }
+	/** minimum change probability of a patch to be added to the
+	 * Pointcloud output, default 0.95 */
+	void setThreshold( double value ) { threshold = value; }
+	double getThreshold() const { return threshold; }
+	/** added in quadrature to the standard deviation of the patches,
+	 * so that the variance is stdev^2 + minStdev^2, default 0.02. If
+	 * both are 0, any difference between the patches is a change. */
+	void setMinStdev( double value ) { minStdev = value; }
+	double getMinStdev() const { return minStdev; }
+	/** size of the tiles in cells, default 64 */
+	void setTileSize( size_t value ) { tileSize = value; }
+	/** number of threads to use, 0 (default) for one per hardware thread */
+	void setThreads( size_t value ) { threads = value; }
+
+    protected:
+	std::string band;
+	double threshold;
+	double minStdev;
+	size_t tileSize;
+	size_t threads;
+    };
+}
+#endif
@@ -3,6 +3,7 @@
 #include <Eigen/LU>
 
 #include <envire/tools/BresenhamLine.hpp>
+#include <envire/core/LieUncertainty.hpp>
 
 using namespace envire;
 
@@ -70,6 +71,9 @@ void MLSProjection::projectPointcloudWithUncertainty( envire::MultiLevelSurfaceG
     projectPointcloud( t_grid.get(), pc );
 
     Eigen::Affine3d C_g2m( C_m2g.getTransform().inverse( Eigen::Isometry ) );
+    // the uncertainty is propagated for every patch, which is cheaper in
+    // the tangent space representation
+    const TransformWithLieUncertainty C_m2g_lie( C_m2g );
 
     // get the origin of the poincloud as a map cell
     Eigen::Vector3d origin_m = C_m2g.getTransform() * pc->getSensorOrigin().translation();
@@ -105,7 +109,7 @@ void MLSProjection::projectPointcloudWithUncertainty( envire::MultiLevelSurfaceG
 
 		// use the cells stdev for the point, this is not quite exact, but should do 
 		const double p_var = cit->stdev * cit->stdev;
-		PointWithUncertainty p = C_m2g * PointWithUncertainty( cellcenter, Eigen::Matrix3d::Zero() );
+		PointWithUncertainty p = C_m2g_lie * PointWithUncertainty( cellcenter, Eigen::Matrix3d::Zero() );
 
 		// write the transformed uncertainty back
 		cit->stdev = sqrt(p_var + p.getCovariance()(2,2));
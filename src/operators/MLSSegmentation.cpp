@@ -0,0 +1,354 @@
+#include "MLSSegmentation.hpp"
+
+#include <envire/maps/MLSGrid.hpp>
+#include <envire/tools/ParallelFor.hpp>
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+using namespace envire;
+
+ENVIRONMENT_ITEM_DEF( MLSSegmentation )
+
+namespace
+{
+    struct Patch
+    {
+	float top;
+	float bottom;
+	bool horizontal;
+    };
+
+    typedef std::vector<std::pair<uint32_t, uint32_t> > Links;
+
+    struct SegmentationTask
+    {
+	enum Phase
+	{
+	    COUNT,
+	    COLLECT,
+	    LINK,
+	    LABEL
+	};
+
+	const MLSGrid& mls;
+	Grid<uint8_t>::ArrayType& dst;
+	const size_t width, height;
+	const size_t tileSize;
+	const size_t tilesX;
+	const double maxStep;
+	const double tanSlope;
+	const double clearance;
+	Phase phase;
+
+	/** the patches of cell i are cells[i] to cells[i+1] */
+	std::vector<size_t> cells;
+	std::vector<Patch> patches;
+	/** union-find forest over the patches */
+	std::vector<uint32_t> parent;
+	/** links which cross the border of each tile */
+	std::vector<Links> borders;
+	/** true for the roots of the ground components */
+	std::vector<uint8_t> ground;
+
+	SegmentationTask( const MLSGrid& mls, Grid<uint8_t>::ArrayType& dst,
+		size_t tileSize, double maxStep, double maxSlope, double clearance )
+	    : mls( mls ), dst( dst ),
+	    width( mls.getCellSizeX() ), height( mls.getCellSizeY() ),
+	    tileSize( tileSize ),
+	    tilesX( (width + tileSize - 1) / tileSize ),
+	    maxStep( maxStep ), tanSlope( std::tan( maxSlope ) ),
+	    clearance( clearance ), phase( COUNT ),
+	    cells( width * height + 1, 0 )
+	{
+	    borders.resize( getTileCount() );
+	}
+
+	size_t getTileCount() const
+	{
+	    return tilesX * ((height + tileSize - 1) / tileSize);
+	}
+
+	uint32_t find( uint32_t i )
+	{
+	    while( parent[i] != i )
+	    {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	    }
+	    return i;
+	}
+
+	void unite( uint32_t a, uint32_t b )
+	{
+	    a = find( a );
+	    b = find( b );
+	    if( a < b )
+		parent[b] = a;
+	    else if( b < a )
+		parent[a] = b;
+	}
+
+	bool connected( const Patch& a, const Patch& b, double distance ) const
+	{
+	    if( !a.horizontal || !b.horizontal )
+		return false;
+	    const double step = std::abs( a.top - b.top );
+	    return step <= maxStep && step <= tanSlope * distance;
+	}
+
+	void link( size_t cell, size_t other, double distance, bool inside, Links& border )
+	{
+	    for( size_t i=cells[cell]; i<cells[cell+1]; i++ )
+		for( size_t j=cells[other]; j<cells[other+1]; j++ )
+		    if( connected( patches[i], patches[j], distance ) )
+		    {
+			if( inside )
+			    unite( i, j );
+			else
+			    border.push_back( std::make_pair( i, j ) );
+		    }
+	}
+
+	void processTile( size_t t )
+	{
+	    const size_t tx = (t % tilesX) * tileSize, ty = (t / tilesX) * tileSize;
+	    const size_t ex = std::min( tx + tileSize, width ),
+		  ey = std::min( ty + tileSize, height );
+
+	    for( size_t yi=ty; yi<ey; yi++ )
+	    {
+		for( size_t xi=tx; xi<ex; xi++ )
+		{
+		    const size_t cell = yi * width + xi;
+		    switch( phase )
+		    {
+			case COUNT:
+			    for( MLSGrid::const_iterator it = mls.beginCell( xi, yi ); it != mls.endCell(); it++ )
+				if( !it->isNegative() )
+				    cells[cell+1]++;
+			    break;
+
+			case COLLECT:
+			{
+			    size_t i = cells[cell];
+			    for( MLSGrid::const_iterator it = mls.beginCell( xi, yi ); it != mls.endCell(); it++ )
+			    {
+				if( it->isNegative() )
+				    continue;
+				Patch& patch( patches[i] );
+				patch.top = it->mean;
+				patch.horizontal = it->isHorizontal();
+				patch.bottom = patch.horizontal ? it->mean : it->mean - it->height;
+				parent[i] = i;
+				i++;
+			    }
+			    break;
+			}
+
+			case LINK:
+			{
+			    // the forward neighbours, the others link to this cell
+			    const int dx[] = { 1, -1, 0, 1 }, dy[] = { 0, 1, 1, 1 };
+			    for( int n=0; n<4; n++ )
+			    {
+				const int nx = xi + dx[n], ny = yi + dy[n];
+				if( nx < 0 || nx >= (int)width || ny >= (int)height )
+				    continue;
+				const double distance = std::sqrt(
+					std::pow( dx[n] * mls.getScaleX(), 2 ) + std::pow( dy[n] * mls.getScaleY(), 2 ) );
+				const bool inside = nx >= (int)tx && nx < (int)ex && ny < (int)ey;
+				link( cell, ny * width + nx, distance, inside, borders[t] );
+			    }
+			    break;
+			}
+
+			case LABEL:
+			    dst[yi][xi] = getLabel( cell );
+			    break;
+		    }
+		}
+	    }
+	}
+
+	uint8_t getLabel( size_t cell ) const
+	{
+	    if( cells[cell] == cells[cell+1] )
+		return MLSSegmentation::UNKNOWN;
+
+	    // the parents are flattened to the roots at this point
+	    float groundTop = -std::numeric_limits<float>::infinity();
+	    for( size_t i=cells[cell]; i<cells[cell+1]; i++ )
+		if( patches[i].horizontal && ground[parent[i]] )
+		    groundTop = std::max( groundTop, patches[i].top );
+	    if( groundTop == -std::numeric_limits<float>::infinity() )
+		return MLSSegmentation::OBSTACLE;
+
+	    uint8_t label = MLSSegmentation::GROUND;
+	    for( size_t i=cells[cell]; i<cells[cell+1]; i++ )
+	    {
+		if( patches[i].top <= groundTop + maxStep )
+		    continue;
+		if( patches[i].bottom < groundTop + clearance )
+		    return MLSSegmentation::OBSTACLE;
+		label = MLSSegmentation::OVERHANG;
+	    }
+	    return label;
+	}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    for( size_t t=begin; t<end; t++ )
+		processTile( t );
+	}
+    };
+}
+
+MLSSegmentation::MLSSegmentation()
+    : band( Grid<uint8_t>::GRID_DATA ), maxStep( 0.1 ), maxSlope( 0.5 ),
+    clearance( 1.0 ), tileSize( 64 ), threads( 0 )
+{
+}
+
+void MLSSegmentation::serialize(Serialization& so)
+{
+    Operator::serialize(so);
+    so.write( "band", band );
+    so.write( "max_step", maxStep );
+    so.write( "max_slope", maxSlope );
+    so.write( "clearance", clearance );
+    so.write( "tile_size", tileSize );
+    so.write( "seed_count", seeds.size() );
+    for( size_t i=0; i<seeds.size(); i++ )
+    {
+	const std::string prefix = "seed_" + boost::lexical_cast<std::string>(i);
+	so.write( prefix + "_x", seeds[i].x() );
+	so.write( prefix + "_y", seeds[i].y() );
+	so.write( prefix + "_z", seeds[i].z() );
+    }
+}
+
+void MLSSegmentation::unserialize(Serialization& so)
+{
+    Operator::unserialize(so);
+    if( so.hasKey( "band" ) )
+	so.read( "band", band );
+    if( so.hasKey( "max_step" ) )
+	so.read( "max_step", maxStep );
+    if( so.hasKey( "max_slope" ) )
+	so.read( "max_slope", maxSlope );
+    if( so.hasKey( "clearance" ) )
+	so.read( "clearance", clearance );
+    if( so.hasKey( "tile_size" ) )
+	so.read( "tile_size", tileSize );
+
+    seeds.clear();
+    if( so.hasKey( "seed_count" ) )
+    {
+	size_t count = 0;
+	so.read( "seed_count", count );
+	for( size_t i=0; i<count; i++ )
+	{
+	    const std::string prefix = "seed_" + boost::lexical_cast<std::string>(i);
+	    Eigen::Vector3d seed;
+	    so.read( prefix + "_x", seed.x() );
+	    so.read( prefix + "_y", seed.y() );
+	    so.read( prefix + "_z", seed.z() );
+	    seeds.push_back( seed );
+	}
+    }
+}
+
+void MLSSegmentation::addInput( MLSGrid* mls )
+{
+    if( env->getInputs(this).size() > 0 )
+        throw std::runtime_error("MLSSegmentation can only have one input.");
+
+    Operator::addInput(mls);
+}
+
+void MLSSegmentation::addOutput( Grid<uint8_t>* labels )
+{
+    if( env->getOutputs(this).size() > 0 )
+        throw std::runtime_error("MLSSegmentation can only have one output.");
+
+    Operator::addOutput(labels);
+}
+
+bool MLSSegmentation::updateAll()
+{
+    MLSGrid* mls = env->getInput<MLSGrid*>(this);
+    Grid<uint8_t>* labels = env->getOutput<Grid<uint8_t>*>(this);
+    if( !mls || !labels )
+	throw std::runtime_error("MLSSegmentation: needs an MLSGrid input and a Grid<uint8_t> output.");
+    if( mls->getCellSizeX() != labels->getCellSizeX() || mls->getCellSizeY() != labels->getCellSizeY() )
+	throw std::runtime_error("MLSSegmentation: the output needs to have the size of the input.");
+
+    SegmentationTask task( *mls, labels->getGridData( band ),
+	    std::max( tileSize, (size_t)1 ), maxStep, maxSlope, clearance );
+    const size_t tiles = task.getTileCount();
+
+    // collect the patches of all cells
+    task.phase = SegmentationTask::COUNT;
+    parallelFor( tiles, task, threads, 1 );
+    for( size_t i=1; i<task.cells.size(); i++ )
+	task.cells[i] += task.cells[i-1];
+    if( task.cells.back() > std::numeric_limits<uint32_t>::max() )
+	throw std::runtime_error("MLSSegmentation: too many patches.");
+    task.patches.resize( task.cells.back() );
+    task.parent.resize( task.cells.back() );
+    task.phase = SegmentationTask::COLLECT;
+    parallelFor( tiles, task, threads, 1 );
+    checkCancelled();
+    reportProgress( 0.2 );
+
+    // components inside the tiles, and then across the tile borders
+    task.phase = SegmentationTask::LINK;
+    parallelFor( tiles, task, threads, 1 );
+    for( size_t t=0; t<tiles; t++ )
+	for( size_t i=0; i<task.borders[t].size(); i++ )
+	    task.unite( task.borders[t][i].first, task.borders[t][i].second );
+    checkCancelled();
+    reportProgress( 0.6 );
+
+    // flatten the forest, so that the labels can look up the roots
+    const size_t count = task.patches.size();
+    std::vector<uint32_t> size( count, 0 );
+    for( size_t i=0; i<count; i++ )
+    {
+	task.parent[i] = task.find( i );
+	if( task.patches[i].horizontal )
+	    size[task.parent[i]]++;
+    }
+
+    task.ground.assign( count, 0 );
+    for( size_t s=0; s<seeds.size(); s++ )
+    {
+	size_t xi, yi;
+	if( !mls->toGrid( seeds[s].x(), seeds[s].y(), xi, yi ) )
+	    continue;
+	const size_t cell = yi * task.width + xi;
+	size_t best = count;
+	for( size_t i=task.cells[cell]; i<task.cells[cell+1]; i++ )
+	    if( task.patches[i].horizontal && (best == count
+			|| std::abs( task.patches[i].top - seeds[s].z() ) < std::abs( task.patches[best].top - seeds[s].z() )) )
+		best = i;
+	if( best < count )
+	    task.ground[task.parent[best]] = 1;
+    }
+    if( seeds.empty() && count > 0 )
+    {
+	const size_t largest = std::max_element( size.begin(), size.end() ) - size.begin();
+	if( size[largest] > 0 )
+	    task.ground[largest] = 1;
+    }
+    checkCancelled();
+    reportProgress( 0.8 );
+
+    task.phase = SegmentationTask::LABEL;
+    parallelFor( tiles, task, threads, 1 );
+
+    env->itemModified( labels );
+    return true;
+}
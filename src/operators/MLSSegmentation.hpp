@@ -0,0 +1,89 @@
+#ifndef __ENVIRE_MLSSEGMENTATION_HPP__
+#define __ENVIRE_MLSSEGMENTATION_HPP__
+
+#include <envire/Core.hpp>
+#include <envire/maps/Grid.hpp>
+
+namespace envire {
+    class MLSGrid;
+
+    /**
+     * Segments an MLSGrid into ground, obstacles and overhangs.
+     *
+     * All horizontal patches are connected to the horizontal patches of the
+     * 8 neighbouring cells, if the step between the two is at most the
+     * maximum step height and the slope between them is at most the maximum
+     * slope. The connected components which contain a seed patch are
+     * ground. The seed patch of a seed position is the patch of its cell
+     * which is closest to it in height. Without seeds, the largest component
+     * is ground.
+     *
+     * Each cell of the Grid<uint8_t> output, which has to have the size of
+     * the MLSGrid, is then labeled from the vertical stack of patches in the
+     * cell:
+     *
+     * - UNKNOWN if there are no (non negative) patches
+     * - OBSTACLE if there is no ground patch, or if another patch reaches
+     *   into the clearance above the highest ground patch. Patches which are
+     *   less than the maximum step above the ground are ignored.
+     * - OVERHANG if there are patches above the clearance
+     * - GROUND otherwise
+     *
+     * The components are found with a union-find on tiles of the grid, which
+     * are processed in parallel. The tiles are joined along their borders
+     * afterwards.
+     */
+    class MLSSegmentation : public Operator
+    {
+	ENVIRONMENT_ITEM( MLSSegmentation )
+
+    public:
+	enum Label
+	{
+	    UNKNOWN = 0,
+	    GROUND = 1,
+	    OBSTACLE = 2,
+	    OVERHANG = 3
+	};
+
+	MLSSegmentation();
+
+	void serialize(Serialization& so);
+        void unserialize(Serialization& so);
+
+	void addInput( MLSGrid* mls );
+	void addOutput( Grid<uint8_t>* labels );
+
+	bool updateAll();
+
+	/** band of the output, default Grid<uint8_t>::GRID_DATA */
+	void setBand( const std::string& value ) { band = value; }
+	const std::string& getBand() const { return band; }
+	/** maximum height difference between connected patches, default 0.1 */
+	void setMaxStep( double value ) { maxStep = value; }
+	double getMaxStep() const { return maxStep; }
+	/** maximum slope between connected patches in radians, default 0.5 */
+	void setMaxSlope( double value ) { maxSlope = value; }
+	double getMaxSlope() const { return maxSlope; }
+	/** free height above the ground, default 1.0 */
+	void setClearance( double value ) { clearance = value; }
+	double getClearance() const { return clearance; }
+	/** adds a seed for the ground, in the frame of the MLSGrid */
+	void addSeed( const Eigen::Vector3d& position ) { seeds.push_back( position ); }
+	void clearSeeds() { seeds.clear(); }
+	/** size of the tiles in cells, default 64 */
+	void setTileSize( size_t value ) { tileSize = value; }
+	/** number of threads to use, 0 (default) for one per hardware thread */
+	void setThreads( size_t value ) { threads = value; }
+
+    protected:
+	std::string band;
+	double maxStep;
+	double maxSlope;
+	double clearance;
+	std::vector<Eigen::Vector3d> seeds;
+	size_t tileSize;
+	size_t threads;
+    };
+}
+#endif
@@ -0,0 +1,349 @@
+#include "MLSToTriMesh.hpp"
+
+#include <envire/maps/MLSGrid.hpp>
+#include <envire/maps/TriMesh.hpp>
+#include <envire/tools/ParallelFor.hpp>
+
+#include <algorithm>
+
+using namespace envire;
+
+ENVIRONMENT_ITEM_DEF( MLSToTriMesh )
+
+namespace
+{
+    /** offset of corner k within a cell. The corners are in counter
+     * clockwise order, starting at the lower left one. */
+    const int CORNER_X[4] = { 0, 1, 1, 0 };
+    const int CORNER_Y[4] = { 0, 0, 1, 1 };
+
+    /** the neighbour across edge k, which goes from corner k to corner
+     * k+1, and the corners of the neighbour at both ends of the edge */
+    const int EDGE_X[4] = { 0, 1, 0, -1 };
+    const int EDGE_Y[4] = { -1, 0, 1, 0 };
+    const int EDGE_CORNER_A[4] = { 3, 0, 1, 2 };
+    const int EDGE_CORNER_B[4] = { 2, 3, 0, 1 };
+
+    /** the top patch of a cell */
+    struct CellTop
+    {
+	/** height at the corners */
+	float z[4];
+	float bottom;
+	float var;
+	bool valid;
+	bool vertical;
+
+	CellTop() : bottom( 0 ), var( 0 ), valid( false ), vertical( false ) {}
+    };
+
+    struct MeshTask
+    {
+	enum Phase
+	{
+	    CELLS,
+	    VERTICES,
+	    FACES
+	};
+
+	const MLSGrid& grid;
+	const double maxStep;
+	const size_t width, height;
+	const size_t tileSize, tilesX;
+	Phase phase;
+
+	std::vector<CellTop> cells;
+	/** index of the vertex of each cell corner, local to the tile which
+	 * owns the corner */
+	std::vector<int> cornerVertex;
+	/** first wall vertex of each cell, local to its tile, and a bit for
+	 * each edge with a wall */
+	std::vector<int> wallVertex;
+	std::vector<unsigned char> walls;
+
+	/** the vertices and faces of each tile */
+	std::vector<std::vector<Eigen::Vector3d> > vertices;
+	std::vector<std::vector<double> > variances;
+	std::vector<std::vector<TriMesh::triangle_t> > faces;
+	/** index of the first vertex of each tile in the mesh */
+	std::vector<size_t> offsets;
+
+	MeshTask( const MLSGrid& grid, double maxStep, size_t tileSize )
+	    : grid( grid ), maxStep( maxStep ),
+	    width( grid.getCellSizeX() ), height( grid.getCellSizeY() ),
+	    tileSize( tileSize ), tilesX( (width + tileSize - 1) / tileSize ),
+	    phase( CELLS ),
+	    cells( width * height ), cornerVertex( width * height * 4, -1 ),
+	    wallVertex( width * height, -1 ), walls( width * height, 0 )
+	{
+	    vertices.resize( getTileCount() );
+	    variances.resize( getTileCount() );
+	    faces.resize( getTileCount() );
+	    offsets.resize( getTileCount() );
+	}
+
+	size_t getTileCount() const
+	{
+	    return tilesX * ((height + tileSize - 1) / tileSize);
+	}
+
+	size_t getOwner( size_t cx, size_t cy ) const
+	{
+	    return (std::min( cy, height - 1 ) / tileSize) * tilesX + std::min( cx, width - 1 ) / tileSize;
+	}
+
+	const CellTop* getCell( int x, int y ) const
+	{
+	    if( x < 0 || y < 0 || x >= (int)width || y >= (int)height )
+		return NULL;
+	    const CellTop& cell( cells[y * width + x] );
+	    return cell.valid ? &cell : NULL;
+	}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    for( size_t t=begin; t<end; t++ )
+	    {
+		const size_t x0 = (t % tilesX) * tileSize, y0 = (t / tilesX) * tileSize;
+		const size_t x1 = std::min( x0 + tileSize, width ), y1 = std::min( y0 + tileSize, height );
+		if( phase == CELLS )
+		    computeCells( x0, y0, x1, y1 );
+		else if( phase == VERTICES )
+		    createVertices( t, x0, y0, x1, y1 );
+		else
+		    createFaces( t, x0, y0, x1, y1 );
+	    }
+	}
+
+	void computeCells( size_t x0, size_t y0, size_t x1, size_t y1 )
+	{
+	    const bool slopeModel = grid.getConfig().updateModel == MLSConfiguration::SLOPE;
+	    for( size_t y=y0; y<y1; y++ )
+	    {
+		for( size_t x=x0; x<x1; x++ )
+		{
+		    const SurfacePatch* top = NULL;
+		    for( MLSGrid::const_iterator it = grid.beginCell( x, y ); it != grid.endCell(); it++ )
+			if( !it->isNegative() && (!top || it->mean > top->mean) )
+			    top = &(*it);
+		    if( !top )
+			continue;
+
+		    CellTop& cell( cells[y * width + x] );
+		    cell.valid = true;
+		    cell.vertical = top->isVertical();
+		    cell.bottom = cell.vertical ? top->mean - top->height : top->mean;
+		    cell.var = top->stdev * top->stdev;
+		    for( int k=0; k<4; k++ )
+		    {
+			if( slopeModel && top->isHorizontal() )
+			    cell.z[k] = top->getHeight( Eigen::Vector2f(
+					CORNER_X[k] * grid.getScaleX(), CORNER_Y[k] * grid.getScaleY() ) );
+			else
+			    cell.z[k] = top->mean;
+		    }
+		}
+	    }
+	}
+
+	void createVertices( size_t t, size_t x0, size_t y0, size_t x1, size_t y1 )
+	{
+	    std::vector<Eigen::Vector3d>& tileVertices( vertices[t] );
+	    std::vector<double>& tileVariances( variances[t] );
+
+	    // the corners on the upper borders of the grid belong to the
+	    // tiles at the border
+	    const size_t cx1 = x1 == width ? width + 1 : x1;
+	    const size_t cy1 = y1 == height ? height + 1 : y1;
+	    std::vector<std::pair<float, size_t> > heights;
+	    for( size_t cy=y0; cy<cy1; cy++ )
+	    {
+		for( size_t cx=x0; cx<cx1; cx++ )
+		{
+		    heights.clear();
+		    for( int k=0; k<4; k++ )
+		    {
+			const int x = cx - CORNER_X[k], y = cy - CORNER_Y[k];
+			if( getCell( x, y ) )
+			    heights.push_back( std::make_pair( cells[y * width + x].z[k], (y * width + x) * 4 + k ) );
+		    }
+		    std::sort( heights.begin(), heights.end() );
+
+		    // cells which are within the maximum step of the lowest
+		    // height of a group share a vertex
+		    for( size_t i=0; i<heights.size(); )
+		    {
+			size_t j = i;
+			double z = 0, var = 0;
+			for( ; j<heights.size() && heights[j].first - heights[i].first <= maxStep; j++ )
+			{
+			    z += heights[j].first;
+			    var += cells[heights[j].second / 4].var;
+			    cornerVertex[heights[j].second] = tileVertices.size();
+			}
+			tileVertices.push_back( Eigen::Vector3d(
+				    cx * grid.getScaleX() + grid.getOffsetX(),
+				    cy * grid.getScaleY() + grid.getOffsetY(),
+				    z / (j - i) ) );
+			tileVariances.push_back( var / (j - i) );
+			i = j;
+		    }
+		}
+	    }
+
+	    // the bottom vertices of the walls of vertical patches
+	    for( size_t y=y0; y<y1; y++ )
+	    {
+		for( size_t x=x0; x<x1; x++ )
+		{
+		    const CellTop* cell = getCell( x, y );
+		    if( !cell || !cell->vertical )
+			continue;
+
+		    const size_t c = y * width + x;
+		    for( int k=0; k<4; k++ )
+		    {
+			const int a = k, b = (k + 1) % 4;
+			const CellTop* nb = getCell( x + EDGE_X[k], y + EDGE_Y[k] );
+			double za = cell->bottom, zb = cell->bottom;
+			if( nb )
+			{
+			    if( nb->z[EDGE_CORNER_A[k]] >= cell->z[a] - maxStep
+				    && nb->z[EDGE_CORNER_B[k]] >= cell->z[b] - maxStep )
+				continue;
+			    za = std::max( za, (double)nb->z[EDGE_CORNER_A[k]] );
+			    zb = std::max( zb, (double)nb->z[EDGE_CORNER_B[k]] );
+			}
+
+			if( !walls[c] )
+			    wallVertex[c] = tileVertices.size();
+			walls[c] |= 1 << k;
+
+			const double ax = (x + CORNER_X[a]) * grid.getScaleX() + grid.getOffsetX(),
+			      ay = (y + CORNER_Y[a]) * grid.getScaleY() + grid.getOffsetY(),
+			      bx = (x + CORNER_X[b]) * grid.getScaleX() + grid.getOffsetX(),
+			      by = (y + CORNER_Y[b]) * grid.getScaleY() + grid.getOffsetY();
+			tileVertices.push_back( Eigen::Vector3d( ax, ay, std::min( za, (double)cell->z[a] ) ) );
+			tileVertices.push_back( Eigen::Vector3d( bx, by, std::min( zb, (double)cell->z[b] ) ) );
+			tileVariances.push_back( cell->var );
+			tileVariances.push_back( cell->var );
+		    }
+		}
+	    }
+	}
+
+	void createFaces( size_t t, size_t x0, size_t y0, size_t x1, size_t y1 )
+	{
+	    std::vector<TriMesh::triangle_t>& tileFaces( faces[t] );
+	    for( size_t y=y0; y<y1; y++ )
+	    {
+		for( size_t x=x0; x<x1; x++ )
+		{
+		    const size_t c = y * width + x;
+		    if( !cells[c].valid )
+			continue;
+
+		    int v[4];
+		    for( int k=0; k<4; k++ )
+			v[k] = offsets[getOwner( x + CORNER_X[k], y + CORNER_Y[k] )] + cornerVertex[c * 4 + k];
+
+		    // counter clockwise seen from above
+		    tileFaces.push_back( TriMesh::triangle_t( v[0], v[1], v[2] ) );
+		    tileFaces.push_back( TriMesh::triangle_t( v[0], v[2], v[3] ) );
+
+		    // the walls face outwards
+		    int w = offsets[t] + wallVertex[c];
+		    for( int k=0; k<4; k++ )
+		    {
+			if( !(walls[c] & (1 << k)) )
+			    continue;
+			const int a = v[k], b = v[(k + 1) % 4];
+			tileFaces.push_back( TriMesh::triangle_t( a, w, w + 1 ) );
+			tileFaces.push_back( TriMesh::triangle_t( a, w + 1, b ) );
+			w += 2;
+		    }
+		}
+	    }
+	}
+    };
+}
+
+MLSToTriMesh::MLSToTriMesh()
+    : maxStep( 0.1 ), tileSize( 64 ), threads( 0 )
+{
+}
+
+void MLSToTriMesh::serialize(Serialization& so)
+{
+    Operator::serialize(so);
+    so.write( "max_step", maxStep );
+    so.write( "tile_size", tileSize );
+}
+
+void MLSToTriMesh::unserialize(Serialization& so)
+{
+    Operator::unserialize(so);
+    if( so.hasKey( "max_step" ) )
+	so.read( "max_step", maxStep );
+    if( so.hasKey( "tile_size" ) )
+	so.read( "tile_size", tileSize );
+}
+
+void MLSToTriMesh::addInput( MLSGrid* mls )
+{
+    if( !env->getInputs(this).empty() )
+        throw std::runtime_error("MLSToTriMesh can only have one input.");
+
+    Operator::addInput(mls);
+}
+
+void MLSToTriMesh::addOutput( TriMesh* mesh )
+{
+    if( !env->getOutputs(this).empty() )
+        throw std::runtime_error("MLSToTriMesh can only have one output.");
+
+    Operator::addOutput(mesh);
+}
+
+bool MLSToTriMesh::updateAll()
+{
+    MLSGrid* mls = env->getInput<MLSGrid*>(this);
+    TriMesh* mesh = env->getOutput<TriMesh*>(this);
+    if( !mls || !mesh )
+	throw std::runtime_error("MLSToTriMesh: needs an MLSGrid input and a TriMesh output.");
+
+    // evicted grids can only be restored from this thread
+    mls->touch();
+
+    MeshTask task( *mls, maxStep, std::max( tileSize, (size_t)1 ) );
+    parallelFor( task.getTileCount(), task, threads, 1 );
+    task.phase = MeshTask::VERTICES;
+    parallelFor( task.getTileCount(), task, threads, 1 );
+
+    size_t vertexCount = 0;
+    for( size_t t=0; t<task.getTileCount(); t++ )
+    {
+	task.offsets[t] = vertexCount;
+	vertexCount += task.vertices[t].size();
+    }
+
+    task.phase = MeshTask::FACES;
+    parallelFor( task.getTileCount(), task, threads, 1 );
+
+    const Transform C_mls2mesh( env->relativeTransform( mls->getFrameNode(), mesh->getFrameNode() ) );
+    mesh->clear();
+    mesh->faces.clear();
+    std::vector<double>& variance( mesh->getVertexData<double>( Pointcloud::VERTEX_VARIANCE ) );
+    mesh->vertices.reserve( vertexCount );
+    variance.reserve( vertexCount );
+    for( size_t t=0; t<task.getTileCount(); t++ )
+    {
+	for( size_t i=0; i<task.vertices[t].size(); i++ )
+	    mesh->vertices.push_back( C_mls2mesh * task.vertices[t][i] );
+	variance.insert( variance.end(), task.variances[t].begin(), task.variances[t].end() );
+	mesh->faces.insert( mesh->faces.end(), task.faces[t].begin(), task.faces[t].end() );
+    }
+
+    env->itemModified( mesh );
+    return true;
+}
@@ -0,0 +1,62 @@
+#ifndef __ENVIRE_MLSTOTRIMESH_HPP__
+#define __ENVIRE_MLSTOTRIMESH_HPP__
+
+#include <envire/Core.hpp>
+
+namespace envire {
+    class MLSGrid;
+    class TriMesh;
+
+    /**
+     * Triangulates the top surface of an MLSGrid into a TriMesh.
+     *
+     * The top patch of each cell, which is the highest patch that is not
+     * negative, is turned into two triangles. For grids which use the slope
+     * update model, the corners of horizontal patches follow the plane of
+     * the patch, otherwise they are at the mean of the patch.
+     *
+     * Neighbouring cells share the vertex at a common corner if their
+     * heights at that corner differ by less than the maximum step. The shared
+     * vertex is at the mean of these heights. Otherwise, the cells get
+     * separate vertices, so the mesh is split at discontinuities. Vertical
+     * patches are closed with walls on the sides where the neighbouring
+     * surface is lower, which reach down to the neighbouring surface or the
+     * bottom of the patch. The variance of the patches is stored in the
+     * VERTEX_VARIANCE data of the mesh.
+     *
+     * The grid is processed in tiles, which are distributed over multiple
+     * threads. The vertices on the borders of the tiles are created once by
+     * the tile which owns the corner, so that the tiles are stitched without
+     * duplicate vertices.
+     */
+    class MLSToTriMesh : public Operator
+    {
+	ENVIRONMENT_ITEM( MLSToTriMesh )
+
+    public:
+	MLSToTriMesh();
+
+	void serialize(Serialization& so);
+        void unserialize(Serialization& so);
+
+	void addInput( MLSGrid* mls );
+	void addOutput( TriMesh* mesh );
+
+	bool updateAll();
+
+	/** largest height difference at a corner, for which neighbouring
+	 * cells are connected, default 0.1 */
+	void setMaxStep( double value ) { maxStep = value; }
+	double getMaxStep() const { return maxStep; }
+	/** size of the tiles in cells, default 64 */
+	void setTileSize( size_t value ) { tileSize = value; }
+	/** number of threads to use, 0 (default) for one per hardware thread */
+	void setThreads( size_t value ) { threads = value; }
+
+    protected:
+	double maxStep;
+	size_t tileSize;
+	size_t threads;
+    };
+}
+#endif
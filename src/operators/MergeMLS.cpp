@@ -50,6 +50,9 @@ bool MergeMLS::updateAll()
 
 	    for(size_t m=0;m<input->getWidth();m++)
 	    {
+		checkCancelled();
+		reportProgress( ((it - grids.begin()) + static_cast<double>( m ) / input->getWidth()) / grids.size() );
+
 		for(size_t n=0;n<input->getHeight();n++)
 		{
 		    for( MLSGrid::iterator cit = input->beginCell(m,n); cit != input->endCell(); cit++ )
@@ -93,6 +96,9 @@ bool MergeMLS::updateAll()
 
 	for(size_t m=0;m<output->getWidth();m++)
 	{
+	    checkCancelled();
+	    reportProgress( static_cast<double>( m ) / output->getWidth() );
+
 	    for(size_t n=0;n<output->getHeight();n++)
 	    {
 		// get 3d position of output gridcell
@@ -49,6 +49,13 @@ void MergePointcloud::setClearOutput( bool clear )
 }
 
 bool MergePointcloud::updateAll(){
+    merge();
+
+    env->itemModified( *env->getOutputs(this).begin() );
+    return true;
+}
+
+void MergePointcloud::merge(){
     Pointcloud* targetcloud = dynamic_cast<envire::Pointcloud*>(*env->getOutputs(this).begin());
     assert( targetcloud );
     if( m_clearOutput )
@@ -112,9 +119,6 @@ bool MergePointcloud::updateAll(){
 	    }
 	}
     }
-
-    env->itemModified( targetcloud );
-    return true;
 }
 
 }//namespace
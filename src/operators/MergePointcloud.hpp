@@ -33,6 +33,12 @@ namespace envire {
 	void addOutput(Pointcloud* globalpc);
 	bool updateAll();
 
+	/** @brief performs the merge of updateAll(), without notifying the
+	 * environment about the modified output. This allows to run merges
+	 * into different outputs in parallel.
+	 */
+	void merge();
+
     protected:
 	bool m_clearOutput;
     };
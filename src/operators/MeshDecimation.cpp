@@ -0,0 +1,614 @@
+#include "MeshDecimation.hpp"
+
+#include <envire/maps/TriMesh.hpp>
+#include <envire/tools/ParallelFor.hpp>
+
+#include <Eigen/LU>
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <queue>
+
+using namespace envire;
+
+ENVIRONMENT_ITEM_DEF( MeshDecimation )
+
+namespace
+{
+    /** slabs with fewer vertices are not worth a thread */
+    const size_t MIN_SLAB_VERTICES = 1024;
+
+    /** collapses which turn a face by more than about 80 degrees are not
+     * done, as they tend to fold the mesh over */
+    const double MIN_NORMAL_COS = 0.2;
+
+    /** sum of squared distances to a set of planes, with
+     * error( p ) = p'Ap + 2b'p + c */
+    struct Quadric
+    {
+	Eigen::Matrix3d A;
+	Eigen::Vector3d b;
+	double c;
+
+	Quadric() : A( Eigen::Matrix3d::Zero() ), b( Eigen::Vector3d::Zero() ), c( 0 ) {}
+
+	/** add the plane n'p + d = 0, with n of unit length */
+	void addPlane( const Eigen::Vector3d& n, double d, double weight )
+	{
+	    A += weight * n * n.transpose();
+	    b += weight * d * n;
+	    c += weight * d * d;
+	}
+
+	Quadric& operator+=( const Quadric& other )
+	{
+	    A += other.A;
+	    b += other.b;
+	    c += other.c;
+	    return *this;
+	}
+
+	double error( const Eigen::Vector3d& p ) const
+	{
+	    return p.dot( A * p ) + 2.0 * b.dot( p ) + c;
+	}
+    };
+
+    struct Face
+    {
+	int v[3];
+
+	bool contains( int vertex ) const
+	{
+	    return v[0] == vertex || v[1] == vertex || v[2] == vertex;
+	}
+    };
+
+    /** candidate collapse of edge (a, b) into a vertex at position */
+    struct Collapse
+    {
+	double cost;
+	int a, b;
+	unsigned stampA, stampB;
+	Eigen::Vector3d position;
+
+	/** the priority queue returns the largest element first */
+	bool operator<( const Collapse& other ) const
+	{
+	    return cost > other.cost;
+	}
+    };
+
+    struct Decimator
+    {
+	enum Phase
+	{
+	    QUADRICS,
+	    COLLAPSE
+	};
+
+	Phase phase;
+	const double boundaryWeight;
+	const double maxError;
+
+	std::vector<Eigen::Vector3d> points;
+	/** optional vertex data, empty if the mesh doesn't have it */
+	std::vector<Eigen::Vector3d> colors;
+	std::vector<Eigen::Vector3d> normals;
+	std::vector<double> variances;
+
+	std::vector<Face> faces;
+	std::vector<unsigned char> faceRemoved;
+	/** faces around each vertex, which may include removed faces */
+	std::vector<std::vector<int> > vertexFaces;
+	std::vector<Quadric> quadrics;
+	std::vector<unsigned char> vertexRemoved;
+	std::vector<unsigned char> boundary;
+	/** incremented with each change of a vertex, to detect outdated
+	 * collapses in the queue */
+	std::vector<unsigned> stamp;
+
+	/** slab of each vertex and the vertices of each slab */
+	std::vector<int> slab;
+	std::vector<std::vector<int> > slabVertices;
+	/** number of faces each slab should remove, and has removed */
+	std::vector<size_t> slabTarget;
+	std::vector<size_t> slabRemoved;
+
+	Decimator( TriMesh& mesh, double boundaryWeight, double maxError )
+	    : phase( QUADRICS ), boundaryWeight( boundaryWeight ), maxError( maxError ),
+	    points( mesh.vertices )
+	{
+	    const size_t n = points.size();
+	    if( mesh.hasData( Pointcloud::VERTEX_COLOR ) && mesh.getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR ).size() == n )
+		colors = mesh.getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR );
+	    if( mesh.hasData( Pointcloud::VERTEX_NORMAL ) && mesh.getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL ).size() == n )
+		normals = mesh.getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL );
+	    if( mesh.hasData( Pointcloud::VERTEX_VARIANCE ) && mesh.getVertexData<double>( Pointcloud::VERTEX_VARIANCE ).size() == n )
+		variances = mesh.getVertexData<double>( Pointcloud::VERTEX_VARIANCE );
+
+	    vertexFaces.resize( n );
+	    faces.reserve( mesh.faces.size() );
+	    for( size_t i=0; i<mesh.faces.size(); i++ )
+	    {
+		Face f;
+		f.v[0] = mesh.faces[i].get<0>();
+		f.v[1] = mesh.faces[i].get<1>();
+		f.v[2] = mesh.faces[i].get<2>();
+		for( int k=0; k<3; k++ )
+		    if( f.v[k] < 0 || f.v[k] >= (int)n )
+			throw std::runtime_error("MeshDecimation: face with invalid vertex index.");
+		for( int k=0; k<3; k++ )
+		    vertexFaces[f.v[k]].push_back( faces.size() );
+		faces.push_back( f );
+	    }
+
+	    faceRemoved.resize( faces.size(), 0 );
+	    quadrics.resize( n );
+	    vertexRemoved.resize( n, 0 );
+	    boundary.resize( n, 0 );
+	    stamp.resize( n, 0 );
+	    slab.resize( n, 0 );
+	}
+
+	size_t getFaceCount() const
+	{
+	    return faces.size() - std::count( faceRemoved.begin(), faceRemoved.end(), 1 );
+	}
+
+	/** @return the unnormalized normal of the face, with vertex from
+	 * replaced by position */
+	Eigen::Vector3d getFaceNormal( const Face& f, int from = -1, const Eigen::Vector3d& position = Eigen::Vector3d::Zero() ) const
+	{
+	    Eigen::Vector3d p[3];
+	    for( int k=0; k<3; k++ )
+		p[k] = f.v[k] == from ? position : points[f.v[k]];
+	    return (p[1] - p[0]).cross( p[2] - p[0] );
+	}
+
+	/** the vertices connected to vertex by an edge, sorted */
+	void getNeighbours( int vertex, std::vector<int>& result ) const
+	{
+	    result.clear();
+	    const std::vector<int>& vf( vertexFaces[vertex] );
+	    for( size_t i=0; i<vf.size(); i++ )
+	    {
+		if( faceRemoved[vf[i]] )
+		    continue;
+		for( int k=0; k<3; k++ )
+		    if( faces[vf[i]].v[k] != vertex )
+			result.push_back( faces[vf[i]].v[k] );
+	    }
+	    std::sort( result.begin(), result.end() );
+	    result.erase( std::unique( result.begin(), result.end() ), result.end() );
+	}
+
+	void computeQuadric( int vertex )
+	{
+	    Quadric& q( quadrics[vertex] );
+	    const std::vector<int>& vf( vertexFaces[vertex] );
+	    for( size_t i=0; i<vf.size(); i++ )
+	    {
+		const Face& f( faces[vf[i]] );
+		const Eigen::Vector3d normal = getFaceNormal( f );
+		if( normal.squaredNorm() == 0 )
+		    continue;
+		const Eigen::Vector3d n = normal.normalized();
+		q.addPlane( n, -n.dot( points[vertex] ), 1.0 );
+
+		// the edges of the face at this vertex, which are on the
+		// boundary if no other face shares them
+		for( int k=0; k<3; k++ )
+		{
+		    const int from = f.v[k], to = f.v[(k+1)%3];
+		    if( from != vertex && to != vertex )
+			continue;
+		    const int other = from == vertex ? to : from;
+		    int shared = 0;
+		    for( size_t j=0; j<vf.size(); j++ )
+			if( faces[vf[j]].contains( other ) )
+			    shared++;
+		    if( shared != 1 )
+			continue;
+
+		    boundary[vertex] = 1;
+		    const Eigen::Vector3d edge = points[to] - points[from];
+		    const Eigen::Vector3d m = edge.cross( n );
+		    if( m.squaredNorm() > 0 )
+			q.addPlane( m.normalized(), -m.normalized().dot( points[vertex] ), boundaryWeight );
+		}
+	    }
+	}
+
+	/** computes the position and the error of collapsing the edge
+	 * (a, b) */
+	void evaluate( int a, int b, Collapse& c ) const
+	{
+	    Quadric q( quadrics[a] );
+	    q += quadrics[b];
+
+	    c.a = a;
+	    c.b = b;
+	    c.stampA = stamp[a];
+	    c.stampB = stamp[b];
+
+	    // the optimal position, as long as it is not far away from the
+	    // edge, otherwise the best of the end and middle points
+	    Eigen::Matrix3d inverse;
+	    bool invertible;
+	    q.A.computeInverseWithCheck( inverse, invertible, 1e-10 );
+	    if( invertible )
+	    {
+		const Eigen::Vector3d p = -(inverse * q.b);
+		const double length = (points[b] - points[a]).norm();
+		if( (p - 0.5 * (points[a] + points[b])).norm() <= length )
+		{
+		    c.position = p;
+		    c.cost = std::max( q.error( p ), 0.0 );
+		    return;
+		}
+	    }
+
+	    const Eigen::Vector3d candidates[3] = { points[a], points[b], 0.5 * (points[a] + points[b]) };
+	    c.cost = std::numeric_limits<double>::infinity();
+	    for( int i=0; i<3; i++ )
+	    {
+		const double error = std::max( q.error( candidates[i] ), 0.0 );
+		if( error < c.cost )
+		{
+		    c.cost = error;
+		    c.position = candidates[i];
+		}
+	    }
+	}
+
+	void push( std::priority_queue<Collapse>& queue, int a, int b ) const
+	{
+	    Collapse c;
+	    evaluate( a, b, c );
+	    if( c.cost <= maxError )
+		queue.push( c );
+	}
+
+	/** @return true if all faces around the vertex are inside slab s */
+	bool isInside( int vertex, int s ) const
+	{
+	    const std::vector<int>& vf( vertexFaces[vertex] );
+	    for( size_t i=0; i<vf.size(); i++ )
+		if( !faceRemoved[vf[i]] )
+		    for( int k=0; k<3; k++ )
+			if( slab[faces[vf[i]].v[k]] != s )
+			    return false;
+	    return true;
+	}
+
+	/** @return true if the collapse keeps the mesh manifold and doesn't
+	 * flip any faces */
+	bool isValid( const Collapse& c, std::vector<int>& na, std::vector<int>& nb ) const
+	{
+	    // the vertices next to both ends of the edge have to be the
+	    // ones of the faces on the edge
+	    getNeighbours( c.a, na );
+	    getNeighbours( c.b, nb );
+	    std::vector<int> common;
+	    std::set_intersection( na.begin(), na.end(), nb.begin(), nb.end(), std::back_inserter( common ) );
+
+	    size_t shared = 0;
+	    const std::vector<int>& fa( vertexFaces[c.a] );
+	    for( size_t i=0; i<fa.size(); i++ )
+		if( !faceRemoved[fa[i]] && faces[fa[i]].contains( c.b ) )
+		    shared++;
+	    if( shared == 0 || common.size() != shared )
+		return false;
+	    // an inner edge between two boundary vertices would pinch the
+	    // mesh
+	    if( boundary[c.a] && boundary[c.b] && shared != 1 )
+		return false;
+
+	    const int ends[2] = { c.a, c.b };
+	    for( int e=0; e<2; e++ )
+	    {
+		const std::vector<int>& vf( vertexFaces[ends[e]] );
+		for( size_t i=0; i<vf.size(); i++ )
+		{
+		    const Face& f( faces[vf[i]] );
+		    if( faceRemoved[vf[i]] || (f.contains( c.a ) && f.contains( c.b )) )
+			continue;
+		    const Eigen::Vector3d before = getFaceNormal( f );
+		    const Eigen::Vector3d after = getFaceNormal( f, ends[e], c.position );
+		    if( after.squaredNorm() <= 1e-12 * before.squaredNorm()
+			    || after.dot( before ) < MIN_NORMAL_COS * after.norm() * before.norm() )
+			return false;
+		}
+	    }
+	    return true;
+	}
+
+	/** collapses b into a, and returns the number of removed faces */
+	size_t apply( const Collapse& c )
+	{
+	    const int a = c.a, b = c.b;
+	    const Eigen::Vector3d edge = points[b] - points[a];
+	    const double t = edge.squaredNorm() > 0 ?
+		std::min( std::max( (c.position - points[a]).dot( edge ) / edge.squaredNorm(), 0.0 ), 1.0 ) : 0.0;
+
+	    size_t removed = 0;
+	    std::vector<int>& fa( vertexFaces[a] );
+	    const std::vector<int>& fb( vertexFaces[b] );
+	    for( size_t i=0; i<fb.size(); i++ )
+	    {
+		if( faceRemoved[fb[i]] )
+		    continue;
+		Face& f( faces[fb[i]] );
+		if( f.contains( a ) )
+		{
+		    faceRemoved[fb[i]] = 1;
+		    removed++;
+		    continue;
+		}
+		for( int k=0; k<3; k++ )
+		    if( f.v[k] == b )
+			f.v[k] = a;
+		fa.push_back( fb[i] );
+	    }
+	    std::vector<int> live;
+	    for( size_t i=0; i<fa.size(); i++ )
+		if( !faceRemoved[fa[i]] )
+		    live.push_back( fa[i] );
+	    fa.swap( live );
+	    std::vector<int>().swap( vertexFaces[b] );
+
+	    points[a] = c.position;
+	    quadrics[a] += quadrics[b];
+	    if( !colors.empty() )
+		colors[a] = (1.0 - t) * colors[a] + t * colors[b];
+	    if( !normals.empty() )
+	    {
+		const Eigen::Vector3d n = (1.0 - t) * normals[a] + t * normals[b];
+		if( n.squaredNorm() > 0 )
+		    normals[a] = n.normalized();
+	    }
+	    if( !variances.empty() )
+		variances[a] = (1.0 - t) * variances[a] + t * variances[b];
+
+	    boundary[a] |= boundary[b];
+	    vertexRemoved[b] = 1;
+	    stamp[a]++;
+	    stamp[b]++;
+
+	    return removed;
+	}
+
+	void decimate( int s )
+	{
+	    std::priority_queue<Collapse> queue;
+	    std::vector<int> na, nb;
+
+	    const std::vector<int>& members( slabVertices[s] );
+	    for( size_t i=0; i<members.size(); i++ )
+	    {
+		const int a = members[i];
+		if( vertexRemoved[a] )
+		    continue;
+		getNeighbours( a, na );
+		for( size_t j=0; j<na.size(); j++ )
+		    if( na[j] > a && slab[na[j]] == s )
+			push( queue, a, na[j] );
+	    }
+
+	    while( !queue.empty() && slabRemoved[s] < slabTarget[s] )
+	    {
+		const Collapse c = queue.top();
+		queue.pop();
+		if( vertexRemoved[c.a] || vertexRemoved[c.b] || stamp[c.a] != c.stampA || stamp[c.b] != c.stampB )
+		    continue;
+		// only change faces which are owned by this slab
+		if( !isInside( c.a, s ) || !isInside( c.b, s ) )
+		    continue;
+		if( !isValid( c, na, nb ) )
+		    continue;
+
+		slabRemoved[s] += apply( c );
+
+		getNeighbours( c.a, na );
+		for( size_t j=0; j<na.size(); j++ )
+		    if( slab[na[j]] == s )
+			push( queue, c.a, na[j] );
+	    }
+	}
+
+	/** splits the vertices into slabs along the longest axis of the
+	 * mesh. With shift, the slabs are moved by half their width. */
+	void setSlabs( size_t count, bool shift )
+	{
+	    Eigen::AlignedBox<double, 3> box;
+	    for( size_t i=0; i<points.size(); i++ )
+		if( !vertexRemoved[i] )
+		    box.extend( points[i] );
+
+	    int axis = 0;
+	    if( !box.isEmpty() )
+		box.sizes().maxCoeff( &axis );
+	    const double width = box.isEmpty() ? 0.0 : box.sizes()[axis] / count;
+
+	    const size_t slabs = count + (shift ? 1 : 0);
+	    slabVertices.assign( slabs, std::vector<int>() );
+	    for( size_t i=0; i<points.size(); i++ )
+	    {
+		if( vertexRemoved[i] )
+		    continue;
+		int s = 0;
+		if( width > 0 )
+		{
+		    const double x = (points[i][axis] - box.min()[axis]) / width + (shift ? 0.5 : 0.0);
+		    s = std::min( std::max( (int)x, 0 ), (int)slabs - 1 );
+		}
+		slab[i] = s;
+		slabVertices[s].push_back( i );
+	    }
+	}
+
+	/** distributes the given part of the faces to remove over the slabs,
+	 * in proportion to their size */
+	void setTargets( size_t targetFaces, double part = 1.0 )
+	{
+	    const size_t slabs = slabVertices.size();
+	    slabRemoved.assign( slabs, 0 );
+	    slabTarget.assign( slabs, std::numeric_limits<size_t>::max() );
+	    if( !targetFaces )
+		return;
+
+	    std::vector<size_t> slabFaces( slabs, 0 );
+	    size_t total = 0;
+	    for( size_t i=0; i<faces.size(); i++ )
+		if( !faceRemoved[i] )
+		{
+		    slabFaces[slab[faces[i].v[0]]]++;
+		    total++;
+		}
+
+	    const size_t remove = total > targetFaces ? (size_t)(part * (total - targetFaces)) : 0;
+	    for( size_t s=0; s<slabs; s++ )
+		slabTarget[s] = total ? (size_t)((double)remove * slabFaces[s] / total) : 0;
+	}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    for( size_t i=begin; i<end; i++ )
+	    {
+		if( phase == QUADRICS )
+		    computeQuadric( i );
+		else
+		    decimate( i );
+	    }
+	}
+    };
+}
+
+MeshDecimation::MeshDecimation()
+    : targetFaces( 0 ), maxError( std::numeric_limits<double>::max() ),
+    boundaryWeight( 1000.0 ), threads( 0 )
+{
+}
+
+void MeshDecimation::serialize(Serialization& so)
+{
+    Operator::serialize(so);
+    so.write( "target_faces", targetFaces );
+    so.write( "max_error", maxError );
+    so.write( "boundary_weight", boundaryWeight );
+}
+
+void MeshDecimation::unserialize(Serialization& so)
+{
+    Operator::unserialize(so);
+    if( so.hasKey( "target_faces" ) )
+	so.read( "target_faces", targetFaces );
+    if( so.hasKey( "max_error" ) )
+	so.read( "max_error", maxError );
+    if( so.hasKey( "boundary_weight" ) )
+	so.read( "boundary_weight", boundaryWeight );
+}
+
+void MeshDecimation::addInput( TriMesh* mesh )
+{
+    if( !env->getInputs(this).empty() )
+        throw std::runtime_error("MeshDecimation can only have one input.");
+
+    Operator::addInput(mesh);
+}
+
+void MeshDecimation::addOutput( TriMesh* mesh )
+{
+    if( !env->getOutputs(this).empty() )
+        throw std::runtime_error("MeshDecimation can only have one output.");
+
+    Operator::addOutput(mesh);
+}
+
+bool MeshDecimation::updateAll()
+{
+    TriMesh* input = env->getInput<TriMesh*>(this);
+    TriMesh* output = env->getOutput<TriMesh*>(this);
+    if( !input || !output )
+	throw std::runtime_error("MeshDecimation: needs a TriMesh input and a TriMesh output.");
+    if( !targetFaces && maxError == std::numeric_limits<double>::max() )
+	throw std::runtime_error("MeshDecimation: needs a target face count or a maximum error.");
+
+    // the vertices are accessed directly
+    input->touch();
+
+    Decimator d( *input, boundaryWeight, maxError );
+    parallelFor( d.points.size(), d, threads );
+    d.phase = Decimator::COLLAPSE;
+
+    // two parallel passes with shifted slabs, so that the edges on the
+    // borders of the first pass are inside the slabs of the second. The
+    // first pass only does half of the work, so that the borders are not
+    // left much denser than the rest of the mesh.
+    const size_t threadCount = getThreadCount( threads );
+    const size_t slabs = std::min( threadCount * 4, d.points.size() / MIN_SLAB_VERTICES );
+    if( threadCount > 1 && slabs > 1 )
+    {
+	for( int pass=0; pass<2; pass++ )
+	{
+	    d.setSlabs( slabs, pass == 1 );
+	    d.setTargets( targetFaces, pass == 0 ? 0.5 : 1.0 );
+	    parallelFor( d.slabVertices.size(), d, threads, 1 );
+	}
+    }
+
+    if( d.getFaceCount() > targetFaces )
+    {
+	d.setSlabs( 1, false );
+	d.setTargets( targetFaces );
+	d.decimate( 0 );
+    }
+
+    // copy the remaining vertices and faces to the output
+    std::vector<int> index( d.points.size(), -1 );
+    std::vector<Eigen::Vector3d> vertices, colors, normals;
+    std::vector<double> variances;
+    for( size_t i=0; i<d.points.size(); i++ )
+    {
+	if( d.vertexRemoved[i] )
+	    continue;
+	index[i] = vertices.size();
+	vertices.push_back( d.points[i] );
+	if( !d.colors.empty() )
+	    colors.push_back( d.colors[i] );
+	if( !d.normals.empty() )
+	    normals.push_back( d.normals[i] );
+	if( !d.variances.empty() )
+	    variances.push_back( d.variances[i] );
+    }
+
+    std::vector<TriMesh::triangle_t> faces;
+    faces.reserve( d.getFaceCount() );
+    for( size_t i=0; i<d.faces.size(); i++ )
+	if( !d.faceRemoved[i] )
+	    faces.push_back( TriMesh::triangle_t( index[d.faces[i].v[0]], index[d.faces[i].v[1]], index[d.faces[i].v[2]] ) );
+
+    if( output != input )
+    {
+	const Transform C_in2out( env->relativeTransform( input->getFrameNode(), output->getFrameNode() ) );
+	for( size_t i=0; i<vertices.size(); i++ )
+	    vertices[i] = C_in2out * vertices[i];
+	for( size_t i=0; i<normals.size(); i++ )
+	    normals[i] = C_in2out.linear() * normals[i];
+    }
+
+    output->clear();
+    output->vertices.swap( vertices );
+    output->faces.swap( faces );
+    if( !colors.empty() )
+	output->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR ).swap( colors );
+    if( !normals.empty() )
+	output->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL ).swap( normals );
+    if( !variances.empty() )
+	output->getVertexData<double>( Pointcloud::VERTEX_VARIANCE ).swap( variances );
+
+    env->itemModified( output );
+    return true;
+}
@@ -0,0 +1,73 @@
+#ifndef __ENVIRE_MESHDECIMATION_HPP__
+#define __ENVIRE_MESHDECIMATION_HPP__
+
+#include <envire/Core.hpp>
+
+namespace envire {
+    class TriMesh;
+
+    /**
+     * Simplifies a TriMesh by collapsing edges, using quadric error metrics.
+     *
+     * Each vertex holds a quadric, which sums up the squared distances to
+     * the planes of the original faces around it. An edge collapse merges
+     * the quadrics of both vertices and moves the remaining vertex to the
+     * position with the smallest error. The collapses are done in order of
+     * increasing error, until the mesh has the target number of faces, or
+     * until the next collapse would exceed the maximum error. At least one
+     * of the two has to be given.
+     *
+     * Boundary edges add planes which are perpendicular to their face to
+     * the quadrics, weighted by the boundary weight, so that the outline of
+     * open meshes is preserved. Collapses which would flip a face or change
+     * the topology of the mesh are not done. The VERTEX_COLOR, VERTEX_NORMAL
+     * and VERTEX_VARIANCE data of the input is interpolated along the
+     * collapsed edges.
+     *
+     * Large meshes are split into slabs along their longest axis, which are
+     * decimated in parallel. Only edges for which all faces around both
+     * vertices lie inside one slab are collapsed, so the threads never
+     * modify the same part of the mesh. A second parallel pass uses slabs
+     * which are shifted by half, and a final pass over the whole mesh
+     * handles the remaining edges.
+     *
+     * The output can be the input mesh itself.
+     */
+    class MeshDecimation : public Operator
+    {
+	ENVIRONMENT_ITEM( MeshDecimation )
+
+    public:
+	MeshDecimation();
+
+	void serialize(Serialization& so);
+        void unserialize(Serialization& so);
+
+	void addInput( TriMesh* mesh );
+	void addOutput( TriMesh* mesh );
+
+	bool updateAll();
+
+	/** number of faces to decimate the mesh to, 0 (default) to only use
+	 * the maximum error */
+	void setTargetFaces( size_t value ) { targetFaces = value; }
+	size_t getTargetFaces() const { return targetFaces; }
+	/** largest quadric error of a collapse, which is the sum of the
+	 * squared distances of the new vertex to the planes of the original
+	 * faces around it. Unlimited by default. */
+	void setMaxError( double value ) { maxError = value; }
+	double getMaxError() const { return maxError; }
+	/** weight of the planes along boundary edges, default 1000 */
+	void setBoundaryWeight( double value ) { boundaryWeight = value; }
+	double getBoundaryWeight() const { return boundaryWeight; }
+	/** number of threads to use, 0 (default) for one per hardware thread */
+	void setThreads( size_t value ) { threads = value; }
+
+    protected:
+	size_t targetFaces;
+	double maxError;
+	double boundaryWeight;
+	size_t threads;
+    };
+}
+#endif
@@ -0,0 +1,142 @@
+#include "NormalEstimation.hpp"
+
+#include <envire/tools/KdTree.hpp>
+#include <envire/tools/ParallelFor.hpp>
+#include <Eigen/Eigenvalues>
+
+using namespace envire;
+
+ENVIRONMENT_ITEM_DEF( NormalEstimation )
+
+namespace
+{
+    struct NormalTask
+    {
+	const KdTree& tree;
+	const std::vector<Eigen::Vector3d>& points;
+	const Eigen::Vector3d& viewpoint;
+	std::vector<Eigen::Vector3d>& normals;
+	size_t neighbours;
+	double radius;
+
+	NormalTask( const KdTree& tree, const Eigen::Vector3d& viewpoint,
+		std::vector<Eigen::Vector3d>& normals, size_t neighbours, double radius )
+	    : tree( tree ), points( tree.getPoints() ), viewpoint( viewpoint ),
+	    normals( normals ), neighbours( neighbours ), radius( radius ) {}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    std::vector<KdTree::Neighbour> result;
+	    for( size_t i=begin; i<end; i++ )
+	    {
+		tree.findNearest( points[i], neighbours, result, radius > 0 ? radius : -1.0 );
+		if( result.size() < 3 )
+		{
+		    normals[i] = Eigen::Vector3d::Zero();
+		    continue;
+		}
+
+		Eigen::Vector3d mean( Eigen::Vector3d::Zero() );
+		for( size_t j=0; j<result.size(); j++ )
+		    mean += points[result[j].index];
+		mean /= result.size();
+
+		Eigen::Matrix3d cov( Eigen::Matrix3d::Zero() );
+		for( size_t j=0; j<result.size(); j++ )
+		{
+		    const Eigen::Vector3d d( points[result[j].index] - mean );
+		    cov += d * d.transpose();
+		}
+
+		// the normal is the direction of least variance, eigenvalues
+		// are sorted in increasing order
+		Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver( cov );
+		Eigen::Vector3d normal( solver.eigenvectors().col( 0 ) );
+		if( normal.dot( viewpoint - points[i] ) < 0 )
+		    normal = -normal;
+		normals[i] = normal;
+	    }
+	}
+    };
+}
+
+NormalEstimation::NormalEstimation()
+    : neighbours( 16 ), radius( 0.0 ), threads( 0 )
+{
+}
+
+void NormalEstimation::serialize(Serialization& so)
+{
+    Operator::serialize(so);
+    so.write( "neighbours", neighbours );
+    so.write( "radius", radius );
+}
+
+void NormalEstimation::unserialize(Serialization& so)
+{
+    Operator::unserialize(so);
+    if( so.hasKey( "neighbours" ) )
+	so.read( "neighbours", neighbours );
+    if( so.hasKey( "radius" ) )
+	so.read( "radius", radius );
+}
+
+void NormalEstimation::addInput( Pointcloud* input ) 
+{
+    if( env->getInputs(this).size() > 0 )
+        throw std::runtime_error("NormalEstimation can only have one input.");
+
+    Operator::addInput(input);
+}
+
+void NormalEstimation::addOutput( Pointcloud* output )
+{
+    if( env->getOutputs(this).size() > 0 )
+        throw std::runtime_error("NormalEstimation can only have one output.");
+
+    Operator::addOutput(output);
+}
+
+void NormalEstimation::computeNormals( const std::vector<Eigen::Vector3d>& points,
+	const Eigen::Vector3d& viewpoint, std::vector<Eigen::Vector3d>& normals )
+{
+    KdTree tree;
+    tree.build( points, threads );
+
+    normals.resize( points.size() );
+    NormalTask task( tree, viewpoint, normals, neighbours, radius );
+    parallelFor( points.size(), task, threads );
+}
+
+bool NormalEstimation::updateAll() 
+{
+    Pointcloud* pc_in = getInput<Pointcloud*>();
+    Pointcloud* pc_out = getOutput<Pointcloud*>();
+    assert( pc_in && pc_out );
+
+    if( pc_in != pc_out )
+    {
+	pc_out->copyFrom( pc_in );
+	if( pc_in->hasData( Pointcloud::VERTEX_COLOR ) )
+	    pc_out->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR ) =
+		pc_in->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR );
+    }
+
+    // the normals are computed in the frame of the input, and need to
+    // be rotated if the output is in a different frame
+    std::vector<Eigen::Vector3d> normals;
+    computeNormals( pc_in->vertices, pc_in->getSensorOrigin().translation(), normals );
+
+    if( pc_in != pc_out )
+    {
+	const Eigen::Matrix3d rot( 
+		env->relativeTransform( pc_in->getFrameNode(), pc_out->getFrameNode() ).linear() );
+	for( size_t i=0; i<normals.size(); i++ )
+	    normals[i] = rot * normals[i];
+    }
+
+    pc_out->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL ).swap( normals );
+
+    env->itemModified( pc_out );
+    return true;
+}
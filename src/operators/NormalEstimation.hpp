@@ -0,0 +1,55 @@
+#ifndef __ENVIRE_NORMALESTIMATION_HPP__
+#define __ENVIRE_NORMALESTIMATION_HPP__
+
+#include <envire/Core.hpp>
+#include <envire/maps/Pointcloud.hpp>
+
+namespace envire {
+    /**
+     * Estimates the surface normal for each point of a pointcloud from the
+     * principal components of its neighbourhood, and stores it in the
+     * Pointcloud::VERTEX_NORMAL attribute of the output.
+     *
+     * The neighbourhood is given by the k nearest neighbours, optionally
+     * limited to a radius. Normals are oriented towards the sensor origin of
+     * the input cloud. Points with too few neighbours get a zero normal.
+     *
+     * Input and output may be the same cloud, in which case only the normals
+     * are written. Otherwise the vertices and colors of the input are copied
+     * to the output.
+     */
+    class NormalEstimation : public Operator
+    {
+	ENVIRONMENT_ITEM( NormalEstimation )
+
+    public:
+	NormalEstimation();
+
+	void serialize(Serialization& so);
+        void unserialize(Serialization& so);
+
+	void addInput( Pointcloud* input ); 
+	void addOutput( Pointcloud* output ); 
+
+	bool updateAll();
+
+	/** number of nearest neighbours used for a point, default 16 */
+	void setNeighbours( size_t value ) { neighbours = value; }
+	/** if greater than zero, only neighbours within this radius are
+	 * used, default 0 */
+	void setRadius( double value ) { radius = value; }
+	/** number of threads to use, 0 (default) for one per hardware thread */
+	void setThreads( size_t value ) { threads = value; }
+
+	/** computes the normals of the given points, oriented towards the
+	 * viewpoint */
+	void computeNormals( const std::vector<Eigen::Vector3d>& points,
+		const Eigen::Vector3d& viewpoint, std::vector<Eigen::Vector3d>& normals );
+
+    protected:
+	size_t neighbours;
+	double radius;
+	size_t threads;
+    };
+}
+#endif
@@ -0,0 +1,64 @@
+#include "OccupancyProjection.hpp"
+
+using namespace envire;
+
+ENVIRONMENT_ITEM_DEF( OccupancyProjection )
+
+OccupancyProjection::OccupancyProjection()
+    : maxRange( 0.0 )
+{
+}
+
+void OccupancyProjection::serialize(Serialization& so)
+{
+    Operator::serialize(so);
+    so.write( "max_range", maxRange );
+}
+
+void OccupancyProjection::unserialize(Serialization& so)
+{
+    Operator::unserialize(so);
+    if( so.hasKey( "max_range" ) )
+	so.read( "max_range", maxRange );
+}
+
+void OccupancyProjection::addInput( Pointcloud* pc ) 
+{
+    Operator::addInput(pc);
+}
+
+void OccupancyProjection::addOutput( OccupancyMap* map )
+{
+    if( env->getOutputs(this).size() > 0 )
+        throw std::runtime_error("OccupancyProjection can only have one output.");
+
+    Operator::addOutput(map);
+}
+
+bool OccupancyProjection::updateAll()
+{
+    OccupancyMap* map = getOutput<OccupancyMap*>();
+    assert( map );
+
+    std::list<Layer*> inputs = env->getInputs(this);
+    for( std::list<Layer*>::iterator it = inputs.begin(); it != inputs.end(); it++ )
+    {
+	Pointcloud* pc = dynamic_cast<envire::Pointcloud*>(*it);
+	assert( pc );
+
+	Transform C_pc2m = env->relativeTransform( pc->getFrameNode(), map->getFrameNode() );
+
+	// transform the scan into the map frame, and raycast it 
+	// from the sensor origin
+	std::vector<Eigen::Vector3d> points;
+	points.reserve( pc->vertices.size() );
+	for( size_t i=0; i<pc->vertices.size(); i++ )
+	    points.push_back( C_pc2m * pc->vertices[i] );
+
+	const Eigen::Vector3d origin = C_pc2m * pc->getSensorOrigin().translation();
+	map->insertScan( origin, points, maxRange );
+    }
+
+    env->itemModified( map );
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef __ENVIRE_OCCUPANCYPROJECTION_HPP__
+#define __ENVIRE_OCCUPANCYPROJECTION_HPP__
+
+#include <envire/Core.hpp>
+#include <envire/core/Operator.hpp>
+#include <envire/maps/Pointcloud.hpp>
+#include <envire/maps/OccupancyMap.hpp>
+
+namespace envire {
+    /**
+     * Inserts pointclouds into an OccupancyMap. Each input cloud is
+     * treated as a single scan, which is raycast from the sensor origin of
+     * the cloud (see Pointcloud::getSensorOrigin()), marking the voxels
+     * along the rays as free and the end points as occupied.
+     */
+    class OccupancyProjection : public Operator
+    {
+	ENVIRONMENT_ITEM( OccupancyProjection )
+
+    public:
+	OccupancyProjection();
+
+	void serialize(Serialization& so);
+        void unserialize(Serialization& so);
+
+	void addInput( Pointcloud* pc ); 
+	void addOutput( OccupancyMap* map ); 
+
+	bool updateAll();
+
+	/** points further away from the sensor origin than this are only used
+	 * to clear free space. A value of 0 (default) disables the limit.
+	 */
+	void setMaxRange( double range ) { maxRange = range; }
+	double getMaxRange() const { return maxRange; }
+
+    protected:
+	double maxRange;
+    };
+}
+#endif
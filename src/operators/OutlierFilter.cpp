@@ -0,0 +1,209 @@
+#include "OutlierFilter.hpp"
+
+#include <envire/tools/KdTree.hpp>
+#include <envire/tools/ParallelFor.hpp>
+#include <cmath>
+
+using namespace envire;
+
+ENVIRONMENT_ITEM_DEF( OutlierFilter )
+
+namespace
+{
+    struct MeanDistanceTask
+    {
+	const KdTree& tree;
+	std::vector<double>& distances;
+	size_t neighbours;
+
+	MeanDistanceTask( const KdTree& tree, std::vector<double>& distances, size_t neighbours )
+	    : tree( tree ), distances( distances ), neighbours( neighbours ) {}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    const std::vector<Eigen::Vector3d>& points( tree.getPoints() );
+	    std::vector<KdTree::Neighbour> result;
+	    for( size_t i=begin; i<end; i++ )
+	    {
+		// the point itself is always the first result
+		tree.findNearest( points[i], neighbours + 1, result );
+		double sum = 0;
+		for( size_t j=1; j<result.size(); j++ )
+		    sum += std::sqrt( result[j].sqDist );
+		distances[i] = result.size() > 1 ? sum / (result.size() - 1) : 0.0;
+	    }
+	}
+    };
+
+    struct RadiusCountTask
+    {
+	const KdTree& tree;
+	std::vector<size_t>& counts;
+	double radius;
+
+	RadiusCountTask( const KdTree& tree, std::vector<size_t>& counts, double radius )
+	    : tree( tree ), counts( counts ), radius( radius ) {}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    const std::vector<Eigen::Vector3d>& points( tree.getPoints() );
+	    std::vector<KdTree::Neighbour> result;
+	    for( size_t i=begin; i<end; i++ )
+	    {
+		tree.findInRadius( points[i], radius, result );
+		// don't count the point itself
+		counts[i] = result.size() - 1;
+	    }
+	}
+    };
+
+    template <class T>
+    void compact( std::vector<T>& data, const std::vector<bool>& inliers )
+    {
+	if( data.size() != inliers.size() )
+	    return;
+
+	size_t j = 0;
+	for( size_t i=0; i<data.size(); i++ )
+	    if( inliers[i] )
+		data[j++] = data[i];
+	data.resize( j );
+    }
+}
+
+OutlierFilter::OutlierFilter()
+    : method( STATISTICAL ), neighbours( 16 ), stddevMultiplier( 1.0 ),
+    radius( 0.1 ), minNeighbours( 2 ), threads( 0 )
+{
+}
+
+void OutlierFilter::serialize(Serialization& so)
+{
+    Operator::serialize(so);
+    so.write( "method", static_cast<int>( method ) );
+    so.write( "neighbours", neighbours );
+    so.write( "stddev_multiplier", stddevMultiplier );
+    so.write( "radius", radius );
+    so.write( "min_neighbours", minNeighbours );
+}
+
+void OutlierFilter::unserialize(Serialization& so)
+{
+    Operator::unserialize(so);
+    if( so.hasKey( "method" ) )
+    {
+	int methodInt = STATISTICAL;
+	so.read( "method", methodInt );
+	method = static_cast<Method>( methodInt );
+    }
+    if( so.hasKey( "neighbours" ) )
+	so.read( "neighbours", neighbours );
+    if( so.hasKey( "stddev_multiplier" ) )
+	so.read( "stddev_multiplier", stddevMultiplier );
+    if( so.hasKey( "radius" ) )
+	so.read( "radius", radius );
+    if( so.hasKey( "min_neighbours" ) )
+	so.read( "min_neighbours", minNeighbours );
+}
+
+void OutlierFilter::addInput( Pointcloud* input ) 
+{
+    if( env->getInputs(this).size() > 0 )
+        throw std::runtime_error("OutlierFilter can only have one input.");
+
+    Operator::addInput(input);
+}
+
+void OutlierFilter::addOutput( Pointcloud* output )
+{
+    if( env->getOutputs(this).size() > 0 )
+        throw std::runtime_error("OutlierFilter can only have one output.");
+
+    Operator::addOutput(output);
+}
+
+void OutlierFilter::computeInliers( const std::vector<Eigen::Vector3d>& points, std::vector<bool>& inliers )
+{
+    KdTree tree;
+    tree.build( points, threads );
+
+    inliers.assign( points.size(), true );
+    if( points.empty() )
+	return;
+
+    if( method == STATISTICAL )
+    {
+	std::vector<double> distances( points.size() );
+	MeanDistanceTask task( tree, distances, neighbours );
+	parallelFor( points.size(), task, threads );
+
+	double sum = 0, sqSum = 0;
+	for( size_t i=0; i<distances.size(); i++ )
+	{
+	    sum += distances[i];
+	    sqSum += distances[i] * distances[i];
+	}
+	const double mean = sum / points.size();
+	const double stddev = std::sqrt( std::max( sqSum / points.size() - mean * mean, 0.0 ) );
+	const double threshold = mean + stddevMultiplier * stddev;
+
+	for( size_t i=0; i<distances.size(); i++ )
+	    inliers[i] = distances[i] <= threshold;
+    }
+    else
+    {
+	std::vector<size_t> counts( points.size() );
+	RadiusCountTask task( tree, counts, radius );
+	parallelFor( points.size(), task, threads );
+
+	for( size_t i=0; i<counts.size(); i++ )
+	    inliers[i] = counts[i] >= minNeighbours;
+    }
+}
+
+bool OutlierFilter::updateAll() 
+{
+    Pointcloud* pc_in = getInput<Pointcloud*>();
+    Pointcloud* pc_out = getOutput<Pointcloud*>();
+    assert( pc_in && pc_out );
+
+    std::vector<bool> inliers;
+    computeInliers( pc_in->vertices, inliers );
+
+    if( pc_in != pc_out )
+    {
+	pc_out->copyFrom( pc_in );
+	if( pc_in->hasData( Pointcloud::VERTEX_COLOR ) )
+	    pc_out->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR ) =
+		pc_in->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR );
+	if( pc_in->hasData( Pointcloud::VERTEX_NORMAL ) )
+	{
+	    const Eigen::Matrix3d rot( 
+		    env->relativeTransform( pc_in->getFrameNode(), pc_out->getFrameNode() ).linear() );
+	    std::vector<Eigen::Vector3d>& normals( pc_out->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL ) );
+	    normals = pc_in->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL );
+	    for( size_t i=0; i<normals.size(); i++ )
+		normals[i] = rot * normals[i];
+	}
+	if( pc_in->hasData( Pointcloud::VERTEX_VARIANCE ) )
+	    pc_out->getVertexData<double>( Pointcloud::VERTEX_VARIANCE ) =
+		pc_in->getVertexData<double>( Pointcloud::VERTEX_VARIANCE );
+	if( pc_in->hasData( Pointcloud::VERTEX_ATTRIBUTES ) )
+	    pc_out->getVertexData<Pointcloud::attr_flag>( Pointcloud::VERTEX_ATTRIBUTES ) =
+		pc_in->getVertexData<Pointcloud::attr_flag>( Pointcloud::VERTEX_ATTRIBUTES );
+    }
+
+    // remove the outliers from the vertices and all per vertex data
+    compact( pc_out->vertices, inliers );
+    if( pc_out->hasData( Pointcloud::VERTEX_COLOR ) )
+	compact( pc_out->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR ), inliers );
+    if( pc_out->hasData( Pointcloud::VERTEX_NORMAL ) )
+	compact( pc_out->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL ), inliers );
+    if( pc_out->hasData( Pointcloud::VERTEX_VARIANCE ) )
+	compact( pc_out->getVertexData<double>( Pointcloud::VERTEX_VARIANCE ), inliers );
+    if( pc_out->hasData( Pointcloud::VERTEX_ATTRIBUTES ) )
+	compact( pc_out->getVertexData<Pointcloud::attr_flag>( Pointcloud::VERTEX_ATTRIBUTES ), inliers );
+
+    env->itemModified( pc_out );
+    return true;
+}
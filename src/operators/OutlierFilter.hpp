@@ -0,0 +1,67 @@
+#ifndef __ENVIRE_OUTLIERFILTER_HPP__
+#define __ENVIRE_OUTLIERFILTER_HPP__
+
+#include <envire/Core.hpp>
+#include <envire/maps/Pointcloud.hpp>
+
+namespace envire {
+    /**
+     * Removes outliers from a pointcloud. Two methods are available:
+     *
+     * - STATISTICAL: for each point the mean distance to its k nearest
+     *   neighbours is computed. Points for which this distance is more than
+     *   stddevMultiplier standard deviations above the mean over all points
+     *   are removed.
+     * - RADIUS: points with less than minNeighbours other points within
+     *   the given radius are removed.
+     *
+     * The remaining points are written to the output together with their
+     * color, normal, variance and attribute data. Input and output may be
+     * the same cloud.
+     */
+    class OutlierFilter : public Operator
+    {
+	ENVIRONMENT_ITEM( OutlierFilter )
+
+    public:
+	enum Method
+	{
+	    STATISTICAL = 0,
+	    RADIUS = 1
+	};
+
+	OutlierFilter();
+
+	void serialize(Serialization& so);
+        void unserialize(Serialization& so);
+
+	void addInput( Pointcloud* input ); 
+	void addOutput( Pointcloud* output ); 
+
+	bool updateAll();
+
+	void setMethod( Method value ) { method = value; }
+	/** STATISTICAL: number of neighbours, default 16 */
+	void setNeighbours( size_t value ) { neighbours = value; }
+	/** STATISTICAL: threshold in standard deviations, default 1.0 */
+	void setStddevMultiplier( double value ) { stddevMultiplier = value; }
+	/** RADIUS: search radius, default 0.1 */
+	void setRadius( double value ) { radius = value; }
+	/** RADIUS: minimum number of neighbours in radius, default 2 */
+	void setMinNeighbours( size_t value ) { minNeighbours = value; }
+	/** number of threads to use, 0 (default) for one per hardware thread */
+	void setThreads( size_t value ) { threads = value; }
+
+	/** computes the inlier flag for each point */
+	void computeInliers( const std::vector<Eigen::Vector3d>& points, std::vector<bool>& inliers );
+
+    protected:
+	Method method;
+	size_t neighbours;
+	double stddevMultiplier;
+	double radius;
+	size_t minNeighbours;
+	size_t threads;
+    };
+}
+#endif
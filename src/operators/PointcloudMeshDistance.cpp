@@ -0,0 +1,143 @@
+#include "PointcloudMeshDistance.hpp"
+
+#include <envire/maps/Pointcloud.hpp>
+#include <envire/maps/TriMesh.hpp>
+#include <envire/tools/TriMeshBVH.hpp>
+
+#include <limits>
+#include <cmath>
+
+using namespace envire;
+
+ENVIRONMENT_ITEM_DEF( PointcloudMeshDistance )
+
+const std::string PointcloudMeshDistance::VERTEX_DISTANCE = "vertex_distance";
+
+PointcloudMeshDistance::PointcloudMeshDistance()
+    : maxDistance( 1.0 ), useSigned( false ), threads( 0 )
+{
+}
+
+void PointcloudMeshDistance::serialize(Serialization& so)
+{
+    Operator::serialize(so);
+    so.write( "max_distance", maxDistance );
+    so.write( "signed", useSigned );
+}
+
+void PointcloudMeshDistance::unserialize(Serialization& so)
+{
+    Operator::unserialize(so);
+    if( so.hasKey( "max_distance" ) )
+	so.read( "max_distance", maxDistance );
+    if( so.hasKey( "signed" ) )
+	so.read( "signed", useSigned );
+}
+
+void PointcloudMeshDistance::addInput( Pointcloud* cloud )
+{
+    std::list<Layer*> inputs = env->getInputs(this);
+    for( std::list<Layer*>::iterator it = inputs.begin(); it != inputs.end(); it++ )
+	if( !dynamic_cast<TriMesh*>( *it ) )
+	    throw std::runtime_error("PointcloudMeshDistance can only have one pointcloud input.");
+
+    Operator::addInput(cloud);
+}
+
+void PointcloudMeshDistance::addInput( TriMesh* mesh )
+{
+    std::list<Layer*> inputs = env->getInputs(this);
+    for( std::list<Layer*>::iterator it = inputs.begin(); it != inputs.end(); it++ )
+	if( dynamic_cast<TriMesh*>( *it ) )
+	    throw std::runtime_error("PointcloudMeshDistance can only have one mesh input.");
+
+    Operator::addInput(mesh);
+}
+
+void PointcloudMeshDistance::addOutput( Pointcloud* distances )
+{
+    if( !env->getOutputs(this).empty() )
+        throw std::runtime_error("PointcloudMeshDistance can only have one output.");
+
+    Operator::addOutput(distances);
+}
+
+bool PointcloudMeshDistance::updateAll()
+{
+    Pointcloud* cloud = NULL;
+    TriMesh* mesh = NULL;
+    std::list<Layer*> inputs = env->getInputs(this);
+    for( std::list<Layer*>::iterator it = inputs.begin(); it != inputs.end(); it++ )
+    {
+	if( TriMesh* m = dynamic_cast<TriMesh*>( *it ) )
+	    mesh = m;
+	else if( Pointcloud* pc = dynamic_cast<Pointcloud*>( *it ) )
+	    cloud = pc;
+    }
+    if( !cloud || !mesh )
+	throw std::runtime_error("PointcloudMeshDistance: needs a Pointcloud and a TriMesh input.");
+
+    Pointcloud* output = NULL;
+    std::list<Layer*> outputs = env->getOutputs(this);
+    if( !outputs.empty() )
+	output = dynamic_cast<Pointcloud*>( outputs.front() );
+
+    // the vertices are accessed directly
+    cloud->touch();
+    mesh->touch();
+
+    const Transform C_cloud2mesh( env->relativeTransform( cloud->getFrameNode(), mesh->getFrameNode() ) );
+    TriMeshBVH::PointVector points;
+    points.reserve( cloud->vertices.size() );
+    for( size_t i=0; i<cloud->vertices.size(); i++ )
+	points.push_back( C_cloud2mesh * cloud->vertices[i] );
+
+    TriMeshBVH bvh( *mesh, 4, threads );
+    TriMeshBVH::HitVector hits;
+    bvh.closestPoint( points, maxDistance, hits );
+
+    std::vector<double> distances( hits.size() );
+    statistics = Statistics();
+    double sum = 0, sumSq = 0;
+    for( size_t i=0; i<hits.size(); i++ )
+    {
+	const TriMeshBVH::Hit& hit( hits[i] );
+	if( hit.distance == std::numeric_limits<double>::infinity() )
+	{
+	    distances[i] = std::numeric_limits<double>::quiet_NaN();
+	    statistics.outliers++;
+	    continue;
+	}
+
+	double d = hit.distance;
+	if( useSigned && (points[i] - hit.point).dot( hit.normal ) < 0 )
+	    d = -d;
+	distances[i] = d;
+
+	statistics.inliers++;
+	statistics.max = std::max( statistics.max, hit.distance );
+	sum += d;
+	sumSq += d * d;
+    }
+    if( statistics.inliers )
+    {
+	statistics.mean = sum / statistics.inliers;
+	statistics.rms = std::sqrt( sumSq / statistics.inliers );
+    }
+
+    if( output )
+    {
+	if( output != cloud )
+	{
+	    const Transform C_cloud2out( env->relativeTransform( cloud->getFrameNode(), output->getFrameNode() ) );
+	    output->clear();
+	    output->vertices.reserve( cloud->vertices.size() );
+	    for( size_t i=0; i<cloud->vertices.size(); i++ )
+		output->vertices.push_back( C_cloud2out * cloud->vertices[i] );
+	}
+	output->getVertexData<double>( VERTEX_DISTANCE ).swap( distances );
+	env->itemModified( output );
+    }
+
+    return true;
+}
@@ -0,0 +1,85 @@
+#ifndef __ENVIRE_POINTCLOUDMESHDISTANCE_HPP__
+#define __ENVIRE_POINTCLOUDMESHDISTANCE_HPP__
+
+#include <envire/Core.hpp>
+
+namespace envire {
+    class Pointcloud;
+    class TriMesh;
+
+    /**
+     * Computes the distance of the points of a Pointcloud to a TriMesh, e.g.
+     * to evaluate the accuracy of a reconstructed mesh against a reference
+     * scan.
+     *
+     * The operator takes a Pointcloud and a TriMesh as input, which are
+     * aligned through their FrameNodes. The closest point on the mesh is
+     * found for all points in parallel, using a TriMeshBVH. Points without a
+     * face within the maximum distance are counted as outliers.
+     *
+     * The statistics of the distances of the inliers are available through
+     * getStatistics() after an update. If a Pointcloud output is given, it
+     * receives the points of the input in its own frame, with the distance
+     * of each point in the VERTEX_DISTANCE data, which is NaN for outliers.
+     * The output can also be the input cloud itself, in which case only the
+     * distance data is added.
+     *
+     * With signed distances, points behind the closest face, according to
+     * its winding order, have a negative distance.
+     */
+    class PointcloudMeshDistance : public Operator
+    {
+	ENVIRONMENT_ITEM( PointcloudMeshDistance )
+
+    public:
+	/** vertex data of the output with the distance of each point */
+	static const std::string VERTEX_DISTANCE;
+
+	struct Statistics
+	{
+	    size_t inliers;
+	    size_t outliers;
+	    /** mean and root mean square of the distances */
+	    double mean;
+	    double rms;
+	    /** largest absolute distance */
+	    double max;
+
+	    Statistics() : inliers( 0 ), outliers( 0 ), mean( 0 ), rms( 0 ), max( 0 ) {}
+	};
+
+    public:
+	PointcloudMeshDistance();
+
+	void serialize(Serialization& so);
+        void unserialize(Serialization& so);
+
+	/** the points to evaluate */
+	void addInput( Pointcloud* cloud );
+	/** the reference surface */
+	void addInput( TriMesh* mesh );
+	/** receives the points with their distances */
+	void addOutput( Pointcloud* distances );
+
+	bool updateAll();
+
+	/** points further away from the mesh are outliers, default 1.0 */
+	void setMaxDistance( double value ) { maxDistance = value; }
+	double getMaxDistance() const { return maxDistance; }
+	/** use signed distances, default false */
+	void setSigned( bool value ) { useSigned = value; }
+	bool getSigned() const { return useSigned; }
+	/** number of threads to use, 0 (default) for one per hardware thread */
+	void setThreads( size_t value ) { threads = value; }
+
+	/** @return the statistics of the last update */
+	const Statistics& getStatistics() const { return statistics; }
+
+    protected:
+	double maxDistance;
+	bool useSigned;
+	size_t threads;
+	Statistics statistics;
+    };
+}
+#endif
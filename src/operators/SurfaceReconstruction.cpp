@@ -109,6 +109,8 @@ bool SurfaceReconstruction::updateAll()
     }
 
     std::cout << "copied to cgal struct" << std::endl;
+    checkCancelled();
+    reportProgress( 0.1 );
  
     // Reconstruction typedefs
     typedef CGAL::Poisson_reconstruction_function<Kernel> Poisson_reconstruction_function;
@@ -134,6 +136,8 @@ bool SurfaceReconstruction::updateAll()
     // at each vertex of the triangulation.
     if ( ! function.compute_implicit_function() )
       return false;
+    checkCancelled();
+    reportProgress( 0.4 );
 
     // Computes average spacing
     FT average_spacing = CGAL::compute_average_spacing(points.begin(), points.end(),
@@ -165,6 +169,8 @@ bool SurfaceReconstruction::updateAll()
                             surface,                              // implicit surface
                             criteria,                             // meshing criteria
                             CGAL::Manifold_with_boundary_tag());  // require manifold mesh
+    checkCancelled();
+    reportProgress( 0.8 );
 
     
 
@@ -220,6 +226,7 @@ bool SurfaceReconstruction::updateAll()
 
     std::cout << "copied faces " << mesh_out->faces.size() << std::endl;
 
+    return true;
 }
 
 
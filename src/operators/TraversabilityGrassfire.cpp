@@ -1,5 +1,6 @@
 #include "TraversabilityGrassfire.hpp"
 #include <maps/MLSGrid.hpp>
+#include <algorithm>
 
 using namespace envire;
 using envire::Grid;
@@ -408,6 +409,9 @@ void TraversabilityGrassfire::computeTraversability()
     
     for(size_t y = 0;y < maxY; y++)
     {
+        checkCancelled();
+        reportProgress(0.5 + 0.5 * y / maxY);
+
         for(size_t x = 0;x < maxX; x++)
         {
             setTraversability(x, y);
@@ -449,8 +453,18 @@ bool envire::TraversabilityGrassfire::updateAll()
         return false;
     }
     
+    // the search is polled every few cells, and its progress is estimated
+    // from the number of cells in the grid
+    const size_t cellCount = mlsGrid->getCellSizeX() * mlsGrid->getCellSizeY();
+    size_t searched = 0;
     while(!searchList.empty())
     {
+        if(++searched % 4096 == 0)
+        {
+            checkCancelled();
+            reportProgress(0.5 * std::min(1.0, static_cast<double>(searched) / cellCount));
+        }
+
         SearchItem next = searchList.front();
         searchList.pop();
         
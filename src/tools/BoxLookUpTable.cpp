@@ -11,6 +11,16 @@ BoxLookUpTable::BoxLookUpTable() : scale(0), sizeX(0), sizeY(0), maxDistFromBox(
 {
 
 }
+
+BoxLookUpTable::BoxLookUpTable(double scale, double sizeX, double sizeY, double maxDistFromBox) : scale(0), sizeX(0), sizeY(0), maxDistFromBox(0), distanceTable(NULL)
+{
+    recompute(scale, sizeX, sizeY, maxDistFromBox);
+}
+
+BoxLookUpTable::~BoxLookUpTable()
+{
+    delete[] distanceTable;
+}
     
 void BoxLookUpTable::recompute(double scalei, double sizeXi, double sizeYi, double maxDistFromBox)
 {
@@ -52,7 +62,7 @@ void BoxLookUpTable::computeDistances()
     if(distanceTable)
         delete[] distanceTable;
         
-    distanceTable = new double[cellSizeX * cellSizeY];
+    distanceTable = new float[cellSizeX * cellSizeY];
     
     for(int y = 0; y < cellSizeY; y++)
     {
@@ -108,13 +118,13 @@ void BoxLookUpTable::computeDistances()
                 }
             }
 
-            distanceTable[cellSizeX * yi + xi] = std::max(dist, distanceTable[cellSizeX * yi + xi]);
+            distanceTable[cellSizeX * yi + xi] = std::max((float)dist, distanceTable[cellSizeX * yi + xi]);
 
         }
     }
 }
 
-const double& BoxLookUpTable::getDistanceToBox(double xp, double yp) const
+float BoxLookUpTable::getDistanceToBox(double xp, double yp) const
 {
     if(!distanceTable)
         throw std::runtime_error("BoxLookUpTable::Lookup table is not computed");    
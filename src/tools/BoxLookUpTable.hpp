@@ -10,21 +10,26 @@ class BoxLookUpTable
 
 public:
     BoxLookUpTable();
+    BoxLookUpTable(double scale, double sizeX, double sizeY, double maxDistFromBox);
+    ~BoxLookUpTable();
     
-    const double& getDistanceToBox(double x, double y) const;
+    float getDistanceToBox(double x, double y) const;
     
     void recompute(double scale, double sizeX, double sizeY, double maxDistFromBox);
     
     void printDebug();
     
 private:
+    BoxLookUpTable(const BoxLookUpTable&);
+    BoxLookUpTable& operator=(const BoxLookUpTable&);
+
     void computeDistances();
     
     double scale;
     double sizeX;
     double sizeY;
     double maxDistFromBox;
-    double *distanceTable;
+    float *distanceTable;
     
     int cellSizeX;
     int cellSizeY;
@@ -0,0 +1,319 @@
+#include "EnvironmentMerge.hpp"
+#include "ParallelFor.hpp"
+
+#include <envire/maps/MLSGrid.hpp>
+#include <envire/maps/Pointcloud.hpp>
+#include <envire/operators/MergeMLS.hpp>
+#include <envire/operators/MergePointcloud.hpp>
+
+#include <boost/scoped_ptr.hpp>
+#include <stdexcept>
+#include <set>
+
+using namespace envire;
+
+namespace
+{
+    /** the links of the items in the source environment */
+    struct Links
+    {
+	std::vector<std::pair<FrameNode*, FrameNode*> > frameTree;
+	std::vector<std::pair<CartesianMap*, FrameNode*> > frameNodes;
+	std::vector<std::pair<Layer*, Layer*> > layerTree;
+	std::vector<std::pair<Operator*, Layer*> > inputs;
+	std::vector<std::pair<Operator*, Layer*> > outputs;
+	/** layers which are part of the layer tree or the operator graph */
+	std::set<Layer*> connected;
+    };
+
+    bool isFusable( const Layer* layer )
+    {
+	return layer->getClassName() == MLSGrid::className
+	    || layer->getClassName() == Pointcloud::className;
+    }
+
+    bool hasSameData( Pointcloud* a, Pointcloud* b )
+    {
+	return a->hasData( Pointcloud::VERTEX_NORMAL ) == b->hasData( Pointcloud::VERTEX_NORMAL )
+	    && a->hasData( Pointcloud::VERTEX_COLOR ) == b->hasData( Pointcloud::VERTEX_COLOR );
+    }
+
+    /** runs the merge operators, and keeps the errors, as parallelFor()
+     * doesn't allow exceptions */
+    struct FuseFunc
+    {
+	std::vector<Operator*>& operators;
+	std::vector<std::string> errors;
+
+	explicit FuseFunc( std::vector<Operator*>& operators )
+	    : operators( operators ), errors( operators.size() ) {}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    for( size_t i=begin; i<end; i++ )
+	    {
+		try
+		{
+		    // MergeMLS doesn't notify the environment, the
+		    // pointcloud merge is done without the notification
+		    MergePointcloud* mp = dynamic_cast<MergePointcloud*>( operators[i] );
+		    if( mp )
+			mp->merge();
+		    else
+			operators[i]->updateAll();
+		}
+		catch( const std::exception& e )
+		{
+		    errors[i] = e.what();
+		}
+	    }
+	}
+    };
+}
+
+EnvironmentMerge::EnvironmentMerge( Environment* target )
+    : target( target ), prefix( target->getEnvironmentPrefix() ),
+    fuseLayers( false ), threads( 0 )
+{
+}
+
+void EnvironmentMerge::setImportPrefix( std::string prefix )
+{
+    if (prefix.empty() || *prefix.begin() != '/')
+        prefix = "/" + prefix;
+    if (*prefix.rbegin() != '/')
+        prefix += "/";
+    this->prefix = prefix;
+}
+
+std::string EnvironmentMerge::remapId( const std::string& id ) const
+{
+    // the ids of attached items always start with '/'
+    std::string res = prefix + id.substr( 1 );
+
+    // a trailing '/' makes the environment append a new numeric id
+    if( target->getItem( res ) )
+	res = res.substr( 0, res.rfind( '/' ) + 1 );
+
+    return res;
+}
+
+FrameNode* EnvironmentMerge::import( const std::string& path, const TransformWithUncertainty& alignment, FrameNode* parent )
+{
+    boost::scoped_ptr<Environment> source( Environment::unserialize( path ) );
+    return import( source.get(), alignment, parent );
+}
+
+FrameNode* EnvironmentMerge::import( Environment* source, const TransformWithUncertainty& alignment, FrameNode* parent )
+{
+    assert( source != target );
+    if( !parent )
+	parent = target->getRootNode();
+    if( parent->getEnvironment() != target )
+	throw std::runtime_error("EnvironmentMerge: parent frame is not part of the target environment.");
+
+    idMap.clear();
+
+    // the layers of the target which can be fused with the imported ones
+    std::vector<Layer*> existing;
+    if( fuseLayers )
+    {
+	std::vector<Layer*> layers = target->getItems<Layer>();
+	for( size_t i=0; i<layers.size(); i++ )
+	    if( isFusable( layers[i] ) )
+		existing.push_back( layers[i] );
+    }
+
+    FrameNode* sourceRoot = source->getRootNode();
+    std::vector<EnvironmentItem*> items;
+    {
+	std::vector<EnvironmentItem*> all = source->getItems<EnvironmentItem>();
+	for( size_t i=0; i<all.size(); i++ )
+	    if( all[i] != sourceRoot )
+		items.push_back( all[i] );
+    }
+
+    // collect the links in the source, as they are removed when the items
+    // are detached
+    Links links;
+    for( size_t i=0; i<items.size(); i++ )
+    {
+	EnvironmentItem* item = items[i];
+	if( FrameNode* fn = dynamic_cast<FrameNode*>( item ) )
+	{
+	    FrameNode* fnParent = source->getParent( fn );
+	    if( fnParent )
+		links.frameTree.push_back( std::make_pair( fnParent, fn ) );
+	}
+	if( CartesianMap* map = dynamic_cast<CartesianMap*>( item ) )
+	{
+	    FrameNode* fn = source->getFrameNode( map );
+	    if( fn )
+		links.frameNodes.push_back( std::make_pair( map, fn ) );
+	}
+	if( Layer* layer = dynamic_cast<Layer*>( item ) )
+	{
+	    std::list<Layer*> children = source->getChildren( layer );
+	    for( std::list<Layer*>::iterator it = children.begin(); it != children.end(); it++ )
+	    {
+		links.layerTree.push_back( std::make_pair( layer, *it ) );
+		links.connected.insert( layer );
+		links.connected.insert( *it );
+	    }
+	}
+	if( Operator* op = dynamic_cast<Operator*>( item ) )
+	{
+	    std::list<Layer*> inputs = source->getInputs( op );
+	    for( std::list<Layer*>::iterator it = inputs.begin(); it != inputs.end(); it++ )
+	    {
+		links.inputs.push_back( std::make_pair( op, *it ) );
+		links.connected.insert( *it );
+	    }
+	    std::list<Layer*> outputs = source->getOutputs( op );
+	    for( std::list<Layer*>::iterator it = outputs.begin(); it != outputs.end(); it++ )
+	    {
+		links.outputs.push_back( std::make_pair( op, *it ) );
+		links.connected.insert( *it );
+	    }
+	}
+    }
+
+    // move the items over, the pointers keep them alive in between
+    std::vector<EnvironmentItem::Ptr> detached;
+    for( size_t i=0; i<items.size(); i++ )
+	detached.push_back( source->detachItem( items[i] ) );
+
+    FrameNode* frame = new FrameNode( alignment );
+    target->attachItem( frame );
+    target->addChild( parent, frame );
+
+    std::vector<Layer*> imported;
+    for( size_t i=0; i<items.size(); i++ )
+    {
+	EnvironmentItem* item = items[i];
+	const std::string oldId = item->getUniqueId();
+	item->setUniqueId( remapId( oldId ) );
+	target->attachItem( item );
+	idMap[oldId] = item->getUniqueId();
+
+	Layer* layer = dynamic_cast<Layer*>( item );
+	if( layer && isFusable( layer ) && !links.connected.count( layer ) )
+	    imported.push_back( layer );
+    }
+
+    for( size_t i=0; i<links.frameTree.size(); i++ )
+    {
+	FrameNode* fnParent = links.frameTree[i].first;
+	target->addChild( fnParent == sourceRoot ? frame : fnParent, links.frameTree[i].second );
+    }
+    for( size_t i=0; i<links.frameNodes.size(); i++ )
+    {
+	FrameNode* fn = links.frameNodes[i].second;
+	target->setFrameNode( links.frameNodes[i].first, fn == sourceRoot ? frame : fn );
+    }
+    for( size_t i=0; i<links.layerTree.size(); i++ )
+	target->addChild( links.layerTree[i].first, links.layerTree[i].second );
+    for( size_t i=0; i<links.inputs.size(); i++ )
+	target->addInput( links.inputs[i].first, links.inputs[i].second );
+    for( size_t i=0; i<links.outputs.size(); i++ )
+	target->addOutput( links.outputs[i].first, links.outputs[i].second );
+
+    if( fuseLayers && !imported.empty() && !existing.empty() )
+	fuse( imported, existing );
+
+    return frame;
+}
+
+void EnvironmentMerge::fuse( const std::vector<Layer*>& imported, const std::vector<Layer*>& existing )
+{
+    // match each imported layer with the only existing layer of the same
+    // class and label
+    typedef std::map<Layer*, std::vector<Layer*> > FusionMap;
+    FusionMap fusions;
+    for( size_t i=0; i<imported.size(); i++ )
+    {
+	Layer* layer = imported[i];
+	Layer* match = NULL;
+	size_t count = 0;
+	for( size_t j=0; j<existing.size(); j++ )
+	{
+	    if( existing[j]->getClassName() == layer->getClassName()
+		    && existing[j]->getLabel() == layer->getLabel() )
+	    {
+		match = existing[j];
+		count++;
+	    }
+	}
+	if( count != 1 )
+	    continue;
+
+	Pointcloud* pc = dynamic_cast<Pointcloud*>( layer );
+	if( pc && !hasSameData( pc, static_cast<Pointcloud*>( match ) ) )
+	    continue;
+
+	fusions[match].push_back( layer );
+    }
+
+    if( fusions.empty() )
+	return;
+
+    // one merge operator for each target layer
+    std::vector<Operator*> operators;
+    std::vector<Layer*> outputs;
+    for( FusionMap::iterator it = fusions.begin(); it != fusions.end(); it++ )
+    {
+	Operator* op;
+	if( dynamic_cast<MLSGrid*>( it->first ) )
+	    op = new MergeMLS();
+	else
+	{
+	    MergePointcloud* mp = new MergePointcloud();
+	    mp->setClearOutput( false );
+	    op = mp;
+	}
+	target->attachItem( op );
+	for( size_t i=0; i<it->second.size(); i++ )
+	    target->addInput( op, it->second[i] );
+	target->addOutput( op, it->first );
+
+	operators.push_back( op );
+	outputs.push_back( it->first );
+    }
+
+    // evicted layers can only be restored from this thread
+    for( FusionMap::iterator it = fusions.begin(); it != fusions.end(); it++ )
+    {
+	it->first->touch();
+	for( size_t i=0; i<it->second.size(); i++ )
+	    it->second[i]->touch();
+    }
+
+    FuseFunc func( operators );
+    parallelFor( operators.size(), func, threads, 1 );
+
+    // the environment is only modified from this thread
+    std::string error;
+    size_t i = 0;
+    for( FusionMap::iterator it = fusions.begin(); it != fusions.end(); it++, i++ )
+    {
+	target->detachItem( operators[i] );
+	if( !func.errors[i].empty() )
+	{
+	    error = func.errors[i];
+	    continue;
+	}
+
+	target->itemModified( outputs[i] );
+	for( size_t j=0; j<it->second.size(); j++ )
+	{
+	    Layer* layer = it->second[j];
+	    for( std::map<std::string, std::string>::iterator id = idMap.begin(); id != idMap.end(); id++ )
+		if( id->second == layer->getUniqueId() )
+		    id->second = outputs[i]->getUniqueId();
+	    target->detachItem( layer );
+	}
+    }
+
+    if( !error.empty() )
+	throw std::runtime_error("EnvironmentMerge: fusing layers failed: " + error);
+}
@@ -0,0 +1,100 @@
+#ifndef __ENVIRE_TOOLS_ENVIRONMENTMERGE_HPP__
+#define __ENVIRE_TOOLS_ENVIRONMENTMERGE_HPP__
+
+#include <envire/Core.hpp>
+#include <map>
+#include <vector>
+#include <string>
+
+namespace envire
+{
+
+/**
+ * Imports the content of other environments, e.g. the maps of a previous
+ * mapping session, into a target environment.
+ *
+ * All items of the source environment are moved to the target
+ * environment, with the exception of the source root node. Instead, a new
+ * FrameNode is created in the target, which takes the place of the source
+ * root. Its transform is the alignment of the source session relative to
+ * the given parent frame, e.g. the result of an ICP run between the maps
+ * of the two sessions. The frame tree, the layer tree, the frame nodes of
+ * the maps and the inputs and outputs of the operators are restored in the
+ * target.
+ *
+ * The unique ids of the imported items are remapped into the import
+ * prefix, which defaults to the prefix of the target environment. An item
+ * keeps the rest of its id, unless it is already used in the target, in
+ * which case a new numeric id is given. The mapping from the old ids to
+ * the new ones is available through getIdMap().
+ *
+ * Optionally, imported layers are fused into existing layers of the target
+ * of the same class and label, if there is exactly one such layer. This is
+ * done for MLSGrid layers using MergeMLS, and for Pointcloud layers using
+ * MergePointcloud. Only layers which are not part of the layer tree or the
+ * operator graph are fused, and pointclouds only if they have the same
+ * normal and color data. The merges for the different target layers are
+ * run in parallel. The fused layers are removed after the merge, and map
+ * to the target layer in the id map.
+ */
+class EnvironmentMerge
+{
+public:
+    /** @param target environment the items are imported into */
+    explicit EnvironmentMerge( Environment* target );
+
+    /** sets the prefix for the ids of the imported items. The prefix is
+     * normalized to start and end with '/'. */
+    void setImportPrefix( std::string prefix );
+    std::string getImportPrefix() const { return prefix; }
+
+    /** enables fusing imported MLSGrid and Pointcloud layers into the
+     * matching layers of the target. Disabled by default. */
+    void setFuseLayers( bool fuse ) { fuseLayers = fuse; }
+    bool getFuseLayers() const { return fuseLayers; }
+
+    /** sets the number of threads used for fusing layers, 0 to use one per
+     * hardware thread */
+    void setThreadCount( size_t threads ) { this->threads = threads; }
+
+    /**
+     * Moves all items of @a source into the target environment. The source
+     * only contains its root node afterwards.
+     *
+     * @param alignment transform of the source root frame in the @a parent
+     *        frame
+     * @param parent frame the source is attached to, the root node of the
+     *        target if NULL
+     * @return the FrameNode which replaces the root node of the source
+     */
+    FrameNode* import( Environment* source, const TransformWithUncertainty& alignment, FrameNode* parent = NULL );
+
+    /** @overload
+     *
+     * Loads a serialized environment from @a path and imports it.
+     */
+    FrameNode* import( const std::string& path, const TransformWithUncertainty& alignment, FrameNode* parent = NULL );
+
+    /** @return the ids of the last import in the target environment,
+     * indexed by the ids they had in the source environment */
+    const std::map<std::string, std::string>& getIdMap() const { return idMap; }
+
+private:
+    /** @return the id an item of the source is attached with */
+    std::string remapId( const std::string& id ) const;
+
+    /** fuses the imported layers into the layers which were in the target
+     * before the import */
+    void fuse( const std::vector<Layer*>& imported, const std::vector<Layer*>& existing );
+
+    Environment* target;
+    std::string prefix;
+    bool fuseLayers;
+    size_t threads;
+
+    std::map<std::string, std::string> idMap;
+};
+
+}
+
+#endif
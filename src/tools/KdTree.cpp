@@ -0,0 +1,193 @@
+#include "KdTree.hpp"
+
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <limits>
+
+#include "ParallelFor.hpp"
+
+using namespace envire;
+
+namespace
+{
+    struct AxisCompare
+    {
+	const std::vector<Eigen::Vector3d>& points;
+	int axis;
+
+	AxisCompare( const std::vector<Eigen::Vector3d>& points, int axis )
+	    : points( points ), axis( axis ) {}
+
+	bool operator()( KdTree::index_t a, KdTree::index_t b ) const
+	{
+	    return points[a][axis] < points[b][axis];
+	}
+    };
+}
+
+KdTree::KdTree( size_t leafSize )
+    : leafSize( std::max( leafSize, (size_t)1 ) ), points( NULL )
+{
+}
+
+size_t KdTree::getNodeCount( size_t n ) const
+{
+    // the tree is always split at n/2, so the node layout only
+    // depends on the number of points
+    if( n <= leafSize )
+	return 1;
+    return 1 + getNodeCount( n / 2 ) + getNodeCount( n - n / 2 );
+}
+
+void KdTree::build( const std::vector<Eigen::Vector3d>& points, size_t threads )
+{
+    this->points = &points;
+    indices.resize( points.size() );
+    for( size_t i=0; i<indices.size(); i++ )
+	indices[i] = i;
+
+    nodes.clear();
+    if( points.empty() )
+	return;
+
+    // since the position of every node is known in advance, the subtrees
+    // can be built from different threads without any locking
+    nodes.resize( getNodeCount( points.size() ) );
+
+    int parallelDepth = 0;
+    for( size_t t = getThreadCount( threads ); t > 1; t /= 2 )
+	parallelDepth++;
+
+    buildNode( 0, 0, points.size(), parallelDepth );
+}
+
+void KdTree::buildNode( size_t node, size_t begin, size_t end, int parallelDepth )
+{
+    Node &n( nodes[node] );
+    n.begin = begin;
+    n.end = end;
+    n.right = 0;
+
+    const size_t count = end - begin;
+    if( count <= leafSize )
+    {
+	n.axis = -1;
+	n.split = 0;
+	return;
+    }
+
+    // split along the axis with the largest extent
+    Eigen::Vector3d min( Eigen::Vector3d::Constant( std::numeric_limits<double>::infinity() ) );
+    Eigen::Vector3d max( -min );
+    for( size_t i=begin; i<end; i++ )
+    {
+	min = min.cwiseMin( (*points)[indices[i]] );
+	max = max.cwiseMax( (*points)[indices[i]] );
+    }
+    int axis;
+    (max - min).maxCoeff( &axis );
+
+    const size_t mid = begin + count / 2;
+    std::nth_element( indices.begin() + begin, indices.begin() + mid, indices.begin() + end,
+	    AxisCompare( *points, axis ) );
+
+    n.axis = axis;
+    n.split = (*points)[indices[mid]][axis];
+    n.right = node + 1 + getNodeCount( count / 2 );
+
+    const size_t right = n.right;
+    if( parallelDepth > 0 && count > 4096 )
+    {
+	// the two subtrees work on disjoint ranges of the index and node
+	// arrays, so build the left one in a separate thread
+	boost::thread left( boost::bind( &KdTree::buildNode, this, node + 1, begin, mid, parallelDepth - 1 ) );
+	buildNode( right, mid, end, parallelDepth - 1 );
+	left.join();
+    }
+    else
+    {
+	buildNode( node + 1, begin, mid, 0 );
+	buildNode( right, mid, end, 0 );
+    }
+}
+
+void KdTree::findNearest( const Eigen::Vector3d& query, size_t k, std::vector<Neighbour>& result, double maxDist ) const
+{
+    result.clear();
+    if( nodes.empty() || k == 0 )
+	return;
+
+    double maxSqDist = maxDist < 0 ? std::numeric_limits<double>::infinity() : maxDist * maxDist;
+    result.reserve( k + 1 );
+    searchNearest( 0, query, k, result, maxSqDist );
+    std::sort_heap( result.begin(), result.end() );
+}
+
+void KdTree::searchNearest( size_t node, const Eigen::Vector3d& query, size_t k,
+	std::vector<Neighbour>& heap, double& maxSqDist ) const
+{
+    const Node &n( nodes[node] );
+    if( n.axis < 0 )
+    {
+	for( size_t i=n.begin; i<n.end; i++ )
+	{
+	    const double d = (query - (*points)[indices[i]]).squaredNorm();
+	    if( d <= maxSqDist )
+	    {
+		// the heap is a max heap on the distance, so the front
+		// is always the worst of the k candidates
+		heap.push_back( Neighbour( indices[i], d ) );
+		std::push_heap( heap.begin(), heap.end() );
+		if( heap.size() > k )
+		{
+		    std::pop_heap( heap.begin(), heap.end() );
+		    heap.pop_back();
+		}
+		if( heap.size() == k )
+		    maxSqDist = heap.front().sqDist;
+	    }
+	}
+	return;
+    }
+
+    // descend into the side of the query first
+    const double diff = query[n.axis] - n.split;
+    const size_t first = diff < 0 ? node + 1 : n.right;
+    const size_t second = diff < 0 ? n.right : node + 1;
+
+    searchNearest( first, query, k, heap, maxSqDist );
+    if( diff * diff <= maxSqDist )
+	searchNearest( second, query, k, heap, maxSqDist );
+}
+
+void KdTree::findInRadius( const Eigen::Vector3d& query, double radius, std::vector<Neighbour>& result ) const
+{
+    result.clear();
+    if( nodes.empty() )
+	return;
+
+    searchRadius( 0, query, radius * radius, result );
+}
+
+void KdTree::searchRadius( size_t node, const Eigen::Vector3d& query, double sqRadius,
+	std::vector<Neighbour>& result ) const
+{
+    const Node &n( nodes[node] );
+    if( n.axis < 0 )
+    {
+	for( size_t i=n.begin; i<n.end; i++ )
+	{
+	    const double d = (query - (*points)[indices[i]]).squaredNorm();
+	    if( d <= sqRadius )
+		result.push_back( Neighbour( indices[i], d ) );
+	}
+	return;
+    }
+
+    const double diff = query[n.axis] - n.split;
+    if( diff < 0 || diff * diff <= sqRadius )
+	searchRadius( node + 1, query, sqRadius, result );
+    if( diff >= 0 || diff * diff <= sqRadius )
+	searchRadius( n.right, query, sqRadius, result );
+}
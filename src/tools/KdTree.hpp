@@ -0,0 +1,92 @@
+#ifndef __ENVIRE_TOOLS_KDTREE_HPP__
+#define __ENVIRE_TOOLS_KDTREE_HPP__
+
+#include <Eigen/Core>
+#include <vector>
+#include <stdint.h>
+
+namespace envire
+{
+
+/**
+ * Static kd-tree over a set of 3D points, which supports k-nearest
+ * neighbour and radius queries.
+ *
+ * The tree is balanced and built in parallel. It stores only the indices
+ * of the points and a reference to the point array, which must stay valid
+ * and unchanged as long as the tree is used. Once built, the tree is read
+ * only, so queries can be run concurrently from several threads.
+ */
+class KdTree
+{
+public:
+    typedef uint32_t index_t;
+
+    /** result of a query, index of the point and squared distance */
+    struct Neighbour
+    {
+	index_t index;
+	double sqDist;
+
+	Neighbour() {}
+	Neighbour( index_t index, double sqDist ) : index( index ), sqDist( sqDist ) {}
+
+	bool operator<( const Neighbour& other ) const { return sqDist < other.sqDist; }
+    };
+
+    /** @param leafSize maximum number of points in a leaf */
+    explicit KdTree( size_t leafSize = 16 );
+
+    /** Builds the tree over the given points.
+     *
+     * @param threads number of threads to use, 0 to use one per hardware thread
+     */
+    void build( const std::vector<Eigen::Vector3d>& points, size_t threads = 0 );
+
+    /** Finds the k nearest neighbours of the query point, sorted by
+     * distance. If maxDist is given, only points within that distance are
+     * returned. A query point that is part of the set will be returned
+     * as its own neighbour.
+     */
+    void findNearest( const Eigen::Vector3d& query, size_t k, std::vector<Neighbour>& result,
+	    double maxDist = -1.0 ) const;
+
+    /** Finds all points within radius of the query point. The result is not
+     * sorted. */
+    void findInRadius( const Eigen::Vector3d& query, double radius, std::vector<Neighbour>& result ) const;
+
+    /** @return the number of points in the tree */
+    size_t size() const { return indices.size(); }
+
+    /** @return the point array the tree was built on */
+    const std::vector<Eigen::Vector3d>& getPoints() const { return *points; }
+
+private:
+    struct Node
+    {
+	/** split axis, or -1 for a leaf */
+	int axis;
+	double split;
+	/** range in the indices array */
+	index_t begin, end;
+	/** the left child is always the next node, this is the right child */
+	index_t right;
+    };
+
+    size_t getNodeCount( size_t n ) const;
+    void buildNode( size_t node, size_t begin, size_t end, int parallelDepth );
+
+    void searchNearest( size_t node, const Eigen::Vector3d& query, size_t k,
+	    std::vector<Neighbour>& heap, double& maxSqDist ) const;
+    void searchRadius( size_t node, const Eigen::Vector3d& query, double sqRadius,
+	    std::vector<Neighbour>& result ) const;
+
+    size_t leafSize;
+    const std::vector<Eigen::Vector3d>* points;
+    std::vector<index_t> indices;
+    std::vector<Node> nodes;
+};
+
+}
+
+#endif
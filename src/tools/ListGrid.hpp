@@ -261,6 +261,13 @@ public:
 	return res; 
     }
 
+    /** @return the approximate number of bytes used by the grid, if it
+     * holds @a count elements */
+    size_t getMemoryUsage( size_t count ) const
+    {
+	return cells.num_elements() * sizeof(Item*) + count * sizeof(Item);
+    }
+
     void clear()
     {
 
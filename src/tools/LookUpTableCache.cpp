@@ -0,0 +1,121 @@
+#include "LookUpTableCache.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace envire;
+
+namespace
+{
+    long long quantize( double value )
+    {
+	return static_cast<long long>( floor( value * 1e6 + 0.5 ) );
+    }
+
+    // created during static initialization, before any thread can use it
+    LookUpTableCache globalCache;
+}
+
+LookUpTableCache::Key::Key( double scale, double sizeX, double sizeY, double borderWidth )
+    : scale( quantize( scale ) ), sizeX( quantize( sizeX ) ), sizeY( quantize( sizeY ) ), 
+    borderWidth( quantize( borderWidth ) )
+{
+}
+
+bool LookUpTableCache::Key::operator<( const Key& other ) const
+{
+    if( scale != other.scale )
+	return scale < other.scale;
+    if( sizeX != other.sizeX )
+	return sizeX < other.sizeX;
+    if( sizeY != other.sizeY )
+	return sizeY < other.sizeY;
+    return borderWidth < other.borderWidth;
+}
+
+LookUpTableCache::LookUpTableCache( size_t maxEntries )
+    : maxEntries( std::max( maxEntries, (size_t)1 ) )
+{
+}
+
+LookUpTableCache& LookUpTableCache::getInstance()
+{
+    return globalCache;
+}
+
+LookUpTableCache::Entry LookUpTableCache::compute( double scale, double sizeX, double sizeY, double borderWidth )
+{
+    Entry entry;
+    entry.radial.reset( new RadialLookUpTable( scale, std::max( sizeX, sizeY ) ) );
+    //note the scale should be higher than the grid scale because 
+    //of the roation. Else we get aliasing problems.
+    entry.box.reset( new BoxLookUpTable( scale / 10.0, sizeX, sizeY, borderWidth * 2 ) );
+    return entry;
+}
+
+LookUpTableCache::Entry LookUpTableCache::get( double scale, double sizeX, double sizeY, double borderWidth )
+{
+    const Key key( scale, sizeX, sizeY, borderWidth );
+    {
+	boost::mutex::scoped_lock lock( mutex );
+	EntryMap::iterator it = entries.find( key );
+	if( it != entries.end() )
+	{
+	    usage.splice( usage.begin(), usage, it->second.second );
+	    return it->second.first;
+	}
+    }
+
+    // computing the tables can take a while, so don't block other
+    // lookups in the meantime. If another thread computed the same
+    // entry concurrently, its result is used and ours is dropped.
+    Entry entry = compute( scale, sizeX, sizeY, borderWidth );
+
+    boost::mutex::scoped_lock lock( mutex );
+    EntryMap::iterator it = entries.find( key );
+    if( it != entries.end() )
+    {
+	usage.splice( usage.begin(), usage, it->second.second );
+	return it->second.first;
+    }
+
+    usage.push_front( key );
+    entries.insert( std::make_pair( key, std::make_pair( entry, usage.begin() ) ) );
+    evict();
+    return entry;
+}
+
+void LookUpTableCache::evict()
+{
+    while( entries.size() > maxEntries )
+    {
+	entries.erase( usage.back() );
+	usage.pop_back();
+    }
+}
+
+void LookUpTableCache::clear()
+{
+    boost::mutex::scoped_lock lock( mutex );
+    entries.clear();
+    usage.clear();
+}
+
+void LookUpTableCache::setMaxEntries( size_t maxEntries )
+{
+    boost::mutex::scoped_lock lock( mutex );
+    this->maxEntries = std::max( maxEntries, (size_t)1 );
+    evict();
+}
+
+size_t LookUpTableCache::getMaxEntries() const
+{
+    boost::mutex::scoped_lock lock( mutex );
+    return maxEntries;
+}
+
+size_t LookUpTableCache::size() const
+{
+    boost::mutex::scoped_lock lock( mutex );
+    return entries.size();
+}
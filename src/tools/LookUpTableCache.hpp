@@ -0,0 +1,86 @@
+#ifndef __ENVIRE_TOOLS_LOOKUPTABLECACHE_HPP__
+#define __ENVIRE_TOOLS_LOOKUPTABLECACHE_HPP__
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/noncopyable.hpp>
+#include <list>
+#include <map>
+
+#include "RadialLookUpTable.hpp"
+#include "BoxLookUpTable.hpp"
+
+namespace envire
+{
+
+/**
+ * Cache for the lookup tables that are used to compute statistics over a
+ * rectangular footprint with a border around it.
+ *
+ * The tables are keyed by the grid scale, the footprint size and the
+ * border width. Once computed, a table is never modified, so the entries
+ * can be shared between any number of threads. The cache holds a bounded
+ * number of entries and evicts the least recently used one when it is
+ * full. Evicted tables stay valid as long as someone holds a pointer to
+ * them.
+ */
+class LookUpTableCache : boost::noncopyable
+{
+public:
+    struct Entry
+    {
+	/** radial distances in grid cells around the center of the footprint */
+	boost::shared_ptr<const RadialLookUpTable> radial;
+	/** distances to the footprint for points in the border */
+	boost::shared_ptr<const BoxLookUpTable> box;
+    };
+
+    /** @param maxEntries maximum number of entries that are kept */
+    explicit LookUpTableCache( size_t maxEntries = 16 );
+
+    /** @return the process wide cache */
+    static LookUpTableCache& getInstance();
+
+    /** @return the tables for the given parameters, which are computed if
+     * they are not in the cache yet. This method is thread safe. 
+     */
+    Entry get( double scale, double sizeX, double sizeY, double borderWidth );
+
+    /** removes all entries from the cache */
+    void clear();
+
+    /** sets the maximum number of entries, evicting entries if required */
+    void setMaxEntries( size_t maxEntries );
+
+    size_t getMaxEntries() const;
+
+    /** @return the number of entries in the cache */
+    size_t size() const;
+
+private:
+    struct Key
+    {
+	/** parameters quantized to micrometers, so that values which only
+	 * differ by rounding errors map to the same entry */
+	long long scale, sizeX, sizeY, borderWidth;
+
+	Key( double scale, double sizeX, double sizeY, double borderWidth );
+	bool operator<( const Key& other ) const;
+    };
+
+    typedef std::list<Key> UsageList;
+    typedef std::map<Key, std::pair<Entry, UsageList::iterator> > EntryMap;
+
+    static Entry compute( double scale, double sizeX, double sizeY, double borderWidth );
+    void evict();
+
+    mutable boost::mutex mutex;
+    size_t maxEntries;
+    /** keys ordered from most to least recently used */
+    UsageList usage;
+    EntryMap entries;
+};
+
+}
+
+#endif
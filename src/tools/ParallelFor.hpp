@@ -0,0 +1,56 @@
+#ifndef __ENVIRE_TOOLS_PARALLELFOR_HPP__
+#define __ENVIRE_TOOLS_PARALLELFOR_HPP__
+
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+#include <algorithm>
+
+namespace envire
+{
+
+/** @return the number of threads to use, which is the given value or the
+ * number of hardware threads if it is 0 */
+inline size_t getThreadCount( size_t threads = 0 )
+{
+    if( threads == 0 )
+	threads = boost::thread::hardware_concurrency();
+    return std::max( threads, (size_t)1 );
+}
+
+/**
+ * Splits the range [0, size) into contiguous chunks and calls func( begin,
+ * end ) for each chunk from a separate thread. Returns after all chunks
+ * have been processed. The functor is shared between the threads, so it
+ * must only modify data that is specific to the indices of its chunk, and
+ * must not throw.
+ *
+ * Small ranges are processed in the calling thread.
+ *
+ * @param threads number of threads to use, 0 to use one per hardware thread
+ * @param minChunkSize don't create chunks smaller than this
+ */
+template <class Func>
+void parallelFor( size_t size, Func& func, size_t threads = 0, size_t minChunkSize = 256 )
+{
+    threads = std::min( getThreadCount( threads ), std::max( size / std::max( minChunkSize, (size_t)1 ), (size_t)1 ) );
+
+    if( threads <= 1 )
+    {
+	func( (size_t)0, size );
+	return;
+    }
+
+    boost::thread_group group;
+    const size_t chunk = (size + threads - 1) / threads;
+    for( size_t begin = chunk; begin < size; begin += chunk )
+	group.create_thread( boost::bind<void>( boost::ref( func ), begin, std::min( begin + chunk, size ) ) );
+
+    // the first chunk is done in this thread
+    func( (size_t)0, std::min( chunk, size ) );
+    group.join_all();
+}
+
+}
+
+#endif
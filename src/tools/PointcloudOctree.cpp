@@ -0,0 +1,405 @@
+#include "PointcloudOctree.hpp"
+
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <cstring>
+#include <deque>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+using namespace envire;
+
+namespace
+{
+    bool isFinite( const Eigen::Vector3d& p )
+    {
+	return boost::math::isfinite( p.x() ) && boost::math::isfinite( p.y() ) && boost::math::isfinite( p.z() );
+    }
+
+    /** FNV-1a over the bits of the coordinates */
+    uint64_t addToChecksum( uint64_t hash, const Eigen::Vector3d& v )
+    {
+	for( int i=0; i<3; i++ )
+	{
+	    uint64_t bits;
+	    const double d = v[i];
+	    std::memcpy( &bits, &d, sizeof(bits) );
+	    hash = (hash ^ bits) * 1099511628211ull;
+	}
+	return hash;
+    }
+}
+
+PointcloudOctree::Node::Node()
+    : parent( -1 ), depth( 0 ), count( 0 ), dirty( true ), checksum( 0 )
+{
+    std::fill( children, children + 8, -1 );
+}
+
+bool PointcloudOctree::Node::isLeaf() const
+{
+    for( int i=0; i<8; i++ )
+	if( children[i] >= 0 )
+	    return false;
+    return true;
+}
+
+PointcloudOctree::PointcloudOctree( size_t maxLeafPoints, size_t lodPoints, double minNodeSize )
+    : root( -1 ), pointCount( 0 ),
+    maxLeafPoints( std::max( maxLeafPoints, (size_t)1 ) ),
+    lodPoints( std::max( lodPoints, (size_t)1 ) ),
+    minNodeSize( minNodeSize ),
+    seed( 2463534242u )
+{
+}
+
+void PointcloudOctree::clear()
+{
+    nodes.clear();
+    skipped.clear();
+    root = -1;
+    pointCount = 0;
+    seed = 2463534242u;
+}
+
+size_t PointcloudOctree::update( const std::vector<Eigen::Vector3d>& vertices )
+{
+    // the vertex array was replaced, so start from scratch
+    if( vertices.size() < pointCount )
+	clear();
+
+    const size_t start = pointCount;
+    for( size_t i=start; i<vertices.size(); i++ )
+	insert( vertices, i );
+
+    return vertices.size() - start;
+}
+
+void PointcloudOctree::insert( const std::vector<Eigen::Vector3d>& vertices, index_t index )
+{
+    const Eigen::Vector3d& p( vertices[index] );
+
+    // the root could never be grown to contain these
+    if( !isFinite( p ) )
+    {
+	skipped.push_back( index );
+	pointCount++;
+	return;
+    }
+
+    if( root < 0 )
+    {
+	// initial root is a unit cube around the first point,
+	// it will be grown on demand
+	const Eigen::Vector3d half( Eigen::Vector3d::Constant( 0.5 ) );
+	root = createNode( Eigen::AlignedBox3d( p - half, p + half ), -1, 0 );
+    }
+
+    while( !nodes[root].box.contains( p ) )
+	growRoot( p );
+
+    int n = root;
+    while( true )
+    {
+	nodes[n].count++;
+	if( nodes[n].isLeaf() )
+	{
+	    nodes[n].points.push_back( index );
+	    nodes[n].dirty = true;
+
+	    if( nodes[n].points.size() > maxLeafPoints
+		    && nodes[n].box.sizes().x() > 2.0 * minNodeSize )
+		split( vertices, n );
+	    break;
+	}
+
+	addSample( n, index );
+
+	const int c = getChildIndex( nodes[n], p );
+	if( nodes[n].children[c] < 0 )
+	{
+	    // create node first, as this may reallocate the node array
+	    const int child = createNode( getChildBox( nodes[n].box, c ), n, nodes[n].depth + 1 );
+	    nodes[n].children[c] = child;
+	}
+	n = nodes[n].children[c];
+    }
+
+    pointCount++;
+}
+
+bool PointcloudOctree::checkModified( const std::vector<Eigen::Vector3d>& vertices,
+	const std::vector<Eigen::Vector3d>* values )
+{
+    // a vertex which has moved out of its leaf needs to be inserted into
+    // another node, which is only possible by starting from scratch
+    bool rebuild = false;
+    for( size_t i=0; i<skipped.size() && !rebuild; i++ )
+	rebuild = isFinite( vertices[skipped[i]] );
+    for( size_t n=0; n<nodes.size() && !rebuild; n++ )
+    {
+	const Node& node( nodes[n] );
+	if( !node.isLeaf() )
+	    continue;
+	for( size_t i=0; i<node.points.size() && !rebuild; i++ )
+	    rebuild = !node.box.contains( vertices[node.points[i]] );
+    }
+    if( rebuild )
+    {
+	clear();
+	update( vertices );
+    }
+
+    for( size_t n=0; n<nodes.size(); n++ )
+    {
+	const uint64_t checksum = getChecksum( n, vertices, values );
+	if( checksum != nodes[n].checksum )
+	{
+	    nodes[n].checksum = checksum;
+	    nodes[n].dirty = true;
+	}
+    }
+
+    return rebuild;
+}
+
+uint64_t PointcloudOctree::getChecksum( int node, const std::vector<Eigen::Vector3d>& vertices,
+	const std::vector<Eigen::Vector3d>* values ) const
+{
+    uint64_t hash = 14695981039346656037ull;
+    const std::vector<index_t>& points( nodes[node].points );
+    for( size_t i=0; i<points.size(); i++ )
+    {
+	hash = addToChecksum( hash, vertices[points[i]] );
+	if( values )
+	    hash = addToChecksum( hash, (*values)[points[i]] );
+    }
+    return hash;
+}
+
+int PointcloudOctree::createNode( const Eigen::AlignedBox3d& box, int parent, int depth )
+{
+    Node node;
+    node.box = box;
+    node.parent = parent;
+    node.depth = depth;
+    nodes.push_back( node );
+    return nodes.size() - 1;
+}
+
+int PointcloudOctree::getChildIndex( const Node& node, const Eigen::Vector3d& p ) const
+{
+    const Eigen::Vector3d center( node.box.center() );
+    return (p.x() >= center.x() ? 1 : 0)
+	| (p.y() >= center.y() ? 2 : 0)
+	| (p.z() >= center.z() ? 4 : 0);
+}
+
+Eigen::AlignedBox3d PointcloudOctree::getChildBox( const Eigen::AlignedBox3d& box, int child ) const
+{
+    const Eigen::Vector3d center( box.center() );
+    Eigen::Vector3d min, max;
+    for( int i=0; i<3; i++ )
+    {
+	if( (child >> i) & 1 )
+	{
+	    min[i] = center[i];
+	    max[i] = box.max()[i];
+	}
+	else
+	{
+	    min[i] = box.min()[i];
+	    max[i] = center[i];
+	}
+    }
+    return Eigen::AlignedBox3d( min, max );
+}
+
+void PointcloudOctree::growRoot( const Eigen::Vector3d& p )
+{
+    const Eigen::AlignedBox3d old_box( nodes[root].box );
+    const Eigen::Vector3d edge( old_box.sizes() );
+
+    // double the size of the root towards the point
+    Eigen::Vector3d min( old_box.min() ), max( old_box.max() );
+    for( int i=0; i<3; i++ )
+    {
+	if( p[i] < old_box.min()[i] )
+	    min[i] -= edge[i];
+	else
+	    max[i] += edge[i];
+    }
+
+    const int old_root = root;
+    const int new_root = createNode( Eigen::AlignedBox3d( min, max ), -1, 0 );
+    Node &r( nodes[new_root] );
+    r.children[ getChildIndex( r, old_box.center() ) ] = old_root;
+    r.count = nodes[old_root].count;
+
+    // the sample of an inner node is already uniform over the whole tree,
+    // for a leaf we need to subsample
+    const std::vector<index_t>& old_points( nodes[old_root].points );
+    if( !nodes[old_root].isLeaf() || old_points.size() <= lodPoints )
+	r.points = old_points;
+    else
+    {
+	r.points.assign( old_points.begin(), old_points.begin() + lodPoints );
+	for( size_t i=lodPoints; i<old_points.size(); i++ )
+	{
+	    const size_t j = random() % (i+1);
+	    if( j < lodPoints )
+		r.points[j] = old_points[i];
+	}
+    }
+
+    nodes[old_root].parent = new_root;
+    increaseDepth( old_root );
+    root = new_root;
+}
+
+void PointcloudOctree::increaseDepth( int node )
+{
+    nodes[node].depth++;
+    for( int i=0; i<8; i++ )
+	if( nodes[node].children[i] >= 0 )
+	    increaseDepth( nodes[node].children[i] );
+}
+
+void PointcloudOctree::split( const std::vector<Eigen::Vector3d>& vertices, int node )
+{
+    std::vector<index_t> old_points;
+    old_points.swap( nodes[node].points );
+    nodes[node].dirty = true;
+
+    // distribute the points to the children
+    for( size_t i=0; i<old_points.size(); i++ )
+    {
+	const int c = getChildIndex( nodes[node], vertices[old_points[i]] );
+	if( nodes[node].children[c] < 0 )
+	{
+	    const int child = createNode( getChildBox( nodes[node].box, c ), node, nodes[node].depth + 1 );
+	    nodes[node].children[c] = child;
+	}
+	Node &child( nodes[ nodes[node].children[c] ] );
+	child.points.push_back( old_points[i] );
+	child.count++;
+    }
+
+    // and build the sample for this node
+    for( size_t i=0; i<old_points.size(); i++ )
+    {
+	if( nodes[node].points.size() < lodPoints )
+	    nodes[node].points.push_back( old_points[i] );
+	else
+	{
+	    const size_t j = random() % (i+1);
+	    if( j < lodPoints )
+		nodes[node].points[j] = old_points[i];
+	}
+    }
+
+    // all points may have ended up in the same child
+    for( int c=0; c<8; c++ )
+    {
+	const int child = nodes[node].children[c];
+	if( child >= 0 && nodes[child].points.size() > maxLeafPoints
+		&& nodes[child].box.sizes().x() > 2.0 * minNodeSize )
+	    split( vertices, child );
+    }
+}
+
+void PointcloudOctree::addSample( int node, index_t index )
+{
+    // reservoir sampling, count already includes the new point
+    Node &n( nodes[node] );
+    if( n.points.size() < lodPoints )
+    {
+	n.points.push_back( index );
+	n.dirty = true;
+    }
+    else
+    {
+	const size_t j = random() % n.count;
+	if( j < lodPoints )
+	{
+	    n.points[j] = index;
+	    n.dirty = true;
+	}
+    }
+}
+
+uint32_t PointcloudOctree::random()
+{
+    // xorshift32, deterministic so that the result does not depend on
+    // the global rand() state
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+double PointcloudOctree::getGeometricError( int node ) const
+{
+    const Node &n( nodes[node] );
+    if( n.isLeaf() || n.points.empty() )
+	return 0.0;
+
+    // assume the points are sampled from a surface
+    return n.box.sizes().maxCoeff() / std::sqrt( static_cast<double>( n.points.size() ) );
+}
+
+void PointcloudOctree::select( const Eigen::Vector3d& eye, double projectionFactor, double maxScreenError,
+	std::vector<Selection>& result, size_t pointBudget ) const
+{
+    result.clear();
+    if( root < 0 )
+	return;
+
+    // breadth first, so that the point budget is spent on the nodes
+    // closer to the root first
+    size_t selectedPoints = 0;
+    std::deque<int> queue;
+    queue.push_back( root );
+    while( !queue.empty() )
+    {
+	const int n = queue.front();
+	queue.pop_front();
+	const Node &node( nodes[n] );
+	if( node.count == 0 )
+	    continue;
+
+	const double distance =
+	    std::max( node.box.exteriorDistance( eye ), std::numeric_limits<double>::epsilon() );
+	Selection sel;
+	sel.node = n;
+	sel.screenError = getGeometricError( n ) * projectionFactor / distance;
+
+	const bool budgetExceeded = pointBudget > 0 && selectedPoints >= pointBudget;
+	if( node.isLeaf() || sel.screenError <= maxScreenError || budgetExceeded )
+	{
+	    result.push_back( sel );
+	    selectedPoints += node.points.size();
+	}
+	else
+	{
+	    for( int i=0; i<8; i++ )
+		if( node.children[i] >= 0 )
+		    queue.push_back( node.children[i] );
+	}
+    }
+}
+
+std::vector<int> PointcloudOctree::getDirtyNodes() const
+{
+    std::vector<int> result;
+    for( size_t i=0; i<nodes.size(); i++ )
+	if( nodes[i].dirty )
+	    result.push_back( i );
+    return result;
+}
+
+void PointcloudOctree::clearDirty()
+{
+    for( size_t i=0; i<nodes.size(); i++ )
+	nodes[i].dirty = false;
+}
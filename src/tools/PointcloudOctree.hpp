@@ -0,0 +1,177 @@
+#ifndef __ENVIRE_TOOLS_POINTCLOUDOCTREE_HPP__
+#define __ENVIRE_TOOLS_POINTCLOUDOCTREE_HPP__
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <vector>
+#include <stdint.h>
+
+namespace envire
+{
+
+/**
+ * Chunked octree over the vertices of a pointcloud, which provides a
+ * subsampled level of detail for each node.
+ *
+ * The tree only stores indices into an external vertex array, which is
+ * usually Pointcloud::vertices. Vertices can be appended incrementally
+ * using update(), which only inserts the vertices that have been added since
+ * the last call. Leaf nodes hold up to maxLeafPoints vertices and are split
+ * when they overflow. Inner nodes hold a uniform random sample (reservoir) of
+ * up to lodPoints vertices of their subtree, which can be drawn instead of
+ * the full subtree when the node is far away from the viewer.
+ *
+ * Each node carries a dirty flag, which is set whenever the set of vertices
+ * to draw for that node changed. This allows a renderer to only regenerate
+ * the buffers of the nodes that actually changed. Vertices which are
+ * modified in place are found by checkModified().
+ *
+ * This class is independent of any rendering library.
+ */
+class PointcloudOctree
+{
+public:
+    typedef uint32_t index_t;
+
+    struct Node
+    {
+	/** bounding box of the node in the frame of the vertices */
+	Eigen::AlignedBox3d box;
+	/** node indices of the children, -1 if not present. The child index
+	 * is composed of the x, y, z bits (x being the least significant) */
+	int children[8];
+	/** parent node or -1 for the root */
+	int parent;
+	/** depth of the node, the root has depth 0 */
+	int depth;
+	/** for leafs all vertex indices of the node, for inner nodes the
+	 * subsampled vertex indices */
+	std::vector<index_t> points;
+	/** total number of vertices in the subtree of this node */
+	size_t count;
+	/** true if points has changed since the last call to clearDirty() */
+	bool dirty;
+	/** checksum of the vertices in points, see checkModified() */
+	uint64_t checksum;
+
+	Node();
+	bool isLeaf() const;
+    };
+
+    /** Result of a selection, see select() */
+    struct Selection
+    {
+	/** the selected node */
+	int node;
+	/** the projected error of the selected node in pixels */
+	double screenError;
+    };
+
+    /**
+     * @param maxLeafPoints number of vertices a leaf can hold before it is split
+     * @param lodPoints number of vertices that are sampled for inner nodes
+     * @param minNodeSize nodes with an edge length smaller than this are not
+     *                    split further, and will grow beyond maxLeafPoints
+     */
+    explicit PointcloudOctree( size_t maxLeafPoints = 4096, size_t lodPoints = 1024, double minNodeSize = 1e-3 );
+
+    /** Removes all nodes from the tree */
+    void clear();
+
+    /** Inserts all vertices starting from getPointCount(). If the vertex
+     * array is smaller than the number of vertices already inserted, the tree
+     * is rebuilt from scratch.
+     *
+     * @return the number of vertices that have been inserted
+     */
+    size_t update( const std::vector<Eigen::Vector3d>& vertices );
+
+    /** Inserts a single vertex, the index is the index of the vertex in
+     * the vertex array. Vertices are required to be inserted in increasing
+     * index order. Vertices which are not finite are skipped.
+     */
+    void insert( const std::vector<Eigen::Vector3d>& vertices, index_t index );
+
+    /** Finds the vertices which have been modified in place, and is called
+     * after update().
+     *
+     * This is a pass over all vertices of the tree, so its cost grows with
+     * the size of the pointcloud. It should only be called when vertices
+     * are known to be edited in place, an append-only pointcloud only needs
+     * update().
+     *
+     * Each node keeps a checksum of its vertices, and optionally of per
+     * vertex values like colors. Nodes with a changed checksum are marked
+     * dirty. If a vertex has left the box of its leaf, or a skipped vertex
+     * became finite, the tree is rebuilt.
+     *
+     * @param values optional per vertex values, with the size of vertices
+     * @return true if the tree has been rebuilt
+     */
+    bool checkModified( const std::vector<Eigen::Vector3d>& vertices,
+	    const std::vector<Eigen::Vector3d>* values = NULL );
+
+    /** Select the nodes to draw for a viewer at the given eye position.
+     *
+     * A node is selected if its projected error is below maxScreenError,
+     * or if it is a leaf. The projected error of a node is the average
+     * spacing of its subsampled vertices divided by the distance to the
+     * eye and multiplied by the projectionFactor, which is the number of
+     * pixels per radian of the viewport (height / (2 * tan(fovy/2))).
+     *
+     * An optional point budget stops the refinement once the selected
+     * nodes contain more than the given number of vertices.
+     */
+    void select( const Eigen::Vector3d& eye, double projectionFactor, double maxScreenError,
+	    std::vector<Selection>& result, size_t pointBudget = 0 ) const;
+
+    /** @return the geometric error of the node, which is the average
+     * spacing between the vertices drawn for this node. Leafs have a zero
+     * error. */
+    double getGeometricError( int node ) const;
+
+    /** @return the indices of all nodes that have the dirty flag set */
+    std::vector<int> getDirtyNodes() const;
+
+    /** Resets the dirty flag on all nodes */
+    void clearDirty();
+
+    int getRoot() const { return root; }
+    const Node& getNode( int node ) const { return nodes[node]; }
+    size_t getNodeCount() const { return nodes.size(); }
+
+    /** @return the number of vertices inserted into the tree, including
+     * the skipped ones */
+    size_t getPointCount() const { return pointCount; }
+
+    size_t getMaxLeafPoints() const { return maxLeafPoints; }
+    size_t getLodPoints() const { return lodPoints; }
+
+private:
+    int createNode( const Eigen::AlignedBox3d& box, int parent, int depth );
+    int getChildIndex( const Node& node, const Eigen::Vector3d& p ) const;
+    Eigen::AlignedBox3d getChildBox( const Eigen::AlignedBox3d& box, int child ) const;
+    void growRoot( const Eigen::Vector3d& p );
+    void split( const std::vector<Eigen::Vector3d>& vertices, int node );
+    void addSample( int node, index_t index );
+    void increaseDepth( int node );
+    uint32_t random();
+    uint64_t getChecksum( int node, const std::vector<Eigen::Vector3d>& vertices,
+	    const std::vector<Eigen::Vector3d>* values ) const;
+
+    std::vector<Node> nodes;
+    int root;
+    size_t pointCount;
+    /** indices of the vertices which were not finite */
+    std::vector<index_t> skipped;
+
+    size_t maxLeafPoints;
+    size_t lodPoints;
+    double minNodeSize;
+
+    uint32_t seed;
+};
+
+}
+
+#endif
@@ -0,0 +1,388 @@
+#include "PoseGraphOptimizer.hpp"
+
+#include <Eigen/Geometry>
+#include <Eigen/LU>
+#include <Eigen/Sparse>
+#include <Eigen/SparseCholesky>
+#include <stdexcept>
+#include <cmath>
+#include <limits>
+
+using namespace envire;
+
+namespace
+{
+    Eigen::Matrix3d skew( const Eigen::Vector3d& v )
+    {
+	Eigen::Matrix3d res;
+	res << 0, -v.z(), v.y(),
+	    v.z(), 0, -v.x(),
+	    -v.y(), v.x(), 0;
+	return res;
+    }
+
+    Eigen::Matrix3d expRotation( const Eigen::Vector3d& r )
+    {
+	const double theta = r.norm();
+	if( theta < 1e-12 )
+	    return Eigen::Matrix3d::Identity() + skew( r );
+	return Eigen::AngleAxisd( theta, r / theta ).toRotationMatrix();
+    }
+
+    Eigen::Vector3d logRotation( const Eigen::Matrix3d& R )
+    {
+	Eigen::AngleAxisd aa( R );
+	return aa.axis() * aa.angle();
+    }
+
+    /** inverse of the right Jacobian of SO(3) */
+    Eigen::Matrix3d invRightJacobian( const Eigen::Vector3d& r )
+    {
+	const double theta = r.norm();
+	const Eigen::Matrix3d S( skew( r ) );
+	double c;
+	if( theta < 1e-4 )
+	    c = 1.0 / 12.0;
+	else
+	    c = 1.0 / (theta * theta) - (1.0 + cos( theta )) / (2.0 * theta * sin( theta ));
+	return Eigen::Matrix3d::Identity() + 0.5 * S + c * S * S;
+    }
+}
+
+PoseGraphOptimizer::PoseGraphOptimizer( Environment* env )
+    : env( env ), method( LEVENBERG_MARQUARDT ), maxIterations( 100 ), tolerance( 1e-9 )
+{
+}
+
+size_t PoseGraphOptimizer::getNodeIndex( FrameNode* frameNode )
+{
+    std::map<const FrameNode*, size_t>::iterator it = nodeIndex.find( frameNode );
+    if( it != nodeIndex.end() )
+	return it->second;
+
+    Node node;
+    node.frameNode = frameNode;
+    const Transform pose( env->relativeTransform( frameNode, env->getRootNode() ) );
+    node.rotation = pose.linear();
+    node.translation = pose.translation();
+    // the root can't be moved
+    node.fixed = frameNode->isRoot();
+    node.param = -1;
+
+    nodes.push_back( node );
+    nodeIndex[frameNode] = nodes.size() - 1;
+    return nodes.size() - 1;
+}
+
+void PoseGraphOptimizer::addNode( FrameNode* node, bool fixed )
+{
+    const size_t idx = getNodeIndex( node );
+    nodes[idx].fixed = nodes[idx].fixed || fixed;
+}
+
+void PoseGraphOptimizer::setFixed( FrameNode* node, bool fixed )
+{
+    std::map<const FrameNode*, size_t>::iterator it = nodeIndex.find( node );
+    if( it == nodeIndex.end() )
+	throw std::runtime_error("PoseGraphOptimizer: node is not part of the graph.");
+    nodes[it->second].fixed = fixed || node->isRoot();
+}
+
+void PoseGraphOptimizer::addConstraint( FrameNode* from, FrameNode* to, const TransformWithUncertainty& measurement )
+{
+    if( from == to )
+	throw std::runtime_error("PoseGraphOptimizer: constraint needs two different nodes.");
+
+    Constraint c;
+    c.from = getNodeIndex( from );
+    c.to = getNodeIndex( to );
+    c.rotation = measurement.getTransform().linear();
+    c.translation = measurement.getTransform().translation();
+    if( measurement.hasUncertainty() )
+    {
+	Eigen::FullPivLU<Matrix6d> lu( measurement.getCovariance() );
+	if( !lu.isInvertible() )
+	    throw std::runtime_error("PoseGraphOptimizer: covariance of constraint is singular.");
+	c.information = lu.inverse();
+    }
+    else
+	c.information = Matrix6d::Identity();
+
+    constraints.push_back( c );
+}
+
+PoseGraphOptimizer::Vector6d PoseGraphOptimizer::computeError( const Constraint& c ) const
+{
+    const Node &from( nodes[c.from] ), &to( nodes[c.to] );
+
+    // the error is the difference of the measurement and the relative
+    // transform between the current pose estimates in [r t] form
+    Vector6d e;
+    e.head<3>() = logRotation( c.rotation.transpose() * from.rotation.transpose() * to.rotation );
+    e.tail<3>() = from.rotation.transpose() * (to.translation - from.translation) - c.translation;
+    return e;
+}
+
+void PoseGraphOptimizer::linearize( const Constraint& c, Vector6d& e, Matrix6d& Jfrom, Matrix6d& Jto ) const
+{
+    const Node &from( nodes[c.from] ), &to( nodes[c.to] );
+
+    e = computeError( c );
+
+    // the poses are perturbed with R' = R * exp(a) and t' = t + b, where
+    // the parameter vector of a node is [a b]
+    const Eigen::Matrix3d Rrel( from.rotation.transpose() * to.rotation );
+    const Eigen::Matrix3d Jr( invRightJacobian( e.head<3>() ) );
+
+    Jfrom.setZero();
+    Jfrom.topLeftCorner<3,3>() = -Jr * Rrel.transpose();
+    Jfrom.bottomLeftCorner<3,3>() = skew( from.rotation.transpose() * (to.translation - from.translation) );
+    Jfrom.bottomRightCorner<3,3>() = -from.rotation.transpose();
+
+    Jto.setZero();
+    Jto.topLeftCorner<3,3>() = Jr;
+    Jto.bottomRightCorner<3,3>() = from.rotation.transpose();
+}
+
+double PoseGraphOptimizer::computeError() const
+{
+    double sum = 0;
+    for( size_t i=0; i<constraints.size(); i++ )
+    {
+	const Vector6d e( computeError( constraints[i] ) );
+	sum += e.dot( constraints[i].information * e );
+    }
+    return sum;
+}
+
+bool PoseGraphOptimizer::solveStep( double lambda )
+{
+    int params = 0;
+    for( size_t i=0; i<nodes.size(); i++ )
+	params = std::max( params, nodes[i].param + 6 );
+
+    typedef Eigen::Triplet<double> Triplet;
+    std::vector<Triplet> triplets;
+    triplets.reserve( constraints.size() * 4 * 36 + params );
+    Eigen::VectorXd b( Eigen::VectorXd::Zero( params ) );
+    Eigen::VectorXd diag( Eigen::VectorXd::Zero( params ) );
+
+    for( size_t i=0; i<constraints.size(); i++ )
+    {
+	const Constraint &c( constraints[i] );
+	Vector6d e;
+	Matrix6d J[2];
+	linearize( c, e, J[0], J[1] );
+	const int p[2] = { nodes[c.from].param, nodes[c.to].param };
+
+	for( int m=0; m<2; m++ )
+	{
+	    if( p[m] < 0 )
+		continue;
+	    b.segment<6>( p[m] ) += J[m].transpose() * c.information * e;
+	    for( int n=0; n<2; n++ )
+	    {
+		if( p[n] < 0 )
+		    continue;
+		const Matrix6d H( J[m].transpose() * c.information * J[n] );
+		for( int k=0; k<6; k++ )
+		    for( int l=0; l<6; l++ )
+			triplets.push_back( Triplet( p[m] + k, p[n] + l, H(k,l) ) );
+		if( m == n )
+		    diag.segment<6>( p[m] ) += H.diagonal();
+	    }
+	}
+    }
+
+    // Marquardt damping, scaled with the diagonal of the system
+    for( int k=0; k<params; k++ )
+	triplets.push_back( Triplet( k, k, lambda * diag(k) ) );
+
+    Eigen::SparseMatrix<double> H( params, params );
+    H.setFromTriplets( triplets.begin(), triplets.end() );
+
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<double> > solver( H );
+    if( solver.info() != Eigen::Success )
+	return false;
+    const Eigen::VectorXd dx( solver.solve( -b ) );
+    if( solver.info() != Eigen::Success || !(dx.array() == dx.array()).all() )
+	return false;
+
+    for( size_t i=0; i<nodes.size(); i++ )
+    {
+	Node &node( nodes[i] );
+	if( node.param < 0 )
+	    continue;
+	// re-orthogonalize through the quaternion, so that errors don't
+	// accumulate over the iterations
+	node.rotation = Eigen::Quaterniond( node.rotation * expRotation( dx.segment<3>( node.param ) ) )
+	    .normalized().toRotationMatrix();
+	node.translation += dx.segment<3>( node.param + 3 );
+    }
+    return true;
+}
+
+void PoseGraphOptimizer::backup()
+{
+    nodesBackup = nodes;
+}
+
+void PoseGraphOptimizer::restore()
+{
+    nodes = nodesBackup;
+}
+
+PoseGraphOptimizer::Result PoseGraphOptimizer::optimize()
+{
+    Result result;
+    result.initialError = result.finalError = computeError();
+    if( constraints.empty() )
+    {
+	result.converged = true;
+	return result;
+    }
+
+    // only nodes that are constrained are optimized, everything else
+    // would make the system singular
+    std::vector<bool> constrained( nodes.size(), false );
+    for( size_t i=0; i<constraints.size(); i++ )
+	constrained[constraints[i].from] = constrained[constraints[i].to] = true;
+
+    // at least one node needs to be fixed to define the reference frame
+    bool hasFixed = false;
+    for( size_t i=0; i<nodes.size(); i++ )
+	hasFixed = hasFixed || (nodes[i].fixed && constrained[i]);
+    bool first = !hasFixed;
+
+    int params = 0;
+    for( size_t i=0; i<nodes.size(); i++ )
+    {
+	nodes[i].param = -1;
+	if( !constrained[i] || nodes[i].fixed )
+	    continue;
+	if( first )
+	{
+	    first = false;
+	    continue;
+	}
+	nodes[i].param = params;
+	params += 6;
+    }
+    if( params == 0 )
+    {
+	result.converged = true;
+	return result;
+    }
+
+    double error = result.initialError;
+    double lambda = method == LEVENBERG_MARQUARDT ? 1e-4 : 0.0;
+    while( result.iterations < maxIterations )
+    {
+	result.iterations++;
+
+	backup();
+	bool improved = false;
+	double newError = error;
+	if( method == GAUSS_NEWTON )
+	{
+	    if( !solveStep( 0.0 ) )
+	    {
+		restore();
+		break;
+	    }
+	    newError = computeError();
+	    improved = true;
+	}
+	else
+	{
+	    // increase the damping until the step reduces the error
+	    while( lambda < 1e10 )
+	    {
+		if( solveStep( lambda ) )
+		{
+		    newError = computeError();
+		    if( newError <= error )
+		    {
+			improved = true;
+			lambda = std::max( lambda / 10.0, 1e-12 );
+			break;
+		    }
+		}
+		restore();
+		lambda *= 10.0;
+	    }
+	}
+
+	if( !improved )
+	{
+	    // no step reduces the error anymore, so we are at the minimum
+	    result.converged = true;
+	    break;
+	}
+
+	const double change = std::fabs( error - newError );
+	error = newError;
+	if( change <= tolerance * std::max( error, std::numeric_limits<double>::min() ) || error < 1e-20 )
+	{
+	    result.converged = true;
+	    break;
+	}
+    }
+
+    result.finalError = error;
+    return result;
+}
+
+Transform PoseGraphOptimizer::getPose( const FrameNode* node ) const
+{
+    std::map<const FrameNode*, size_t>::const_iterator it = nodeIndex.find( node );
+    if( it == nodeIndex.end() )
+	throw std::runtime_error("PoseGraphOptimizer: node is not part of the graph.");
+
+    Transform pose( Transform::Identity() );
+    pose.linear() = nodes[it->second].rotation;
+    pose.translation() = nodes[it->second].translation;
+    return pose;
+}
+
+void PoseGraphOptimizer::apply()
+{
+    // compute all transforms first, since writing them back changes the
+    // poses of nodes which are not part of the graph
+    std::vector<Transform, Eigen::aligned_allocator<Transform> > local( nodes.size() );
+    for( size_t i=0; i<nodes.size(); i++ )
+    {
+	const FrameNode *frameNode = nodes[i].frameNode;
+	if( frameNode->isRoot() )
+	    continue;
+
+	// pose of the parent from the closest ancestor in the graph
+	const FrameNode *parent = frameNode->getParent();
+	const FrameNode *ancestor = parent;
+	while( !ancestor->isRoot() && !nodeIndex.count( ancestor ) )
+	    ancestor = ancestor->getParent();
+
+	Transform parentPose( env->relativeTransform( parent, ancestor ) );
+	if( nodeIndex.count( ancestor ) )
+	    parentPose = getPose( ancestor ) * parentPose;
+
+	local[i] = Transform( parentPose.inverse( Eigen::Isometry ) * getPose( frameNode ) );
+    }
+
+    for( size_t i=0; i<nodes.size(); i++ )
+    {
+	FrameNode *frameNode = nodes[i].frameNode;
+	if( frameNode->isRoot() )
+	    continue;
+
+	// fixed nodes only change if one of their ancestors moved
+	const TransformWithUncertainty &current( frameNode->getTransformWithUncertainty() );
+	if( current.getTransform().isApprox( local[i], 1e-12 ) )
+	    continue;
+
+	if( current.hasUncertainty() )
+	    frameNode->setTransform( TransformWithUncertainty( local[i], current.getCovariance() ) );
+	else
+	    frameNode->setTransform( local[i] );
+    }
+}
@@ -0,0 +1,156 @@
+#ifndef __ENVIRE_TOOLS_POSEGRAPHOPTIMIZER_HPP__
+#define __ENVIRE_TOOLS_POSEGRAPHOPTIMIZER_HPP__
+
+#include <envire/Core.hpp>
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+#include <vector>
+#include <map>
+
+namespace envire
+{
+
+/**
+ * Sparse pose-graph optimizer over FrameNode transforms.
+ *
+ * The nodes of the graph are FrameNodes, the edges are relative
+ * measurements between two nodes, e.g. the result of an ICP run between
+ * the pointclouds attached to them. The optimizer estimates the poses of
+ * the nodes in the root frame, which best agree with all measurements in
+ * the least squares sense, weighted by the inverse covariance of the
+ * measurements.
+ *
+ * The problem is solved using Gauss-Newton or Levenberg-Marquardt
+ * iterations, where each step is computed with a sparse Cholesky
+ * decomposition. The poses are parametrized as rotation and translation
+ * in the root frame, the rotation is updated through a local rotation
+ * vector.
+ *
+ * Optimization doesn't change the environment. Calling apply() writes the
+ * corrected transforms back to the FrameNodes, which will generate the
+ * usual modification events.
+ */
+class PoseGraphOptimizer
+{
+public:
+    enum Method
+    {
+	GAUSS_NEWTON,
+	LEVENBERG_MARQUARDT
+    };
+
+    struct Result
+    {
+	/** number of iterations that have been performed */
+	size_t iterations;
+	/** weighted sum of squared errors before and after the optimization */
+	double initialError;
+	double finalError;
+	/** true if the relative change of the error dropped below the
+	 * tolerance */
+	bool converged;
+
+	Result() : iterations(0), initialError(0), finalError(0), converged(false) {}
+    };
+
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    /** @param env environment the FrameNodes belong to */
+    explicit PoseGraphOptimizer( Environment* env );
+
+    /** adds a node to the graph. Nodes that are referenced by a constraint
+     * are added automatically. The pose of a fixed node is not changed by
+     * the optimization. If no node is fixed, the first node is kept fixed.
+     */
+    void addNode( FrameNode* node, bool fixed = false );
+
+    /** sets a node that is already in the graph fixed or free */
+    void setFixed( FrameNode* node, bool fixed = true );
+
+    /**
+     * adds a relative measurement between two nodes. The measurement is
+     * the transform from the frame of @a to into the frame of @a from,
+     * which is the same as to->relativeTransform( from ) for consistent
+     * poses. The covariance of the measurement is used to weight the
+     * constraint, if the measurement has no uncertainty, it is weighted
+     * with the identity.
+     */
+    void addConstraint( FrameNode* from, FrameNode* to, const TransformWithUncertainty& measurement );
+
+    void setMethod( Method method ) { this->method = method; }
+    void setMaxIterations( size_t maxIterations ) { this->maxIterations = maxIterations; }
+    /** the optimization stops when the relative change in error is below this */
+    void setTolerance( double tolerance ) { this->tolerance = tolerance; }
+
+    size_t getNodeCount() const { return nodes.size(); }
+    size_t getConstraintCount() const { return constraints.size(); }
+
+    /** @return weighted sum of the squared errors of all constraints for
+     * the current pose estimates */
+    double computeError() const;
+
+    /** runs the optimization, starting from the current pose estimates.
+     * The initial estimates are the transforms of the FrameNodes to the
+     * root node at the time they were added.
+     */
+    Result optimize();
+
+    /** @return the current pose estimate of the node in the root frame */
+    Transform getPose( const FrameNode* node ) const;
+
+    /** writes the optimized poses back to the FrameNodes. The transforms
+     * are converted to the parent frame of each node, taking into account
+     * the optimized poses of parents that are part of the graph. Only
+     * FrameNodes whose transform changed are modified.
+     */
+    void apply();
+
+private:
+    struct Node
+    {
+	FrameNode* frameNode;
+	Eigen::Matrix3d rotation;
+	Eigen::Vector3d translation;
+	bool fixed;
+	/** index of the first parameter in the linear system, -1 if fixed */
+	int param;
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+
+    struct Constraint
+    {
+	size_t from, to;
+	Eigen::Matrix3d rotation;
+	Eigen::Vector3d translation;
+	Eigen::Matrix<double,6,6> information;
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+
+    typedef Eigen::Matrix<double,6,1> Vector6d;
+    typedef Eigen::Matrix<double,6,6> Matrix6d;
+
+    size_t getNodeIndex( FrameNode* node );
+    Vector6d computeError( const Constraint& c ) const;
+    void linearize( const Constraint& c, Vector6d& e, Matrix6d& Jfrom, Matrix6d& Jto ) const;
+    /** solves (H + lambda diag(H)) dx = -b and applies the step to the nodes */
+    bool solveStep( double lambda );
+    void backup();
+    void restore();
+
+    Environment* env;
+    Method method;
+    size_t maxIterations;
+    double tolerance;
+
+    std::vector<Node, Eigen::aligned_allocator<Node> > nodes;
+    std::vector<Constraint, Eigen::aligned_allocator<Constraint> > constraints;
+    std::map<const FrameNode*, size_t> nodeIndex;
+    std::vector<Node, Eigen::aligned_allocator<Node> > nodesBackup;
+};
+
+}
+
+#endif
@@ -8,6 +8,17 @@ RadialLookUpTable::RadialLookUpTable() : numElementsPerLine(0), distanceTable(0)
     
 }
 
+RadialLookUpTable::RadialLookUpTable(double scale, double maxRadius) : numElementsPerLine(0), distanceTable(0), angleTable(0), scale(0), maxRadius(0)
+{
+    recompute(scale, maxRadius);
+}
+
+RadialLookUpTable::~RadialLookUpTable()
+{
+    delete[] distanceTable;
+    delete[] angleTable;
+}
+
 void RadialLookUpTable::recompute(double scale, double maxRadius)
 {
     if(this->scale == scale && this->maxRadius == maxRadius)
@@ -28,7 +39,7 @@ void RadialLookUpTable::computeDistances()
     if(distanceTable)
 	delete[] distanceTable;
     
-    distanceTable = new double[numElementsPerLine * numElementsPerLine];
+    distanceTable = new float[numElementsPerLine * numElementsPerLine];
     for(int y = 0; y < numElementsPerLine; y++)
     {
 	for(int x = 0; x < numElementsPerLine;x++)
@@ -45,7 +56,7 @@ void RadialLookUpTable::computeAngles()
     if(angleTable)
 	delete[] angleTable;
     
-    angleTable = new double[numElementsPerLine * numElementsPerLine];
+    angleTable = new float[numElementsPerLine * numElementsPerLine];
     for(int y = 0; y < numElementsPerLine; y++)
     {
 	for(int x = 0; x < numElementsPerLine;x++)
@@ -57,7 +68,7 @@ void RadialLookUpTable::computeAngles()
     }
 }
 
-const double& RadialLookUpTable::getAngle(int x, int y) const
+float RadialLookUpTable::getAngle(int x, int y) const
 {
     unsigned int xd = x + numElementsPerLineHalf;
     unsigned int yd = y + numElementsPerLineHalf;
@@ -65,7 +76,7 @@ const double& RadialLookUpTable::getAngle(int x, int y) const
 }
 
 
-const double &RadialLookUpTable::getDistance(int x, int y) const
+float RadialLookUpTable::getDistance(int x, int y) const
 {
     unsigned int xd = x + numElementsPerLineHalf;
     unsigned int yd = y + numElementsPerLineHalf;
@@ -9,20 +9,25 @@ class RadialLookUpTable
 
 public:
     RadialLookUpTable();
+    RadialLookUpTable(double scale, double maxRadius);
+    ~RadialLookUpTable();
     
-    const double& getDistance(int x, int y) const;
-    const double& getAngle(int x, int y) const;
+    float getDistance(int x, int y) const;
+    float getAngle(int x, int y) const;
     
     void recompute(double scale, double maxRadius);
     
 private:
+    RadialLookUpTable(const RadialLookUpTable&);
+    RadialLookUpTable& operator=(const RadialLookUpTable&);
+
     void computeDistances();
     void computeAngles();
     
     int numElementsPerLine;
     int numElementsPerLineHalf;
-    double *distanceTable;
-    double *angleTable;
+    float *distanceTable;
+    float *angleTable;
     double scale;
     double maxRadius;
 };
@@ -0,0 +1,341 @@
+#include "RangeSensorSimulator.hpp"
+#include "TriMeshBVH.hpp"
+#include "ParallelFor.hpp"
+
+#include <envire/maps/MLSGrid.hpp>
+#include <envire/maps/TriMesh.hpp>
+#include <envire/maps/LaserScan.hpp>
+
+#include <boost/random/normal_distribution.hpp>
+#include <boost/random/linear_congruential.hpp>
+#include <boost/random/uniform_real.hpp>
+#include <boost/random/variate_generator.hpp>
+#include <boost/math/special_functions/fpclassify.hpp>
+
+#include <stdexcept>
+#include <limits>
+#include <cmath>
+
+using namespace envire;
+
+namespace
+{
+    const double NaN = std::numeric_limits<double>::quiet_NaN();
+    const double INF = std::numeric_limits<double>::infinity();
+
+    /** seeds the generator of a single ray, the bits of the ray index
+     * are mixed, so neighbouring rays don't get correlated sequences */
+    boost::uint32_t raySeed( boost::uint32_t seed, size_t ray )
+    {
+	boost::uint32_t x = seed ^ (boost::uint32_t)( ray * 0x9e3779b9u );
+	x ^= x >> 16;
+	x *= 0x85ebca6bu;
+	x ^= x >> 13;
+	x *= 0xc2b2ae35u;
+	x ^= x >> 16;
+	// minstd_rand needs a seed in [1, 2^31-2]
+	return x % 2147483646u + 1;
+    }
+
+    /** casts rays into an MLSGrid, in the frame of the grid */
+    struct MLSCaster
+    {
+	const MLSGrid& grid;
+	const bool slopeModel;
+
+	explicit MLSCaster( const MLSGrid& grid )
+	    : grid( grid ), slopeModel( grid.getConfig().updateModel == MLSConfiguration::SLOPE ) {}
+
+	/** @return the distance of the first patch in the cell which is hit
+	 * by the ray between tEnter and tExit, or INF */
+	double intersectCell( size_t xi, size_t yi, const Eigen::Vector3d& o, const Eigen::Vector3d& d, double tEnter, double tExit ) const
+	{
+	    // the ray relative to the corner of the cell, which is the
+	    // origin of the patch planes
+	    const double ox = o.x() - (xi * grid.getScaleX() + grid.getOffsetX());
+	    const double oy = o.y() - (yi * grid.getScaleY() + grid.getOffsetY());
+
+	    double best = INF;
+	    for( MLSGrid::const_iterator it = grid.beginCell( xi, yi ); it != grid.endCell(); it++ )
+	    {
+		const SurfacePatch& p( *it );
+		if( p.isNegative() )
+		    continue;
+
+		double t;
+		if( p.isHorizontal() )
+		{
+		    // surface z = a * x + b * y + c
+		    double a = 0, b = 0, c = p.mean;
+		    if( slopeModel )
+		    {
+			c = p.getHeight( Eigen::Vector2f( 0, 0 ) );
+			a = p.getHeight( Eigen::Vector2f( 1, 0 ) ) - c;
+			b = p.getHeight( Eigen::Vector2f( 0, 1 ) ) - c;
+		    }
+		    const double denom = d.z() - a * d.x() - b * d.y();
+		    if( std::abs( denom ) < 1e-12 )
+			continue;
+		    t = (c + a * ox + b * oy - o.z()) / denom;
+		    if( t < tEnter || t > tExit )
+			continue;
+		}
+		else
+		{
+		    // block from mean - height up to mean
+		    const double zmin = p.mean - p.height, zmax = p.mean;
+		    double tz0 = -INF, tz1 = INF;
+		    if( std::abs( d.z() ) < 1e-12 )
+		    {
+			if( o.z() < zmin || o.z() > zmax )
+			    continue;
+		    }
+		    else
+		    {
+			tz0 = (zmin - o.z()) / d.z();
+			tz1 = (zmax - o.z()) / d.z();
+			if( tz0 > tz1 )
+			    std::swap( tz0, tz1 );
+		    }
+		    t = std::max( tEnter, tz0 );
+		    if( t > std::min( tExit, tz1 ) )
+			continue;
+		}
+
+		best = std::min( best, t );
+	    }
+	    return best;
+	}
+
+	double cast( const Eigen::Vector3d& o, const Eigen::Vector3d& d, double maxRange ) const
+	{
+	    const double lo[2] = { grid.getOffsetX(), grid.getOffsetY() };
+	    const double scale[2] = { grid.getScaleX(), grid.getScaleY() };
+	    const int size[2] = { (int)grid.getCellSizeX(), (int)grid.getCellSizeY() };
+
+	    // clip the ray to the extents of the grid
+	    double t0 = 0, t1 = maxRange;
+	    for( int i=0; i<2; i++ )
+	    {
+		const double hi = lo[i] + size[i] * scale[i];
+		if( std::abs( d[i] ) < 1e-12 )
+		{
+		    if( o[i] < lo[i] || o[i] >= hi )
+			return NaN;
+		    continue;
+		}
+		double ta = (lo[i] - o[i]) / d[i], tb = (hi - o[i]) / d[i];
+		if( ta > tb )
+		    std::swap( ta, tb );
+		t0 = std::max( t0, ta );
+		t1 = std::min( t1, tb );
+	    }
+	    if( t0 > t1 )
+		return NaN;
+
+	    // cell traversal as in VoxelTraversal, starting where the ray
+	    // enters the grid
+	    int cur[2], step[2];
+	    double tMax[2], tDelta[2];
+	    for( int i=0; i<2; i++ )
+	    {
+		const double p = o[i] + d[i] * t0;
+		cur[i] = std::min( std::max( (int)std::floor( (p - lo[i]) / scale[i] ), 0 ), size[i] - 1 );
+		if( d[i] > 1e-12 )
+		{
+		    step[i] = 1;
+		    tMax[i] = (lo[i] + (cur[i] + 1) * scale[i] - o[i]) / d[i];
+		    tDelta[i] = scale[i] / d[i];
+		}
+		else if( d[i] < -1e-12 )
+		{
+		    step[i] = -1;
+		    tMax[i] = (lo[i] + cur[i] * scale[i] - o[i]) / d[i];
+		    tDelta[i] = -scale[i] / d[i];
+		}
+		else
+		{
+		    step[i] = 0;
+		    tMax[i] = INF;
+		    tDelta[i] = INF;
+		}
+	    }
+
+	    double tEnter = t0;
+	    while( true )
+	    {
+		const int axis = tMax[0] < tMax[1] ? 0 : 1;
+		const double tExit = std::min( tMax[axis], t1 );
+
+		const double t = intersectCell( cur[0], cur[1], o, d, tEnter, tExit );
+		if( t < INF )
+		    return t;
+
+		if( tMax[axis] >= t1 )
+		    break;
+
+		cur[axis] += step[axis];
+		if( cur[axis] < 0 || cur[axis] >= size[axis] )
+		    break;
+		tEnter = tMax[axis];
+		tMax[axis] += tDelta[axis];
+	    }
+	    return NaN;
+	}
+    };
+
+    /** casts rays into a TriMesh, in the frame of the mesh */
+    struct BVHCaster
+    {
+	const TriMeshBVH& bvh;
+
+	explicit BVHCaster( const TriMeshBVH& bvh ) : bvh( bvh ) {}
+
+	double cast( const Eigen::Vector3d& o, const Eigen::Vector3d& d, double maxRange ) const
+	{
+	    TriMeshBVH::Hit hit;
+	    if( bvh.intersect( o, d, maxRange, hit ) )
+		return hit.distance;
+	    return NaN;
+	}
+    };
+
+    template <class Caster>
+    struct SimulateFunc
+    {
+	const Caster& caster;
+	const RangeSensorSimulator::ScannerModel& scanner;
+	const RangeSensorSimulator::NoiseModel& noise;
+	const Transform& sensor2map;
+	std::vector<double>& ranges;
+
+	SimulateFunc( const Caster& caster, const RangeSensorSimulator::ScannerModel& scanner,
+		const RangeSensorSimulator::NoiseModel& noise, const Transform& sensor2map,
+		std::vector<double>& ranges )
+	    : caster( caster ), scanner( scanner ), noise( noise ), sensor2map( sensor2map ), ranges( ranges ) {}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    const Eigen::Vector3d origin( sensor2map.translation() );
+	    const Eigen::Matrix3d rotation( sensor2map.linear() );
+
+	    for( size_t i=begin; i<end; i++ )
+	    {
+		boost::minstd_rand gen( raySeed( noise.seed, i ) );
+		boost::variate_generator<boost::minstd_rand&, boost::normal_distribution<> >
+		    randNorm( gen, boost::normal_distribution<>( 0, 1.0 ) );
+		boost::variate_generator<boost::minstd_rand&, boost::uniform_real<> >
+		    randUni( gen, boost::uniform_real<>( 0, 1.0 ) );
+
+		const size_t line = i / scanner.pointsPerLine, point = i % scanner.pointsPerLine;
+		double psi = scanner.startPsi + point * scanner.psiResolution;
+		double phi = scanner.startPhi + line * scanner.phiResolution;
+		if( noise.angleStdev > 0 )
+		{
+		    psi += randNorm() * noise.angleStdev;
+		    phi += randNorm() * noise.angleStdev;
+		}
+
+		if( noise.dropoutProbability > 0 && randUni() < noise.dropoutProbability )
+		{
+		    ranges[i] = NaN;
+		    continue;
+		}
+
+		const Eigen::Vector3d dir( std::cos( phi ) * std::cos( psi ), std::sin( psi ), std::sin( phi ) * std::cos( psi ) );
+		double range = caster.cast( origin, rotation * dir, scanner.maxRange );
+		if( noise.rangeStdev > 0 )
+		    range += randNorm() * noise.rangeStdev;
+
+		// NaN fails both comparisons
+		ranges[i] = (range >= scanner.minRange && range <= scanner.maxRange) ? range : NaN;
+	    }
+	}
+    };
+}
+
+RangeSensorSimulator::RangeSensorSimulator( const ScannerModel& scanner, const NoiseModel& noise, size_t threads )
+    : scanner( scanner ), noise( noise ), threads( threads )
+{
+}
+
+Eigen::Vector3d RangeSensorSimulator::getRayDirection( size_t line, size_t point ) const
+{
+    const double psi = scanner.startPsi + point * scanner.psiResolution;
+    const double phi = scanner.startPhi + line * scanner.phiResolution;
+    return Eigen::Vector3d( std::cos( phi ) * std::cos( psi ), std::sin( psi ), std::sin( phi ) * std::cos( psi ) );
+}
+
+void RangeSensorSimulator::simulate( const MLSGrid& grid, const Transform& sensor2grid, std::vector<double>& ranges ) const
+{
+    // evicted grids can only be restored from this thread
+    grid.touch();
+
+    ranges.resize( scanner.getRayCount() );
+    MLSCaster caster( grid );
+    SimulateFunc<MLSCaster> func( caster, scanner, noise, sensor2grid, ranges );
+    parallelFor( ranges.size(), func, threads, 64 );
+}
+
+void RangeSensorSimulator::simulate( const TriMeshBVH& bvh, const Transform& sensor2mesh, std::vector<double>& ranges ) const
+{
+    ranges.resize( scanner.getRayCount() );
+    BVHCaster caster( bvh );
+    SimulateFunc<BVHCaster> func( caster, scanner, noise, sensor2mesh, ranges );
+    parallelFor( ranges.size(), func, threads, 64 );
+}
+
+void RangeSensorSimulator::simulate( const MLSGrid& grid, const FrameNode* sensor, std::vector<double>& ranges ) const
+{
+    simulate( grid, sensor->relativeTransform( grid.getFrameNode() ), ranges );
+}
+
+void RangeSensorSimulator::simulate( const TriMesh& mesh, const FrameNode* sensor, std::vector<double>& ranges ) const
+{
+    mesh.touch();
+    TriMeshBVH bvh( mesh, 4, threads );
+    simulate( bvh, sensor->relativeTransform( mesh.getFrameNode() ), ranges );
+}
+
+void RangeSensorSimulator::fillLaserScan( const std::vector<double>& ranges, LaserScan& scan ) const
+{
+    if( ranges.size() != scanner.getRayCount() )
+	throw std::runtime_error("envire: number of ranges does not match the scanner model.");
+
+    scan.setXForward();
+    scan.origin_psi = scanner.startPsi;
+    scan.delta_psi = scanner.psiResolution;
+    scan.origin_phi = 0;
+    scan.points_per_line = scanner.pointsPerLine;
+    scan.lines.clear();
+    for( size_t l=0; l<scanner.lines; l++ )
+    {
+	LaserScan::scanline_t line;
+	line.delta_phi = scanner.startPhi + l * scanner.phiResolution;
+	line.ranges.reserve( scanner.pointsPerLine );
+	for( size_t p=0; p<scanner.pointsPerLine; p++ )
+	{
+	    // the ranges of a scan are in mm
+	    const double range = ranges[l * scanner.pointsPerLine + p];
+	    line.ranges.push_back( boost::math::isnan( range ) ? 0 : (unsigned int)( range * 1000.0 + 0.5 ) );
+	}
+	scan.lines.push_back( line );
+    }
+}
+
+void RangeSensorSimulator::fillPointcloud( const std::vector<double>& ranges, Pointcloud& pc ) const
+{
+    if( ranges.size() != scanner.getRayCount() )
+	throw std::runtime_error("envire: number of ranges does not match the scanner model.");
+
+    pc.clear();
+    for( size_t l=0; l<scanner.lines; l++ )
+    {
+	for( size_t p=0; p<scanner.pointsPerLine; p++ )
+	{
+	    const double range = ranges[l * scanner.pointsPerLine + p];
+	    if( !boost::math::isnan( range ) )
+		pc.vertices.push_back( getRayDirection( l, p ) * range );
+	}
+    }
+}
@@ -0,0 +1,139 @@
+#ifndef __ENVIRE_TOOLS_RANGESENSORSIMULATOR_HPP__
+#define __ENVIRE_TOOLS_RANGESENSORSIMULATOR_HPP__
+
+#include <envire/Core.hpp>
+#include <boost/cstdint.hpp>
+#include <vector>
+#include <cmath>
+
+namespace envire
+{
+    class MLSGrid;
+    class TriMesh;
+    class TriMeshBVH;
+    class LaserScan;
+    class Pointcloud;
+
+    /**
+     * Generates synthetic range measurements by casting the rays of a
+     * scanner model into a map.
+     *
+     * The scanner model follows the conventions of LaserScan with
+     * x_forward set: psi is the angle within a scan line, phi the angle of
+     * the line, and a ray points along (cos phi cos psi, sin psi, sin phi
+     * cos psi) in the sensor frame.
+     *
+     * Rays are cast into MLSGrid maps by stepping through the cells along
+     * the ray, and intersecting it with the patches of each cell. Horizontal
+     * patches are surfaces, which are planes for the slope update model,
+     * vertical patches are blocks from mean - height up to mean, and
+     * negative patches are ignored. Rays are cast into TriMesh maps using a
+     * TriMeshBVH.
+     *
+     * The rays are cast in parallel. The noise of each ray is drawn from a
+     * generator which is seeded with the seed of the noise model and the
+     * index of the ray, so the result only depends on the seed, and not on
+     * the number of threads.
+     */
+    class RangeSensorSimulator
+    {
+    public:
+	struct ScannerModel
+	{
+	    /** angle of the first point in a line, and the step between
+	     * points */
+	    double startPsi;
+	    double psiResolution;
+	    size_t pointsPerLine;
+	    /** angle of the first line, and the step between lines */
+	    double startPhi;
+	    double phiResolution;
+	    size_t lines;
+	    /** measurements outside of this interval are invalid */
+	    double minRange;
+	    double maxRange;
+
+	    /** a 2D scanner with 181 points over 180 degrees */
+	    ScannerModel()
+		: startPsi( -M_PI / 2.0 ), psiResolution( M_PI / 180.0 ), pointsPerLine( 181 ),
+		startPhi( 0 ), phiResolution( 0 ), lines( 1 ),
+		minRange( 0.1 ), maxRange( 30.0 ) {}
+
+	    size_t getRayCount() const { return pointsPerLine * lines; }
+	};
+
+	struct NoiseModel
+	{
+	    /** standard deviation of the gaussian noise added to the ranges */
+	    double rangeStdev;
+	    /** standard deviation of the gaussian noise added to psi and phi
+	     * of each ray */
+	    double angleStdev;
+	    /** probability that a ray gives no measurement */
+	    double dropoutProbability;
+	    boost::uint32_t seed;
+
+	    NoiseModel()
+		: rangeStdev( 0 ), angleStdev( 0 ), dropoutProbability( 0 ), seed( 42 ) {}
+	};
+
+    public:
+	/** @param threads number of threads to use, 0 to use one per hardware thread */
+	explicit RangeSensorSimulator( const ScannerModel& scanner = ScannerModel(),
+		const NoiseModel& noise = NoiseModel(), size_t threads = 0 );
+
+	void setScannerModel( const ScannerModel& scanner ) { this->scanner = scanner; }
+	const ScannerModel& getScannerModel() const { return scanner; }
+
+	void setNoiseModel( const NoiseModel& noise ) { this->noise = noise; }
+	const NoiseModel& getNoiseModel() const { return noise; }
+
+	void setThreads( size_t threads ) { this->threads = threads; }
+
+	/**
+	 * Casts the rays of the scanner into the grid.
+	 *
+	 * @param sensor2grid pose of the sensor in the frame of the grid
+	 * @param ranges the range of each ray, line by line. Rays that don't
+	 *        give a measurement are NaN.
+	 */
+	void simulate( const MLSGrid& grid, const Transform& sensor2grid, std::vector<double>& ranges ) const;
+
+	/** @overload
+	 *
+	 * Casts the rays into the mesh of the BVH.
+	 */
+	void simulate( const TriMeshBVH& bvh, const Transform& sensor2mesh, std::vector<double>& ranges ) const;
+
+	/** @overload
+	 *
+	 * The sensor pose is given by the relative transform of @a sensor to
+	 * the frame of the grid.
+	 */
+	void simulate( const MLSGrid& grid, const FrameNode* sensor, std::vector<double>& ranges ) const;
+
+	/** @overload
+	 *
+	 * Builds a BVH for the mesh. Use the BVH version to simulate multiple
+	 * poses on the same mesh.
+	 */
+	void simulate( const TriMesh& mesh, const FrameNode* sensor, std::vector<double>& ranges ) const;
+
+	/** fills the scan with the given ranges, invalid ranges are stored as 0 */
+	void fillLaserScan( const std::vector<double>& ranges, LaserScan& scan ) const;
+
+	/** replaces the vertices of the pointcloud with the points of the
+	 * valid ranges, in the sensor frame */
+	void fillPointcloud( const std::vector<double>& ranges, Pointcloud& pc ) const;
+
+	/** @return the direction of a ray in the sensor frame, without noise */
+	Eigen::Vector3d getRayDirection( size_t line, size_t point ) const;
+
+    private:
+	ScannerModel scanner;
+	NoiseModel noise;
+	size_t threads;
+    };
+}
+
+#endif
@@ -0,0 +1,286 @@
+#include "SurfaceQuery.hpp"
+
+#include <envire/maps/MLSGrid.hpp>
+#include <envire/maps/MLSMap.hpp>
+#include <envire/maps/ElevationGrid.hpp>
+#include <envire/tools/ParallelFor.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+using namespace envire;
+
+namespace
+{
+    /** a point that falls into the grid, together with its cell */
+    struct CellQuery
+    {
+	size_t cell;
+	size_t index;
+	size_t xi, yi;
+	double xmod, ymod;
+
+	bool operator<( const CellQuery& other ) const
+	{
+	    return cell < other.cell || (cell == other.cell && index < other.index);
+	}
+    };
+
+    /** collects the points which are inside the grid, sorted by cell, so
+     * that neighbouring queries access the same memory */
+    void sortByCell( const GridBase& grid, const Eigen::Affine3d& trans,
+	    const SurfaceQuery::PointVector& points, const SurfaceQuery::ResultVector& result,
+	    std::vector<CellQuery>& queries )
+    {
+	queries.clear();
+	queries.reserve( points.size() );
+	for( size_t i=0; i<points.size(); i++ )
+	{
+	    // points which have been answered by a previous grid are skipped
+	    if( result[i].valid )
+		continue;
+
+	    const Eigen::Vector3d p( trans * points[i] );
+	    CellQuery q;
+	    if( grid.toGrid( p.x(), p.y(), q.xi, q.yi, q.xmod, q.ymod ) )
+	    {
+		q.cell = q.yi * grid.getCellSizeX() + q.xi;
+		q.index = i;
+		queries.push_back( q );
+	    }
+	}
+	std::sort( queries.begin(), queries.end() );
+    }
+
+    /** @return the slope between the heights of two cells, using a one sided
+     * difference if only one of them is available */
+    double slope( bool hasPrev, double prev, bool hasNext, double next, double center, double scale )
+    {
+	if( hasPrev && hasNext )
+	    return (next - prev) / (2.0 * scale);
+	if( hasPrev )
+	    return (center - prev) / scale;
+	if( hasNext )
+	    return (next - center) / scale;
+	return 0.0;
+    }
+
+    struct MLSQuery
+    {
+	const MLSGrid& grid;
+	const std::vector<CellQuery>& queries;
+	SurfaceQuery::ResultVector& result;
+	/** rotation and height offset from the grid to the frame of the
+	 * results, the grid is assumed to be only rotated around z */
+	const Eigen::Matrix3d rotation;
+	const double zOffset;
+
+	MLSQuery( const MLSGrid& grid, const std::vector<CellQuery>& queries, SurfaceQuery::ResultVector& result,
+		const Eigen::Affine3d& C_g2m )
+	    : grid( grid ), queries( queries ), result( result ),
+	    rotation( C_g2m.linear() ), zOffset( C_g2m.translation().z() ) {}
+
+	const SurfacePatch* getTop( size_t xi, size_t yi ) const
+	{
+	    const SurfacePatch* top = NULL;
+	    for( MLSGrid::const_iterator it = grid.beginCell( xi, yi ); it != grid.endCell(); it++ )
+	    {
+		if( !it->isNegative() && (!top || it->mean > top->mean) )
+		    top = &(*it);
+	    }
+	    return top;
+	}
+
+	/** finds the patch in the neighbouring cell which is closest to the
+	 * given height, this way the normal is not affected by overhanging
+	 * structures */
+	bool getNeighbour( int xi, int yi, double height, double& neighbour ) const
+	{
+	    if( xi < 0 || yi < 0 || xi >= (int)grid.getCellSizeX() || yi >= (int)grid.getCellSizeY() )
+		return false;
+
+	    double best = std::numeric_limits<double>::infinity();
+	    for( MLSGrid::const_iterator it = grid.beginCell( xi, yi ); it != grid.endCell(); it++ )
+	    {
+		if( !it->isNegative() && std::fabs( it->mean - height ) < best )
+		{
+		    best = std::fabs( it->mean - height );
+		    neighbour = it->mean;
+		}
+	    }
+	    return best < std::numeric_limits<double>::infinity();
+	}
+
+	Eigen::Vector3d estimateNormal( size_t xi, size_t yi, double height ) const
+	{
+	    double l = 0, r = 0, d = 0, u = 0;
+	    const bool hl = getNeighbour( xi - 1, yi, height, l ),
+		  hr = getNeighbour( xi + 1, yi, height, r ),
+		  hd = getNeighbour( xi, yi - 1, height, d ),
+		  hu = getNeighbour( xi, yi + 1, height, u );
+
+	    const double sx = slope( hl, l, hr, r, height, grid.getScaleX() );
+	    const double sy = slope( hd, d, hu, u, height, grid.getScaleY() );
+	    return Eigen::Vector3d( -sx, -sy, 1.0 ).normalized();
+	}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    const bool slopeModel = grid.getConfig().updateModel == MLSConfiguration::SLOPE;
+
+	    size_t lastCell = std::numeric_limits<size_t>::max();
+	    const SurfacePatch* top = NULL;
+	    Eigen::Vector3d normal;
+	    for( size_t i=begin; i<end; i++ )
+	    {
+		const CellQuery& q( queries[i] );
+		if( q.cell != lastCell )
+		{
+		    // the cell lookups are shared between all points in the
+		    // same cell
+		    lastCell = q.cell;
+		    top = getTop( q.xi, q.yi );
+		    if( top )
+		    {
+			if( slopeModel && top->isHorizontal() )
+			    normal = top->getNormal().cast<double>();
+			else
+			    normal = estimateNormal( q.xi, q.yi, top->mean );
+		    }
+		}
+
+		if( !top )
+		    continue;
+
+		SurfaceQuery::Result &res( result[q.index] );
+		res.valid = true;
+		if( slopeModel && top->isHorizontal() )
+		    res.height = top->getHeight( Eigen::Vector2f( q.xmod, q.ymod ) );
+		else
+		    res.height = top->mean;
+		res.height += zOffset;
+		res.normal = rotation * normal;
+		res.variance = top->stdev * top->stdev;
+	    }
+	}
+    };
+
+    struct ElevationQuery
+    {
+	const ElevationGrid& grid;
+	const ElevationGrid::ArrayType& data;
+	const std::vector<CellQuery>& queries;
+	SurfaceQuery::ResultVector& result;
+
+	ElevationQuery( const ElevationGrid& grid, const std::vector<CellQuery>& queries, SurfaceQuery::ResultVector& result )
+	    : grid( grid ), data( grid.getGridData( ElevationGrid::ELEVATION ) ),
+	    queries( queries ), result( result ) {}
+
+	Eigen::Vector3d getNormal( size_t xi, size_t yi ) const
+	{
+	    const double h = data[yi][xi];
+	    const size_t w = grid.getCellSizeX(), ht = grid.getCellSizeY();
+	    const double sx = slope( xi > 0, xi > 0 ? data[yi][xi-1] : 0.0,
+		    xi + 1 < w, xi + 1 < w ? data[yi][xi+1] : 0.0, h, grid.getScaleX() );
+	    const double sy = slope( yi > 0, yi > 0 ? data[yi-1][xi] : 0.0,
+		    yi + 1 < ht, yi + 1 < ht ? data[yi+1][xi] : 0.0, h, grid.getScaleY() );
+	    return Eigen::Vector3d( -sx, -sy, 1.0 ).normalized();
+	}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    size_t lastCell = std::numeric_limits<size_t>::max();
+	    Eigen::Vector3d normal;
+	    for( size_t i=begin; i<end; i++ )
+	    {
+		const CellQuery& q( queries[i] );
+		if( q.cell != lastCell )
+		{
+		    lastCell = q.cell;
+		    normal = getNormal( q.xi, q.yi );
+		}
+
+		// the height is given for the center of the cell, and the
+		// surface is the plane through it with the cell normal
+		const double dx = q.xmod - grid.getScaleX() * 0.5;
+		const double dy = q.ymod - grid.getScaleY() * 0.5;
+
+		SurfaceQuery::Result &res( result[q.index] );
+		res.valid = true;
+		res.height = data[q.yi][q.xi] - (dx * normal.x() + dy * normal.y()) / normal.z();
+		res.normal = normal;
+		res.variance = 0;
+	    }
+	}
+    };
+}
+
+SurfaceQuery::SurfaceQuery( size_t threads )
+    : threads( threads )
+{
+}
+
+void SurfaceQuery::query( const MLSGrid& grid, const PointVector& points, ResultVector& result ) const
+{
+    result.assign( points.size(), Result() );
+
+    // evicted grids can only be restored from this thread
+    grid.touch();
+    std::vector<CellQuery> queries;
+    sortByCell( grid, Eigen::Affine3d::Identity(), points, result, queries );
+
+    MLSQuery func( grid, queries, result, Eigen::Affine3d::Identity() );
+    parallelFor( queries.size(), func, threads );
+}
+
+void SurfaceQuery::query( const MLSMap& map, const PointVector& points, ResultVector& result ) const
+{
+    result.assign( points.size(), Result() );
+
+    // go backwards through the grids, so that the most recent grid is used
+    // for points which are covered by several grids
+    std::vector<CellQuery> queries;
+    for( std::vector<MLSGrid::Ptr>::const_reverse_iterator it = map.grids.rbegin(); it != map.grids.rend(); it++ )
+    {
+	const MLSGrid &grid( **it );
+	grid.touch();
+	const Eigen::Affine3d C_m2g( map.getFrameNode()->relativeTransform( grid.getFrameNode() ) );
+
+	sortByCell( grid, C_m2g, points, result, queries );
+	if( queries.empty() )
+	    continue;
+
+	MLSQuery func( grid, queries, result, C_m2g.inverse() );
+	parallelFor( queries.size(), func, threads );
+    }
+}
+
+void SurfaceQuery::query( const ElevationGrid& grid, const PointVector& points, ResultVector& result ) const
+{
+    result.assign( points.size(), Result() );
+
+    grid.touch();
+    std::vector<CellQuery> queries;
+    sortByCell( grid, Eigen::Affine3d::Identity(), points, result, queries );
+
+    ElevationQuery func( grid, queries, result );
+    parallelFor( queries.size(), func, threads );
+}
+
+void SurfaceQuery::samplePolyline( const PointVector& polyline, double step, PointVector& points )
+{
+    points.clear();
+    if( polyline.empty() )
+	return;
+
+    points.push_back( polyline.front() );
+    for( size_t i=1; i<polyline.size(); i++ )
+    {
+	const Eigen::Vector3d d( polyline[i] - polyline[i-1] );
+	const int steps = step > 0 ? std::ceil( d.norm() / step ) : 1;
+	for( int s=1; s<steps; s++ )
+	    points.push_back( polyline[i-1] + d * (double)s / steps );
+	points.push_back( polyline[i] );
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef __ENVIRE_TOOLS_SURFACEQUERY_HPP__
+#define __ENVIRE_TOOLS_SURFACEQUERY_HPP__
+
+#include <envire/Core.hpp>
+#include <Eigen/StdVector>
+#include <vector>
+
+namespace envire
+{
+    class MLSGrid;
+    class MLSMap;
+    class ElevationGrid;
+
+    /**
+     * Batched queries of the top surface of MLS and elevation maps.
+     *
+     * For a set of points, e.g. the samples along a planned path, the height
+     * of the top surface, its normal and the variance of the height are
+     * looked up. The queries are sorted by grid cell, so that neighbouring
+     * points share the cell lookups, and are evaluated in parallel.
+     *
+     * All points are given in the frame of the map that is queried, only
+     * their x and y coordinates are used. The results are in the same frame
+     * and in the same order as the points.
+     */
+    class SurfaceQuery
+    {
+    public:
+	struct Result
+	{
+	    /** false if the point is outside the map, or there is no surface
+	     * in its cell */
+	    bool valid;
+	    /** height of the top surface at the point */
+	    double height;
+	    /** normal of the top surface */
+	    Eigen::Vector3d normal;
+	    /** variance of the height, 0 for elevation grids */
+	    double variance;
+
+	    Result() : valid( false ), height( 0 ), normal( Eigen::Vector3d::UnitZ() ), variance( 0 ) {}
+	};
+
+	typedef std::vector<Eigen::Vector3d> PointVector;
+	typedef std::vector<Result> ResultVector;
+
+    public:
+	/** @param threads number of threads to use, 0 to use one per hardware thread */
+	explicit SurfaceQuery( size_t threads = 0 );
+
+	void setThreads( size_t threads ) { this->threads = threads; }
+
+	/** queries the top horizontal or vertical patch of each cell. For
+	 * grids which use the slope model, the height and normal are those of
+	 * the plane of the patch, otherwise the normal is estimated from the
+	 * neighbouring cells. */
+	void query( const MLSGrid& grid, const PointVector& points, ResultVector& result ) const;
+
+	/** queries the grids of the map, the grids which have been added last
+	 * take precedence, which is the same as for MLSMap::getPatch() */
+	void query( const MLSMap& map, const PointVector& points, ResultVector& result ) const;
+
+	/** queries the elevation band, the height is interpolated with the
+	 * plane given by the normal of the cell, as in
+	 * ElevationGrid::getElevation() */
+	void query( const ElevationGrid& grid, const PointVector& points, ResultVector& result ) const;
+
+	/**
+	 * Samples a polyline with the given step size. The vertices of the
+	 * polyline are always part of the result.
+	 */
+	static void samplePolyline( const PointVector& polyline, double step, PointVector& points );
+
+    private:
+	size_t threads;
+    };
+}
+
+#endif
@@ -0,0 +1,372 @@
+#include "TraversabilityPlanner.hpp"
+
+#include <queue>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+using namespace envire;
+
+namespace
+{
+    const float infinity = std::numeric_limits<float>::infinity();
+}
+
+TraversabilityPlanner::TraversabilityPlanner( const TraversabilityGrid& grid )
+    : grid( grid ), width( 0 ), height( 0 ), probabilityWeight( 0.0 ),
+    classBand( NULL ), probabilityBand( NULL ), minCost( 1.0 ), expanded( 0 ), dstarValid( false ),
+    start( 0 ), goal( 0 ), last( 0 ), km( 0 )
+{
+    updateCostTable();
+}
+
+void TraversabilityPlanner::setProbabilityWeight( double weight )
+{
+    if( weight < 0 || weight > 1.0 )
+	throw std::runtime_error("TraversabilityPlanner: probability weight needs to be in the range [0, 1].");
+    probabilityWeight = weight;
+    updateCostTable();
+}
+
+void TraversabilityPlanner::updateCostTable()
+{
+    const size_t values = std::numeric_limits<uint8_t>::max() + 1;
+    const std::vector<TraversabilityClass>& classes( grid.getTraversabilityClasses() );
+
+    costTable.resize( values * values );
+    minCost = infinity;
+    for( size_t klass=0; klass<values; klass++ )
+    {
+	const double drivability = klass < classes.size() ? classes[klass].getDrivability() : 0.0;
+	for( size_t prob=0; prob<values; prob++ )
+	{
+	    const double p = (double)prob / std::numeric_limits<uint8_t>::max();
+	    const double confidence = 1.0 - probabilityWeight + probabilityWeight * p;
+	    float cost = infinity;
+	    if( drivability > 0 && confidence > 0 )
+		cost = 1.0 / (drivability * confidence);
+	    costTable[klass * values + prob] = cost;
+	    minCost = std::min( minCost, cost );
+	}
+    }
+    // the heuristic needs a finite lower bound of the cost
+    if( minCost == infinity )
+	minCost = 1.0;
+
+    width = grid.getCellSizeX();
+    height = grid.getCellSizeY();
+    classBand = probabilityBand = NULL;
+    if( grid.hasBand( TraversabilityGrid::TRAVERSABILITY ) )
+	classBand = &grid.getGridData( TraversabilityGrid::TRAVERSABILITY );
+    if( grid.hasBand( TraversabilityGrid::PROBABILITY ) )
+	probabilityBand = &grid.getGridData( TraversabilityGrid::PROBABILITY );
+
+    dirtyRegions.clear();
+    dstarValid = false;
+}
+
+float TraversabilityPlanner::getCost( size_t cell ) const
+{
+    if( !classBand )
+	return infinity;
+
+    // the bands are stored row by row, without probability band all cells
+    // are certain
+    const size_t values = std::numeric_limits<uint8_t>::max() + 1;
+    const size_t p = probabilityBand ? probabilityBand->data()[cell] : values - 1;
+    return costTable[classBand->data()[cell] * values + p];
+}
+
+size_t TraversabilityPlanner::getNeighbours( size_t cell, size_t* neighbours ) const
+{
+    const size_t x = cell % width, y = cell / width;
+    size_t count = 0;
+    for( int dy=-1; dy<=1; dy++ )
+    {
+	for( int dx=-1; dx<=1; dx++ )
+	{
+	    if( (!dx && !dy) || (dx < 0 && x == 0) || (dy < 0 && y == 0)
+		    || (dx > 0 && x + 1 >= width) || (dy > 0 && y + 1 >= height) )
+		continue;
+	    neighbours[count++] = (y + dy) * width + x + dx;
+	}
+    }
+    return count;
+}
+
+double TraversabilityPlanner::getEdgeCost( size_t from, size_t to ) const
+{
+    const float cf = getCost( from ), ct = getCost( to );
+    if( cf == infinity || ct == infinity )
+	return infinity;
+
+    const size_t fx = from % width, fy = from / width,
+	  tx = to % width, ty = to / width;
+    double dist;
+    if( fx != tx && fy != ty )
+    {
+	// don't cut the corners of obstacles
+	if( getCost( fy * width + tx ) == infinity || getCost( ty * width + fx ) == infinity )
+	    return infinity;
+	dist = std::sqrt( std::pow( grid.getScaleX(), 2 ) + std::pow( grid.getScaleY(), 2 ) );
+    }
+    else
+	dist = fx != tx ? grid.getScaleX() : grid.getScaleY();
+
+    return dist * 0.5 * (cf + ct);
+}
+
+double TraversabilityPlanner::heuristic( size_t a, size_t b ) const
+{
+    // octile distance for cells with the lowest cost
+    const size_t dx = std::max( a % width, b % width ) - std::min( a % width, b % width );
+    const size_t dy = std::max( a / width, b / width ) - std::min( a / width, b / width );
+    const size_t diag = std::min( dx, dy );
+    const double diagDist = std::sqrt( std::pow( grid.getScaleX(), 2 ) + std::pow( grid.getScaleY(), 2 ) );
+    return minCost * (diag * diagDist + (dx - diag) * grid.getScaleX() + (dy - diag) * grid.getScaleY());
+}
+
+bool TraversabilityPlanner::planAStar( const Position& startPos, const Position& goalPos,
+	std::vector<Position>& path, double* cost )
+{
+    path.clear();
+    expanded = 0;
+    if( startPos.x >= width || startPos.y >= height || goalPos.x >= width || goalPos.y >= height )
+	throw std::runtime_error("TraversabilityPlanner: start or goal outside of the grid.");
+
+    const size_t s = startPos.y * width + startPos.x, t = goalPos.y * width + goalPos.x;
+    if( getCost( s ) == infinity || getCost( t ) == infinity )
+	return false;
+
+    std::vector<double> dist( width * height, infinity );
+    std::vector<size_t> parent( width * height, 0 );
+    std::vector<bool> closed( width * height, false );
+
+    typedef std::pair<double, size_t> Entry;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > open;
+    dist[s] = 0;
+    open.push( Entry( heuristic( s, t ), s ) );
+
+    size_t neighbours[8];
+    while( !open.empty() )
+    {
+	const size_t u = open.top().second;
+	open.pop();
+	if( closed[u] )
+	    continue;
+	closed[u] = true;
+	expanded++;
+
+	if( u == t )
+	    break;
+
+	const size_t n = getNeighbours( u, neighbours );
+	for( size_t i=0; i<n; i++ )
+	{
+	    const size_t v = neighbours[i];
+	    if( closed[v] )
+		continue;
+	    const double d = dist[u] + getEdgeCost( u, v );
+	    if( d < dist[v] )
+	    {
+		dist[v] = d;
+		parent[v] = u;
+		open.push( Entry( d + heuristic( v, t ), v ) );
+	    }
+	}
+    }
+
+    if( !closed[t] )
+	return false;
+
+    for( size_t c = t; c != s; c = parent[c] )
+	path.push_back( Position( c % width, c / width ) );
+    path.push_back( startPos );
+    std::reverse( path.begin(), path.end() );
+
+    if( cost )
+	*cost = dist[t];
+    return true;
+}
+
+TraversabilityPlanner::Key TraversabilityPlanner::calculateKey( size_t cell ) const
+{
+    const double m = std::min( g[cell], rhs[cell] );
+    return Key( m + heuristic( start, cell ) + km, m );
+}
+
+bool TraversabilityPlanner::keyLess( const Key& a, const Key& b )
+{
+    const double eps = 1e-9 * std::max( 1.0, std::fabs( a.first ) );
+    if( a.first < b.first - eps )
+	return true;
+    if( a.first > b.first + eps )
+	return false;
+    return a.second < b.second;
+}
+
+void TraversabilityPlanner::updateVertex( size_t cell )
+{
+    if( cell != goal )
+    {
+	double best = infinity;
+	size_t neighbours[8];
+	const size_t n = getNeighbours( cell, neighbours );
+	for( size_t i=0; i<n; i++ )
+	    best = std::min( best, getEdgeCost( cell, neighbours[i] ) + g[neighbours[i]] );
+	rhs[cell] = best;
+    }
+
+    if( queued[cell] )
+    {
+	queue.erase( std::make_pair( queuedKey[cell], cell ) );
+	queued[cell] = false;
+    }
+    if( g[cell] != rhs[cell] )
+    {
+	queuedKey[cell] = calculateKey( cell );
+	queue.insert( std::make_pair( queuedKey[cell], cell ) );
+	queued[cell] = true;
+    }
+}
+
+void TraversabilityPlanner::computeShortestPath()
+{
+    size_t neighbours[8];
+    while( !queue.empty() &&
+	    (keyLess( queue.begin()->first, calculateKey( start ) ) || rhs[start] != g[start]) )
+    {
+	const Key kold = queue.begin()->first;
+	const size_t u = queue.begin()->second;
+	queue.erase( queue.begin() );
+	queued[u] = false;
+	expanded++;
+
+	const Key knew = calculateKey( u );
+	if( kold < knew )
+	{
+	    queuedKey[u] = knew;
+	    queue.insert( std::make_pair( knew, u ) );
+	    queued[u] = true;
+	}
+	else if( g[u] > rhs[u] )
+	{
+	    g[u] = rhs[u];
+	    const size_t n = getNeighbours( u, neighbours );
+	    for( size_t i=0; i<n; i++ )
+		updateVertex( neighbours[i] );
+	}
+	else
+	{
+	    g[u] = infinity;
+	    updateVertex( u );
+	    const size_t n = getNeighbours( u, neighbours );
+	    for( size_t i=0; i<n; i++ )
+		updateVertex( neighbours[i] );
+	}
+    }
+}
+
+void TraversabilityPlanner::initDStar( const Position& startPos, const Position& goalPos )
+{
+    if( startPos.x >= width || startPos.y >= height || goalPos.x >= width || goalPos.y >= height )
+	throw std::runtime_error("TraversabilityPlanner: start or goal outside of the grid.");
+
+    start = last = startPos.y * width + startPos.x;
+    goal = goalPos.y * width + goalPos.x;
+    km = 0;
+    g.assign( width * height, infinity );
+    rhs.assign( width * height, infinity );
+    queuedKey.assign( width * height, Key() );
+    queued.assign( width * height, false );
+    queue.clear();
+
+    rhs[goal] = 0;
+    queuedKey[goal] = calculateKey( goal );
+    queue.insert( std::make_pair( queuedKey[goal], goal ) );
+    queued[goal] = true;
+
+    dstarValid = true;
+}
+
+void TraversabilityPlanner::addDirtyRegion( size_t x0, size_t y0, size_t x1, size_t y1 )
+{
+    dirtyRegions.push_back( x0 );
+    dirtyRegions.push_back( y0 );
+    dirtyRegions.push_back( x1 );
+    dirtyRegions.push_back( y1 );
+}
+
+bool TraversabilityPlanner::replan( const Position& startPos, std::vector<Position>& path, double* cost )
+{
+    if( !dstarValid )
+	throw std::runtime_error("TraversabilityPlanner: initDStar() needs to be called before replan().");
+    if( startPos.x >= width || startPos.y >= height )
+	throw std::runtime_error("TraversabilityPlanner: start outside of the grid.");
+
+    expanded = 0;
+
+    // the keys stay a lower bound if the start moves, by adding the
+    // distance it moved
+    start = startPos.y * width + startPos.x;
+    km += heuristic( last, start );
+    last = start;
+
+    // repair the search around the modified cells. The cost of a cell
+    // affects all edges to its neighbours and the diagonals past it, so
+    // the neighbours are checked as well. updateVertex() compares the
+    // search with the current costs, and leaves cells whose cost did not
+    // change as they are.
+    for( size_t i=0; i<dirtyRegions.size(); i+=4 )
+    {
+	const size_t x0 = dirtyRegions[i] > 0 ? dirtyRegions[i] - 1 : 0,
+	      y0 = dirtyRegions[i+1] > 0 ? dirtyRegions[i+1] - 1 : 0,
+	      x1 = std::min( dirtyRegions[i+2] + 1, width - 1 ),
+	      y1 = std::min( dirtyRegions[i+3] + 1, height - 1 );
+	for( size_t y=y0; y<=y1; y++ )
+	    for( size_t x=x0; x<=x1; x++ )
+		updateVertex( y * width + x );
+    }
+    dirtyRegions.clear();
+
+    computeShortestPath();
+    return extractPath( path, cost );
+}
+
+bool TraversabilityPlanner::extractPath( std::vector<Position>& path, double* cost ) const
+{
+    path.clear();
+    if( g[start] == infinity )
+	return false;
+
+    size_t neighbours[8];
+    size_t cell = start;
+    double sum = 0;
+    path.push_back( Position( cell % width, cell / width ) );
+    while( cell != goal )
+    {
+	// follow the cheapest successor, which is the gradient of g
+	double best = infinity;
+	size_t next = cell;
+	const size_t n = getNeighbours( cell, neighbours );
+	for( size_t i=0; i<n; i++ )
+	{
+	    const double c = getEdgeCost( cell, neighbours[i] ) + g[neighbours[i]];
+	    if( c < best )
+	    {
+		best = c;
+		next = neighbours[i];
+	    }
+	}
+	if( best == infinity || path.size() > width * height )
+	    return false;
+
+	sum += getEdgeCost( cell, next );
+	cell = next;
+	path.push_back( Position( cell % width, cell / width ) );
+    }
+
+    if( cost )
+	*cost = sum;
+    return true;
+}
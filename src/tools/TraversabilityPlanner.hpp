@@ -0,0 +1,137 @@
+#ifndef __ENVIRE_TOOLS_TRAVERSABILITYPLANNER_HPP__
+#define __ENVIRE_TOOLS_TRAVERSABILITYPLANNER_HPP__
+
+#include <envire/maps/TraversabilityGrid.hpp>
+#include <vector>
+#include <set>
+
+namespace envire
+{
+    /**
+     * Shortest path planning on the 8-connected cells of a
+     * TraversabilityGrid.
+     *
+     * The planner reads the traversability and probability bands of the
+     * grid directly, whenever it needs the cost of a cell, and keeps no copy
+     * of them. The cost of a cell is given by a table over the class
+     * and probability values, which is computed from the registered
+     * TraversabilityClasses: a cell with drivability d and probability p
+     * costs
+     *
+     *   1 / (d * (1 - w + w * p))
+     *
+     * per meter, where w is the probability weight. Cells with a drivability
+     * of 0 are obstacles. The cost of moving between two cells is the mean of
+     * their costs times the distance between the cell centers. Diagonal
+     * moves past an obstacle are not allowed.
+     *
+     * Two methods are available:
+     * - planAStar() runs a full A* search with the octile distance as
+     *   heuristic.
+     * - initDStar() and replan() implement D* Lite, which searches from the
+     *   goal to the start. After the grid has been modified, the changed
+     *   areas are passed with addDirtyRegion(), and replan() only repairs the
+     *   part of the search that is affected by the changes, and by the
+     *   movement of the start.
+     *
+     * The planner keeps a reference to the grid, which must stay valid while
+     * the planner is used. Changes of the traversability classes or of the
+     * size of the grid are only seen after updateCostTable(). Changes of
+     * the cells are seen immediately by planAStar(), but have to be passed
+     * to addDirtyRegion() before the next replan().
+     */
+    class TraversabilityPlanner
+    {
+    public:
+	typedef GridBase::Position Position;
+
+	explicit TraversabilityPlanner( const TraversabilityGrid& grid );
+
+	/** weight w of the probability in the cell cost, in the range
+	 * [0, 1]. The default of 0 ignores the probability band. */
+	void setProbabilityWeight( double weight );
+	double getProbabilityWeight() const { return probabilityWeight; }
+
+	/** recomputes the cost table from the traversability classes of the
+	 * grid. Needs to be called if the classes, the bands or the size of
+	 * the grid changed. Invalidates the D* Lite search. */
+	void updateCostTable();
+
+	/** @return the cost per meter of the cell, infinity for obstacles */
+	float getCellCost( size_t x, size_t y ) const { return getCost( y * width + x ); }
+
+	/**
+	 * Plans the cheapest path from start to goal using A*.
+	 *
+	 * @param path the cells of the path, including start and goal
+	 * @param cost optional, the cost of the path
+	 * @return false if there is no path
+	 */
+	bool planAStar( const Position& start, const Position& goal,
+		std::vector<Position>& path, double* cost = NULL );
+
+	/** starts a new D* Lite search towards the goal */
+	void initDStar( const Position& start, const Position& goal );
+
+	/**
+	 * Marks the cells in the rectangle [x0, x1] x [y0, y1] as modified.
+	 * On the next call of replan(), the search is checked against the
+	 * grid for these cells and their neighbours, and only the cells whose
+	 * cost changed trigger a repair of the search.
+	 */
+	void addDirtyRegion( size_t x0, size_t y0, size_t x1, size_t y1 );
+
+	/**
+	 * Updates the D* Lite search for the new start and the dirty
+	 * regions, and returns the cheapest path from start to goal.
+	 *
+	 * @return false if there is no path
+	 */
+	bool replan( const Position& start, std::vector<Position>& path, double* cost = NULL );
+
+	/** @return number of cells which have been expanded by the last call
+	 * of planAStar() or replan() */
+	size_t getExpandedCount() const { return expanded; }
+
+    private:
+	typedef std::pair<double, double> Key;
+	typedef std::set<std::pair<Key, size_t> > Queue;
+
+	/** looks up the cost of the cell from the bands of the grid */
+	float getCost( size_t cell ) const;
+	double getEdgeCost( size_t from, size_t to ) const;
+	double heuristic( size_t a, size_t b ) const;
+	/** @return the neighbours of the cell */
+	size_t getNeighbours( size_t cell, size_t* neighbours ) const;
+
+	Key calculateKey( size_t cell ) const;
+	/** compares the keys with a tolerance on the first value, so that
+	 * ties are decided by the second value in spite of rounding errors */
+	static bool keyLess( const Key& a, const Key& b );
+	void updateVertex( size_t cell );
+	void computeShortestPath();
+	bool extractPath( std::vector<Position>& path, double* cost ) const;
+
+	const TraversabilityGrid& grid;
+	size_t width, height;
+	double probabilityWeight;
+	/** cost per meter for each class and probability value */
+	std::vector<float> costTable;
+	/** bands of the grid, the probability band is optional */
+	const TraversabilityGrid::ArrayType *classBand, *probabilityBand;
+	float minCost;
+	size_t expanded;
+
+	// D* Lite state
+	bool dstarValid;
+	size_t start, goal, last;
+	double km;
+	std::vector<double> g, rhs;
+	std::vector<Key> queuedKey;
+	std::vector<bool> queued;
+	Queue queue;
+	std::vector<size_t> dirtyRegions;
+    };
+}
+
+#endif
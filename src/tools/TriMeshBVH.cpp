@@ -0,0 +1,626 @@
+#include "TriMeshBVH.hpp"
+#include "ParallelFor.hpp"
+#include <envire/maps/TriMesh.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+#include <cmath>
+
+using namespace envire;
+
+namespace
+{
+    typedef Eigen::AlignedBox<double, 3> Box;
+
+    const double INF = std::numeric_limits<double>::infinity();
+
+    /** number of bins along each axis for evaluating the surface area
+     * heuristic */
+    const int SAH_BINS = 16;
+
+    double surfaceArea( const Box& box )
+    {
+	if( box.isEmpty() )
+	    return 0;
+	const Eigen::Vector3d s( box.sizes() );
+	return 2.0 * (s.x() * s.y() + s.y() * s.z() + s.z() * s.x());
+    }
+
+    int binIndex( double c, double lo, double extent )
+    {
+	return std::min( SAH_BINS - 1, (int)((c - lo) / extent * SAH_BINS) );
+    }
+
+    struct BinPredicate
+    {
+	const std::vector<Eigen::Vector3d>& centroids;
+	int axis;
+	double lo, extent;
+	int split;
+
+	BinPredicate( const std::vector<Eigen::Vector3d>& centroids, int axis, double lo, double extent, int split )
+	    : centroids( centroids ), axis( axis ), lo( lo ), extent( extent ), split( split ) {}
+
+	bool operator()( size_t face ) const
+	{
+	    return binIndex( centroids[face][axis], lo, extent ) < split;
+	}
+    };
+
+    /** slab test, returns the entry distance of the ray into the box */
+    bool intersectBox( const Box& box, const Eigen::Vector3d& origin, const Eigen::Vector3d& invDir, double maxDistance, double& entry )
+    {
+	double tmin = 0, tmax = maxDistance;
+	for( int i=0; i<3; i++ )
+	{
+	    double t1 = (box.min()[i] - origin[i]) * invDir[i];
+	    double t2 = (box.max()[i] - origin[i]) * invDir[i];
+	    if( t1 > t2 )
+		std::swap( t1, t2 );
+	    // NaN for a zero direction and the origin on the boundary is
+	    // treated as inside
+	    if( t1 > tmin ) tmin = t1;
+	    if( t2 < tmax ) tmax = t2;
+	    if( tmin > tmax )
+		return false;
+	}
+	entry = tmin;
+	return true;
+    }
+
+    /** closest point on the triangle abc, see "Real-Time Collision
+     * Detection", Christer Ericson, section 5.1.5 */
+    Eigen::Vector3d closestPointOnTriangle( const Eigen::Vector3d& p,
+	    const Eigen::Vector3d& a, const Eigen::Vector3d& b, const Eigen::Vector3d& c )
+    {
+	const Eigen::Vector3d ab = b - a, ac = c - a, ap = p - a;
+	const double d1 = ab.dot( ap ), d2 = ac.dot( ap );
+	if( d1 <= 0 && d2 <= 0 )
+	    return a;
+
+	const Eigen::Vector3d bp = p - b;
+	const double d3 = ab.dot( bp ), d4 = ac.dot( bp );
+	if( d3 >= 0 && d4 <= d3 )
+	    return b;
+
+	const double vc = d1 * d4 - d3 * d2;
+	if( vc <= 0 && d1 >= 0 && d3 <= 0 )
+	    return a + ab * (d1 / (d1 - d3));
+
+	const Eigen::Vector3d cp = p - c;
+	const double d5 = ab.dot( cp ), d6 = ac.dot( cp );
+	if( d6 >= 0 && d5 <= d6 )
+	    return c;
+
+	const double vb = d5 * d2 - d1 * d6;
+	if( vb <= 0 && d2 >= 0 && d6 <= 0 )
+	    return a + ac * (d2 / (d2 - d6));
+
+	const double va = d3 * d6 - d5 * d4;
+	if( va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0 )
+	    return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+	const double sum = va + vb + vc;
+	if( sum <= 0 )
+	    return a;
+	return a + ab * (vb / sum) + ac * (vc / sum);
+    }
+
+    /** runs the single queries of the BVH for a batch */
+    struct RayBatch
+    {
+	const TriMeshBVH& bvh;
+	const TriMeshBVH::PointVector& origins;
+	const TriMeshBVH::PointVector& dirs;
+	double maxDistance;
+	TriMeshBVH::HitVector& hits;
+
+	RayBatch( const TriMeshBVH& bvh, const TriMeshBVH::PointVector& origins, const TriMeshBVH::PointVector& dirs,
+		double maxDistance, TriMeshBVH::HitVector& hits )
+	    : bvh( bvh ), origins( origins ), dirs( dirs ), maxDistance( maxDistance ), hits( hits ) {}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    for( size_t i=begin; i<end; i++ )
+		if( !bvh.intersect( origins[i], dirs[i], maxDistance, hits[i] ) )
+		    hits[i].distance = INF;
+	}
+    };
+
+    struct PointBatch
+    {
+	const TriMeshBVH& bvh;
+	const TriMeshBVH::PointVector& points;
+	double maxDistance;
+	TriMeshBVH::HitVector& hits;
+
+	PointBatch( const TriMeshBVH& bvh, const TriMeshBVH::PointVector& points, double maxDistance,
+		TriMeshBVH::HitVector& hits )
+	    : bvh( bvh ), points( points ), maxDistance( maxDistance ), hits( hits ) {}
+
+	void operator()( size_t begin, size_t end )
+	{
+	    for( size_t i=begin; i<end; i++ )
+		if( !bvh.closestPoint( points[i], maxDistance, hits[i] ) )
+		    hits[i].distance = INF;
+	}
+    };
+}
+
+/**
+ * Builds the tree in two phases. The upper levels are built in the calling
+ * thread, until the ranges of faces get smaller than the task size. These
+ * ranges are built into separate node vectors in parallel, which are then
+ * appended to the tree. The tasks work on disjoint ranges of the face
+ * index, so they don't need any synchronization.
+ */
+struct TriMeshBVH::Builder
+{
+    typedef std::vector<Node> NodeVector;
+
+    struct Task
+    {
+	size_t node, begin, end;
+	NodeVector nodes;
+    };
+
+    struct PrepareFunc
+    {
+	Builder& builder;
+	explicit PrepareFunc( Builder& builder ) : builder( builder ) {}
+	void operator()( size_t begin, size_t end )
+	{
+	    for( size_t i=begin; i<end; i++ )
+	    {
+		builder.faceBoxes[i] = builder.bvh.getFaceBox( i );
+		builder.centroids[i] = builder.faceBoxes[i].center();
+	    }
+	}
+    };
+
+    struct TaskFunc
+    {
+	Builder& builder;
+	explicit TaskFunc( Builder& builder ) : builder( builder ) {}
+	void operator()( size_t begin, size_t end )
+	{
+	    for( size_t i=begin; i<end; i++ )
+	    {
+		Task& task( builder.tasks[i] );
+		task.nodes.reserve( 2 * (task.end - task.begin) / builder.bvh.leafSize + 1 );
+		task.nodes.resize( 1 );
+		builder.buildNode( task.nodes, 0, task.begin, task.end, false );
+	    }
+	}
+    };
+
+    TriMeshBVH& bvh;
+    std::vector<Box> faceBoxes;
+    std::vector<Eigen::Vector3d> centroids;
+    /** ranges up to this size are built as separate tasks */
+    size_t taskSize;
+    std::vector<Task> tasks;
+
+    explicit Builder( TriMeshBVH& bvh )
+	: bvh( bvh ), faceBoxes( bvh.faceIndex.size() ), centroids( bvh.faceIndex.size() )
+    {
+	const size_t threads = getThreadCount( bvh.threads );
+	taskSize = threads > 1 ? std::max( bvh.faceIndex.size() / (threads * 4), (size_t)1024 ) : 0;
+    }
+
+    void build()
+    {
+	PrepareFunc prepare( *this );
+	parallelFor( faceBoxes.size(), prepare, bvh.threads );
+
+	bvh.nodes.reserve( 2 * faceBoxes.size() / bvh.leafSize + 1 );
+	bvh.nodes.resize( 1 );
+	buildNode( bvh.nodes, 0, 0, faceBoxes.size(), taskSize > 0 );
+
+	TaskFunc run( *this );
+	parallelFor( tasks.size(), run, bvh.threads, 1 );
+
+	// the root of a task replaces its placeholder, the other nodes are
+	// appended, so the children still come after their parents
+	for( size_t i=0; i<tasks.size(); i++ )
+	{
+	    const NodeVector& local( tasks[i].nodes );
+	    const size_t offset = bvh.nodes.size() - 1;
+	    for( size_t n=0; n<local.size(); n++ )
+	    {
+		Node node( local[n] );
+		if( !node.count )
+		    node.first += offset;
+		if( n == 0 )
+		    bvh.nodes[tasks[i].node] = node;
+		else
+		    bvh.nodes.push_back( node );
+	    }
+	}
+    }
+
+    void buildNode( NodeVector& nodes, size_t idx, size_t begin, size_t end, bool spawn )
+    {
+	std::vector<size_t>& faceIndex( bvh.faceIndex );
+
+	Box box, centroidBox;
+	for( size_t i=begin; i<end; i++ )
+	{
+	    box.extend( faceBoxes[faceIndex[i]] );
+	    centroidBox.extend( centroids[faceIndex[i]] );
+	}
+	nodes[idx].box = box;
+
+	if( end - begin <= bvh.leafSize )
+	{
+	    nodes[idx].first = begin;
+	    nodes[idx].count = end - begin;
+	    return;
+	}
+
+	if( spawn && end - begin <= taskSize )
+	{
+	    Task task;
+	    task.node = idx;
+	    task.begin = begin;
+	    task.end = end;
+	    tasks.push_back( task );
+	    return;
+	}
+
+	const size_t mid = split( begin, end, centroidBox );
+	const size_t left = nodes.size();
+	nodes.resize( left + 2 );
+	nodes[idx].first = left;
+	nodes[idx].count = 0;
+	buildNode( nodes, left, begin, mid, spawn );
+	buildNode( nodes, left + 1, mid, end, spawn );
+    }
+
+    /** partitions the faces at the split with the lowest cost according
+     * to the surface area heuristic, and returns the split position */
+    size_t split( size_t begin, size_t end, const Box& centroidBox )
+    {
+	std::vector<size_t>& faceIndex( bvh.faceIndex );
+
+	double bestCost = INF;
+	int bestAxis = -1, bestSplit = 0;
+	for( int axis=0; axis<3; axis++ )
+	{
+	    const double lo = centroidBox.min()[axis];
+	    const double extent = centroidBox.max()[axis] - lo;
+	    if( extent <= 0 )
+		continue;
+
+	    Box bins[SAH_BINS];
+	    size_t counts[SAH_BINS] = { 0 };
+	    for( size_t i=begin; i<end; i++ )
+	    {
+		const size_t f = faceIndex[i];
+		const int k = binIndex( centroids[f][axis], lo, extent );
+		bins[k].extend( faceBoxes[f] );
+		counts[k]++;
+	    }
+
+	    // the cost of the right side for a split before bin k
+	    double rightArea[SAH_BINS];
+	    size_t rightCount[SAH_BINS];
+	    Box acc;
+	    size_t n = 0;
+	    for( int k=SAH_BINS-1; k>0; k-- )
+	    {
+		acc.extend( bins[k] );
+		n += counts[k];
+		rightArea[k] = surfaceArea( acc );
+		rightCount[k] = n;
+	    }
+
+	    acc.setEmpty();
+	    n = 0;
+	    for( int k=1; k<SAH_BINS; k++ )
+	    {
+		acc.extend( bins[k-1] );
+		n += counts[k-1];
+		if( !n || !rightCount[k] )
+		    continue;
+		const double cost = surfaceArea( acc ) * n + rightArea[k] * rightCount[k];
+		if( cost < bestCost )
+		{
+		    bestCost = cost;
+		    bestAxis = axis;
+		    bestSplit = k;
+		}
+	    }
+	}
+
+	if( bestAxis >= 0 )
+	{
+	    const double lo = centroidBox.min()[bestAxis];
+	    const double extent = centroidBox.max()[bestAxis] - lo;
+	    const size_t mid = std::partition( faceIndex.begin() + begin, faceIndex.begin() + end,
+		    BinPredicate( centroids, bestAxis, lo, extent, bestSplit ) ) - faceIndex.begin();
+	    if( mid != begin && mid != end )
+		return mid;
+	}
+
+	// all centroids are in the same place
+	return begin + (end - begin) / 2;
+    }
+};
+
+struct TriMeshBVH::RefitFunc
+{
+    TriMeshBVH& bvh;
+    explicit RefitFunc( TriMeshBVH& bvh ) : bvh( bvh ) {}
+    void operator()( size_t begin, size_t end )
+    {
+	for( size_t i=begin; i<end; i++ )
+	{
+	    Node& node( bvh.nodes[i] );
+	    if( !node.count )
+		continue;
+	    node.box.setEmpty();
+	    for( size_t f=node.first; f<node.first+node.count; f++ )
+		node.box.extend( bvh.getFaceBox( bvh.faceIndex[f] ) );
+	}
+    }
+};
+
+TriMeshBVH::TriMeshBVH( const TriMesh& mesh, size_t leafSize, size_t threads )
+    : mesh( mesh ), leafSize( std::max( leafSize, (size_t)1 ) ), threads( threads )
+{
+    build();
+}
+
+Eigen::AlignedBox<double, 3> TriMeshBVH::getFaceBox( size_t face ) const
+{
+    const TriMesh::triangle_t& f( mesh.faces[face] );
+    Box box( mesh.vertices[f.get<0>()] );
+    box.extend( mesh.vertices[f.get<1>()] );
+    box.extend( mesh.vertices[f.get<2>()] );
+    return box;
+}
+
+Eigen::Vector3d TriMeshBVH::getFaceNormal( size_t face ) const
+{
+    const TriMesh::triangle_t& f( mesh.faces[face] );
+    const Eigen::Vector3d& v0( mesh.vertices[f.get<0>()] );
+    const Eigen::Vector3d n = (mesh.vertices[f.get<1>()] - v0).cross( mesh.vertices[f.get<2>()] - v0 );
+    const double norm = n.norm();
+    return norm > 0 ? Eigen::Vector3d( n / norm ) : n;
+}
+
+Eigen::AlignedBox<double, 3> TriMeshBVH::getBounds() const
+{
+    return nodes.empty() ? Box() : nodes[0].box;
+}
+
+void TriMeshBVH::build()
+{
+    nodes.clear();
+    faceIndex.resize( mesh.faces.size() );
+    if( faceIndex.empty() )
+	return;
+
+    for( size_t i=0; i<faceIndex.size(); i++ )
+	faceIndex[i] = i;
+
+    Builder builder( *this );
+    builder.build();
+}
+
+void TriMeshBVH::refit()
+{
+    if( faceIndex.size() != mesh.faces.size() )
+	throw std::runtime_error("envire: the faces of the mesh changed, the BVH needs to be rebuilt.");
+
+    RefitFunc func( *this );
+    parallelFor( nodes.size(), func, threads );
+
+    // children always come after their parent
+    for( size_t i=nodes.size(); i-- > 0; )
+    {
+	Node& node( nodes[i] );
+	if( node.count )
+	    continue;
+	node.box = nodes[node.first].box;
+	node.box.extend( nodes[node.first + 1].box );
+    }
+}
+
+bool TriMeshBVH::intersectFace( size_t face, const Eigen::Vector3d& origin, const Eigen::Vector3d& dir, double& distance ) const
+{
+    // Moeller-Trumbore ray triangle intersection
+    const TriMesh::triangle_t& f( mesh.faces[face] );
+    const Eigen::Vector3d& v0( mesh.vertices[f.get<0>()] );
+    const Eigen::Vector3d e1 = mesh.vertices[f.get<1>()] - v0;
+    const Eigen::Vector3d e2 = mesh.vertices[f.get<2>()] - v0;
+
+    const Eigen::Vector3d p = dir.cross( e2 );
+    const double det = e1.dot( p );
+    if( std::abs( det ) < 1e-12 )
+	return false;
+
+    const double invDet = 1.0 / det;
+    const Eigen::Vector3d s = origin - v0;
+    const double u = s.dot( p ) * invDet;
+    if( u < 0 || u > 1 )
+	return false;
+
+    const Eigen::Vector3d q = s.cross( e1 );
+    const double v = dir.dot( q ) * invDet;
+    if( v < 0 || u + v > 1 )
+	return false;
+
+    distance = e2.dot( q ) * invDet;
+    return distance >= 0;
+}
+
+bool TriMeshBVH::intersect( const Eigen::Vector3d& origin, const Eigen::Vector3d& dir, double maxDistance, Hit& hit ) const
+{
+    if( nodes.empty() )
+	return false;
+
+    const Eigen::Vector3d invDir = dir.cwiseInverse();
+    double best = maxDistance;
+    size_t bestFace = 0;
+    bool found = false;
+
+    // the closer child is visited first, the other one is kept on the
+    // stack with its entry distance
+    std::vector<std::pair<size_t, double> > stack;
+    double entry;
+    if( intersectBox( nodes[0].box, origin, invDir, best, entry ) )
+	stack.push_back( std::make_pair( (size_t)0, entry ) );
+
+    while( !stack.empty() )
+    {
+	const std::pair<size_t, double> cur = stack.back();
+	stack.pop_back();
+	if( cur.second > best )
+	    continue;
+
+	const Node& node( nodes[cur.first] );
+	if( node.count )
+	{
+	    for( size_t i=node.first; i<node.first+node.count; i++ )
+	    {
+		double distance;
+		if( intersectFace( faceIndex[i], origin, dir, distance ) && distance <= best )
+		{
+		    best = distance;
+		    bestFace = faceIndex[i];
+		    found = true;
+		}
+	    }
+	}
+	else
+	{
+	    const size_t left = node.first, right = node.first + 1;
+	    double leftEntry, rightEntry;
+	    const bool hitLeft = intersectBox( nodes[left].box, origin, invDir, best, leftEntry );
+	    const bool hitRight = intersectBox( nodes[right].box, origin, invDir, best, rightEntry );
+	    if( hitLeft && hitRight )
+	    {
+		if( leftEntry < rightEntry )
+		{
+		    stack.push_back( std::make_pair( right, rightEntry ) );
+		    stack.push_back( std::make_pair( left, leftEntry ) );
+		}
+		else
+		{
+		    stack.push_back( std::make_pair( left, leftEntry ) );
+		    stack.push_back( std::make_pair( right, rightEntry ) );
+		}
+	    }
+	    else if( hitLeft )
+		stack.push_back( std::make_pair( left, leftEntry ) );
+	    else if( hitRight )
+		stack.push_back( std::make_pair( right, rightEntry ) );
+	}
+    }
+
+    if( !found )
+	return false;
+
+    Eigen::Vector3d normal = getFaceNormal( bestFace );
+    if( normal.dot( dir ) > 0 )
+	normal = -normal;
+
+    hit.distance = best;
+    hit.face = bestFace;
+    hit.point = origin + dir * best;
+    hit.normal = normal;
+    return true;
+}
+
+void TriMeshBVH::intersect( const PointVector& origins, const PointVector& dirs, double maxDistance, HitVector& hits ) const
+{
+    if( origins.size() != dirs.size() )
+	throw std::runtime_error("envire: number of ray origins and directions differ.");
+
+    hits.resize( origins.size() );
+    RayBatch func( *this, origins, dirs, maxDistance, hits );
+    parallelFor( origins.size(), func, threads, 64 );
+}
+
+bool TriMeshBVH::closestPoint( const Eigen::Vector3d& point, double maxDistance, Hit& hit ) const
+{
+    if( nodes.empty() )
+	return false;
+
+    double best = maxDistance * maxDistance;
+    size_t bestFace = 0;
+    Eigen::Vector3d bestPoint;
+    bool found = false;
+
+    // same as for the rays, with the squared distance to the boxes
+    std::vector<std::pair<size_t, double> > stack;
+    const double rootDistance = nodes[0].box.squaredExteriorDistance( point );
+    if( rootDistance <= best )
+	stack.push_back( std::make_pair( (size_t)0, rootDistance ) );
+
+    while( !stack.empty() )
+    {
+	const std::pair<size_t, double> cur = stack.back();
+	stack.pop_back();
+	if( cur.second > best )
+	    continue;
+
+	const Node& node( nodes[cur.first] );
+	if( node.count )
+	{
+	    for( size_t i=node.first; i<node.first+node.count; i++ )
+	    {
+		const TriMesh::triangle_t& f( mesh.faces[faceIndex[i]] );
+		const Eigen::Vector3d p = closestPointOnTriangle( point,
+			mesh.vertices[f.get<0>()], mesh.vertices[f.get<1>()], mesh.vertices[f.get<2>()] );
+		const double distance = (p - point).squaredNorm();
+		if( distance <= best )
+		{
+		    best = distance;
+		    bestFace = faceIndex[i];
+		    bestPoint = p;
+		    found = true;
+		}
+	    }
+	}
+	else
+	{
+	    const size_t left = node.first, right = node.first + 1;
+	    const double leftDistance = nodes[left].box.squaredExteriorDistance( point );
+	    const double rightDistance = nodes[right].box.squaredExteriorDistance( point );
+	    if( leftDistance < rightDistance )
+	    {
+		if( rightDistance <= best )
+		    stack.push_back( std::make_pair( right, rightDistance ) );
+		if( leftDistance <= best )
+		    stack.push_back( std::make_pair( left, leftDistance ) );
+	    }
+	    else
+	    {
+		if( leftDistance <= best )
+		    stack.push_back( std::make_pair( left, leftDistance ) );
+		if( rightDistance <= best )
+		    stack.push_back( std::make_pair( right, rightDistance ) );
+	    }
+	}
+    }
+
+    if( !found )
+	return false;
+
+    hit.distance = std::sqrt( best );
+    hit.face = bestFace;
+    hit.point = bestPoint;
+    hit.normal = getFaceNormal( bestFace );
+    return true;
+}
+
+void TriMeshBVH::closestPoint( const PointVector& points, double maxDistance, HitVector& hits ) const
+{
+    hits.resize( points.size() );
+    PointBatch func( *this, points, maxDistance, hits );
+    parallelFor( points.size(), func, threads, 64 );
+}
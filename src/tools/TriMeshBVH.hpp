@@ -0,0 +1,124 @@
+#ifndef __ENVIRE_TOOLS_TRIMESHBVH_HPP__
+#define __ENVIRE_TOOLS_TRIMESHBVH_HPP__
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <vector>
+
+namespace envire
+{
+    class TriMesh;
+
+    /**
+     * Bounding volume hierarchy over the faces of a TriMesh.
+     *
+     * The hierarchy is a binary tree of axis aligned boxes, where each leaf
+     * holds a small number of faces. The faces of a node are split using the
+     * surface area heuristic, which is evaluated for a fixed number of bins
+     * along each axis. The upper levels of the tree are built in the calling
+     * thread, the subtrees below them in parallel.
+     *
+     * The BVH keeps a reference to the mesh, which needs to stay valid. If
+     * only the vertices of the mesh are moved, refit() updates the boxes of
+     * the existing tree. If faces are added or removed, it has to be rebuilt
+     * with build(). The queries don't modify the BVH, so they can be run
+     * from multiple threads.
+     */
+    class TriMeshBVH
+    {
+    public:
+	struct Hit
+	{
+	    /** distance along the ray, or to the query point */
+	    double distance;
+	    /** index of the face in TriMesh::faces */
+	    size_t face;
+	    /** the point on the face and the normal of the face. For rays the
+	     * normal points against the ray, for closest point queries it
+	     * follows the winding order of the face. */
+	    Eigen::Vector3d point;
+	    Eigen::Vector3d normal;
+	};
+
+	typedef std::vector<Eigen::Vector3d> PointVector;
+	typedef std::vector<Hit> HitVector;
+
+    public:
+	/** @param leafSize maximum number of faces in a leaf
+	 *  @param threads number of threads for building the tree and for the
+	 *         batched queries, 0 to use one per hardware thread */
+	explicit TriMeshBVH( const TriMesh& mesh, size_t leafSize = 4, size_t threads = 0 );
+
+	void setThreads( size_t threads ) { this->threads = threads; }
+
+	/** builds the hierarchy from the current faces of the mesh */
+	void build();
+
+	/** updates the boxes of the hierarchy after vertices of the mesh
+	 * have been moved. The faces need to be the same as for build(). */
+	void refit();
+
+	/**
+	 * Finds the first face that is hit by a ray.
+	 *
+	 * @param origin start of the ray, in the frame of the mesh
+	 * @param dir direction of the ray, needs to be normalized
+	 * @param maxDistance faces further away are ignored
+	 * @return true if a face has been hit
+	 */
+	bool intersect( const Eigen::Vector3d& origin, const Eigen::Vector3d& dir, double maxDistance, Hit& hit ) const;
+
+	/** @overload
+	 *
+	 * Casts the rays given by @a origins and @a dirs in parallel. The
+	 * distance of rays which don't hit a face is infinity.
+	 */
+	void intersect( const PointVector& origins, const PointVector& dirs, double maxDistance, HitVector& hits ) const;
+
+	/**
+	 * Finds the closest point on the mesh.
+	 *
+	 * @param point query point, in the frame of the mesh
+	 * @param maxDistance faces further away are ignored
+	 * @return true if a face is within @a maxDistance
+	 */
+	bool closestPoint( const Eigen::Vector3d& point, double maxDistance, Hit& hit ) const;
+
+	/** @overload
+	 *
+	 * Queries the points in parallel. The distance of points which have
+	 * no face within @a maxDistance is infinity.
+	 */
+	void closestPoint( const PointVector& points, double maxDistance, HitVector& hits ) const;
+
+	size_t getNodeCount() const { return nodes.size(); }
+
+	/** @return the bounding box of the whole mesh */
+	Eigen::AlignedBox<double, 3> getBounds() const;
+
+    private:
+	struct Node
+	{
+	    Eigen::AlignedBox<double, 3> box;
+	    /** for leafs the range in faceIndex, for inner nodes count is 0
+	     * and first is the index of the left child. The right child
+	     * always follows the left one. */
+	    size_t first, count;
+	};
+
+	struct Builder;
+	struct RefitFunc;
+
+	Eigen::AlignedBox<double, 3> getFaceBox( size_t face ) const;
+	bool intersectFace( size_t face, const Eigen::Vector3d& origin, const Eigen::Vector3d& dir, double& distance ) const;
+	Eigen::Vector3d getFaceNormal( size_t face ) const;
+
+	const TriMesh& mesh;
+	size_t leafSize;
+	size_t threads;
+	std::vector<Node> nodes;
+	std::vector<size_t> faceIndex;
+    };
+}
+
+#endif
@@ -12,10 +12,16 @@
 #define BOOST_TEST_MODULE EnvireTest 
 #include <boost/test/included/unit_test.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/ref.hpp>
 
 #include "envire/tools/GridAccess.hpp"
+#include "envire/tools/PoseGraphOptimizer.hpp"
+#include "envire/tools/EnvironmentMerge.hpp"
 #include "envire/maps/Grids.hpp"
 #include "envire/maps/ElevationGrid.hpp"
+#include "envire/maps/MLSGrid.hpp"
+
+#include <boost/filesystem/operations.hpp>
 
 #include "base/timemark.h"
    
@@ -36,6 +42,44 @@ public:
     void serialize(Serialization &) {};
 };
 
+/** processes rows, and polls the execution context for each */
+class RowOperator : public Operator 
+{
+public:
+    RowOperator() : rows( 0 ) {}
+    void set( EnvironmentItem* other ) {}
+    Operator* clone() const {return new RowOperator(*this);}
+    void serialize(Serialization &) {};
+    bool updateAll() 
+    {
+	rows = 0;
+	for( int i=0; i<100; i++ )
+	{
+	    checkCancelled();
+	    reportProgress( i / 100.0 );
+	    rows++;
+	}
+	return true;
+    };
+
+    int rows;
+};
+
+/** runs through without polling the context, and reports when it is
+ * done */
+class FinishOperator : public Operator 
+{
+public:
+    void set( EnvironmentItem* other ) {}
+    Operator* clone() const {return new FinishOperator(*this);}
+    void serialize(Serialization &) {};
+    bool updateAll() 
+    {
+	reportProgress( 1.0 );
+	return true;
+    };
+};
+
 class DummyLayer : public Layer 
 {
 public:
@@ -340,6 +384,105 @@ BOOST_AUTO_TEST_CASE( env_eventsync )
     env->removeEventHandler( &ep );
 }
 
+static Eigen::Affine3d makePose( double x, double y, double z, double yaw, double pitch, double roll )
+{
+    Eigen::Affine3d t( Eigen::Translation3d( x, y, z ) );
+    t.rotate( Eigen::AngleAxisd( yaw, Eigen::Vector3d::UnitZ() )
+	    * Eigen::AngleAxisd( pitch, Eigen::Vector3d::UnitY() )
+	    * Eigen::AngleAxisd( roll, Eigen::Vector3d::UnitX() ) );
+    return t;
+}
+
+static void checkPoseGraph( PoseGraphOptimizer::Method method )
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+    boost::scoped_ptr<Environment> env2( new Environment() );
+    EventProcessor ep( env2.get() );
+    ep.allowMultithreading(true);
+    env->addEventHandler( &ep );
+
+    // a loop of poses, the second node is attached to the first one to
+    // check the handling of nested frames
+    const int n = 6;
+    std::vector<Eigen::Affine3d, Eigen::aligned_allocator<Eigen::Affine3d> > truth;
+    std::vector<FrameNode*> fn;
+    for( int i=0; i<n; i++ )
+    {
+	const double a = 2.0 * M_PI * i / n;
+	truth.push_back( makePose( 5.0 * cos( a ), 5.0 * sin( a ), 0.3 * i, a + M_PI / 2.0, 0.1 * i, -0.05 * i ) );
+	fn.push_back( new FrameNode() );
+	env->addChild( i == 1 ? fn[0] : env->getRootNode(), fn.back() );
+    }
+
+    // initialize with disturbed poses, the first node is correct
+    for( int i=0; i<n; i++ )
+    {
+	Eigen::Affine3d global( truth[i] );
+	if( i > 0 )
+	    global = global * makePose( 0.3 * sin( i ), -0.2 * i, 0.1, 0.1 * i, -0.05, 0.08 );
+	Eigen::Affine3d parent( env->relativeTransform( fn[i]->getParent(), env->getRootNode() ) );
+	fn[i]->setTransform( Eigen::Affine3d( parent.inverse() * global ) );
+    }
+
+    PoseGraphOptimizer opt( env.get() );
+    opt.setMethod( method );
+    opt.addNode( fn[0], true );
+    TransformWithUncertainty::Covariance cov( TransformWithUncertainty::Covariance::Identity() * 0.01 );
+    for( int i=0; i<n; i++ )
+    {
+	const int j = (i + 1) % n;
+	opt.addConstraint( fn[i], fn[j], 
+		TransformWithUncertainty( Eigen::Affine3d( truth[i].inverse() * truth[j] ), cov ) );
+    }
+    // an additional constraint without uncertainty across the loop
+    opt.addConstraint( fn[0], fn[3], TransformWithUncertainty( Eigen::Affine3d( truth[0].inverse() * truth[3] ) ) );
+    BOOST_CHECK_EQUAL( opt.getNodeCount(), n );
+    BOOST_CHECK_EQUAL( opt.getConstraintCount(), n + 1 );
+
+    PoseGraphOptimizer::Result result = opt.optimize();
+    BOOST_CHECK( result.converged );
+    BOOST_CHECK( result.initialError > 1.0 );
+    BOOST_CHECK_SMALL( result.finalError, 1e-10 );
+    for( int i=0; i<n; i++ )
+	BOOST_CHECK( opt.getPose( fn[i] ).isApprox( truth[i], 1e-6 ) );
+
+    // nothing is changed until the result is applied
+    BOOST_CHECK( !env->relativeTransform( fn[2], env->getRootNode() ).isApprox( truth[2], 1e-3 ) );
+
+    ep.flush();
+    opt.apply();
+    ep.flush();
+    for( int i=0; i<n; i++ )
+    {
+	BOOST_CHECK( env->relativeTransform( fn[i], env->getRootNode() ).isApprox( truth[i], 1e-6 ) );
+	// the changes are also propagated as events
+	FrameNode *copy = env2->getItem<FrameNode>( fn[i]->getUniqueId() ).get();
+	BOOST_CHECK( copy->getTransform().isApprox( fn[i]->getTransform(), 1e-12 ) );
+    }
+
+    env->removeEventHandler( &ep );
+}
+
+BOOST_AUTO_TEST_CASE( pose_graph_optimizer ) 
+{
+    checkPoseGraph( PoseGraphOptimizer::LEVENBERG_MARQUARDT );
+    checkPoseGraph( PoseGraphOptimizer::GAUSS_NEWTON );
+
+    // the constraint with the lower covariance dominates
+    Environment env;
+    FrameNode *a = new FrameNode(), *b = new FrameNode();
+    env.addChild( env.getRootNode(), a );
+    env.addChild( env.getRootNode(), b );
+
+    PoseGraphOptimizer opt( &env );
+    opt.addNode( a, true );
+    TransformWithUncertainty::Covariance cov( TransformWithUncertainty::Covariance::Identity() );
+    opt.addConstraint( a, b, TransformWithUncertainty( Eigen::Affine3d( Eigen::Translation3d( 1.0, 0, 0 ) ), cov ) );
+    opt.addConstraint( a, b, TransformWithUncertainty( Eigen::Affine3d( Eigen::Translation3d( 2.0, 0, 0 ) ), cov * 3.0 ) );
+    opt.optimize();
+    BOOST_CHECK_CLOSE( opt.getPose( b ).translation().x(), 1.25, 1e-6 );
+}
+
 BOOST_AUTO_TEST_CASE( env_metadata ) 
 {
     Pointcloud::Ptr pout;
@@ -366,5 +509,274 @@ BOOST_AUTO_TEST_CASE( env_metadata )
     BOOST_CHECK( vec.front() == base::Vector3d::Zero() );
 }
 
+BOOST_AUTO_TEST_CASE( env_memory_budget ) 
+{
+    const std::string path = "/tmp/envire_memory_test";
+    boost::filesystem::remove_all( path );
+
+    boost::scoped_ptr<Environment> env( new Environment() );
+
+    Grid<double> *g1 = new Grid<double>( 100, 100, 0.1, 0.1 );
+    env->attachItem( g1 );
+    g1->getGridData()[10][20] = 1.5;
+
+    Grid<double> *g2 = new Grid<double>( 100, 100, 0.1, 0.1 );
+    env->attachItem( g2 );
+    g2->getGridData()[30][40] = 2.5;
+    g2->setNoData( Grid<double>::GRID_DATA, -1.0 );
+
+    MLSGrid *mls = new MLSGrid( 20, 20, 0.5, 0.5 );
+    env->attachItem( mls );
+    mls->insertTail( 3, 4, SurfacePatch( 1.0, 0.1 ) );
+    mls->insertTail( 3, 4, SurfacePatch( 5.0, 0.1 ) );
+
+    BOOST_CHECK_EQUAL( g1->getMemoryUsage(), 100 * 100 * sizeof(double) );
+    BOOST_CHECK( mls->getMemoryUsage() > 20 * 20 * sizeof(void*) );
+    BOOST_CHECK_EQUAL( env->getMemoryUsage(),
+	    g1->getMemoryUsage() + g2->getMemoryUsage() + mls->getMemoryUsage() );
+
+    // the modified grid is kept, and the larger of the two others evicted
+    env->setMemoryBudget( 100000, path );
+    env->itemModified( g1 );
+    BOOST_CHECK( !g1->isEvicted() );
+    BOOST_CHECK( g2->isEvicted() );
+    BOOST_CHECK( !mls->isEvicted() );
+    BOOST_CHECK_EQUAL( env->getMemoryUsage(), g1->getMemoryUsage() + mls->getMemoryUsage() );
+
+    // restored on access
+    BOOST_CHECK_EQUAL( g2->getFromRaster( Grid<double>::GRID_DATA, 40, 30 ), 2.5 );
+    BOOST_CHECK( !g2->isEvicted() );
+    BOOST_CHECK_EQUAL( g2->getNoData( Grid<double>::GRID_DATA ).first, -1.0 );
+
+    // now g1 and the mls are the least recently accessed
+    env->itemModified( g2 );
+    BOOST_CHECK( g1->isEvicted() );
+    BOOST_CHECK( mls->isEvicted() );
+    BOOST_CHECK_EQUAL( mls->getCellCount(), 2 );
+
+    MLSGrid::iterator it = mls->beginCell( 3, 4 );
+    BOOST_CHECK( !mls->isEvicted() );
+    BOOST_CHECK_EQUAL( it->mean, 1.0 );
+    it++;
+    BOOST_CHECK_EQUAL( it->mean, 5.0 );
+    BOOST_CHECK_EQUAL( mls->getCellCount(), 2 );
+
+    // copies and detached items are complete
+    Grid<double>::Ptr copy( g1->clone() );
+    BOOST_CHECK( !g1->isEvicted() );
+    BOOST_CHECK_EQUAL( copy->getGridData()[10][20], 1.5 );
+
+    BOOST_CHECK( env->evictLayer( g2 ) );
+    EnvironmentItem::Ptr detached = env->detachItem( g2 );
+    BOOST_CHECK( !g2->isEvicted() );
+    BOOST_CHECK_EQUAL( g2->getGridData()[30][40], 2.5 );
+
+    // pointclouds and meshes are counted, but never evicted, since their
+    // vertices and faces are used directly
+    Pointcloud *pc = new Pointcloud();
+    env->attachItem( pc );
+    pc->vertices.resize( 10000, Eigen::Vector3d::Ones() );
+    TriMesh *mesh = new TriMesh();
+    env->attachItem( mesh );
+    mesh->vertices.resize( 3, Eigen::Vector3d::Zero() );
+    mesh->faces.resize( 5000, TriMesh::triangle_t( 0, 1, 2 ) );
+    BOOST_CHECK_EQUAL( pc->getMemoryUsage(), 10000 * sizeof(Eigen::Vector3d) );
+    BOOST_CHECK( mesh->getMemoryUsage() >= 5000 * sizeof(TriMesh::triangle_t) );
+    BOOST_CHECK( !env->evictLayer( pc ) );
+    BOOST_CHECK( !env->evictLayer( mesh ) );
+
+    env->itemModified( g1 );
+    BOOST_CHECK( !pc->isEvicted() );
+    BOOST_CHECK( !mesh->isEvicted() );
+    BOOST_CHECK( env->getMemoryUsage() > env->getMemoryBudget() );
+    pc->vertices.push_back( Eigen::Vector3d::Zero() );
+    env->itemModified( g1 );
+    BOOST_CHECK_EQUAL( pc->vertices.size(), 10001u );
+    BOOST_CHECK_EQUAL( mesh->faces.size(), 5000u );
+
+    // references to the bands stay valid while a grid is evicted
+    Grid<double>::ArrayType& band( g1->getGridData() );
+    BOOST_CHECK( env->evictLayer( g1 ) );
+    BOOST_CHECK_EQUAL( band.num_elements(), 0u );
+    g1->touch();
+    BOOST_CHECK( !g1->isEvicted() );
+    BOOST_CHECK_EQUAL( band[10][20], 1.5 );
+
+    // the other inputs and outputs of an operator are kept, when it
+    // modifies one of its outputs
+    Operator *op = new DummyOperator();
+    env->attachItem( op );
+    env->addInput( op, g1 );
+    env->addOutput( op, mls );
+    env->itemModified( mls );
+    BOOST_CHECK( !g1->isEvicted() );
+    BOOST_CHECK( !mls->isEvicted() );
+    env->removeInput( op, g1 );
+    env->itemModified( mls );
+    BOOST_CHECK( g1->isEvicted() );
+
+    // the files of evicted layers are removed with the environment
+    BOOST_CHECK( env->evictLayer( mls ) );
+    BOOST_CHECK( !boost::filesystem::is_empty( path ) );
+    env.reset();
+    BOOST_CHECK( boost::filesystem::is_empty( path ) );
+    boost::filesystem::remove_all( path );
+}
+
+BOOST_AUTO_TEST_CASE( env_merge ) 
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+    MLSGrid *mls = new MLSGrid( 20, 20, 0.5, 0.5 );
+    env->attachItem( mls );
+    mls->insertTail( 2, 2, SurfacePatch( 1.0, 0.1 ) );
+    Pointcloud *pc = new Pointcloud();
+    env->attachItem( pc );
+    pc->vertices.push_back( Eigen::Vector3d( 1, 0, 0 ) );
+
+    boost::scoped_ptr<Environment> session( new Environment() );
+    FrameNode *fn = new FrameNode( Transform( Eigen::Translation3d( 0, 0, 1 ) ) );
+    session->getRootNode()->addChild( fn );
+    MLSGrid *mls2 = new MLSGrid( 20, 20, 0.5, 0.5 );
+    session->attachItem( mls2, fn );
+    mls2->insertTail( 2, 2, SurfacePatch( 1.0, 0.1 ) );
+    Pointcloud *pc2 = new Pointcloud();
+    session->attachItem( pc2 );
+    pc2->vertices.push_back( Eigen::Vector3d( 0, 0, 0 ) );
+    TriMesh *mesh = new TriMesh();
+    mesh->setUniqueId( "mesh" );
+    session->attachItem( mesh );
+
+    {
+	// the id of the mesh is already used in the target
+	boost::scoped_ptr<Environment> copy( new Environment() );
+	FrameNode *used = new FrameNode();
+	used->setUniqueId( "/session/mesh" );
+	copy->getRootNode()->addChild( used );
+
+	EnvironmentMerge merge( copy.get() );
+	merge.setImportPrefix( "session" );
+	FrameNode *frame = merge.import( session.get(), TransformWithUncertainty( Transform( Eigen::Translation3d( 1, 0, 0 ) ) ) );
+	BOOST_CHECK_EQUAL( session->getItems<EnvironmentItem>().size(), 1 );
+	BOOST_CHECK_EQUAL( copy->getItems<Layer>().size(), 3 );
+	BOOST_CHECK( mesh->getEnvironment() == copy.get() );
+	BOOST_CHECK( mesh->getUniqueId() != "/session/mesh" );
+	BOOST_CHECK_EQUAL( mesh->getUniqueIdPrefix(), "/session" );
+	BOOST_CHECK_EQUAL( merge.getIdMap().find( "/mesh" )->second, mesh->getUniqueId() );
+	BOOST_CHECK( fn->getParent() == frame );
+	BOOST_CHECK( mls2->getFrameNode() == fn );
+	BOOST_CHECK( pc2->getFrameNode() == frame );
+	BOOST_CHECK( copy->relativeTransform( fn, copy->getRootNode() ).translation().isApprox( Eigen::Vector3d( 1, 0, 1 ) ) );
+
+	// and back again
+	EnvironmentMerge back( session.get() );
+	back.import( copy.get(), TransformWithUncertainty( Transform( Eigen::Translation3d( -1, 0, 0 ) ) ) );
+	BOOST_CHECK_EQUAL( session->getItems<Layer>().size(), 3 );
+	BOOST_CHECK( session->relativeTransform( fn, session->getRootNode() ).translation().isApprox( Eigen::Vector3d( 0, 0, 1 ) ) );
+    }
+
+    const std::string meshId = mesh->getUniqueId();
+    const std::string mlsId = mls2->getUniqueId();
+    EnvironmentMerge merge( env.get() );
+    merge.setFuseLayers( true );
+    merge.import( session.get(), TransformWithUncertainty( Transform( Eigen::Translation3d( 0, 0, 1 ) ) ) );
+
+    // the mls and the pointcloud are fused, the mesh is added
+    BOOST_CHECK_EQUAL( env->getItems<Layer>().size(), 3 );
+    BOOST_CHECK( env->getItems<Operator>().empty() );
+    BOOST_CHECK( mesh->getEnvironment() == env.get() );
+    BOOST_CHECK_EQUAL( merge.getIdMap().find( meshId )->second, mesh->getUniqueId() );
+    BOOST_CHECK_EQUAL( merge.getIdMap().find( mlsId )->second, mls->getUniqueId() );
+
+    BOOST_CHECK_EQUAL( pc->vertices.size(), 2 );
+    BOOST_CHECK( pc->vertices.back().isApprox( Eigen::Vector3d( 0, 0, 1 ) ) );
+
+    size_t patches = 0;
+    for( MLSGrid::iterator it = mls->beginCell( 2, 2 ); it != mls->endCell(); it++ )
+    {
+	if( patches++ )
+	    BOOST_CHECK_CLOSE( it->mean, 3.0, 1e-6 );
+    }
+    BOOST_CHECK_EQUAL( patches, 2 );
+}
+
+/** cancels the context once the progress reaches a threshold */
+struct CancelAt
+{
+    ExecutionContext* context;
+    double threshold;
+    int calls;
+
+    void operator()( const std::string& item, double progress )
+    {
+	calls++;
+	if( progress >= threshold )
+	    context->cancel();
+    }
+};
+
+BOOST_AUTO_TEST_CASE( operator_execution_context ) 
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+    RowOperator *op = new RowOperator();
+    env->attachItem( op );
+
+    // without a context, or with an unused one, the update runs through
+    BOOST_CHECK( op->updateAll() );
+    BOOST_CHECK_EQUAL( op->rows, 100 );
+    ExecutionContext context;
+    BOOST_CHECK( op->execute( context ) );
+    BOOST_CHECK_EQUAL( op->rows, 100 );
+    BOOST_CHECK_CLOSE( context.getProgress(), 0.99, 1e-6 );
+
+    // cancelled from the progress callback
+    CancelAt cancelAt = { &context, 0.5, 0 };
+    context.reset();
+    context.setProgressCallback( boost::ref( cancelAt ) );
+    BOOST_CHECK( !op->execute( context ) );
+    BOOST_CHECK( op->wasAbandoned() );
+    BOOST_CHECK_EQUAL( op->rows, 51 );
+    BOOST_CHECK_EQUAL( cancelAt.calls, 51 );
+    BOOST_CHECK( context.isCancelled() );
+    BOOST_CHECK( !env->updateOperators( context ) );
+    BOOST_CHECK_THROW( context.check(), OperationCancelled );
+
+    // out of time
+    context.reset();
+    context.setProgressCallback( ExecutionContext::ProgressCallback() );
+    BOOST_CHECK( !context.isCancelled() );
+    context.setTimeBudget( -1.0 );
+    BOOST_CHECK( context.isExpired() );
+    BOOST_CHECK( !op->execute( context ) );
+    BOOST_CHECK_EQUAL( op->rows, 0 );
+
+    context.reset();
+    context.setTimeBudget( 60.0 );
+    BOOST_CHECK( env->updateOperators( context ) );
+    BOOST_CHECK_EQUAL( op->rows, 100 );
+    BOOST_CHECK( !op->wasAbandoned() );
+
+    // an operator which completes is kept, even if the context is
+    // cancelled right at the end
+    boost::scoped_ptr<Environment> env2( new Environment() );
+    FinishOperator *finish = new FinishOperator();
+    env2->attachItem( finish );
+    DummyLayer *output = new DummyLayer();
+    env2->attachItem( output );
+    finish->addOutput( output );
+    CancelAt cancelAtEnd = { &context, 1.0, 0 };
+    context.reset();
+    context.setProgressCallback( boost::ref( cancelAtEnd ) );
+    BOOST_CHECK( finish->execute( context ) );
+    BOOST_CHECK( !finish->wasAbandoned() );
+    BOOST_CHECK( context.isCancelled() );
+
+    context.reset();
+    const unsigned long generation = output->getGeneration();
+    BOOST_CHECK( env2->updateOperators( context ) );
+    BOOST_CHECK( context.isCancelled() );
+    BOOST_CHECK( output->getGeneration() > generation );
+    BOOST_CHECK( !env2->updateOperators( context ) );
+}
+
 // EOF
 //
@@ -6,6 +6,7 @@
 #include "envire/maps/TriMesh.hpp"
 
 #include "boost/scoped_ptr.hpp"
+#include <algorithm>
 
 #define BOOST_TEST_MODULE ICPTest 
 #include <boost/test/included/unit_test.hpp>
@@ -161,6 +162,66 @@ BOOST_AUTO_TEST_CASE( icp_test2 )
     test.env.get()->serialize( "/tmp/test" );
 } 
 
+BOOST_AUTO_TEST_CASE( icp_quality )
+{
+    envire::icp::ICPQualityConfiguration conf;
+    conf.enabled = true;
+    conf.normal_radius = 0.25;
+
+    // three walls of a cube constrain all directions
+    ICPTest test;
+    test.setTestEnvironment( ICPTest::box, 
+	    Eigen::Affine3d( Eigen::Affine3d::Identity() ),
+	    Eigen::Translation3d( 0.02, 0.01, 0.03 )
+	    * Eigen::AngleAxisd( 0.02, Eigen::Vector3d::UnitZ()) );
+
+    envire::icp::TrimmedKD icp;
+    icp.setQualityConfiguration( conf );
+    icp.addToModel( envire::icp::PointcloudAdapter( test.mesh, 1.0 ) );
+    icp.align( envire::icp::PointcloudAdapter( test.mesh2, 1.0 ), 20, 1e-6, 1e-7, 0.9 );
+
+    const envire::icp::RegistrationQuality& quality( icp.getQuality() );
+    BOOST_CHECK( quality.valid );
+    BOOST_CHECK( quality.degeneracy > 0.1 );
+    BOOST_CHECK( quality.svm_value > 0 );
+    BOOST_CHECK( quality.isAcceptable( conf ) );
+
+    // a single plane leaves the translation in the plane and the rotation
+    // around its normal free
+    ICPTest plane;
+    plane.setTestEnvironment( ICPTest::box, 
+	    Eigen::Affine3d( Eigen::Affine3d::Identity() ),
+	    Eigen::Affine3d( Eigen::Translation3d( 0.0, 0.0, 0.05 ) ) );
+    for( int m = 0; m < 2; m++ )
+    {
+	// only keep the points on the z=0 wall
+	std::vector<Eigen::Vector3d>& points( m ? plane.mesh2->vertices : plane.mesh->vertices );
+	for( size_t i = 0; i < points.size() / 3; i++ )
+	    points[i] = points[i*3];
+	points.resize( points.size() / 3 );
+    }
+
+    envire::icp::TrimmedKD icp2;
+    icp2.setQualityConfiguration( conf );
+    icp2.addToModel( envire::icp::PointcloudAdapter( plane.mesh, 1.0 ) );
+    icp2.align( envire::icp::PointcloudAdapter( plane.mesh2, 1.0 ), 20, 1e-6, 1e-7, 0.9 );
+    BOOST_CHECK( icp2.getQuality().valid );
+    BOOST_CHECK( icp2.getQuality().degeneracy < 1e-6 );
+    BOOST_CHECK( !icp2.getQuality().isAcceptable( conf ) );
+
+    // the histogram doesn't depend on the order of the distances
+    std::vector<double> distances;
+    for( int i = 0; i < 200; i++ )
+	distances.push_back( (i * 37 % 200) * 0.003 - 0.1 );
+    envire::icp::Histogram h1( conf.histogram ), h2( conf.histogram );
+    h1.calculateHistogram( distances );
+    std::sort( distances.begin(), distances.end() );
+    h2.calculateHistogram( distances );
+    BOOST_CHECK( h1.getHistogram() == h2.getHistogram() );
+    BOOST_CHECK_EQUAL( h1.getHistogram().size(), 10 );
+    BOOST_CHECK_EQUAL( h1.getSVMValue(), h2.getSVMValue() );
+}
+
 using namespace envire::ransac;
 
 BOOST_AUTO_TEST_CASE( ransac_test )
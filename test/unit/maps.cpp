@@ -6,6 +6,13 @@
 #include <envire/maps/ElevationGrid.hpp>
 #include <envire/tools/VoxelTraversal.hpp>
 #include <envire/tools/BoxLookUpTable.hpp>
+#include <envire/tools/LookUpTableCache.hpp>
+#include <boost/thread/thread.hpp>
+#include <envire/maps/OccupancyMap.hpp>
+#include <envire/operators/GridResampling.hpp>
+#include <envire/tools/TraversabilityPlanner.hpp>
+#include <sstream>
+#include <limits>
 
 using namespace envire;
 using namespace Eigen;
@@ -280,3 +287,306 @@ BOOST_AUTO_TEST_CASE( test_BoxLookupTable )
     }  
 }
 
+struct LookUpTableCacheWorker
+{
+    LookUpTableCache &cache;
+    std::vector<const BoxLookUpTable*> &result;
+    size_t index;
+
+    LookUpTableCacheWorker(LookUpTableCache &cache, std::vector<const BoxLookUpTable*> &result, size_t index)
+        : cache(cache), result(result), index(index) {}
+
+    void operator()()
+    {
+        // all threads request the same two footprints
+        for(int i = 0; i < 50; i++)
+            result[index] = cache.get(0.1, 1.0 + (i % 2), 0.6, 0.5).box.get();
+    }
+};
+
+BOOST_AUTO_TEST_CASE( test_LookUpTableCache )
+{
+    LookUpTableCache cache(2);
+
+    LookUpTableCache::Entry a = cache.get(0.1, 1.0, 0.6, 0.5);
+    LookUpTableCache::Entry a2 = cache.get(0.1, 1.0 + 1e-9, 0.6, 0.5);
+    BOOST_CHECK( a.radial && a.box );
+    BOOST_CHECK_EQUAL( a.radial.get(), a2.radial.get() );
+    BOOST_CHECK_EQUAL( a.box.get(), a2.box.get() );
+    BOOST_CHECK_EQUAL( cache.size(), 1 );
+
+    // the tables equal freshly computed ones
+    BoxLookUpTable box(0.01, 1.0, 0.6, 1.0);
+    RadialLookUpTable radial(0.1, 1.0);
+    BOOST_CHECK_EQUAL( a.box->getDistanceToBox(0.8, 0.1), box.getDistanceToBox(0.8, 0.1) );
+    BOOST_CHECK_EQUAL( a.radial->getDistance(3, -4), radial.getDistance(3, -4) );
+
+    LookUpTableCache::Entry b = cache.get(0.1, 2.0, 0.6, 0.5);
+    BOOST_CHECK( a.box.get() != b.box.get() );
+    BOOST_CHECK_EQUAL( cache.size(), 2 );
+
+    // a is the least recently used entry, and gets evicted
+    cache.get(0.1, 2.0, 0.6, 0.5);
+    cache.get(0.2, 2.0, 0.6, 0.5);
+    BOOST_CHECK_EQUAL( cache.size(), 2 );
+    BOOST_CHECK( cache.get(0.1, 2.0, 0.6, 0.5).box.get() == b.box.get() );
+    BOOST_CHECK( cache.get(0.1, 1.0, 0.6, 0.5).box.get() != a.box.get() );
+    // evicted tables stay valid for their users
+    BOOST_CHECK_EQUAL( a.box->getDistanceToBox(0.8, 0.1), box.getDistanceToBox(0.8, 0.1) );
+
+    // concurrent lookups all end up with the same shared tables
+    cache.clear();
+    const size_t threads = 8;
+    std::vector<const BoxLookUpTable*> result(threads);
+    boost::thread_group group;
+    for(size_t i = 0; i < threads; i++)
+        group.create_thread(LookUpTableCacheWorker(cache, result, i));
+    group.join_all();
+
+    BOOST_CHECK_EQUAL( cache.size(), 2 );
+    const BoxLookUpTable *last = cache.get(0.1, 2.0, 0.6, 0.5).box.get();
+    for(size_t i = 0; i < threads; i++)
+        BOOST_CHECK_EQUAL( result[i], last );
+}
+
+BOOST_AUTO_TEST_CASE( test_occupancymap )
+{
+    OccupancyMap map( 0.1 );
+
+    // a wall at x = 2.0 seen from the origin
+    std::vector<Eigen::Vector3d> points;
+    for( double y = -0.5; y <= 0.5; y += 0.05 )
+	for( double z = -0.5; z <= 0.5; z += 0.05 )
+	    points.push_back( Eigen::Vector3d( 2.05, y, z ) );
+
+    map.insertScan( Eigen::Vector3d( 0.05, 0.05, 0.05 ), points );
+
+    // each voxel is only updated once per scan
+    const OccupancyMap::Index wall = map.toIndex( Eigen::Vector3d( 2.05, 0.05, 0.05 ) );
+    const OccupancyMap::Index free = map.toIndex( Eigen::Vector3d( 1.05, 0.05, 0.05 ) );
+    BOOST_CHECK( map.isOccupied( wall ) );
+    BOOST_CHECK( map.isFree( free ) );
+    BOOST_CHECK_CLOSE( map.getProbability( wall ), map.getProbHit(), 1e-3 );
+    BOOST_CHECK_CLOSE( map.getProbability( free ), map.getProbMiss(), 1e-3 );
+
+    // behind the wall and negative indices are unknown
+    BOOST_CHECK( !map.isKnown( map.toIndex( Eigen::Vector3d( 2.55, 0.05, 0.05 ) ) ) );
+    BOOST_CHECK( !map.isKnown( map.toIndex( Eigen::Vector3d( -1.0, -1.0, -1.0 ) ) ) );
+    BOOST_CHECK( map.isKnown( map.toIndex( Eigen::Vector3d( 1.05, -0.2, -0.2 ) ) ) );
+
+    // repeated scans are clamped
+    for( int i=0; i<100; i++ )
+	map.insertScan( Eigen::Vector3d( 0.05, 0.05, 0.05 ), points );
+    BOOST_CHECK_CLOSE( map.getProbability( wall ), 0.97, 1e-3 );
+    BOOST_CHECK_CLOSE( map.getProbability( free ), 0.12, 1e-3 );
+
+    // a limited range only clears space
+    OccupancyMap map2( 0.1 );
+    map2.insertScan( Eigen::Vector3d( 0.05, 0.05, 0.05 ), points, 1.0 );
+    BOOST_CHECK( !map2.isKnown( wall ) );
+    BOOST_CHECK( map2.isFree( map2.toIndex( Eigen::Vector3d( 0.55, 0.05, 0.05 ) ) ) );
+
+    OccupancyMap::Extents extents = map.getExtents();
+    BOOST_CHECK( extents.contains( Eigen::Vector3d( 2.05, 0.45, 0.45 ) ) );
+    BOOST_CHECK( !extents.contains( Eigen::Vector3d( 2.25, 0.05, 0.05 ) ) );
+
+    // binary round trip
+    std::stringstream ss;
+    map.writeMap( ss );
+    OccupancyMap map3( 0.1 );
+    map3.readMap( ss );
+    BOOST_CHECK_EQUAL( map3.getBlockCount(), map.getBlockCount() );
+    BOOST_CHECK_CLOSE( map3.getProbability( wall ), 0.97, 1e-3 );
+    BOOST_CHECK( map3.isFree( free ) );
+    std::vector<Eigen::Vector3d> occupied, occupied3;
+    map.getOccupiedVoxels( occupied );
+    map3.getOccupiedVoxels( occupied3 );
+    BOOST_CHECK_EQUAL( occupied.size(), occupied3.size() );
+
+    // non-finite points are skipped, a non-finite origin is rejected
+    OccupancyMap map4( 0.1 );
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    const double inf = std::numeric_limits<double>::infinity();
+    std::vector<Eigen::Vector3d> invalid;
+    invalid.push_back( Eigen::Vector3d( nan, 0.05, 0.05 ) );
+    invalid.push_back( Eigen::Vector3d( inf, 0.05, 0.05 ) );
+    invalid.push_back( Eigen::Vector3d( 0.05, -inf, 0.05 ) );
+    invalid.push_back( Eigen::Vector3d( 1e300, 0.05, 0.05 ) );
+    map4.insertScan( Eigen::Vector3d( 0.05, 0.05, 0.05 ), invalid );
+    BOOST_CHECK_EQUAL( map4.getBlockCount(), 0 );
+    invalid.push_back( Eigen::Vector3d( 1.05, 0.05, 0.05 ) );
+    map4.insertScan( Eigen::Vector3d( 0.05, 0.05, 0.05 ), invalid, 5.0 );
+    BOOST_CHECK( map4.isOccupied( map4.toIndex( Eigen::Vector3d( 1.05, 0.05, 0.05 ) ) ) );
+    BOOST_CHECK_THROW( map4.insertScan( Eigen::Vector3d( nan, 0.0, 0.0 ), points ), std::runtime_error );
+}
+
+BOOST_AUTO_TEST_CASE( test_gridresampling )
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+
+    // input grid with the x index as value and a no-data cell
+    Grid<float> *in = new Grid<float>( 20, 20, 0.1, 0.1 );
+    env->attachItem( in );
+    Grid<float>::ArrayType &inData( in->getGridData() );
+    for( size_t y=0; y<20; y++ )
+	for( size_t x=0; x<20; x++ )
+	    inData[y][x] = x;
+    inData[0][0] = -1;
+    in->setNoData( in->getBands().front(), -1 );
+
+    Grid<float> *out = new Grid<float>( 10, 10, 0.2, 0.2 );
+    env->attachItem( out );
+    out->getGridData()[0][0] = 42;
+
+    GridResampling *op = new GridResampling();
+    env->attachItem( op );
+    op->addInput( in );
+    op->addOutput( out );
+    op->setTileSize( 3 );
+
+    const Grid<float>::ArrayType &outData( out->getGridData() );
+    op->setMethod( GridResampling::MEAN );
+    op->updateAll();
+    BOOST_CHECK_CLOSE( outData[5][3], 6.5, 1e-3 );
+    // only the valid cells are used
+    BOOST_CHECK_CLOSE( outData[0][0], 2.0 / 3.0, 1e-3 );
+    BOOST_CHECK( out->getNoData().second );
+
+    op->setMethod( GridResampling::MIN );
+    op->updateAll();
+    BOOST_CHECK_EQUAL( outData[5][3], 6 );
+    BOOST_CHECK_EQUAL( outData[9][9], 18 );
+
+    op->setMethod( GridResampling::MAX );
+    op->updateAll();
+    BOOST_CHECK_EQUAL( outData[5][3], 7 );
+
+    // output with the same resolution, shifted by half a cell in a
+    // different frame
+    FrameNode *fn = new FrameNode( Eigen::Affine3d( Eigen::Translation3d( 0.13, 0, 0 ) ) );
+    env->addChild( env->getRootNode(), fn );
+    Grid<float> *shifted = new Grid<float>( 20, 20, 0.1, 0.1 );
+    env->attachItem( shifted );
+    env->setFrameNode( shifted, fn );
+    op = new GridResampling();
+    env->attachItem( op );
+    op->addInput( in );
+    op->addOutput( shifted );
+
+    op->setMethod( GridResampling::BILINEAR );
+    op->updateAll();
+    const Grid<float>::ArrayType &shiftedData( shifted->getGridData() );
+    BOOST_CHECK_CLOSE( shiftedData[3][2], 3.3, 1e-3 );
+    // border of the input falls back to nearest
+    BOOST_CHECK_CLOSE( shiftedData[3][18], 19, 1e-3 );
+    // outside of the input the output is unchanged
+    BOOST_CHECK_EQUAL( shiftedData[3][19], 0 );
+
+    op->setMethod( GridResampling::NEAREST );
+    op->updateAll();
+    BOOST_CHECK_EQUAL( shiftedData[3][2], 3 );
+
+    // integer types are rounded
+    Grid<uint8_t> *inInt = new Grid<uint8_t>( 4, 4, 0.1, 0.1 );
+    env->attachItem( inInt );
+    Grid<uint8_t>::ArrayType &inIntData( inInt->getGridData() );
+    for( size_t y=0; y<4; y++ )
+	for( size_t x=0; x<4; x++ )
+	    inIntData[y][x] = x * 10 + y;
+    Grid<uint8_t> *outInt = new Grid<uint8_t>( 2, 2, 0.2, 0.2 );
+    env->attachItem( outInt );
+    GridResampling *opInt = new GridResampling();
+    env->attachItem( opInt );
+    opInt->addInput( inInt );
+    opInt->addOutput( outInt );
+    opInt->setMethod( GridResampling::MEAN );
+    opInt->updateAll();
+    BOOST_CHECK_EQUAL( outInt->getGridData()[0][0], 6 );
+    BOOST_CHECK_EQUAL( outInt->getGridData()[1][1], 28 );
+
+    // mismatching types are rejected
+    GridResampling *opMixed = new GridResampling();
+    env->attachItem( opMixed );
+    opMixed->addInput( in );
+    opMixed->addOutput( outInt );
+    BOOST_CHECK_THROW( opMixed->updateAll(), std::runtime_error );
+}
+
+static bool checkPath( const std::vector<GridBase::Position>& path,
+	const GridBase::Position& start, const GridBase::Position& goal )
+{
+    if( path.empty() || !(path.front() == start) || !(path.back() == goal) )
+	return false;
+    for( size_t i=1; i<path.size(); i++ )
+	if( std::abs( (int)path[i].x - (int)path[i-1].x ) > 1 || std::abs( (int)path[i].y - (int)path[i-1].y ) > 1 )
+	    return false;
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE( test_traversabilityplanner )
+{
+    TraversabilityGrid grid( 30, 30, 0.1, 0.1 );
+    grid.setTraversabilityClass( 1, TraversabilityClass( 1.0 ) );
+    grid.setTraversabilityClass( 2, TraversabilityClass( 0.0 ) );
+    for( size_t y=0; y<30; y++ )
+	for( size_t x=0; x<30; x++ )
+	    grid.setTraversabilityAndProbability( x == 15 && y < 25 ? 2 : 1, 1.0, x, y );
+
+    TraversabilityPlanner planner( grid );
+    BOOST_CHECK_EQUAL( planner.getCellCost( 0, 0 ), 1.0 );
+    BOOST_CHECK( planner.getCellCost( 15, 0 ) == std::numeric_limits<float>::infinity() );
+
+    const GridBase::Position start( 2, 2 ), goal( 28, 2 );
+    std::vector<GridBase::Position> path;
+    double astarCost = 0;
+
+    // free straight line
+    BOOST_REQUIRE( planner.planAStar( GridBase::Position( 2, 27 ), GridBase::Position( 28, 27 ), path, &astarCost ) );
+    BOOST_CHECK_EQUAL( path.size(), 27 );
+    BOOST_CHECK_CLOSE( astarCost, 2.6, 1e-3 );
+
+    // around the wall
+    BOOST_REQUIRE( planner.planAStar( start, goal, path, &astarCost ) );
+    BOOST_CHECK( checkPath( path, start, goal ) );
+    for( size_t i=0; i<path.size(); i++ )
+	BOOST_CHECK( path[i].x != 15 || path[i].y >= 25 );
+
+    double dstarCost = 0;
+    planner.initDStar( start, goal );
+    BOOST_REQUIRE( planner.replan( start, path, &dstarCost ) );
+    BOOST_CHECK( checkPath( path, start, goal ) );
+    BOOST_CHECK_CLOSE( dstarCost, astarCost, 1e-3 );
+    const size_t initialExpanded = planner.getExpandedCount();
+
+    // open a gap in the wall
+    grid.setTraversability( 1, 15, 2 );
+    grid.setTraversability( 1, 15, 3 );
+    BOOST_CHECK_EQUAL( planner.getCellCost( 15, 2 ), 1.0 );
+    planner.addDirtyRegion( 15, 2, 15, 3 );
+    BOOST_REQUIRE( planner.replan( start, path, &dstarCost ) );
+    BOOST_CHECK( checkPath( path, start, goal ) );
+    BOOST_CHECK_CLOSE( dstarCost, 2.6, 1e-3 );
+    BOOST_CHECK( planner.getExpandedCount() < initialExpanded );
+
+    // move along the path and close the wall completely
+    const GridBase::Position next( path[5] );
+    for( size_t y=0; y<30; y++ )
+	grid.setTraversability( 2, 15, y );
+    planner.addDirtyRegion( 15, 0, 15, 29 );
+    BOOST_CHECK( !planner.replan( next, path ) );
+    BOOST_CHECK( !planner.planAStar( next, goal, path ) );
+
+    // reopen it and compare with a fresh search
+    grid.setTraversability( 1, 15, 20 );
+    planner.addDirtyRegion( 15, 20, 15, 20 );
+    BOOST_REQUIRE( planner.replan( next, path, &dstarCost ) );
+    BOOST_CHECK( checkPath( path, next, goal ) );
+    BOOST_REQUIRE( planner.planAStar( next, goal, path, &astarCost ) );
+    BOOST_CHECK_CLOSE( dstarCost, astarCost, 1e-3 );
+
+    // uncertain cells become more expensive with the probability weight
+    grid.setProbability( 0.5, 0, 0 );
+    planner.setProbabilityWeight( 1.0 );
+    BOOST_CHECK_CLOSE( planner.getCellCost( 0, 0 ), 255.0 / 127.0, 1e-3 );
+    BOOST_CHECK_CLOSE( planner.getCellCost( 1, 0 ), 1.0, 1e-3 );
+}
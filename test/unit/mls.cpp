@@ -5,10 +5,23 @@
 #include "envire/Core.hpp"
 
 #include "envire/maps/MLSGrid.hpp"
+#include "envire/maps/MLSMap.hpp"
 #include "envire/operators/MLSProjection.hpp"
 #include "envire/operators/MergeMLS.hpp"
 
 #include "envire/tools/ListGrid.hpp"
+#include "envire/tools/SurfaceQuery.hpp"
+#include "envire/maps/ElevationGrid.hpp"
+#include "envire/maps/Grids.hpp"
+#include "envire/operators/ImageDraping.hpp"
+#include "envire/operators/MLSChangeDetection.hpp"
+#include "envire/operators/MLSSegmentation.hpp"
+#include "envire/operators/MLSToTriMesh.hpp"
+#include "envire/maps/Pointcloud.hpp"
+#include "envire/maps/TriMesh.hpp"
+#include "envire/maps/LaserScan.hpp"
+#include "envire/tools/TriMeshBVH.hpp"
+#include "envire/tools/RangeSensorSimulator.hpp"
 
 #include <base/timemark.h>
 
@@ -243,4 +256,483 @@ BOOST_AUTO_TEST_CASE( mls_patch )
     }
 }
 
+BOOST_AUTO_TEST_CASE( surface_query )
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+    MLSGrid *mls = new MLSGrid(10, 10, 0.1, 0.1);
+    env->attachItem( mls );
+
+    // a ramp with slope 0.5 in x direction, and a patch below the surface
+    for( size_t x=0; x<10; x++ )
+	for( size_t y=0; y<5; y++ )
+	{
+	    mls->insertHead( x, y, MLSGrid::SurfacePatch( (x+0.5) * 0.05, 0.1 ) );
+	    mls->insertHead( x, y, MLSGrid::SurfacePatch( -1.0, 0.2 ) );
+	}
+
+    SurfaceQuery::PointVector polyline;
+    polyline.push_back( Eigen::Vector3d( 0.02, 0.25, 0 ) );
+    polyline.push_back( Eigen::Vector3d( 0.98, 0.25, 0 ) );
+    polyline.push_back( Eigen::Vector3d( 0.98, 0.75, 0 ) );
+    polyline.push_back( Eigen::Vector3d( 1.5, 0.75, 0 ) );
+
+    SurfaceQuery::PointVector points;
+    SurfaceQuery::samplePolyline( polyline, 0.01, points );
+    BOOST_CHECK( points.size() > 150 );
+    BOOST_CHECK( points.front() == polyline.front() );
+    BOOST_CHECK( points.back() == polyline.back() );
+
+    SurfaceQuery query( 4 );
+    SurfaceQuery::ResultVector result;
+    query.query( *mls, points, result );
+    BOOST_REQUIRE_EQUAL( result.size(), points.size() );
+
+    for( size_t i=0; i<points.size(); i++ )
+    {
+	const Eigen::Vector3d &p( points[i] );
+	const SurfaceQuery::Result &res( result[i] );
+
+	size_t xi, yi;
+	if( !mls->toGrid( p.x(), p.y(), xi, yi ) || yi >= 5 )
+	{
+	    BOOST_CHECK( !res.valid );
+	    continue;
+	}
+
+	BOOST_REQUIRE( res.valid );
+	BOOST_CHECK_CLOSE( res.height, (xi+0.5) * 0.05, 1e-3 );
+	BOOST_CHECK_CLOSE( res.variance, 0.01, 1e-3 );
+	BOOST_CHECK( res.normal.isApprox( Eigen::Vector3d( -0.5, 0, 1.0 ).normalized(), 1e-5 ) );
+    }
+
+    // the elevation grid interpolates with the plane of the cell
+    ElevationGrid *eg = new ElevationGrid(10, 10, 0.1, 0.1);
+    env->attachItem( eg );
+    ElevationGrid::ArrayType &data( eg->getGridData( ElevationGrid::ELEVATION ) );
+    for( size_t x=0; x<10; x++ )
+	for( size_t y=0; y<10; y++ )
+	    data[y][x] = (y+0.5) * 0.2;
+
+    points.clear();
+    points.push_back( Eigen::Vector3d( 0.55, 0.52, 0 ) );
+    points.push_back( Eigen::Vector3d( 0.31, 0.09, 0 ) );
+    points.push_back( Eigen::Vector3d( -0.1, 0.5, 0 ) );
+    query.query( *eg, points, result );
+
+    BOOST_CHECK( result[0].valid );
+    BOOST_CHECK_CLOSE( result[0].height, 0.52 * 2, 1e-3 );
+    BOOST_CHECK_CLOSE( result[0].height, eg->getElevation( Eigen::Vector2d( 0.55, 0.52 ) ), 1e-3 );
+    BOOST_CHECK( result[0].normal.isApprox( Eigen::Vector3d( 0, -2.0, 1.0 ).normalized(), 1e-5 ) );
+    BOOST_CHECK( result[1].valid );
+    BOOST_CHECK_CLOSE( result[1].height, 0.09 * 2, 1e-3 );
+    BOOST_CHECK( !result[2].valid );
+
+    // the same ramp in a grid of an MLSMap, which is rotated by 90 degrees
+    // and offset against the map
+    MLSMap *map = new MLSMap();
+    env->attachItem( map );
+    env->setFrameNode( map, env->getRootNode() );
+    Eigen::Affine3d C_g2m( Eigen::Translation3d( 1.0, 2.0, 0.5 ) );
+    C_g2m.rotate( Eigen::AngleAxisd( M_PI / 2.0, Eigen::Vector3d::UnitZ() ) );
+    FrameNode *gridFrame = new FrameNode( C_g2m );
+    env->addChild( env->getRootNode(), gridFrame );
+    MLSGrid *grid = new MLSGrid(10, 10, 0.1, 0.1);
+    env->attachItem( grid );
+    env->setFrameNode( grid, gridFrame );
+    for( size_t x=0; x<10; x++ )
+	for( size_t y=0; y<10; y++ )
+	    grid->insertHead( x, y, MLSGrid::SurfacePatch( (x+0.5) * 0.05, 0.1 ) );
+    map->addGrid( grid );
+
+    points.clear();
+    points.push_back( C_g2m * Eigen::Vector3d( 0.45, 0.55, 0 ) );
+    points.push_back( Eigen::Vector3d( 0.45, 0.55, 0 ) );
+    query.query( *map, points, result );
+    BOOST_REQUIRE( result[0].valid );
+    BOOST_CHECK_CLOSE( result[0].height, 4.5 * 0.05 + 0.5, 1e-3 );
+    BOOST_CHECK( result[0].normal.isApprox( Eigen::Vector3d( 0, -0.5, 1.0 ).normalized(), 1e-5 ) );
+    BOOST_CHECK( !result[1].valid );
+}
+
+BOOST_AUTO_TEST_CASE( image_draping )
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+
+    // camera 2m above the ground looking down, with the image columns along
+    // x and the rows along -y
+    Eigen::Affine3d cameraPose( Eigen::Translation3d( 1.5, 1.0, 2.0 ) );
+    cameraPose.rotate( Eigen::AngleAxisd( M_PI, Eigen::Vector3d::UnitX() ) );
+    FrameNode *cameraFrame = new FrameNode( cameraPose );
+    env->addChild( env->getRootNode(), cameraFrame );
+
+    ImageRGB24 *image = new ImageRGB24( 40, 40, 1.0, 1.0 );
+    env->attachItem( image );
+    env->setFrameNode( image, cameraFrame );
+    for( size_t v=0; v<40; v++ )
+	for( size_t u=0; u<40; u++ )
+	{
+	    image->getGridData( ImageRGB24::R )[v][u] = u * 5;
+	    image->getGridData( ImageRGB24::G )[v][u] = v * 5;
+	    image->getGridData( ImageRGB24::B )[v][u] = 100;
+	}
+
+    // ground with a plateau of 1m height for x >= 1.0
+    ElevationGrid *elevation = new ElevationGrid( 20, 20, 0.1, 0.1 );
+    env->attachItem( elevation );
+    for( size_t y=0; y<20; y++ )
+	for( size_t x=0; x<20; x++ )
+	    elevation->getGridData( ElevationGrid::ELEVATION )[y][x] = x >= 10 ? 1.0 : 0.0;
+
+    ImageRGB24 *texture = new ImageRGB24( 20, 20, 0.1, 0.1 );
+    env->attachItem( texture );
+
+    ImageDraping *op = new ImageDraping();
+    env->attachItem( op );
+    op->setCameraModel( ImageDraping::CameraModel( 40, 40, 19.5, 19.5 ) );
+    op->setTileSize( 16 );
+    op->addInput( image );
+    op->addInput( elevation );
+    op->addOutput( texture );
+    op->updateAll();
+
+    // cell on the plateau covers the pixels 20..23 and 16..19
+    BOOST_CHECK_EQUAL( texture->getGridData( ImageRGB24::R )[10][15], 108 );
+    BOOST_CHECK_EQUAL( texture->getGridData( ImageRGB24::G )[10][15], 88 );
+    BOOST_CHECK_EQUAL( texture->getGridData( ImageRGB24::B )[10][15], 100 );
+    // cell on the ground covers the pixels 0..1 and 18..19
+    BOOST_CHECK_EQUAL( texture->getGridData( ImageRGB24::R )[10][5], 3 );
+    BOOST_CHECK_EQUAL( texture->getGridData( ImageRGB24::G )[10][5], 93 );
+    // the ground right next to the plateau is hidden
+    BOOST_CHECK_EQUAL( texture->getGridData( ImageRGB24::B )[10][8], 0 );
+
+    // the texture has to cover the same area as the elevation grid
+    ImageRGB24 *coarse = new ImageRGB24( 20, 20, 0.2, 0.2 );
+    env->attachItem( coarse );
+    op->removeOutput( texture );
+    op->addOutput( coarse );
+    BOOST_CHECK_THROW( op->updateAll(), std::runtime_error );
+    ImageRGB24 *moved = new ImageRGB24( 20, 20, 0.1, 0.1 );
+    env->attachItem( moved, cameraFrame );
+    op->removeOutput( coarse );
+    op->addOutput( moved );
+    BOOST_CHECK_THROW( op->updateAll(), std::runtime_error );
+
+    // the same for the top patches of an MLS
+    MLSGrid *mls = new MLSGrid( 20, 20, 0.1, 0.1 );
+    env->attachItem( mls );
+    for( size_t y=0; y<20; y++ )
+	for( size_t x=0; x<20; x++ )
+	{
+	    MLSGrid::SurfacePatch patch( x >= 10 ? 1.0 : 0.0, 0.1 );
+	    patch.setColor( Eigen::Vector3d::Zero() );
+	    mls->insertHead( x, y, patch );
+	}
+
+    ImageDraping *mlsOp = new ImageDraping();
+    env->attachItem( mlsOp );
+    mlsOp->setCameraModel( ImageDraping::CameraModel( 40, 40, 19.5, 19.5 ) );
+    mlsOp->setBlendWeight( 0.5 );
+    mlsOp->addInput( image );
+    mlsOp->addOutput( mls );
+    mlsOp->updateAll();
+
+    BOOST_CHECK( mls->getHasCellColor() );
+    BOOST_CHECK_EQUAL( (int)mls->beginCell( 15, 10 )->color[0], 54 );
+    BOOST_CHECK_EQUAL( (int)mls->beginCell( 15, 10 )->color[2], 50 );
+    BOOST_CHECK_EQUAL( (int)mls->beginCell( 8, 10 )->color[2], 0 );
+}
+
+BOOST_AUTO_TEST_CASE( mls_change_detection )
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+
+    // flat ground at 0
+    MLSGrid *before = new MLSGrid( 20, 20, 0.1, 0.1 );
+    env->attachItem( before );
+    for( size_t y=0; y<20; y++ )
+	for( size_t x=0; x<20; x++ )
+	    before->updateCell( x, y, 0.0, 0.05 );
+
+    // coarser map in a frame 0.5m higher, with the ground raised by 0.5m
+    // for x >= 1.0 and one unobserved cell
+    FrameNode *frame = new FrameNode( Eigen::Affine3d( Eigen::Translation3d( 0, 0, 0.5 ) ) );
+    env->addChild( env->getRootNode(), frame );
+    MLSGrid *after = new MLSGrid( 10, 10, 0.2, 0.2 );
+    env->attachItem( after );
+    env->setFrameNode( after, frame );
+    for( size_t y=0; y<10; y++ )
+	for( size_t x=0; x<10; x++ )
+	    if( x != 0 || y != 9 )
+		after->updateCell( x, y, x >= 5 ? 0.0 : -0.5, 0.05 );
+
+    Grid<float> *change = new Grid<float>( 20, 20, 0.1, 0.1 );
+    env->attachItem( change );
+    Pointcloud *pc = new Pointcloud();
+    env->attachItem( pc );
 
+    MLSChangeDetection *op = new MLSChangeDetection();
+    env->attachItem( op );
+    op->setTileSize( 8 );
+    op->addInput( before );
+    op->addInput( after );
+    op->addOutput( change );
+    op->addOutput( pc );
+    op->updateAll();
+
+    Grid<float>::ArrayType &prob( change->getGridData() );
+    BOOST_CHECK_SMALL( prob[2][2], 0.01f );
+    BOOST_CHECK_SMALL( prob[10][9], 0.01f );
+    BOOST_CHECK_GT( prob[5][15], 0.99f );
+    BOOST_CHECK_GT( prob[10][10], 0.99f );
+    // not observed in the second map
+    BOOST_CHECK( prob[19][1] != prob[19][1] );
+    BOOST_CHECK( prob[17][1] == prob[17][1] );
+
+    // each changed patch is reported once, from both maps
+    BOOST_CHECK_EQUAL( pc->vertices.size(), 200 + 50 );
+    BOOST_CHECK_EQUAL( pc->getVertexData<double>( Pointcloud::VERTEX_VARIANCE ).size(), 250 );
+    for( size_t i=0; i<pc->vertices.size(); i++ )
+    {
+	BOOST_CHECK_GE( pc->vertices[i].x(), 1.0 );
+	BOOST_CHECK( std::abs( pc->vertices[i].z() ) < 1e-6 || std::abs( pc->vertices[i].z() - 0.5 ) < 1e-6 );
+    }
+
+    // without any uncertainty, any difference is a change
+    MLSGrid *exact0 = new MLSGrid( 2, 1, 0.1, 0.1 ), *exact1 = new MLSGrid( 2, 1, 0.1, 0.1 );
+    env->attachItem( exact0 );
+    env->attachItem( exact1 );
+    exact0->updateCell( 0, 0, 0.0, 0.0 );
+    exact0->updateCell( 1, 0, 0.0, 0.0 );
+    exact1->updateCell( 0, 0, 0.0, 0.0 );
+    exact1->updateCell( 1, 0, 0.1, 0.0 );
+    Grid<float> *exactChange = new Grid<float>( 2, 1, 0.1, 0.1 );
+    env->attachItem( exactChange );
+    MLSChangeDetection *exactOp = new MLSChangeDetection();
+    env->attachItem( exactOp );
+    exactOp->setMinStdev( 0.0 );
+    exactOp->addInput( exact0 );
+    exactOp->addInput( exact1 );
+    exactOp->addOutput( exactChange );
+    exactOp->updateAll();
+    BOOST_CHECK_EQUAL( exactChange->getGridData()[0][0], 0.0f );
+    BOOST_CHECK_EQUAL( exactChange->getGridData()[0][1], 1.0f );
+}
+
+BOOST_AUTO_TEST_CASE( mls_segmentation )
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+
+    // flat ground with a ramp for x >= 2.0, a 0.5m high platform, a wall,
+    // an overhang and a low obstacle
+    MLSGrid *mls = new MLSGrid( 30, 30, 0.1, 0.1 );
+    env->attachItem( mls );
+    for( size_t y=0; y<30; y++ )
+    {
+	for( size_t x=0; x<30; x++ )
+	{
+	    if( x == 0 && y == 29 )
+		continue;
+	    if( y == 29 && x >= 10 && x < 20 )
+		mls->updateCell( x, y, SurfacePatch( 1.0, 0.05, 1.0, SurfacePatch::VERTICAL ) );
+	    else if( x >= 10 && x < 15 && y >= 10 && y < 15 )
+		mls->updateCell( x, y, 0.5, 0.05 );
+	    else
+		mls->updateCell( x, y, x >= 20 ? (x - 19) * 0.05 : 0.0, 0.05 );
+	}
+    }
+    mls->updateCell( 5, 5, 2.0, 0.05 );
+    mls->updateCell( 6, 5, 0.5, 0.05 );
+
+    Grid<uint8_t> *labels = new Grid<uint8_t>( 30, 30, 0.1, 0.1 );
+    env->attachItem( labels );
+
+    MLSSegmentation *op = new MLSSegmentation();
+    env->attachItem( op );
+    op->setTileSize( 4 );
+    op->addInput( mls );
+    op->addOutput( labels );
+    op->updateAll();
+
+    // without seeds, the largest component is ground
+    Grid<uint8_t>::ArrayType &l( labels->getGridData() );
+    BOOST_CHECK_EQUAL( l[2][2], MLSSegmentation::GROUND );
+    BOOST_CHECK_EQUAL( l[3][29], MLSSegmentation::GROUND );
+    BOOST_CHECK_EQUAL( l[12][12], MLSSegmentation::OBSTACLE );
+    BOOST_CHECK_EQUAL( l[29][12], MLSSegmentation::OBSTACLE );
+    BOOST_CHECK_EQUAL( l[5][5], MLSSegmentation::OVERHANG );
+    BOOST_CHECK_EQUAL( l[5][6], MLSSegmentation::OBSTACLE );
+    BOOST_CHECK_EQUAL( l[29][0], MLSSegmentation::UNKNOWN );
+
+    // the tiles don't change the result
+    std::vector<uint8_t> tiled( l.data(), l.data() + l.num_elements() );
+    op->setTileSize( 64 );
+    op->updateAll();
+    BOOST_CHECK( std::equal( tiled.begin(), tiled.end(), l.data() ) );
+
+    // seeded on the platform
+    op->addSeed( Eigen::Vector3d( 1.2, 1.2, 0.5 ) );
+    op->updateAll();
+    BOOST_CHECK_EQUAL( l[12][12], MLSSegmentation::GROUND );
+    BOOST_CHECK_EQUAL( l[2][2], MLSSegmentation::OBSTACLE );
+}
+
+BOOST_AUTO_TEST_CASE( range_sensor_simulator )
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+
+    // flat ground at 0 and a 1m high wall at x = 3.0
+    MLSGrid *mls = new MLSGrid( 40, 40, 0.1, 0.1 );
+    env->attachItem( mls );
+    for( size_t y=0; y<40; y++ )
+    {
+	for( size_t x=0; x<40; x++ )
+	    mls->updateCell( x, y, 0.0, 0.05 );
+	mls->insertHead( 30, y, MLSGrid::SurfacePatch( 1.0, 0.05, 1.0, MLSGrid::SurfacePatch::VERTICAL ) );
+    }
+
+    // the same scene as a mesh, the ground is split into many faces
+    TriMesh *mesh = new TriMesh();
+    env->attachItem( mesh );
+    for( size_t y=0; y<=20; y++ )
+	for( size_t x=0; x<=20; x++ )
+	    mesh->vertices.push_back( Eigen::Vector3d( x * 0.2, y * 0.2, 0 ) );
+    for( int y=0; y<20; y++ )
+	for( int x=0; x<20; x++ )
+	{
+	    const int i = y * 21 + x;
+	    mesh->faces.push_back( TriMesh::triangle_t( i, i + 1, i + 22 ) );
+	    mesh->faces.push_back( TriMesh::triangle_t( i, i + 22, i + 21 ) );
+	}
+    const int w = mesh->vertices.size();
+    mesh->vertices.push_back( Eigen::Vector3d( 3.0, 0, 0 ) );
+    mesh->vertices.push_back( Eigen::Vector3d( 3.0, 4.0, 0 ) );
+    mesh->vertices.push_back( Eigen::Vector3d( 3.0, 4.0, 1.0 ) );
+    mesh->vertices.push_back( Eigen::Vector3d( 3.0, 0, 1.0 ) );
+    mesh->faces.push_back( TriMesh::triangle_t( w, w + 1, w + 2 ) );
+    mesh->faces.push_back( TriMesh::triangle_t( w, w + 2, w + 3 ) );
+
+    FrameNode *sensor = new FrameNode( Eigen::Affine3d( Eigen::Translation3d( 0.55, 2.05, 0.5 ) ) );
+    env->addChild( env->getRootNode(), sensor );
+
+    // one ray forward onto the wall, one 45 degrees down onto the ground,
+    // and two backwards, which leave the map
+    RangeSensorSimulator::ScannerModel scanner;
+    scanner.startPsi = 0;
+    scanner.psiResolution = M_PI;
+    scanner.pointsPerLine = 2;
+    scanner.startPhi = 0;
+    scanner.phiResolution = -M_PI / 4.0;
+    scanner.lines = 2;
+    RangeSensorSimulator sim( scanner );
+
+    std::vector<double> mlsRanges, meshRanges;
+    sim.simulate( *mls, sensor, mlsRanges );
+    sim.simulate( *mesh, sensor, meshRanges );
+
+    TriMeshBVH bvh( *mesh );
+    BOOST_CHECK( bvh.getNodeCount() > 100 );
+
+    BOOST_REQUIRE_EQUAL( mlsRanges.size(), 4 );
+    BOOST_REQUIRE_EQUAL( meshRanges.size(), 4 );
+    BOOST_CHECK_CLOSE( mlsRanges[0], 2.45, 1e-3 );
+    BOOST_CHECK_CLOSE( meshRanges[0], 2.45, 1e-3 );
+    BOOST_CHECK( mlsRanges[1] != mlsRanges[1] );
+    BOOST_CHECK( meshRanges[1] != meshRanges[1] );
+    BOOST_CHECK_CLOSE( mlsRanges[2], 0.5 * sqrt( 2.0 ), 1e-3 );
+    BOOST_CHECK_CLOSE( meshRanges[2], 0.5 * sqrt( 2.0 ), 1e-3 );
+    BOOST_CHECK( mlsRanges[3] != mlsRanges[3] );
+    BOOST_CHECK( meshRanges[3] != meshRanges[3] );
+
+    LaserScan scan;
+    sim.fillLaserScan( mlsRanges, scan );
+    BOOST_REQUIRE_EQUAL( scan.lines.size(), 2 );
+    BOOST_CHECK_EQUAL( scan.lines[0].ranges[0], 2450 );
+    BOOST_CHECK_EQUAL( scan.lines[0].ranges[1], 0 );
+
+    Pointcloud pc;
+    sim.fillPointcloud( mlsRanges, pc );
+    BOOST_REQUIRE_EQUAL( pc.vertices.size(), 2 );
+    BOOST_CHECK( pc.vertices[1].isApprox( Eigen::Vector3d( 0.5, 0, -0.5 ), 1e-5 ) );
+
+    // the noise only depends on the seed, not on the threads
+    RangeSensorSimulator::NoiseModel noise;
+    noise.rangeStdev = 0.01;
+    noise.angleStdev = 0.001;
+    scanner.startPsi = -M_PI / 4.0;
+    scanner.psiResolution = M_PI / 360.0;
+    scanner.pointsPerLine = 181;
+    scanner.phiResolution = -M_PI / 720.0;
+    scanner.lines = 50;
+    std::vector<double> a, b, c;
+    RangeSensorSimulator( scanner, noise, 1 ).simulate( *mls, sensor, a );
+    RangeSensorSimulator( scanner, noise, 4 ).simulate( *mls, sensor, b );
+    BOOST_CHECK( a.size() == b.size() );
+    size_t valid = 0;
+    for( size_t i=0; i<a.size(); i++ )
+    {
+	BOOST_CHECK( a[i] == b[i] || (a[i] != a[i] && b[i] != b[i]) );
+	if( a[i] == a[i] )
+	    valid++;
+    }
+    BOOST_CHECK( valid > a.size() / 2 );
+
+    noise.seed++;
+    RangeSensorSimulator( scanner, noise, 4 ).simulate( *mls, sensor, c );
+    BOOST_CHECK( a != c );
+
+    noise.dropoutProbability = 1.0;
+    RangeSensorSimulator( scanner, noise ).simulate( *mls, sensor, c );
+    for( size_t i=0; i<c.size(); i++ )
+	BOOST_CHECK( c[i] != c[i] );
+}
+
+BOOST_AUTO_TEST_CASE( mls_to_trimesh )
+{
+    boost::scoped_ptr<Environment> env( new Environment() );
+
+    // a step of 0.5m at x = 0.5, and a block on the lower part
+    MLSGrid *mls = new MLSGrid( 10, 10, 0.1, 0.1 );
+    env->attachItem( mls );
+    for( size_t y=0; y<10; y++ )
+	for( size_t x=0; x<10; x++ )
+	    if( x != 2 || y != 2 )
+		mls->updateCell( x, y, x < 5 ? 0.0 : 0.5, 0.05 );
+    mls->insertHead( 2, 2, MLSGrid::SurfacePatch( 0.3, 0.05, 0.3, MLSGrid::SurfacePatch::VERTICAL ) );
+
+    TriMesh *tiled = new TriMesh();
+    env->attachItem( tiled );
+    MLSToTriMesh *op = new MLSToTriMesh();
+    env->attachItem( op );
+    op->addInput( mls );
+    op->addOutput( tiled );
+    op->setTileSize( 3 );
+    op->setThreads( 4 );
+    op->updateAll();
+
+    // 11x11 corners, 11 extra ones along the step, 4 for the top of the
+    // block and 2 for each of its walls
+    BOOST_CHECK_EQUAL( tiled->vertices.size(), 121u + 11 + 4 + 8 );
+    BOOST_CHECK_EQUAL( tiled->faces.size(), 200u + 8 );
+    BOOST_CHECK_EQUAL( tiled->getVertexData<double>( Pointcloud::VERTEX_VARIANCE ).size(), tiled->vertices.size() );
+
+    // the tiles don't change the mesh
+    TriMesh *single = new TriMesh();
+    env->attachItem( single );
+    MLSToTriMesh *op2 = new MLSToTriMesh();
+    env->attachItem( op2 );
+    op2->addInput( mls );
+    op2->addOutput( single );
+    op2->updateAll();
+    BOOST_CHECK_EQUAL( single->vertices.size(), tiled->vertices.size() );
+    BOOST_CHECK_EQUAL( single->faces.size(), tiled->faces.size() );
+
+    TriMeshBVH bvh( *tiled );
+    TriMeshBVH::Hit hit;
+    BOOST_REQUIRE( bvh.intersect( Eigen::Vector3d( 0.25, 0.25, 2.0 ), -Eigen::Vector3d::UnitZ(), 10.0, hit ) );
+    BOOST_CHECK_CLOSE( hit.distance, 1.7, 1e-3 );
+    BOOST_REQUIRE( bvh.intersect( Eigen::Vector3d( 0.75, 0.25, 2.0 ), -Eigen::Vector3d::UnitZ(), 10.0, hit ) );
+    BOOST_CHECK_CLOSE( hit.distance, 1.5, 1e-3 );
+    BOOST_REQUIRE( bvh.intersect( Eigen::Vector3d( 0.05, 0.25, 0.15 ), Eigen::Vector3d::UnitX(), 10.0, hit ) );
+    BOOST_CHECK_CLOSE( hit.distance, 0.15, 1e-3 );
+    BOOST_CHECK( hit.normal.isApprox( -Eigen::Vector3d::UnitX() ) );
+}
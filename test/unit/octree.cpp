@@ -0,0 +1,209 @@
+#define BOOST_TEST_MODULE OctreeTest
+#include <boost/test/included/unit_test.hpp>
+
+#include <envire/tools/PointcloudOctree.hpp>
+#include <set>
+#include <algorithm>
+#include <limits>
+
+using namespace envire;
+
+static void fillPlane( std::vector<Eigen::Vector3d>& vertices, size_t count, double size )
+{
+    srand( 42 );
+    for( size_t i=0; i<count; i++ )
+    {
+	vertices.push_back( Eigen::Vector3d(
+		    size * rand() / RAND_MAX,
+		    size * rand() / RAND_MAX,
+		    0.1 * rand() / RAND_MAX ) );
+    }
+}
+
+static void collectLeafPoints( const PointcloudOctree& tree, int n, std::set<PointcloudOctree::index_t>& points )
+{
+    const PointcloudOctree::Node& node( tree.getNode( n ) );
+    if( node.isLeaf() )
+	points.insert( node.points.begin(), node.points.end() );
+    for( int i=0; i<8; i++ )
+	if( node.children[i] >= 0 )
+	    collectLeafPoints( tree, node.children[i], points );
+}
+
+static void checkNode( const PointcloudOctree& tree, int n, const std::vector<Eigen::Vector3d>& vertices )
+{
+    const PointcloudOctree::Node& node( tree.getNode( n ) );
+    size_t count = 0;
+    for( size_t i=0; i<node.points.size(); i++ )
+	BOOST_CHECK( node.box.contains( vertices[node.points[i]] ) );
+    if( node.isLeaf() )
+	count = node.points.size();
+    else
+    {
+	BOOST_CHECK( node.points.size() <= tree.getLodPoints() );
+	for( int i=0; i<8; i++ )
+	{
+	    if( node.children[i] >= 0 )
+	    {
+		BOOST_CHECK_EQUAL( tree.getNode( node.children[i] ).parent, n );
+		BOOST_CHECK_EQUAL( tree.getNode( node.children[i] ).depth, node.depth + 1 );
+		count += tree.getNode( node.children[i] ).count;
+		checkNode( tree, node.children[i], vertices );
+	    }
+	}
+    }
+    BOOST_CHECK_EQUAL( count, node.count );
+}
+
+BOOST_AUTO_TEST_CASE( test_octree_construction )
+{
+    std::vector<Eigen::Vector3d> vertices;
+    fillPlane( vertices, 20000, 10.0 );
+
+    PointcloudOctree tree( 500, 100 );
+    BOOST_CHECK_EQUAL( tree.update( vertices ), vertices.size() );
+    BOOST_CHECK_EQUAL( tree.getPointCount(), vertices.size() );
+    BOOST_CHECK_EQUAL( tree.getNode( tree.getRoot() ).count, vertices.size() );
+    BOOST_CHECK_EQUAL( tree.getNode( tree.getRoot() ).depth, 0 );
+
+    checkNode( tree, tree.getRoot(), vertices );
+
+    // every point is in exactly one leaf
+    std::set<PointcloudOctree::index_t> points;
+    collectLeafPoints( tree, tree.getRoot(), points );
+    BOOST_CHECK_EQUAL( points.size(), vertices.size() );
+}
+
+BOOST_AUTO_TEST_CASE( test_octree_incremental )
+{
+    std::vector<Eigen::Vector3d> vertices;
+    fillPlane( vertices, 5000, 10.0 );
+
+    PointcloudOctree tree( 500, 100 );
+    tree.update( vertices );
+    tree.clearDirty();
+    BOOST_CHECK( tree.getDirtyNodes().empty() );
+
+    // append a few points far away from the initial cloud, this
+    // will grow the root and only touch a few nodes
+    const size_t nodeCount = tree.getNodeCount();
+    vertices.push_back( Eigen::Vector3d( 100, 100, 0 ) );
+    vertices.push_back( Eigen::Vector3d( 100.1, 100, 0 ) );
+    BOOST_CHECK_EQUAL( tree.update( vertices ), 2u );
+    BOOST_CHECK_EQUAL( tree.getNode( tree.getRoot() ).count, vertices.size() );
+    BOOST_CHECK( tree.getDirtyNodes().size() < tree.getNodeCount() - nodeCount + 10 );
+    checkNode( tree, tree.getRoot(), vertices );
+
+    // nothing new, nothing to do
+    BOOST_CHECK_EQUAL( tree.update( vertices ), 0u );
+
+    // vertices which are not finite are skipped
+    vertices.push_back( Eigen::Vector3d( std::numeric_limits<double>::quiet_NaN(), 0, 0 ) );
+    vertices.push_back( Eigen::Vector3d( 0, std::numeric_limits<double>::infinity(), 0 ) );
+    BOOST_CHECK_EQUAL( tree.update( vertices ), 2u );
+    BOOST_CHECK_EQUAL( tree.getPointCount(), vertices.size() );
+    BOOST_CHECK_EQUAL( tree.getNode( tree.getRoot() ).count, vertices.size() - 2 );
+
+    // a smaller vertex array results in a rebuild
+    vertices.resize( 100 );
+    BOOST_CHECK_EQUAL( tree.update( vertices ), 100u );
+    BOOST_CHECK_EQUAL( tree.getPointCount(), 100u );
+    checkNode( tree, tree.getRoot(), vertices );
+}
+
+BOOST_AUTO_TEST_CASE( test_octree_modified )
+{
+    std::vector<Eigen::Vector3d> vertices, colors;
+    fillPlane( vertices, 5000, 10.0 );
+    colors.resize( vertices.size(), Eigen::Vector3d::Ones() );
+
+    PointcloudOctree tree( 500, 100 );
+    tree.update( vertices );
+    BOOST_CHECK( !tree.checkModified( vertices, &colors ) );
+    tree.clearDirty();
+    BOOST_CHECK( !tree.checkModified( vertices, &colors ) );
+    BOOST_CHECK( tree.getDirtyNodes().empty() );
+
+    // a small change in place only touches the nodes which draw the vertex
+    vertices[10] += Eigen::Vector3d( 1e-6, 0, 0 );
+    tree.update( vertices );
+    BOOST_CHECK( !tree.checkModified( vertices, &colors ) );
+    const std::vector<int> dirty( tree.getDirtyNodes() );
+    BOOST_CHECK( !dirty.empty() );
+    BOOST_CHECK( (int)dirty.size() <= tree.getNode( tree.getRoot() ).depth + 10 );
+    for( size_t i=0; i<dirty.size(); i++ )
+    {
+	const std::vector<PointcloudOctree::index_t>& points( tree.getNode( dirty[i] ).points );
+	BOOST_CHECK( std::find( points.begin(), points.end(), 10 ) != points.end() );
+    }
+    tree.clearDirty();
+
+    colors[20] = Eigen::Vector3d::Zero();
+    BOOST_CHECK( !tree.checkModified( vertices, &colors ) );
+    BOOST_CHECK( !tree.getDirtyNodes().empty() );
+    tree.clearDirty();
+
+    // a vertex which leaves its leaf results in a rebuild
+    vertices[30] = Eigen::Vector3d( 50.0, 50.0, 0 );
+    tree.update( vertices );
+    BOOST_CHECK( tree.checkModified( vertices, &colors ) );
+    BOOST_CHECK_EQUAL( tree.getDirtyNodes().size(), tree.getNodeCount() );
+    checkNode( tree, tree.getRoot(), vertices );
+    tree.clearDirty();
+
+    // as does a skipped vertex which becomes finite
+    vertices.push_back( Eigen::Vector3d::Constant( std::numeric_limits<double>::quiet_NaN() ) );
+    colors.push_back( Eigen::Vector3d::Ones() );
+    tree.update( vertices );
+    BOOST_CHECK( !tree.checkModified( vertices, &colors ) );
+    vertices.back() = Eigen::Vector3d( 1.0, 1.0, 0 );
+    BOOST_CHECK( tree.checkModified( vertices, &colors ) );
+    BOOST_CHECK_EQUAL( tree.getNode( tree.getRoot() ).count, vertices.size() );
+}
+
+BOOST_AUTO_TEST_CASE( test_octree_selection )
+{
+    std::vector<Eigen::Vector3d> vertices;
+    fillPlane( vertices, 20000, 10.0 );
+
+    PointcloudOctree tree( 500, 100 );
+    tree.update( vertices );
+
+    // very far away, the root sample is enough
+    std::vector<PointcloudOctree::Selection> sel;
+    tree.select( Eigen::Vector3d( 0, 0, 1e6 ), 1000.0, 1.0, sel );
+    BOOST_REQUIRE_EQUAL( sel.size(), 1u );
+    BOOST_CHECK_EQUAL( sel[0].node, tree.getRoot() );
+
+    // very close, all the leafs get selected
+    tree.select( Eigen::Vector3d( 5, 5, 0.05 ), 1000.0, 1e-9, sel );
+    size_t count = 0;
+    for( size_t i=0; i<sel.size(); i++ )
+    {
+	BOOST_CHECK( tree.getNode( sel[i].node ).isLeaf() );
+	count += tree.getNode( sel[i].node ).points.size();
+    }
+    BOOST_CHECK_EQUAL( count, vertices.size() );
+
+    // in between, nodes close to the viewer are more detailed
+    tree.select( Eigen::Vector3d( 0, 0, 1.0 ), 1000.0, 10.0, sel );
+    BOOST_CHECK( sel.size() > 1 );
+    int near_depth = 0, far_depth = 0;
+    for( size_t i=0; i<sel.size(); i++ )
+    {
+	const PointcloudOctree::Node& node( tree.getNode( sel[i].node ) );
+	BOOST_CHECK( node.isLeaf() || sel[i].screenError <= 10.0 );
+	if( node.box.contains( Eigen::Vector3d( 0.1, 0.1, 0.05 ) ) )
+	    near_depth = node.depth;
+	if( node.box.contains( Eigen::Vector3d( 9.9, 9.9, 0.05 ) ) )
+	    far_depth = node.depth;
+    }
+    BOOST_CHECK( near_depth > far_depth );
+
+    // a point budget limits the refinement
+    tree.select( Eigen::Vector3d( 5, 5, 0.05 ), 1000.0, 1e-9, sel, 1000 );
+    count = 0;
+    for( size_t i=0; i<sel.size(); i++ )
+	count += tree.getNode( sel[i].node ).points.size();
+    BOOST_CHECK( count < vertices.size() );
+}
@@ -0,0 +1,463 @@
+#define BOOST_TEST_MODULE PointcloudTest 
+#include <boost/test/included/unit_test.hpp>
+
+#include <envire/Core.hpp>
+#include <envire/maps/Pointcloud.hpp>
+#include <envire/maps/TriMesh.hpp>
+#include <envire/tools/KdTree.hpp>
+#include <envire/operators/NormalEstimation.hpp>
+#include <envire/operators/OutlierFilter.hpp>
+#include <envire/operators/PointcloudMeshDistance.hpp>
+#include <envire/operators/MeshDecimation.hpp>
+#include <envire/operators/EuclideanClustering.hpp>
+#include <envire/tools/TriMeshBVH.hpp>
+#include <algorithm>
+#include <limits>
+
+using namespace envire;
+
+static void fillRandom( std::vector<Eigen::Vector3d>& points, size_t count )
+{
+    srand( 42 );
+    for( size_t i=0; i<count; i++ )
+	points.push_back( Eigen::Vector3d::Random() );
+}
+
+BOOST_AUTO_TEST_CASE( test_kdtree )
+{
+    std::vector<Eigen::Vector3d> points;
+    fillRandom( points, 20000 );
+
+    KdTree tree( 8 );
+    tree.build( points, 4 );
+    BOOST_CHECK_EQUAL( tree.size(), points.size() );
+
+    std::vector<Eigen::Vector3d> queries;
+    fillRandom( queries, 50 );
+    for( size_t q=0; q<queries.size(); q++ )
+    {
+	// brute force reference
+	std::vector<KdTree::Neighbour> ref;
+	for( size_t i=0; i<points.size(); i++ )
+	    ref.push_back( KdTree::Neighbour( i, (points[i] - queries[q]).squaredNorm() ) );
+	std::sort( ref.begin(), ref.end() );
+
+	std::vector<KdTree::Neighbour> result;
+	tree.findNearest( queries[q], 10, result );
+	BOOST_REQUIRE_EQUAL( result.size(), 10u );
+	for( size_t i=0; i<result.size(); i++ )
+	    BOOST_CHECK_CLOSE( result[i].sqDist, ref[i].sqDist, 1e-9 );
+
+	const double radius = 0.1;
+	tree.findInRadius( queries[q], radius, result );
+	size_t count = 0;
+	while( count < ref.size() && ref[count].sqDist <= radius * radius )
+	    count++;
+	BOOST_CHECK_EQUAL( result.size(), count );
+
+	// limited distance
+	tree.findNearest( queries[q], 1000, result, radius );
+	BOOST_CHECK_EQUAL( result.size(), std::min( count, (size_t)1000 ) );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_normal_estimation )
+{
+    // tilted plane, seen from above
+    std::vector<Eigen::Vector3d> points;
+    const Eigen::Vector3d normal = Eigen::Vector3d( 0.2, -0.1, 1.0 ).normalized();
+    const Eigen::Vector3d u = normal.unitOrthogonal(), v = normal.cross( u );
+    srand( 42 );
+    for( int i=0; i<5000; i++ )
+	points.push_back( u * (rand() / (double)RAND_MAX) + v * (rand() / (double)RAND_MAX) );
+
+    NormalEstimation ne;
+    ne.setNeighbours( 10 );
+    std::vector<Eigen::Vector3d> normals;
+    ne.computeNormals( points, Eigen::Vector3d( 0, 0, 10.0 ), normals );
+    BOOST_REQUIRE_EQUAL( normals.size(), points.size() );
+    for( size_t i=0; i<normals.size(); i++ )
+	BOOST_CHECK_CLOSE( normals[i].dot( normal ), 1.0, 1e-6 );
+
+    // viewpoint below flips the normals
+    ne.computeNormals( points, Eigen::Vector3d( 0, 0, -10.0 ), normals );
+    BOOST_CHECK_CLOSE( normals[0].dot( normal ), -1.0, 1e-6 );
+}
+
+BOOST_AUTO_TEST_CASE( test_outlier_filter )
+{
+    std::vector<Eigen::Vector3d> points;
+    srand( 42 );
+    for( int i=0; i<5000; i++ )
+	points.push_back( Eigen::Vector3d( rand() / (double)RAND_MAX, rand() / (double)RAND_MAX, 0 ) );
+    // some isolated points
+    points.push_back( Eigen::Vector3d( 0.5, 0.5, 1.0 ) );
+    points.push_back( Eigen::Vector3d( 5.0, 0.5, 0.0 ) );
+
+    OutlierFilter filter;
+    std::vector<bool> inliers;
+    filter.setNeighbours( 8 );
+    filter.setStddevMultiplier( 3.0 );
+    filter.computeInliers( points, inliers );
+    BOOST_CHECK( !inliers[5000] );
+    BOOST_CHECK( !inliers[5001] );
+    BOOST_CHECK( std::count( inliers.begin(), inliers.end(), true ) > 4900 );
+
+    filter.setMethod( OutlierFilter::RADIUS );
+    filter.setRadius( 0.1 );
+    filter.setMinNeighbours( 3 );
+    filter.computeInliers( points, inliers );
+    BOOST_CHECK( !inliers[5000] );
+    BOOST_CHECK( !inliers[5001] );
+    BOOST_CHECK_EQUAL( std::count( inliers.begin(), inliers.end(), true ), 5000 );
+
+    // through the environment
+    Environment env;
+    Pointcloud *pc = new Pointcloud();
+    env.attachItem( pc );
+    pc->vertices = points;
+    pc->getVertexData<double>( Pointcloud::VERTEX_VARIANCE ).resize( points.size(), 0.01 );
+    Pointcloud *out = new Pointcloud();
+    env.attachItem( out );
+
+    OutlierFilter *op = new OutlierFilter();
+    env.attachItem( op );
+    op->setMethod( OutlierFilter::RADIUS );
+    op->setRadius( 0.1 );
+    op->setMinNeighbours( 3 );
+    op->addInput( pc );
+    op->addOutput( out );
+    op->updateAll();
+    BOOST_CHECK_EQUAL( out->vertices.size(), 5000u );
+    BOOST_CHECK_EQUAL( out->getVertexData<double>( Pointcloud::VERTEX_VARIANCE ).size(), 5000u );
+
+    NormalEstimation *ne = new NormalEstimation();
+    env.attachItem( ne );
+    ne->addInput( out );
+    ne->addOutput( out );
+    ne->updateAll();
+    BOOST_CHECK_EQUAL( out->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_NORMAL ).size(), 5000u );
+}
+
+BOOST_AUTO_TEST_CASE( test_pointcloud_mesh_distance )
+{
+    Environment env;
+
+    // a plane at z = 0.5 in the root frame, with the faces facing up
+    FrameNode *fn = new FrameNode( Eigen::Affine3d( Eigen::Translation3d( 0, 0, 0.5 ) ) );
+    env.addChild( env.getRootNode(), fn );
+    TriMesh *mesh = new TriMesh();
+    env.attachItem( mesh );
+    mesh->setFrameNode( fn );
+    for( int y=0; y<=20; y++ )
+	for( int x=0; x<=20; x++ )
+	    mesh->vertices.push_back( Eigen::Vector3d( x * 0.1, y * 0.1, 0 ) );
+    for( int y=0; y<20; y++ )
+	for( int x=0; x<20; x++ )
+	{
+	    const int i = y * 21 + x;
+	    mesh->faces.push_back( TriMesh::triangle_t( i, i + 1, i + 22 ) );
+	    mesh->faces.push_back( TriMesh::triangle_t( i, i + 22, i + 21 ) );
+	}
+
+    srand( 42 );
+    Pointcloud *pc = new Pointcloud();
+    env.attachItem( pc );
+    for( int i=0; i<200; i++ )
+    {
+	const double x = 0.1 + 1.8 * rand() / RAND_MAX, y = 0.1 + 1.8 * rand() / RAND_MAX;
+	pc->vertices.push_back( Eigen::Vector3d( x, y, i < 100 ? 0.6 : 0.45 ) );
+    }
+    pc->vertices.push_back( Eigen::Vector3d( 1.0, 1.0, 5.0 ) );
+
+    // batched queries in the frame of the mesh, before and after moving
+    // the vertices
+    TriMeshBVH bvh( *mesh, 4, 2 );
+    TriMeshBVH::PointVector origins, dirs;
+    for( size_t i=0; i<200; i++ )
+    {
+	origins.push_back( Eigen::Vector3d( pc->vertices[i].x(), pc->vertices[i].y(), 1.0 ) );
+	dirs.push_back( -Eigen::Vector3d::UnitZ() );
+    }
+    TriMeshBVH::HitVector hits;
+    bvh.intersect( origins, dirs, 10.0, hits );
+    for( size_t i=0; i<hits.size(); i++ )
+    {
+	BOOST_CHECK_CLOSE( hits[i].distance, 1.0, 1e-6 );
+	BOOST_CHECK( hits[i].normal.isApprox( Eigen::Vector3d::UnitZ() ) );
+    }
+
+    for( size_t i=0; i<mesh->vertices.size(); i++ )
+	mesh->vertices[i].z() += 0.2;
+    bvh.refit();
+    BOOST_CHECK_CLOSE( bvh.getBounds().min().z(), 0.2, 1e-6 );
+    bvh.intersect( origins, dirs, 10.0, hits );
+    for( size_t i=0; i<hits.size(); i++ )
+	BOOST_CHECK_CLOSE( hits[i].distance, 0.8, 1e-6 );
+    bvh.closestPoint( origins, 0.5, hits );
+    for( size_t i=0; i<hits.size(); i++ )
+	BOOST_CHECK( hits[i].distance == std::numeric_limits<double>::infinity() );
+    for( size_t i=0; i<mesh->vertices.size(); i++ )
+	mesh->vertices[i].z() -= 0.2;
+
+    Pointcloud *out = new Pointcloud();
+    env.attachItem( out );
+
+    PointcloudMeshDistance *op = new PointcloudMeshDistance();
+    env.attachItem( op );
+    op->addInput( pc );
+    op->addInput( mesh );
+    op->addOutput( out );
+    op->setSigned( true );
+    op->updateAll();
+
+    const PointcloudMeshDistance::Statistics& stats( op->getStatistics() );
+    BOOST_CHECK_EQUAL( stats.inliers, 200u );
+    BOOST_CHECK_EQUAL( stats.outliers, 1u );
+    BOOST_CHECK_CLOSE( stats.mean, 0.025, 1e-4 );
+    BOOST_CHECK_CLOSE( stats.max, 0.1, 1e-4 );
+    BOOST_CHECK_CLOSE( stats.rms, std::sqrt( 0.00625 ), 1e-4 );
+
+    BOOST_REQUIRE_EQUAL( out->vertices.size(), 201u );
+    const std::vector<double>& distance( out->getVertexData<double>( PointcloudMeshDistance::VERTEX_DISTANCE ) );
+    BOOST_REQUIRE_EQUAL( distance.size(), 201u );
+    BOOST_CHECK_CLOSE( distance[0], 0.1, 1e-4 );
+    BOOST_CHECK_CLOSE( distance[100], -0.05, 1e-4 );
+    BOOST_CHECK( distance[200] != distance[200] );
+}
+
+BOOST_AUTO_TEST_CASE( test_mesh_decimation )
+{
+    Environment env;
+
+    // a flat square with a colour gradient, and a surface with a crease
+    // along x = 1
+    TriMesh *plane = new TriMesh();
+    env.attachItem( plane );
+    TriMesh *crease = new TriMesh();
+    env.attachItem( crease );
+    std::vector<Eigen::Vector3d>& colors( plane->getVertexData<Eigen::Vector3d>( Pointcloud::VERTEX_COLOR ) );
+    for( int y=0; y<=20; y++ )
+	for( int x=0; x<=20; x++ )
+	{
+	    plane->vertices.push_back( Eigen::Vector3d( x * 0.1, y * 0.1, 0 ) );
+	    colors.push_back( Eigen::Vector3d( x * 0.05, y * 0.05, 0 ) );
+	    crease->vertices.push_back( Eigen::Vector3d( x * 0.1, y * 0.1, std::abs( x - 10 ) * 0.05 ) );
+	}
+    for( int y=0; y<20; y++ )
+	for( int x=0; x<20; x++ )
+	{
+	    const int i = y * 21 + x;
+	    plane->faces.push_back( TriMesh::triangle_t( i, i + 1, i + 22 ) );
+	    plane->faces.push_back( TriMesh::triangle_t( i, i + 22, i + 21 ) );
+	}
+    crease->faces = plane->faces;
+
+    // decimate the plane in place to a face count
+    MeshDecimation *op = new MeshDecimation();
+    env.attachItem( op );
+    op->addInput( plane );
+    op->addOutput( plane );
+    op->setTargetFaces( 100 );
+    op->setThreads( 4 );
+    op->updateAll();
+
+    BOOST_CHECK_EQUAL( plane->faces.size(), 100u );
+    BOOST_REQUIRE_EQUAL( colors.size(), plane->vertices.size() );
+    double area = 0;
+    for( size_t i=0; i<plane->faces.size(); i++ )
+    {
+	const Eigen::Vector3d& a( plane->vertices[plane->faces[i].get<0>()] );
+	const Eigen::Vector3d& b( plane->vertices[plane->faces[i].get<1>()] );
+	const Eigen::Vector3d& c( plane->vertices[plane->faces[i].get<2>()] );
+	const Eigen::Vector3d n = (b - a).cross( c - a );
+	// no face is flipped, and the boundary is kept
+	BOOST_CHECK( n.z() > 0 );
+	area += 0.5 * n.norm();
+    }
+    BOOST_CHECK_CLOSE( area, 4.0, 1e-6 );
+    for( size_t i=0; i<plane->vertices.size(); i++ )
+    {
+	BOOST_CHECK_SMALL( plane->vertices[i].z(), 1e-9 );
+	BOOST_CHECK( colors[i].isApprox( Eigen::Vector3d( plane->vertices[i].x() * 0.5, plane->vertices[i].y() * 0.5, 0 ), 1e-6 ) );
+    }
+
+    // with a small error bound, only the crease and the corners remain
+    TriMesh *out = new TriMesh();
+    env.attachItem( out );
+    MeshDecimation *op2 = new MeshDecimation();
+    env.attachItem( op2 );
+    op2->addInput( crease );
+    op2->addOutput( out );
+    op2->setMaxError( 1e-8 );
+    op2->updateAll();
+
+    BOOST_CHECK_EQUAL( crease->faces.size(), 800u );
+    BOOST_CHECK_EQUAL( out->faces.size(), 4u );
+    BOOST_CHECK_EQUAL( out->vertices.size(), 6u );
+    for( size_t i=0; i<out->vertices.size(); i++ )
+	BOOST_CHECK_SMALL( out->vertices[i].z() - std::abs( out->vertices[i].x() - 1.0 ) * 0.5, 1e-6 );
+}
+
+static void makeGridMesh( TriMesh& mesh, int size, double crease )
+{
+    for( int y=0; y<=size; y++ )
+	for( int x=0; x<=size; x++ )
+	    mesh.vertices.push_back( Eigen::Vector3d( x * 0.1, y * 0.1, std::abs( x - size / 2 ) * crease ) );
+    for( int y=0; y<size; y++ )
+	for( int x=0; x<size; x++ )
+	{
+	    const int i = y * (size + 1) + x;
+	    mesh.faces.push_back( TriMesh::triangle_t( i, i + 1, i + size + 2 ) );
+	    mesh.faces.push_back( TriMesh::triangle_t( i, i + size + 2, i + size + 1 ) );
+	}
+}
+
+static double getMeshArea( const TriMesh& mesh, bool& flipped )
+{
+    double area = 0;
+    flipped = false;
+    for( size_t i=0; i<mesh.faces.size(); i++ )
+    {
+	const Eigen::Vector3d& a( mesh.vertices[mesh.faces[i].get<0>()] );
+	const Eigen::Vector3d& b( mesh.vertices[mesh.faces[i].get<1>()] );
+	const Eigen::Vector3d& c( mesh.vertices[mesh.faces[i].get<2>()] );
+	const Eigen::Vector3d n = (b - a).cross( c - a );
+	flipped |= n.z() <= 0;
+	area += 0.5 * n.norm();
+    }
+    return area;
+}
+
+BOOST_AUTO_TEST_CASE( test_mesh_decimation_slabs )
+{
+    // 4225 vertices, which is enough for the parallel slab passes to run.
+    // They have to give the same result as the serial decimation.
+    Environment env;
+    TriMesh *serial[2], *parallel[2];
+    for( int i=0; i<2; i++ )
+    {
+	TriMesh *input = new TriMesh();
+	env.attachItem( input );
+	makeGridMesh( *input, 64, i == 0 ? 0.0 : 0.05 );
+	BOOST_REQUIRE_GE( input->vertices.size(), 2048u );
+
+	for( int threads=1; threads<=4; threads+=3 )
+	{
+	    TriMesh *out = new TriMesh();
+	    env.attachItem( out );
+	    MeshDecimation *op = new MeshDecimation();
+	    env.attachItem( op );
+	    op->addInput( input );
+	    op->addOutput( out );
+	    if( i == 0 )
+		op->setTargetFaces( 500 );
+	    else
+		op->setMaxError( 1e-8 );
+	    op->setThreads( threads );
+	    op->updateAll();
+	    (threads == 1 ? serial : parallel)[i] = out;
+	}
+    }
+
+    // the plane is decimated to the same number of faces, and keeps its
+    // outline
+    bool flipped;
+    BOOST_CHECK_LE( serial[0]->faces.size(), 500u );
+    BOOST_CHECK_EQUAL( parallel[0]->faces.size(), serial[0]->faces.size() );
+    BOOST_CHECK_CLOSE( getMeshArea( *serial[0], flipped ), 6.4 * 6.4, 1e-6 );
+    BOOST_CHECK( !flipped );
+    BOOST_CHECK_CLOSE( getMeshArea( *parallel[0], flipped ), 6.4 * 6.4, 1e-6 );
+    BOOST_CHECK( !flipped );
+
+    // the crease is reduced to the same minimal mesh, with the vertices in
+    // a different order
+    BOOST_CHECK_EQUAL( serial[1]->faces.size(), 4u );
+    BOOST_CHECK_EQUAL( parallel[1]->faces.size(), serial[1]->faces.size() );
+    BOOST_REQUIRE_EQUAL( parallel[1]->vertices.size(), serial[1]->vertices.size() );
+    for( size_t i=0; i<serial[1]->vertices.size(); i++ )
+    {
+	bool found = false;
+	for( size_t j=0; j<parallel[1]->vertices.size(); j++ )
+	    found |= (parallel[1]->vertices[j] - serial[1]->vertices[i]).norm() < 1e-6;
+	BOOST_CHECK( found );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( test_euclidean_clustering )
+{
+    // two blobs, a line which crosses the slabs, and a small blob
+    std::vector<Eigen::Vector3d> points;
+    srand( 42 );
+    for( int i=0; i<3000; i++ )
+	points.push_back( Eigen::Vector3d::Random() * 0.3 );
+    for( int i=0; i<2000; i++ )
+	points.push_back( Eigen::Vector3d( 5.0, 0, 0 ) + Eigen::Vector3d::Random() * 0.3 );
+    for( int i=0; i<1500; i++ )
+	points.push_back( Eigen::Vector3d( -10.0 + i * 0.01, 3.0, 0 ) );
+    for( int i=0; i<5; i++ )
+	points.push_back( Eigen::Vector3d( 10.0, 0, 0 ) + Eigen::Vector3d::Random() * 0.01 );
+
+    EuclideanClustering ec;
+    ec.setRadius( 0.1 );
+    ec.setMinSize( 10 );
+    std::vector<int> ids;
+    // the result doesn't depend on the number of slabs
+    for( size_t threads=1; threads<=8; threads*=2 )
+    {
+	ec.setThreads( threads );
+	BOOST_REQUIRE_EQUAL( ec.computeClusters( points, ids ), 3u );
+	BOOST_REQUIRE_EQUAL( ids.size(), points.size() );
+	BOOST_CHECK_EQUAL( std::count( ids.begin(), ids.end(), 0 ), 3000 );
+	BOOST_CHECK_EQUAL( std::count( ids.begin(), ids.end(), 1 ), 2000 );
+	BOOST_CHECK_EQUAL( std::count( ids.begin(), ids.end(), 2 ), 1500 );
+	BOOST_CHECK_EQUAL( std::count( ids.begin(), ids.end(), -1 ), 5 );
+	BOOST_CHECK_EQUAL( ids[0], 0 );
+	BOOST_CHECK_EQUAL( ids[3000], 1 );
+	BOOST_CHECK_EQUAL( ids[5000], 2 );
+    }
+
+    // split the clusters into outputs, without the largest one
+    Environment env;
+    Pointcloud *pc = new Pointcloud();
+    env.attachItem( pc );
+    pc->vertices = points;
+    std::vector<double>& variance( pc->getVertexData<double>( Pointcloud::VERTEX_VARIANCE ) );
+    for( size_t i=0; i<points.size(); i++ )
+	variance.push_back( i < 3000 ? 0.1 : 0.2 );
+
+    EuclideanClustering *op = new EuclideanClustering();
+    env.attachItem( op );
+    op->setMinSize( 10 );
+    op->setMaxSize( 2500 );
+    op->setSplit( true );
+    op->addInput( pc );
+    Pointcloud *out[3];
+    for( int i=0; i<3; i++ )
+    {
+	out[i] = new Pointcloud();
+	env.attachItem( out[i] );
+	op->addOutput( out[i] );
+    }
+    out[2]->vertices.resize( 7 );
+    op->updateAll();
+    BOOST_CHECK_EQUAL( op->getClusterCount(), 2u );
+    BOOST_CHECK_EQUAL( out[0]->vertices.size(), 2000u );
+    BOOST_CHECK_EQUAL( out[0]->getVertexData<double>( Pointcloud::VERTEX_VARIANCE ).size(), 2000u );
+    BOOST_CHECK_EQUAL( out[0]->getVertexData<double>( Pointcloud::VERTEX_VARIANCE )[0], 0.2 );
+    BOOST_CHECK_EQUAL( out[1]->vertices.size(), 1500u );
+    BOOST_CHECK_EQUAL( out[2]->vertices.size(), 0u );
+
+    // label the input in place
+    EuclideanClustering *label = new EuclideanClustering();
+    env.attachItem( label );
+    label->setMinSize( 10 );
+    label->addInput( pc );
+    label->addOutput( pc );
+    label->updateAll();
+    BOOST_CHECK_EQUAL( pc->vertices.size(), points.size() );
+    const std::vector<int>& clusterIds( pc->getVertexData<int>( EuclideanClustering::CLUSTER_ID ) );
+    BOOST_REQUIRE_EQUAL( clusterIds.size(), points.size() );
+    BOOST_CHECK_EQUAL( clusterIds[0], 0 );
+    BOOST_CHECK_EQUAL( clusterIds[6500], -1 );
+}
@@ -101,4 +101,65 @@ BOOST_AUTO_TEST_CASE( test_nonIntersectingSame )
     std::cout << "dist is " << dist << " Time " << end-start <<  std::endl;
 //     BOOST_CHECK_CLOSE( dist, sqrt(2), 2 );
     
-}
\ No newline at end of file
+}
+BOOST_AUTO_TEST_CASE( test_batchQuery ) 
+{
+    PolygonSet set;
+    std::vector<Polygon*> obstacles;
+
+    // a row of obstacles along the x axis
+    for(int i = 0; i < 100; i++)
+    {
+	Polygon *poly = new Polygon(getBoxPoly(2.0));
+	base::Pose pose;
+	pose.position.x() = i * 3.0;
+	poly->move(pose);
+	set.add(*poly);
+	obstacles.push_back(poly);
+    }
+
+    // footprints along the same line, every second one collides
+    std::vector<Polygon*> footprints;
+    std::vector<const Polygon*> queries;
+    for(int i = 0; i < 200; i++)
+    {
+	Polygon *poly = new Polygon(getBoxPoly(0.5));
+	poly->setDistanceCalculationArea(getBoxPoly(4.0));
+	base::Pose pose;
+	pose.position.x() = i * 1.5;
+	poly->move(pose);
+	footprints.push_back(poly);
+	queries.push_back(poly);
+    }
+
+    std::vector<PolygonSet::QueryResult> results;
+    set.query(queries, results, 4);
+    BOOST_REQUIRE_EQUAL(results.size(), queries.size());
+    for(size_t i = 0; i < queries.size(); i++)
+    {
+	BOOST_CHECK_EQUAL(results[i].intersecting, i % 2 == 0);
+	BOOST_CHECK_EQUAL(results[i].inside, i % 2 == 0);
+	BOOST_CHECK_EQUAL(results[i].intersecting, set.isIntersecting(*footprints[i]));
+	BOOST_CHECK_CLOSE(results[i].minDistance, set.getMinimalDistance(*footprints[i]), 1e-3);
+	if(i % 2)
+	    BOOST_CHECK_CLOSE(results[i].minDistance, 0.25, 1e-3);
+    }
+
+    // remove an obstacle, and move another one on top of a free footprint
+    set.remove(*obstacles[0]);
+    base::Pose pose;
+    pose.position.x() = 1.5;
+    obstacles[1]->move(pose);
+    set.update(*obstacles[1]);
+
+    set.query(queries, results);
+    BOOST_CHECK(!results[0].intersecting);
+    BOOST_CHECK(results[1].intersecting);
+    BOOST_CHECK(!results[2].intersecting);
+    BOOST_CHECK(results[4].intersecting);
+
+    for(size_t i = 0; i < obstacles.size(); i++)
+	delete obstacles[i];
+    for(size_t i = 0; i < footprints.size(); i++)
+	delete footprints[i];
+}
@@ -4,9 +4,15 @@
 
 #include "envire/Core.hpp"
 #include "envire/core/Serialization.hpp"
+#include "envire/core/EventLog.hpp"
+#include "envire/core/SynchronizationScheduler.hpp"
+#include <boost/filesystem/operations.hpp>
+#include <unistd.h>
+#include <fstream>
 
 #include "envire/maps/MLSGrid.hpp"
 #include "envire/maps/Grids.hpp"
+#include "envire/maps/Pointcloud.hpp"
 
 using namespace envire;
 
@@ -275,4 +281,328 @@ BOOST_AUTO_TEST_CASE( ImageRGB24_serialization )
     BOOST_CHECK_EQUAL(dg2->getFromRaster( ImageRGB24::B, 20, 1 ), 30 );
 }
 
+BOOST_AUTO_TEST_CASE( eventlog_record_and_seek )
+{
+    std::string log_path = serialization_test_path + "/eventlog";
+    boost::filesystem::remove_all( log_path );
+
+    boost::scoped_ptr<Environment> env( new Environment() );
+    FrameNode *fn = new FrameNode();
+    env->addChild( env->getRootNode(), fn );
+    const std::string fn_id = fn->getUniqueId();
+
+    std::vector<base::Time> times;
+    {
+	EventLogRecorder recorder( log_path, env.get() );
+	recorder.setKeyframeInterval( 3 );
+	recorder.setMaxSegmentSize( 1024 );
+	env->addEventHandler( &recorder );
+	recorder.flush();
+
+	// move the framenode a couple of times
+	for( int i=0; i<10; i++ )
+	{
+	    usleep( 2000 );
+	    fn->setTransform( Eigen::Affine3d(Eigen::Translation3d( i, 0.0, 0.0 )) );
+	    recorder.flush();
+	    usleep( 2000 );
+	    times.push_back( base::Time::now() );
+	}
+
+	env->removeEventHandler( &recorder );
+    }
+
+    EventLogReplay replay( log_path );
+    BOOST_CHECK( replay.getRecordCount() > 10 );
+    BOOST_CHECK( replay.getStartTime() <= times.front() );
+
+    // small segments, so there should be more than one
+    BOOST_CHECK( replay.getIndexEntry( replay.getRecordCount() - 1 ).segment > 0 );
+
+    // seek to any point in the log
+    for( int i=9; i>=0; i-- )
+    {
+	boost::scoped_ptr<Environment> env2( replay.seek( times[i] ) );
+	FrameNode *fn2 = env2->getItem<FrameNode>( fn_id ).get();
+	BOOST_REQUIRE( fn2 );
+	BOOST_CHECK_CLOSE( fn2->getTransform().translation().x() + 1.0, i + 1.0, 1e-6 );
+	BOOST_CHECK( fn2->getParent() == env2->getRootNode() );
+    }
+
+    // and play forward from there
+    boost::scoped_ptr<Environment> env3( replay.seek( times[2] ) );
+    BOOST_CHECK( replay.advance( env3.get(), times[5] ) > 0 );
+    FrameNode *fn3 = env3->getItem<FrameNode>( fn_id ).get();
+    BOOST_CHECK_CLOSE( fn3->getTransform().translation().x(), 5.0, 1e-6 );
+
+    // appending to an existing log keeps the old records
+    const size_t records = replay.getRecordCount();
+    {
+	EventLogRecorder recorder( log_path, env.get() );
+	env->addEventHandler( &recorder );
+	fn->setTransform( Eigen::Affine3d(Eigen::Translation3d( 20.0, 0.0, 0.0 )) );
+	recorder.flush();
+	env->removeEventHandler( &recorder );
+    }
+    EventLogReplay replay2( log_path );
+    BOOST_CHECK( replay2.getRecordCount() > records );
+    boost::scoped_ptr<Environment> env4( replay2.seek( replay2.getEndTime() ) );
+    BOOST_CHECK_CLOSE( env4->getItem<FrameNode>( fn_id )->getTransform().translation().x(), 20.0, 1e-6 );
+}
+
+/** records events without going through an environment */
+class EventRecorder : public EventLogRecorder
+{
+public:
+    EventRecorder( const std::string& path, Environment* env ) : EventLogRecorder( path, env ) {}
+    void record( std::vector<BinaryEvent>& msgs ) { handle( msgs ); }
+};
+
+BOOST_AUTO_TEST_CASE( eventlog_keyframe_time )
+{
+    std::string log_path = serialization_test_path + "/eventlog_time";
+    boost::filesystem::remove_all( log_path );
+
+    Environment env;
+    FrameNode *fn = new FrameNode();
+    env.addChild( env.getRootNode(), fn );
+
+    // events from an hour ago, e.g. from a replay. The keyframes get the
+    // time of the events, so that the index stays sorted.
+    const base::Time past = base::Time::now() - base::Time::fromSeconds( 3600 );
+    {
+	EventRecorder recorder( log_path, &env );
+	for( int i=0; i<3; i++ )
+	{
+	    std::vector<BinaryEvent> events( 1, BinaryEvent( event::ITEM, event::UPDATE, fn->getUniqueId(), "" ) );
+	    events.back().time = past + base::Time::fromSeconds( i );
+	    recorder.record( events );
+	    recorder.writeKeyframe();
+	}
+    }
+
+    EventLogReplay replay( log_path );
+    BOOST_REQUIRE_EQUAL( replay.getRecordCount(), 6 );
+    for( size_t i=1; i<replay.getRecordCount(); i++ )
+	BOOST_CHECK( !(replay.getIndexEntry( i ).time < replay.getIndexEntry( i - 1 ).time) );
+    BOOST_CHECK( replay.getEndTime() == past + base::Time::fromSeconds( 2 ) );
+}
+
+BOOST_AUTO_TEST_CASE( synchronization_scheduler )
+{
+    Environment env;
+    FrameNode *fn = new FrameNode( Eigen::Affine3d(Eigen::Translation3d( 1.0, 0.0, 0.0 )) );
+    env.addChild( env.getRootNode(), fn );
+    Pointcloud *pc = new Pointcloud();
+    env.attachItem( pc, fn );
+    for( int i=0; i<5000; i++ )
+	pc->vertices.push_back( Eigen::Vector3d( i, 0.0, 0.0 ) );
+    const std::string fn_id = fn->getUniqueId();
+    const std::string pc_id = pc->getUniqueId();
+
+    const size_t budget = 20000;
+    SynchronizationScheduler scheduler;
+    scheduler.setByteBudget( budget );
+    scheduler.setChunkSize( 16000 );
+    env.addEventHandler( &scheduler );
+
+    // an item which is added and removed again before it was sent
+    FrameNode *tmp = new FrameNode();
+    env.addChild( env.getRootNode(), tmp );
+    const std::string tmp_id = tmp->getUniqueId();
+    env.detachItem( tmp, true );
+
+    Environment env2;
+    SynchronizationChunkAssembler assembler;
+    std::vector<BinaryEvent> events;
+    int rounds = 0;
+    for( ; rounds < 100 && (rounds == 0 || scheduler.getPendingCount() || assembler.getPendingCount()); rounds++ )
+    {
+	if( rounds == 2 )
+	    fn->setTransform( Eigen::Affine3d(Eigen::Translation3d( 2.0, 0.0, 0.0 )) );
+
+	scheduler.popEvents( events );
+	BOOST_REQUIRE( !events.empty() );
+
+	size_t used = 0;
+	for( size_t i=0; i<events.size(); i++ )
+	    used += SynchronizationScheduler::getEventSize( events[i] );
+	BOOST_CHECK( used <= budget || events.size() == 1 );
+
+	// the transform overtakes the chunks of the pointcloud
+	if( rounds == 2 )
+	    BOOST_CHECK_EQUAL( events.front().className, FrameNode::className );
+
+	assembler.process( events );
+	BinarySerialization::applyEvents( &env2, events );
+    }
+    // the pointcloud needs a couple of rounds
+    BOOST_CHECK( rounds > 3 );
+    BOOST_CHECK( rounds < 100 );
+
+    FrameNode *fn2 = env2.getItem<FrameNode>( fn_id ).get();
+    BOOST_REQUIRE( fn2 );
+    BOOST_CHECK_CLOSE( fn2->getTransform().translation().x(), 2.0, 1e-6 );
+    Pointcloud *pc2 = env2.getItem<Pointcloud>( pc_id ).get();
+    BOOST_REQUIRE( pc2 );
+    BOOST_CHECK_EQUAL( pc2->vertices.size(), 5000 );
+    BOOST_CHECK_CLOSE( pc2->vertices.back().x(), 4999.0, 1e-6 );
+    BOOST_CHECK( pc2->getFrameNode() == fn2 );
+    BOOST_CHECK( !env2.getItem<FrameNode>( tmp_id ) );
+
+    env.removeEventHandler( &scheduler );
+}
+
+BOOST_AUTO_TEST_CASE( synchronization_scheduler_remove )
+{
+    Environment env;
+    SynchronizationScheduler scheduler;
+    scheduler.setByteBudget( 20000 );
+    scheduler.setChunkSize( 16000 );
+    env.addEventHandler( &scheduler );
+
+    Environment env2;
+    SynchronizationChunkAssembler assembler;
+    std::vector<BinaryEvent> events;
+
+    // an item which is removed while its chunks are sent, first when it
+    // is added and then when it is updated
+    for( int update=0; update<2; update++ )
+    {
+	Pointcloud *pc = new Pointcloud();
+	env.attachItem( pc );
+	for( int i=0; i<5000; i++ )
+	    pc->vertices.push_back( Eigen::Vector3d( i, 0.0, 0.0 ) );
+	const std::string pc_id = pc->getUniqueId();
+
+	if( update )
+	{
+	    for( int rounds=0; rounds < 100 && scheduler.getPendingCount(); rounds++ )
+	    {
+		scheduler.popEvents( events );
+		assembler.process( events );
+		BinarySerialization::applyEvents( &env2, events );
+	    }
+	    BOOST_REQUIRE( env2.getItem<Pointcloud>( pc_id ) );
+	    env.itemModified( pc );
+	}
+
+	scheduler.popEvents( events );
+	assembler.process( events );
+	BinarySerialization::applyEvents( &env2, events );
+	BOOST_CHECK_EQUAL( assembler.getPendingCount(), 1u );
+
+	env.detachItem( pc, true );
+	for( int rounds=0; rounds < 100 && scheduler.getPendingCount(); rounds++ )
+	{
+	    scheduler.popEvents( events );
+	    assembler.process( events );
+	    BinarySerialization::applyEvents( &env2, events );
+	}
+	BOOST_CHECK_EQUAL( scheduler.getPendingCount(), 0u );
+	BOOST_CHECK_EQUAL( assembler.getPendingCount(), 0u );
+	BOOST_CHECK( !env2.getItem<Pointcloud>( pc_id ) );
+    }
+
+    env.removeEventHandler( &scheduler );
+}
+
+BOOST_AUTO_TEST_CASE( environment_checkpoint )
+{
+    namespace fs = boost::filesystem;
+    std::string path = serialization_test_path + "/checkpoint";
+    fs::remove_all( path );
+
+    boost::scoped_ptr<Environment> env( new Environment() );
+    Pointcloud *pc1 = new Pointcloud();
+    env->attachItem( pc1 );
+    pc1->vertices.push_back( Eigen::Vector3d( 1, 0, 0 ) );
+    Pointcloud *pc2 = new Pointcloud();
+    env->attachItem( pc2 );
+    pc2->vertices.push_back( Eigen::Vector3d( 2, 0, 0 ) );
+
+    env->checkpoint( path );
+    const fs::path file1( fs::path( path ) / (pc1->getMapFileName() + ".ply") );
+    const fs::path file2( fs::path( path ) / (pc2->getMapFileName() + ".ply") );
+    BOOST_CHECK( fs::exists( file1 ) );
+    BOOST_CHECK( fs::exists( file2 ) );
+    BOOST_CHECK( !fs::exists( fs::path( path ) / FileSerialization::CHECKPOINT_DIR ) );
+    BOOST_CHECK( !fs::exists( fs::path( path ) / FileSerialization::CHECKPOINT_MANIFEST ) );
+
+    // only the binary data of the modified pointcloud is written
+    const unsigned long generation = pc2->getGeneration();
+    pc2->vertices.push_back( Eigen::Vector3d( 3, 0, 0 ) );
+    pc2->itemModified();
+    BOOST_CHECK( pc2->getGeneration() > generation );
+    fs::remove( file1 );
+    env->checkpoint( path );
+    BOOST_CHECK( !fs::exists( file1 ) );
+    BOOST_CHECK( fs::exists( file2 ) );
+
+    // a new directory gets a full checkpoint
+    env->checkpoint( path + "_full" );
+    BOOST_CHECK( fs::exists( fs::path( path + "_full" ) / (pc1->getMapFileName() + ".ply") ) );
+    fs::remove_all( path + "_full" );
+
+    pc1->itemModified();
+    env->checkpoint( path );
+    BOOST_CHECK( fs::exists( file1 ) );
+
+    // an unchanged grid is not restored by a checkpoint
+    Grid<double> *grid = new Grid<double>( 10, 10, 0.1, 0.1 );
+    env->attachItem( grid );
+    grid->getGridData()[2][3] = 4.0;
+    env->checkpoint( path );
+    env->setMemoryBudget( 1000000, path + "_evicted" );
+    BOOST_CHECK( env->evictLayer( grid ) );
+    env->checkpoint( path );
+    BOOST_CHECK( grid->isEvicted() );
+    BOOST_CHECK_EQUAL( grid->getGridData()[2][3], 4.0 );
+    env->setMemoryBudget( 0, path + "_evicted" );
+    fs::remove_all( path + "_evicted" );
+
+    // an uncommitted checkpoint is discarded
+    const fs::path staging( fs::path( path ) / FileSerialization::CHECKPOINT_DIR );
+    fs::create_directories( staging );
+    fs::copy_file( file2, staging / file1.filename() );
+    {
+	boost::scoped_ptr<Environment> env2( Environment::unserialize( path ) );
+	BOOST_CHECK( !fs::exists( staging ) );
+	BOOST_CHECK_EQUAL( env2->getItem<Pointcloud>( pc1->getUniqueId() )->vertices.size(), 1 );
+    }
+
+    // a committed one is completed
+    fs::create_directories( staging );
+    fs::rename( file2, staging / file2.filename() );
+    {
+	std::ofstream manifest( (fs::path( path ) / FileSerialization::CHECKPOINT_MANIFEST).string().c_str() );
+	manifest << file2.filename().string() << std::endl;
+    }
+
+    boost::scoped_ptr<Environment> env2( Environment::unserialize( path ) );
+    BOOST_CHECK( fs::exists( file2 ) );
+    BOOST_CHECK( !fs::exists( fs::path( path ) / FileSerialization::CHECKPOINT_MANIFEST ) );
+    Pointcloud *pc = env2->getItem<Pointcloud>( pc2->getUniqueId() ).get();
+    BOOST_REQUIRE( pc );
+    BOOST_CHECK_EQUAL( pc->vertices.size(), 2 );
+    BOOST_REQUIRE( env2->getItem<Pointcloud>( pc1->getUniqueId() ) );
+    BOOST_CHECK_EQUAL( env2->getItem<Pointcloud>( pc1->getUniqueId() )->vertices.size(), 1 );
+    BOOST_REQUIRE( env2->getItem<Grid<double> >( grid->getUniqueId() ) );
+    BOOST_CHECK_EQUAL( env2->getItem<Grid<double> >( grid->getUniqueId() )->getGridData()[2][3], 4.0 );
+
+    // changes through the data accessors are written without itemModified()
+    env2->getItem<Grid<double> >( grid->getUniqueId() )->getGridData()[2][3] = 5.0;
+    env2->checkpoint( path );
+    {
+	boost::scoped_ptr<Environment> env3( Environment::unserialize( path ) );
+	BOOST_CHECK_EQUAL( env3->getItem<Grid<double> >( grid->getUniqueId() )->getGridData()[2][3], 5.0 );
+    }
+
+    // the files of removed items are deleted with the checkpoint
+    env2->detachItem( pc );
+    env2->checkpoint( path );
+    BOOST_CHECK( !fs::exists( file2 ) );
+    BOOST_CHECK( fs::exists( file1 ) );
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -1,4 +1,5 @@
 #include <envire/Core.hpp>
+#include <envire/core/LieUncertainty.hpp>
 
 #define BOOST_TEST_MODULE UncertaintyTest 
 #include <boost/test/included/unit_test.hpp>
@@ -74,3 +75,142 @@ BOOST_AUTO_TEST_CASE( test_relative_uncertainty )
 //    std::cout << t1r.getCovariance() << std::endl;
     
 }
+
+typedef Eigen::Matrix<double,6,1> Vector6d;
+typedef Eigen::Matrix<double,6,6> Matrix6d;
+
+static Vector6d toParams( const Transform& t )
+{
+    Eigen::AngleAxisd aa( t.linear() );
+    Vector6d p;
+    p << aa.axis() * aa.angle(), t.translation();
+    return p;
+}
+
+static Transform fromParams( const Vector6d& p )
+{
+    Transform t( Transform::Identity() );
+    if( p.head<3>().norm() > 0 )
+	t.linear() = Eigen::AngleAxisd( p.head<3>().norm(), p.head<3>().normalized() ).toRotationMatrix();
+    t.translation() = p.tail<3>();
+    return t;
+}
+
+static Matrix6d makeCovariance( double scale, int seed )
+{
+    Matrix6d A;
+    for( int i=0; i<36; i++ )
+	A(i) = sin( 1.3 * (i + 1) * (seed + 1) );
+    return scale * (A * A.transpose() + Matrix6d::Identity() * 0.1);
+}
+
+static TransformWithUncertainty makeTransform( const Eigen::Vector3d& r, const Eigen::Vector3d& t, int seed )
+{
+    Vector6d p;
+    p << r, t;
+    return TransformWithUncertainty( fromParams( p ), makeCovariance( 0.01, seed ) );
+}
+
+/** first order covariance of t2 * t1 in [r t] parameters, using numerical
+ * differentiation */
+static Matrix6d numericComposition( const TransformWithUncertainty& t2, const TransformWithUncertainty& t1 )
+{
+    const double h = 1e-6;
+    const Vector6d p1( toParams( t1.getTransform() ) ), p2( toParams( t2.getTransform() ) );
+    Matrix6d J1, J2;
+    for( int i=0; i<6; i++ )
+    {
+	Vector6d d( Vector6d::Zero() );
+	d[i] = h;
+	J1.col(i) = (toParams( fromParams( p2 ) * fromParams( p1 + d ) ) - toParams( fromParams( p2 ) * fromParams( p1 - d ) )) / (2 * h);
+	J2.col(i) = (toParams( fromParams( p2 + d ) * fromParams( p1 ) ) - toParams( fromParams( p2 - d ) * fromParams( p1 ) )) / (2 * h);
+    }
+    return J1 * t1.getCovariance() * J1.transpose() + J2 * t2.getCovariance() * J2.transpose();
+}
+
+static Eigen::Matrix3d numericPoint( const TransformWithUncertainty& t, const Eigen::Vector3d& x )
+{
+    const double h = 1e-6;
+    const Vector6d p( toParams( t.getTransform() ) );
+    Eigen::Matrix<double,3,6> J;
+    for( int i=0; i<6; i++ )
+    {
+	Vector6d d( Vector6d::Zero() );
+	d[i] = h;
+	J.col(i) = (fromParams( p + d ) * x - fromParams( p - d ) * x) / (2 * h);
+    }
+    return J * t.getCovariance() * J.transpose();
+}
+
+BOOST_AUTO_TEST_CASE( test_lie_uncertainty ) 
+{
+    // a default constructed transform has no uncertainty
+    TransformWithLieUncertainty empty;
+    BOOST_CHECK( !empty.hasUncertainty() );
+    BOOST_CHECK( empty.getCovariance().isZero() );
+
+    // for small rotations, the result is the same as with the series
+    // approximations of TransformWithUncertainty
+    TransformWithUncertainty s1( makeTransform( Eigen::Vector3d( 0.02, -0.03, 0.01 ), Eigen::Vector3d( 1, 2, 0.5 ), 1 ) );
+    TransformWithUncertainty s2( makeTransform( Eigen::Vector3d( -0.01, 0.02, 0.04 ), Eigen::Vector3d( -0.5, 0, 3 ), 2 ) );
+
+    TransformWithUncertainty ref( s2 * s1 );
+    TransformWithUncertainty res( (TransformWithLieUncertainty( s2 ) * TransformWithLieUncertainty( s1 )).toTransformWithUncertainty() );
+    BOOST_CHECK( res.getTransform().isApprox( ref.getTransform(), 1e-12 ) );
+    BOOST_CHECK( res.getCovariance().isApprox( ref.getCovariance(), 1e-3 ) );
+
+    const Eigen::Vector3d x( 2.0, -1.0, 0.5 );
+    PointWithUncertainty pref( s2 * PointWithUncertainty( x ) );
+    PointWithUncertainty pres( TransformWithLieUncertainty( s2 ) * PointWithUncertainty( x ) );
+    BOOST_CHECK( pres.getPoint().isApprox( pref.getPoint(), 1e-12 ) );
+    // drx_by_dr has an error which grows quadratically with the angle
+    BOOST_CHECK( pres.getCovariance().isApprox( pref.getCovariance(), 1e-2 ) );
+
+    // for large rotations, compare against numerical differentiation
+    TransformWithUncertainty t1( makeTransform( Eigen::Vector3d( 1.2, 0.3, -0.4 ), Eigen::Vector3d( 1, 0, 0 ), 3 ) );
+    TransformWithUncertainty t2( makeTransform( Eigen::Vector3d( -0.2, 0.9, 0.5 ), Eigen::Vector3d( 0, 1, 2 ), 4 ) );
+
+    res = (TransformWithLieUncertainty( t2 ) * TransformWithLieUncertainty( t1 )).toTransformWithUncertainty();
+    BOOST_CHECK( res.getCovariance().isApprox( numericComposition( t2, t1 ), 1e-6 ) );
+
+    pres = TransformWithLieUncertainty( t2 ) * PointWithUncertainty( x );
+    BOOST_CHECK( pres.getCovariance().isApprox( numericPoint( t2, x ), 1e-6 ) );
+
+    // the conversion between both representations is lossless
+    BOOST_CHECK( TransformWithLieUncertainty( t1 ).toTransformWithUncertainty().getCovariance().isApprox( t1.getCovariance(), 1e-12 ) );
+
+    // the inverse composed with the transform gives back the uncertainty
+    // of the transform, seen from the other side
+    TransformWithLieUncertainty l1( t1 );
+    TransformWithLieUncertainty inv( l1.inverse() );
+    BOOST_CHECK( (l1 * TransformWithLieUncertainty( inv.getTransform() )).getTransform().isApprox( Transform::Identity(), 1e-12 ) );
+    BOOST_CHECK( inv.inverse().getCovariance().isApprox( l1.getCovariance(), 1e-12 ) );
+
+    // the batched versions give the same results as the single ones
+    TransformWithLieUncertainty::TransformVector transforms, result;
+    std::vector<PointWithUncertainty> points, presult;
+    for( int i=0; i<1000; i++ )
+    {
+	const Eigen::Vector3d r( 0.001 * i, -0.5, 0.002 * i );
+	const Eigen::Vector3d t( i, 1, -0.5 * i );
+	if( i % 3 )
+	    transforms.push_back( makeTransform( r, t, i ) );
+	else
+	    transforms.push_back( TransformWithUncertainty( fromParams( (Vector6d() << r, t).finished() ) ) );
+	points.push_back( PointWithUncertainty( t, makeCovariance( 0.01, i ).topLeftCorner<3,3>() ) );
+    }
+    TransformWithLieUncertainty::compose( t2, transforms, result, 4 );
+    TransformWithLieUncertainty::transform( t2, points, presult, 4 );
+    BOOST_REQUIRE_EQUAL( result.size(), transforms.size() );
+    BOOST_REQUIRE_EQUAL( presult.size(), points.size() );
+    for( size_t i=0; i<transforms.size(); i++ )
+    {
+	TransformWithUncertainty single( (TransformWithLieUncertainty( t2 ) * TransformWithLieUncertainty( transforms[i] )).toTransformWithUncertainty() );
+	BOOST_CHECK( result[i].getTransform().isApprox( single.getTransform(), 1e-12 ) );
+	BOOST_CHECK( result[i].getCovariance().isApprox( single.getCovariance(), 1e-9 ) );
+
+	PointWithUncertainty p( TransformWithLieUncertainty( t2 ) * points[i] );
+	BOOST_CHECK( presult[i].getPoint().isApprox( p.getPoint(), 1e-12 ) );
+	BOOST_CHECK( presult[i].getCovariance().isApprox( p.getCovariance(), 1e-12 ) );
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef __ENVIRE_TOOLS_TOOLCONTEXT__
+#define __ENVIRE_TOOLS_TOOLCONTEXT__
+
+#include <envire/core/ExecutionContext.hpp>
+
+#include <boost/lexical_cast.hpp>
+
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+
+/**
+ * Execution context for the env_* tools, which run long operators. Since
+ * the tools take positional arguments, it is configured through environment
+ * variables:
+ *
+ * ENVIRE_TIME_BUDGET  seconds after which the operators are abandoned
+ * ENVIRE_PROGRESS     if set, the progress is printed to stderr
+ *
+ * SIGINT (Ctrl-C) cancels the running operator. The tools don't write the
+ * environment back when the update was abandoned.
+ */
+namespace
+{
+    envire::ExecutionContext toolContext;
+
+    void cancelToolContext( int )
+    {
+	toolContext.cancel();
+    }
+
+    void printToolProgress( const std::string& item, double progress )
+    {
+	std::cerr << "\r" << item << ": " << static_cast<int>( progress * 100 ) << "%   " << std::flush;
+    }
+
+    /** sets up and returns the context. The time budget starts with this
+     * call. */
+    envire::ExecutionContext& getToolContext()
+    {
+	if( const char* budget = getenv( "ENVIRE_TIME_BUDGET" ) )
+	    toolContext.setTimeBudget( boost::lexical_cast<double>( budget ) );
+	if( getenv( "ENVIRE_PROGRESS" ) )
+	    toolContext.setProgressCallback( &printToolProgress );
+	signal( SIGINT, &cancelToolContext );
+	return toolContext;
+    }
+
+    /** prints a message if the update was abandoned. Use the result of
+     * Environment::updateOperators() or Operator::wasAbandoned(), the
+     * context itself also reports an expired time budget after the update
+     * completed.
+     *
+     * @return abandoned */
+    bool isToolAbandoned( bool abandoned )
+    {
+	if( abandoned )
+	    std::cerr << std::endl << "update abandoned, the environment is not written" << std::endl;
+	return abandoned;
+    }
+}
+
+#endif
@@ -3,6 +3,7 @@
 #include <envire/operators/GridIllumination.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/lexical_cast.hpp>
+#include "ToolContext.hpp"
 
 #include <iostream>
 
@@ -42,7 +43,10 @@ int main(int argc, char* argv[])
     op->setOutputBand( grid_band_name );
     op->setLightSource( lightPos, diameter );
     op->addOutput( input.get() );
-    op->updateAll();
+    envire::ExecutionContext& context( getToolContext() );
+    op->execute( context );
+    if( isToolAbandoned( op->wasAbandoned() ) )
+        return 1;
     env->serialize(env_path);
     std::cout << op->getUniqueId() << std::endl;
     return 0;
@@ -4,6 +4,7 @@
 #include "envire/operators/SimpleTraversability.hpp"
 
 #include "boost/scoped_ptr.hpp"
+#include "ToolContext.hpp"
 
 using namespace envire;
 using namespace std;
@@ -30,7 +31,9 @@ int main( int argc, char* argv[] )
     // asked
     boost::intrusive_ptr< Grid<float> > input = env->getItem< Grid<float> >();
 
-    env->updateOperators();
+    envire::ExecutionContext& context( getToolContext() );
+    if( isToolAbandoned( !env->updateOperators( context ) ) )
+        return 1;
 
     boost::intrusive_ptr< SimpleTraversability::OutputLayer > output = new SimpleTraversability::OutputLayer(
             input->getWidth(), input->getHeight(),
@@ -60,7 +63,9 @@ int main( int argc, char* argv[] )
     if (input->hasBand("corrected_max_step"))
         op->setMaxStep(input.get(), "corrected_max_step");
     op->setOutput(output.get(), "traversability_class");
-    op->updateAll();
+    op->execute( context );
+    if( isToolAbandoned( op->wasAbandoned() ) )
+        return 1;
 
     env->serialize(argv[1]);
 } 
@@ -1,5 +1,6 @@
 #include "envire/Core.hpp"
 #include "boost/scoped_ptr.hpp"
+#include "ToolContext.hpp"
 
 #include <iostream>
 
@@ -13,12 +14,16 @@ int main( int argc, char* argv[] )
         std::cout << "usage: env_update <path_to_env>\n"
             << "  loads the specified environment and update all the generated maps\n"
             << "  (i.e. runs all operators)\n"
+            << "  set ENVIRE_TIME_BUDGET to a number of seconds to limit the update time,\n"
+            << "  and ENVIRE_PROGRESS to print the progress\n"
             << std::endl;
         exit(1);
     }
 
     boost::scoped_ptr<envire::Environment> env(Environment::unserialize(argv[1]));
-    env->updateOperators();
+    envire::ExecutionContext& context( getToolContext() );
+    if( isToolAbandoned( !env->updateOperators( context ) ) )
+        return 1;
     env->serialize(argv[1]);
 }
 
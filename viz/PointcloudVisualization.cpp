@@ -9,16 +9,88 @@
 #include <osg/Drawable>
 #include <osg/ShapeDrawable>
 #include <osg/LineWidth>
+#include <osgUtil/CullVisitor>
+#include <envire/tools/PointcloudOctree.hpp>
 
 using namespace envire;
 
+namespace
+{
+    /** Per group state for the chunked rendering of the vertices. Each node
+     * of the octree has its own geode, which is only regenerated when the
+     * node changed.
+     */
+    class PointcloudChunks : public osg::Referenced
+    {
+    public:
+	PointcloudChunks() : maxScreenError( 1.0 ) {}
+
+	PointcloudOctree octree;
+	std::vector< osg::ref_ptr<osg::Geode> > geodes;
+	osg::Vec4 color;
+	double maxScreenError;
+    };
+
+    /** Cull callback, which only traverses the chunks the octree selects
+     * for the current view.
+     */
+    class PointcloudChunksCullCallback : public osg::NodeCallback
+    {
+    public:
+	void operator()( osg::Node* node, osg::NodeVisitor* nv )
+	{
+	    osgUtil::CullVisitor* cv = dynamic_cast<osgUtil::CullVisitor*>( nv );
+	    PointcloudChunks* chunks = dynamic_cast<PointcloudChunks*>( node->getUserData() );
+	    if( !cv || !chunks )
+	    {
+		traverse( node, nv );
+		return;
+	    }
+
+	    // pixels per radian of the current view
+	    double projectionFactor = 1000.0;
+	    double fovy, aspect, zNear, zFar;
+	    const osg::Viewport* viewport = cv->getViewport();
+	    if( viewport && cv->getProjectionMatrix()->getPerspective( fovy, aspect, zNear, zFar ) )
+		projectionFactor = viewport->height() / (2.0 * tan( osg::DegreesToRadians( fovy ) / 2.0 ));
+
+	    const osg::Vec3 eye = cv->getEyeLocal();
+	    std::vector<PointcloudOctree::Selection> selection;
+	    chunks->octree.select( Eigen::Vector3d( eye.x(), eye.y(), eye.z() ),
+		    projectionFactor, chunks->maxScreenError, selection );
+
+	    for( size_t i=0; i<selection.size(); i++ )
+	    {
+		const size_t n = selection[i].node;
+		if( n < chunks->geodes.size() && chunks->geodes[n].valid() )
+		    chunks->geodes[n]->accept( *nv );
+	    }
+	}
+    };
+
+    void setChunksColor( osg::Group* group, const osg::Vec4& c )
+    {
+	osg::Group* chunkGroup = group->getChild(1)->asGroup();
+	for( size_t i=0; i<chunkGroup->getNumChildren(); i++ )
+	{
+	    osg::ref_ptr<osg::Vec4Array> color = new osg::Vec4Array;
+	    color->push_back(c);
+	    osg::Geometry *geom = chunkGroup->getChild(i)->asGeode()->getDrawable(0)->asGeometry();
+	    geom->setColorArray(color.get());
+	    geom->setColorBinding( osg::Geometry::BIND_OVERALL );
+	}
+    }
+}
+
 PointcloudVisualization::PointcloudVisualization()
     : vertexColor(osg::Vec4(0.1,0.9,0.1,.5)), 
       normalColor(osg::Vec4(0.9,0.1,0.1,.5)), 
       normalScaling(0.2),
       showNormals(false),
       showFeatures(false),
-      colorCycling(false)
+      colorCycling(false),
+      lodScreenError(1.0),
+      detectInPlaceChanges(false)
 {
 }
 
@@ -29,9 +101,16 @@ osg::Group* PointcloudVisualization::getNodeForItem(envire::EnvironmentItem* ite
     
     group->addChild(geode.get());
 
+    // the vertices are kept in chunks, which are managed by an octree
+    osg::ref_ptr<osg::Group> chunkGroup = new osg::Group();
+    chunkGroup->setUserData( new PointcloudChunks() );
+    chunkGroup->setCullCallback( new PointcloudChunksCullCallback() );
+    group->addChild(chunkGroup.get());
+
     // switch off lighting for this node
     osg::StateSet* stategeode = geode->getOrCreateStateSet();
     stategeode->setMode( GL_LIGHTING, osg::StateAttribute::OFF );
+    chunkGroup->getOrCreateStateSet()->setMode( GL_LIGHTING, osg::StateAttribute::OFF );
     
     updateNode(item, group);
     
@@ -45,20 +124,12 @@ bool PointcloudVisualization::handlesItem(envire::EnvironmentItem* item) const
 
 void PointcloudVisualization::highlightNode(envire::EnvironmentItem* item, osg::Group* group) const
 {
-    osg::ref_ptr<osg::Vec4Array> color = new osg::Vec4Array;
-    color->push_back(osg::Vec4(1,0,0,1));
-    osg::Geometry *geom = group->getChild(0)->asGeode()->getDrawable(0)->asGeometry();
-    geom->setColorArray(color.get());
-    geom->setColorBinding( osg::Geometry::BIND_OVERALL );
+    setChunksColor( group, osg::Vec4(1,0,0,1) );
 }
 
 void PointcloudVisualization::unHighlightNode(envire::EnvironmentItem* item, osg::Group* group) const
 {
-    osg::ref_ptr<osg::Vec4Array> color = new osg::Vec4Array;
-    color->push_back(vertexColor);
-    osg::Geometry *geom = group->getChild(0)->asGeode()->getDrawable(0)->asGeometry();
-    geom->setColorArray(color.get());
-    geom->setColorBinding( osg::Geometry::BIND_OVERALL );
+    setChunksColor( group, vertexColor );
 }
 
 void PointcloudVisualization::updateNode(envire::EnvironmentItem* item, osg::Group* group) const
@@ -70,9 +141,6 @@ void PointcloudVisualization::updateNode(envire::EnvironmentItem* item, osg::Gro
     envire::Pointcloud *pointcloud = dynamic_cast<envire::Pointcloud *>(item);
     assert(pointcloud);
 
-    osg::ref_ptr<osg::Geometry> geom = new osg::Geometry;
-    osg::ref_ptr<osg::Vec4Array> color = new osg::Vec4Array;
-
     // get a color value
     osg::Vec4 pointColor = vertexColor;
     if( colorCycling )
@@ -83,43 +151,94 @@ void PointcloudVisualization::updateNode(envire::EnvironmentItem* item, osg::Gro
 	pointColor = osg::Vec4( ((col*88734)%256)/255.0, ((col*398482)%256)/255.0, ((col*36784787)%256)/255.0, 1.0 ); 
     }
 
-    // create color
+    std::vector<Eigen::Vector3d> *pc_color = 0;
     if( pointcloud->hasData(envire::Pointcloud::VERTEX_COLOR) )
     {
-	std::vector<Eigen::Vector3d> &pc_color(pointcloud->getVertexData<Eigen::Vector3d>(envire::Pointcloud::VERTEX_COLOR));
-	for(std::vector<Eigen::Vector3d>::const_iterator it = pc_color.begin(); it != pc_color.end(); it++) {
-	    color->push_back(osg::Vec4(it->x(),it->y(), it->z(), 1.0));
-	}
-
-	geom->setColorArray(color.get());
-	geom->setColorBinding( osg::Geometry::BIND_PER_VERTEX );
+	pc_color = &pointcloud->getVertexData<Eigen::Vector3d>(envire::Pointcloud::VERTEX_COLOR);
+	if( pc_color->size() != pointcloud->vertices.size() )
+	    pc_color = 0;
     }
-    else
-    {
-	color->push_back( pointColor );
 
-	geom->setColorArray(color.get());
-	geom->setColorBinding( osg::Geometry::BIND_OVERALL );
-    }
-    
-    // create vertices
-    osg::ref_ptr<osg::Vec3Array> vertices = new osg::Vec3Array;
-    
-    for(std::vector<Eigen::Vector3d>::const_iterator it = pointcloud->vertices.begin(); it != pointcloud->vertices.end(); it++) {
-	vertices->push_back(osg::Vec3(it->x(),it->y(), it->z()));
+    // only the chunks of octree nodes which received new vertices, or
+    // whose vertices or colors were changed in place, are regenerated.
+    // Finding the changes in place needs a full pass, so it is optional.
+    osg::Group* chunkGroup = group->getChild(1)->asGroup();
+    PointcloudChunks* chunks = static_cast<PointcloudChunks*>( chunkGroup->getUserData() );
+    chunks->maxScreenError = lodScreenError;
+    const bool shrunk = pointcloud->vertices.size() < chunks->octree.getPointCount();
+    chunks->octree.update( pointcloud->vertices );
+    const bool rebuilt = detectInPlaceChanges
+	&& chunks->octree.checkModified( pointcloud->vertices, pc_color );
+    if( shrunk || rebuilt )
+    {
+	chunkGroup->removeChildren( 0, chunkGroup->getNumChildren() );
+	chunks->geodes.clear();
     }
-    
-    //attach vertivces to geometry
-    geom->setVertexArray(vertices);
-    
-    osg::ref_ptr<osg::DrawArrays> drawArrays = new osg::DrawArrays( osg::PrimitiveSet::POINTS, 0, vertices->size() );
-    geom->addPrimitiveSet(drawArrays.get());
+    chunks->geodes.resize( chunks->octree.getNodeCount() );
+
     osg::ref_ptr<osg::Point> point = new osg::Point();
     point->setSize(10.0);
     point->setDistanceAttenuation( osg::Vec3(0.5, 0.5, 0.5 ) );
     point->setMinSize( 0.2 );
     point->setMaxSize( 5.0 );
-    geom->getOrCreateStateSet()->setAttribute( point, osg::StateAttribute::ON );
+    chunkGroup->getOrCreateStateSet()->setAttribute( point, osg::StateAttribute::ON );
+
+    // regenerate all chunks if the overall color changed, otherwise only the dirty ones
+    std::vector<int> dirty = chunks->octree.getDirtyNodes();
+    if( chunks->color != pointColor )
+    {
+	dirty.clear();
+	for( size_t n=0; n<chunks->octree.getNodeCount(); n++ )
+	    dirty.push_back( n );
+	chunks->color = pointColor;
+    }
+
+    for( size_t i=0; i<dirty.size(); i++ )
+    {
+	const PointcloudOctree::Node& node( chunks->octree.getNode( dirty[i] ) );
+
+	osg::ref_ptr<osg::Geometry> geom = new osg::Geometry;
+	osg::ref_ptr<osg::Vec4Array> color = new osg::Vec4Array;
+	osg::ref_ptr<osg::Vec3Array> vertices = new osg::Vec3Array;
+	vertices->reserve( node.points.size() );
+
+	for(size_t p=0;p<node.points.size();p++) {
+	    const Eigen::Vector3d &v( pointcloud->vertices[node.points[p]] );
+	    vertices->push_back(osg::Vec3(v.x(),v.y(), v.z()));
+	}
+
+	// create color
+	if( pc_color )
+	{
+	    for(size_t p=0;p<node.points.size();p++) {
+		const Eigen::Vector3d &c( (*pc_color)[node.points[p]] );
+		color->push_back(osg::Vec4(c.x(),c.y(), c.z(), 1.0));
+	    }
+	    geom->setColorArray(color.get());
+	    geom->setColorBinding( osg::Geometry::BIND_PER_VERTEX );
+	}
+	else
+	{
+	    color->push_back( pointColor );
+	    geom->setColorArray(color.get());
+	    geom->setColorBinding( osg::Geometry::BIND_OVERALL );
+	}
+
+	//attach vertivces to geometry
+	geom->setVertexArray(vertices);
+	osg::ref_ptr<osg::DrawArrays> drawArrays = new osg::DrawArrays( osg::PrimitiveSet::POINTS, 0, vertices->size() );
+	geom->addPrimitiveSet(drawArrays.get());
+
+	osg::ref_ptr<osg::Geode> &chunk( chunks->geodes[dirty[i]] );
+	if( !chunk.valid() )
+	{
+	    chunk = new osg::Geode();
+	    chunkGroup->addChild( chunk.get() );
+	}
+	chunk->removeDrawables( 0, chunk->getNumDrawables() );
+	chunk->addDrawable( geom.get() );
+    }
+    chunks->octree.clearDirty();
 
     if( pointcloud->hasData(envire::Pointcloud::VERTEX_NORMAL) && showNormals )
     {
@@ -190,8 +309,6 @@ void PointcloudVisualization::updateNode(envire::EnvironmentItem* item, osg::Gro
 
 	geode->addDrawable(ngeom.get());    
     }
-
-    geode->addDrawable(geom.get());    
 }
 
 bool PointcloudVisualization::areNormalsShown() const
@@ -269,3 +386,25 @@ void PointcloudVisualization::setVertexColor(QColor color)
     vertexColor.w() = color.alphaF();
     emit propertyChanged("vertex_color");
 }
+
+double PointcloudVisualization::getLodScreenError() const
+{
+    return lodScreenError;
+}
+
+void PointcloudVisualization::setLodScreenError(double error)
+{
+    lodScreenError = error;
+    emit propertyChanged("lod_screen_error");
+}
+
+bool PointcloudVisualization::areInPlaceChangesDetected() const
+{
+    return detectInPlaceChanges;
+}
+
+void PointcloudVisualization::setDetectInPlaceChanges(bool enabled)
+{
+    detectInPlaceChanges = enabled;
+    emit propertyChanged("detect_inplace_changes");
+}
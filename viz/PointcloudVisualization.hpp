@@ -16,6 +16,8 @@ class PointcloudVisualization : public EnvironmentItemVisualizer
     Q_PROPERTY(double normal_scaling READ getNormalScaling WRITE setNormalScaling)
     Q_PROPERTY(QColor normal_color READ getNormalColor WRITE setNormalColor)
     Q_PROPERTY(QColor vertex_color READ getVertexColor WRITE setVertexColor)
+    Q_PROPERTY(double lod_screen_error READ getLodScreenError WRITE setLodScreenError)
+    Q_PROPERTY(bool detect_inplace_changes READ areInPlaceChangesDetected WRITE setDetectInPlaceChanges)
     
     public:
 	PointcloudVisualization();
@@ -39,6 +41,14 @@ class PointcloudVisualization : public EnvironmentItemVisualizer
         void setNormalColor(QColor color);
         QColor getVertexColor() const;
         void setVertexColor(QColor color);
+        double getLodScreenError() const;
+        void setLodScreenError(double error);
+        /** if enabled, vertices and colors which are modified in place are
+         * found on each update. This needs a pass over the whole
+         * pointcloud, so it is off by default, and only appended vertices
+         * are shown. */
+        bool areInPlaceChangesDetected() const;
+        void setDetectInPlaceChanges(bool enabled);
 
     protected:
 	osg::Vec4 vertexColor;
@@ -47,6 +57,8 @@ class PointcloudVisualization : public EnvironmentItemVisualizer
 	bool showNormals;
 	bool showFeatures;
 	bool colorCycling;
+	double lodScreenError;
+	bool detectInPlaceChanges;
 
 };
 }